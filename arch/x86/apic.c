@@ -11,6 +11,7 @@
 #include <kernel/cpu.h>
 #include <kernel/irq.h>
 #include <kernel/time.h>
+#include <kernel/sched.h>
 #include <kernel/kernel.h>
 #include <kernel/page_mmio.h>
 
@@ -162,9 +163,12 @@ void apic_ipi_send(uint8_t lapic_id, uint32_t value)
     }
 }
 
-extern void empty_isr(void);
 extern void apic_error_isr(void);
 extern void apic_spurious_isr(void);
+extern void apic_timer_isr(void);
+extern void apic_resched_isr(void);
+extern void apic_smp_notif_isr(void);
+extern void apic_tlb_shootdown_isr(void);
 
 UNMAP_AFTER_INIT void apic_initialize(void)
 {
@@ -211,7 +215,10 @@ UNMAP_AFTER_INIT void apic_initialize(void)
 
     apic->esr = 0;
 
-    idt_set(APIC_SMP_NOTIF_VECTOR, addr(&empty_isr));
+    idt_set(APIC_TLB_SHOOTDOWN_VECTOR, addr(&apic_tlb_shootdown_isr));
+    idt_set(APIC_RESCHED_VECTOR, addr(&apic_resched_isr));
+    idt_set(APIC_TIMER_VECTOR, addr(&apic_timer_isr));
+    idt_set(APIC_SMP_NOTIF_VECTOR, addr(&apic_smp_notif_isr));
     idt_set(APIC_ERROR_IRQ_VECTOR, addr(&apic_error_isr));
     idt_set(APIC_SPURIOUS_IRQ_VECTOR, addr(&apic_spurious_isr));
 
@@ -253,6 +260,20 @@ UNMAP_AFTER_INIT void apic_ap_initialize(void)
     apic_eoi(0);
 }
 
+// Enable periodic timer of the AP using the count calibrated on
+// the BSP; it's only used to drive the scheduler on that CPU
+void apic_ap_timer_enable(void)
+{
+    if (!init_cnt)
+    {
+        return;
+    }
+
+    apic->lvt_timer = APIC_TIMER_VECTOR | APIC_LVT_TIMER_PERIODIC;
+    apic->timer_div = APIC_TIMER_DIV_16;
+    apic->timer_init_cnt = init_cnt;
+}
+
 UNMAP_AFTER_INIT void apic_timer_initialize(void)
 {
     if (!apic)
@@ -272,6 +293,13 @@ void apic_eoi(uint32_t)
     apic->eoi = 0;
 }
 
+// Tick of the AP local timer
+void apic_timer_tick(void)
+{
+    apic_eoi(0);
+    sched_tick();
+}
+
 static int apic_timer_irq_enable(void)
 {
     if (!init_cnt)
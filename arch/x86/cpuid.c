@@ -47,6 +47,8 @@ READONLY static const char* feature_strings[NR_FEATURES * 32] = {
     FEATURE(X86_FEATURE_IA64, "ia64"),
     FEATURE(X86_FEATURE_PBE, "pbe"),
     FEATURE(X86_FEATURE_SSE3, "sse3"),
+    FEATURE(X86_FEATURE_XSAVE, "xsave"),
+    FEATURE(X86_FEATURE_AVX, "avx"),
     FEATURE(X86_FEATURE_PREFETCHW, "prefetchw"),
     FEATURE(X86_FEATURE_SYSCALL, "syscall"),
     FEATURE(X86_FEATURE_RDTSCP, "rdtscp"),
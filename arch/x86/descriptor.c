@@ -1,3 +1,4 @@
+#include <arch/percpu.h>
 #include <arch/segment.h>
 #include <arch/descriptor.h>
 
@@ -28,7 +29,7 @@ READONLY idt_data_t ALIGN(8) idt = {
     .entries = {}
 };
 
-tss_t tss;
+PER_CPU_DECLARE(tss_t tss);
 
 static inline void idt_set_gate(uint8_t num, uintptr_t base, uint16_t selector, uint32_t flags)
 {
@@ -69,6 +70,32 @@ UNMAP_AFTER_INIT void tss_init()
     tss_load();
 }
 
+#ifdef __i386__
+// Setup TSS of the AP; GDT of the AP is a copy of the BSP's one, so the TSS
+// descriptor has to be pointed to this CPU TSS and marked as not busy
+void tss_ap_init(void)
+{
+    tss_t* this_tss = THIS_CPU_GET(tss);
+    gdt_t* this_gdt = THIS_CPU_GET(gdt);
+    gdt_entry_t* this_gdt_entries = *THIS_CPU_GET(gdt_entries);
+
+    // GDT was loaded using physical address by the trampoline
+    this_gdt->base = addr(this_gdt_entries);
+    gdt_load(this_gdt);
+
+    descriptor_set_base(this_gdt_entries, TSS_ENTRY, addr(this_tss));
+    this_gdt_entries[TSS_ENTRY].access = DESC_ACCESS_TSS | (1 << 7);
+
+    this_tss->iomap_offset = IOMAP_OFFSET;
+    this_tss->ss0 = KERNEL_DS;
+    this_tss->ss2 = USER_DS;
+
+    memset(this_tss->io_bitmap, 0xff, IO_BITMAP_SIZE);
+
+    tss_load();
+}
+#endif
+
 void idt_set(int nr, uintptr_t addr)
 {
     idt_set_gate(nr, addr, KERNEL_CS, DESC_ACCESS_32TRAP_GATE);
@@ -15,6 +15,7 @@
 #include <kernel/framebuffer.h>
 
 #include <arch/io.h>
+#include <arch/fpu.h>
 #include <arch/irq.h>
 #include <arch/earlycon.h>
 #include <arch/register.h>
@@ -139,6 +140,16 @@ void do_exception(uintptr_t nr, const pt_regs_t regs)
     uintptr_t cr2 = regs.cr2;
     uintptr_t cr3 = cr3_get();
 
+    if (nr == DEVICE_NA && regs.cs == USER_CS)
+    {
+        if (unlikely(fpu_activate(p)))
+        {
+            goto handle_fault;
+        }
+
+        return;
+    }
+
     if (unlikely(nr != PAGE_FAULT))
     {
         goto handle_fault;
@@ -0,0 +1,403 @@
+#define log_fmt(fmt) "fpu: " fmt
+#include <arch/fpu.h>
+#include <arch/cpuid.h>
+#include <arch/percpu.h>
+#include <arch/register.h>
+#include <kernel/cpu.h>
+#include <kernel/init.h>
+#include <kernel/malloc.h>
+#include <kernel/string.h>
+#include <kernel/process.h>
+#include <kernel/sections.h>
+
+// References:
+// Intel 64 and IA-32 Architectures Software Developer's Manual, Volume 1, Chapter 13
+
+#define FNSAVE_SIZE     108
+#define FXSAVE_SIZE     512
+
+#define FCW_DEFAULT     0x37f
+#define FTW_EMPTY       0xffff
+#define MXCSR_DEFAULT   0x1f80
+
+#define XFEATURE_X87    (1 << 0)
+#define XFEATURE_SSE    (1 << 1)
+#define XFEATURE_AVX    (1 << 2)
+
+typedef enum
+{
+    FPU_NONE,
+    FPU_FNSAVE,
+    FPU_FXSAVE,
+    FPU_XSAVE,
+    FPU_XSAVEOPT,
+} fpu_mode_t;
+
+READONLY static const char* fpu_mode_names[] = {
+    [FPU_NONE]      = "none",
+    [FPU_FNSAVE]    = "fnsave",
+    [FPU_FXSAVE]    = "fxsave",
+    [FPU_XSAVE]     = "xsave",
+    [FPU_XSAVEOPT]  = "xsaveopt",
+};
+
+static fpu_mode_t fpu_mode;
+static size_t fpu_size;
+static uint32_t xfeatures;
+static uintptr_t fpu_cr4;
+
+// Process whose state is loaded to the registers of the CPU
+static PER_CPU_DECLARE(process_t* fpu_owner);
+
+static inline void clts(void)
+{
+    asm volatile("clts");
+}
+
+static inline void stts(void)
+{
+    uintptr_t cr0 = cr0_get();
+
+    if (!(cr0 & CR0_TS))
+    {
+        asm volatile("mov %0, %%cr0" :: "r" (cr0 | CR0_TS));
+    }
+}
+
+static inline void xsetbv(uint32_t index, uint64_t value)
+{
+    asm volatile("xsetbv" :: "c" (index), "a" ((uint32_t)value), "d" ((uint32_t)(value >> 32)));
+}
+
+static void fpu_save(fpu_state_t* fpu)
+{
+    switch (fpu_mode)
+    {
+        case FPU_FNSAVE:
+            asm volatile("fnsave (%0); fwait" :: "r" (fpu->data) : "memory");
+            break;
+        case FPU_FXSAVE:
+            asm volatile("fxsave (%0)" :: "r" (fpu->data) : "memory");
+            break;
+        case FPU_XSAVE:
+            asm volatile("xsave (%0)" :: "r" (fpu->data), "a" (-1), "d" (-1) : "memory");
+            break;
+        case FPU_XSAVEOPT:
+            asm volatile("xsaveopt (%0)" :: "r" (fpu->data), "a" (-1), "d" (-1) : "memory");
+            break;
+        default:
+            break;
+    }
+}
+
+static void fpu_load(fpu_state_t* fpu)
+{
+    switch (fpu_mode)
+    {
+        case FPU_FNSAVE:
+            asm volatile("frstor (%0)" :: "r" (fpu->data) : "memory");
+            break;
+        case FPU_FXSAVE:
+            asm volatile("fxrstor (%0)" :: "r" (fpu->data) : "memory");
+            break;
+        case FPU_XSAVE:
+        case FPU_XSAVEOPT:
+            asm volatile("xrstor (%0)" :: "r" (fpu->data), "a" (-1), "d" (-1) : "memory");
+            break;
+        default:
+            break;
+    }
+}
+
+// Slab objects bigger than 128 bytes have sizes being multiples of 64, so
+// the data is properly aligned. Zeroed xsave header puts all the components
+// in their initial state, only MXCSR is always read from the legacy area
+static fpu_state_t* fpu_alloc(void)
+{
+    uint32_t* data;
+    fpu_state_t* fpu = slab_alloc(sizeof(*fpu) + fpu_size);
+
+    if (unlikely(!fpu))
+    {
+        return NULL;
+    }
+
+    fpu->prev = NULL;
+    data = ptr(fpu->data);
+    memset(data, 0, fpu_size);
+
+    data[0] = FCW_DEFAULT;
+
+    if (fpu_mode == FPU_FNSAVE)
+    {
+        data[2] = FTW_EMPTY;
+    }
+    else
+    {
+        data[6] = MXCSR_DEFAULT;
+    }
+
+    return fpu;
+}
+
+static void fpu_free(fpu_state_t* fpu)
+{
+    slab_free(fpu, sizeof(*fpu) + fpu_size);
+}
+
+// Saves registers of the process if it has used them since they were loaded;
+// fnsave reinitializes the FPU, so afterwards the state has to be loaded again
+static void fpu_flush(process_t* p, process_t** owner)
+{
+    if (*owner != p || (cr0_get() & CR0_TS))
+    {
+        return;
+    }
+
+    fpu_save(p->context.fpu);
+
+    if (fpu_mode == FPU_FNSAVE)
+    {
+        *owner = NULL;
+        stts();
+    }
+}
+
+static void fpu_drop(process_t* p)
+{
+    process_t** owner = THIS_CPU_GET(fpu_owner);
+
+    if (*owner == p)
+    {
+        *owner = NULL;
+        stts();
+    }
+
+    p->context.fpu_cpu = -1;
+}
+
+int fpu_activate(process_t* p)
+{
+    process_t** owner = THIS_CPU_GET(fpu_owner);
+
+    if (unlikely(fpu_mode == FPU_NONE))
+    {
+        return -ENODEV;
+    }
+
+    if (!p->context.fpu && unlikely(!(p->context.fpu = fpu_alloc())))
+    {
+        return -ENOMEM;
+    }
+
+    clts();
+    fpu_load(p->context.fpu);
+
+    *owner = p;
+    p->context.fpu_cpu = this_cpu_id();
+
+    return 0;
+}
+
+// State is saved when leaving the CPU whenever it was used in the time slice,
+// as the process can be resumed on another CPU; with xsaveopt only the modified
+// components are written. Loading is deferred until the first use, unless the
+// registers still hold the state of the next process
+void fpu_switch(process_t* prev, process_t* next)
+{
+    process_t** owner = THIS_CPU_GET(fpu_owner);
+
+    if (fpu_mode == FPU_NONE)
+    {
+        return;
+    }
+
+    fpu_flush(prev, owner);
+
+    if (*owner == next && next->context.fpu && next->context.fpu_cpu == this_cpu_id())
+    {
+        clts();
+    }
+    else
+    {
+        stts();
+    }
+}
+
+int fpu_copy(process_t* dest, process_t* src)
+{
+    dest->context.fpu = NULL;
+    dest->context.fpu_saved = NULL;
+    dest->context.fpu_cpu = -1;
+
+    if (!src->context.fpu)
+    {
+        return 0;
+    }
+
+    if (unlikely(!(dest->context.fpu = fpu_alloc())))
+    {
+        return -ENOMEM;
+    }
+
+    scoped_irq_lock();
+
+    fpu_flush(src, THIS_CPU_GET(fpu_owner));
+    memcpy(dest->context.fpu->data, src->context.fpu->data, fpu_size);
+
+    return 0;
+}
+
+void fpu_release(process_t* p)
+{
+    fpu_state_t* fpu;
+
+    scoped_irq_lock();
+
+    fpu_drop(p);
+
+    if (p->context.fpu)
+    {
+        fpu_free(p->context.fpu);
+        p->context.fpu = NULL;
+    }
+
+    while ((fpu = p->context.fpu_saved))
+    {
+        p->context.fpu_saved = fpu->prev;
+        fpu_free(fpu);
+    }
+}
+
+// Signal handler starts with the initial state; state of the interrupted
+// context is put aside until sigreturn
+void fpu_signal_enter(process_t* p, signal_frame_t* frame)
+{
+    fpu_state_t* fpu = p->context.fpu;
+
+    frame->fpu = fpu;
+    frame->fpu_saved = p->context.fpu_saved;
+
+    if (!fpu)
+    {
+        return;
+    }
+
+    scoped_irq_lock();
+
+    fpu_flush(p, THIS_CPU_GET(fpu_owner));
+    fpu_drop(p);
+
+    fpu->prev = p->context.fpu_saved;
+    p->context.fpu_saved = fpu;
+    p->context.fpu = NULL;
+}
+
+void fpu_signal_leave(process_t* p, signal_frame_t* frame)
+{
+    fpu_state_t* fpu;
+    fpu_state_t* saved = frame->fpu;
+    fpu_state_t* top = saved ? saved : frame->fpu_saved;
+
+    scoped_irq_lock();
+
+    fpu_drop(p);
+
+    if (p->context.fpu)
+    {
+        fpu_free(p->context.fpu);
+        p->context.fpu = NULL;
+    }
+
+    // States put aside by nested handlers which never returned are discarded,
+    // also when the interrupted context itself had no state
+    while ((fpu = p->context.fpu_saved) && fpu != top)
+    {
+        p->context.fpu_saved = fpu->prev;
+        fpu_free(fpu);
+    }
+
+    if (saved && likely(fpu == saved))
+    {
+        p->context.fpu_saved = saved->prev;
+        p->context.fpu = saved;
+    }
+}
+
+void fpu_cpu_init(void)
+{
+    if (fpu_mode == FPU_NONE)
+    {
+        return;
+    }
+
+    if (fpu_cr4)
+    {
+        asm volatile("mov %0, %%cr4" :: "r" (cr4_get() | fpu_cr4));
+    }
+
+    if (fpu_mode >= FPU_XSAVE)
+    {
+        xsetbv(0, xfeatures);
+    }
+
+    asm volatile("mov %0, %%cr0" :: "r" ((cr0_get() & ~CR0_EM) | CR0_MP | CR0_TS));
+}
+
+UNMAP_AFTER_INIT void fpu_init(void)
+{
+    cpuid_regs_t regs = {};
+
+    if (!cpu_has(X86_FEATURE_FPU))
+    {
+        log_notice("not available");
+        return;
+    }
+
+    fpu_mode = FPU_FNSAVE;
+    fpu_size = FNSAVE_SIZE;
+
+    if (CONFIG_X86 > 4 && cpu_has(X86_FEATURE_FXSR))
+    {
+        fpu_mode = FPU_FXSAVE;
+        fpu_size = FXSAVE_SIZE;
+        fpu_cr4 = CR4_OSFXSR;
+
+        if (cpu_has(X86_FEATURE_SSE))
+        {
+            fpu_cr4 |= CR4_OSXMMEXCPT;
+        }
+
+        if (cpu_has(X86_FEATURE_XSAVE))
+        {
+            cpuid_read(0xd, &regs);
+            xfeatures = regs.eax & (XFEATURE_X87 | XFEATURE_SSE);
+
+            if (cpu_has(X86_FEATURE_AVX))
+            {
+                xfeatures |= regs.eax & XFEATURE_AVX;
+            }
+
+            regs.ecx = 1;
+            cpuid_read(0xd, &regs);
+
+            fpu_mode = regs.eax & 1 ? FPU_XSAVEOPT : FPU_XSAVE;
+            fpu_cr4 |= CR4_OSXSAVE;
+        }
+    }
+
+    fpu_cpu_init();
+
+    if (fpu_mode >= FPU_XSAVE)
+    {
+        // Size of the area for components enabled in XCR0
+        regs.ecx = 0;
+        cpuid_read(0xd, &regs);
+        fpu_size = regs.ebx;
+    }
+
+    log_info("using %s; features: %#x, state size: %u",
+        fpu_mode_names[fpu_mode],
+        xfeatures,
+        fpu_size);
+}
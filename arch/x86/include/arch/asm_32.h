@@ -2,6 +2,12 @@
 
 #ifdef __ASSEMBLER__
 
+// Read per CPU variable; base of the per CPU area is kept at %fs:0
+#define PER_CPU_READ(var, reg) \
+    mov %fs:0, reg; \
+    sub $SYMBOL_NAME(_data_per_cpu_start), reg; \
+    mov SYMBOL_NAME(var)(reg), reg
+
 #define SAVE_ALL(has_error_code) \
     cld; \
     .if has_error_code == 0; \
@@ -29,7 +35,7 @@
     push %ebx;          /* ebx */ \
     cmpl $KERNEL_CS, REGS_CS(%esp); \
     je 1f; \
-    mov SYMBOL_NAME(process_current), %ecx; \
+    PER_CPU_READ(current_process, %ecx); \
     mov REGS_ESP(%esp), %edx; \
     mov %edx, CONTEXT_ESP2(%ecx); \
     1:
@@ -53,6 +59,7 @@
     ENTRY(isr_##nr) \
         cli; \
         SAVE_ALL(0); \
+        call SYMBOL_NAME(kernel_lock_enter); \
         call SYMBOL_NAME(timestamp_update); \
         push %esp; \
         push $nr - 32; \
@@ -68,6 +75,7 @@
     ENTRY(isr_##nr) \
         cli; \
         SAVE_ALL(0); \
+        call SYMBOL_NAME(kernel_lock_enter); \
         call SYMBOL_NAME(timestamp_update); \
         push %esp; \
         push $nr - 48; \
@@ -81,6 +89,7 @@
     ENTRY(exc_##x##_handler) \
         cli; \
         SAVE_ALL(has_error_code); \
+        call SYMBOL_NAME(kernel_lock_enter); \
         call SYMBOL_NAME(timestamp_update); \
         push $nr; \
         call do_exception; \
@@ -93,6 +102,7 @@
     ENTRY(exc_##x##_handler) \
         cli; \
         SAVE_ALL(0); \
+        call SYMBOL_NAME(kernel_lock_enter); \
         push $nr; \
         call do_exception; \
         movl $0, %eax; \
@@ -76,8 +76,10 @@ typedef struct cpuid_regs cpuid_regs_t;
 
 #define CPUID_1_ECX_INDEX       1
 #define CPUID_1_ECX_OFFSET      0
-#define CPUID_1_ECX_MASK        (1 << 3 | 1 << 0)
+#define CPUID_1_ECX_MASK        (1 << 28 | 1 << 26 | 1 << 3 | 1 << 0)
 #define X86_FEATURE_SSE3        (CPUID_1_ECX_INDEX * 32 + 0)
+#define X86_FEATURE_XSAVE       (CPUID_1_ECX_INDEX * 32 + 26)
+#define X86_FEATURE_AVX         (CPUID_1_ECX_INDEX * 32 + 28)
 
 #define CPUID_80000001_INDEX    1
 #define CPUID_80000001_OFFSET   4
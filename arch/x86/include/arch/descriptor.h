@@ -35,6 +35,7 @@ static inline void gdt_load(gdt_t* gdt)
 }
 
 void tss_init(void);
+void tss_ap_init(void);
 void idt_init(void);
 void idt_set(int nr, uintptr_t addr);
 void idt_write_protect(void);
@@ -20,6 +20,7 @@
 #define ERROR_CODE      1
 #define NO_ERROR_CODE   0
 
+#define DEVICE_NA           7
 #define GENERAL_PROTECTION  13
 #define PAGE_FAULT          14
 
@@ -30,7 +31,7 @@ __exception(breakpoint,         3,      NO_ERROR_CODE,  "breakpoint",
 __exception(overflow,           4,      NO_ERROR_CODE,  "into detected overflow",       SIGSEGV)
 __exception(bound_range,        5,      NO_ERROR_CODE,  "out of bounds",                SIGSEGV)
 __exception(invalid_opcode,     6,      NO_ERROR_CODE,  "invalid opcode",               SIGILL)
-__exception(device_na,          7,      NO_ERROR_CODE,  "no coprocessor",               0)
+__exception(device_na,          7,      NO_ERROR_CODE,  "no coprocessor",               SIGFPE)
 __exception(double_fault,       8,      ERROR_CODE,     "double fault",                 SIGSEGV)
 __exception(coprocessor,        9,      NO_ERROR_CODE,  "coprocessor segment overrun",  SIGFPE)
 __exception(invalid_tss,        10,     ERROR_CODE,     "bad tss",                      SIGSEGV)
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <kernel/compiler.h>
+
+struct process;
+struct signal_frame;
+
+typedef struct fpu_state fpu_state_t;
+
+// Extended state of a process; allocated on the first use of x87/SSE/AVX
+// instruction. Data is in the format of whichever of fnsave/fxsave/xsave
+// is used by the CPU, so it has to be aligned to 64 bytes
+struct fpu_state
+{
+    fpu_state_t* prev; // State of the context interrupted by a signal
+    uint8_t      data[] ALIGN(64);
+};
+
+void fpu_init(void);
+void fpu_cpu_init(void);
+
+int fpu_activate(struct process* p);
+void fpu_switch(struct process* prev, struct process* next);
+int fpu_copy(struct process* dest, struct process* src);
+void fpu_release(struct process* p);
+
+void fpu_signal_enter(struct process* p, struct signal_frame* frame);
+void fpu_signal_leave(struct process* p, struct signal_frame* frame);
@@ -56,10 +56,21 @@ static inline void pgd_reload(void)
 #define invlpg(address) \
     asm volatile("invlpg (%0);" :: "r" (address) : "memory")
 #else
-#define invlpg(address) ({ (void)(address); tlb_flush(); })
+#define invlpg(address) ({ (void)(address); pgd_reload(); })
 #endif
-#define tlb_flush()            pgd_reload()
-#define tlb_flush_single(addr) invlpg(addr)
+
+#define TLB_SHOOTDOWN_ALL (~(uintptr_t)0)
+
+void tlb_shootdown(uintptr_t address);
+
+#define local_tlb_flush()            pgd_reload()
+#define local_tlb_flush_single(addr) invlpg(addr)
+
+#define tlb_flush() \
+    ({ local_tlb_flush(); tlb_shootdown(TLB_SHOOTDOWN_ALL); })
+
+#define tlb_flush_single(addr) \
+    ({ uintptr_t __a = (uintptr_t)(addr); local_tlb_flush_single(__a); tlb_shootdown(__a); })
 
 void page_tables_print(const char* header, loglevel_t severity, uintptr_t address, const pgd_t* pgd);
 
@@ -25,9 +25,11 @@ typedef struct signal_context signal_context_t;
 
 struct signal_frame
 {
-    int             sig;
-    pt_regs_t*      context;
-    signal_frame_t* prev;
+    int               sig;
+    pt_regs_t*        context;
+    signal_frame_t*   prev;
+    struct fpu_state* fpu;          // State of the interrupted context
+    struct fpu_state* fpu_saved;    // Last of the states put aside before
 };
 
 #endif
@@ -44,6 +44,9 @@ struct context
     uint32_t esp0;
     uint32_t esp2;
     uint32_t tls_base;
+    struct fpu_state* fpu;
+    struct fpu_state* fpu_saved;
+    int32_t  fpu_cpu;
 };
 
 #define CONTEXT_IP(context) \
@@ -134,6 +137,7 @@ typedef struct context_switch_frame context_switch_frame_t;
 #define INIT_PROCESS_CONTEXT(name) \
     { \
         .esp = (uintptr_t)&name##_stack[INIT_PROCESS_STACK_SIZE], \
+        .fpu_cpu = -1, \
     }
 
-#define NEED_RESCHED_SIGNAL_OFFSET  20
+#define NEED_RESCHED_SIGNAL_OFFSET  32
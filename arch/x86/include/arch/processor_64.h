@@ -32,6 +32,9 @@ struct context
     uint64_t rsp0;
     uint64_t rsp2;
     uint64_t tls_base;
+    struct fpu_state* fpu;
+    struct fpu_state* fpu_saved;
+    int32_t  fpu_cpu;
 };
 
 #define CONTEXT_IP(context) \
@@ -114,6 +117,7 @@ typedef struct context_switch_frame context_switch_frame_t;
 #define INIT_PROCESS_CONTEXT(name) \
     { \
         .rsp = (uintptr_t)&name##_stack[INIT_PROCESS_STACK_SIZE], \
+        .fpu_cpu = -1, \
     }
 
-#define NEED_RESCHED_SIGNAL_OFFSET  40
+#define NEED_RESCHED_SIGNAL_OFFSET  64
@@ -44,5 +44,7 @@ enum
 void smp_cpus_boot(uint8_t* lapic_ids, size_t num);
 void smp_notify(uint8_t notif);
 void smp_wait_for(uint8_t notif);
+void smp_resched_send(uint8_t lapic_id);
+void tlb_shootdown_poll(void);
 
 #endif
@@ -19,6 +19,20 @@ static inline void spinlock_lock(spinlock_t* lock)
         :: "memory");
 }
 
+// Returns 0 if lock was acquired
+static inline int spinlock_try_lock(spinlock_t* lock)
+{
+    int ret;
+
+    asm volatile(
+        "lock; btsl $0, %1;"
+        "sbb %0, %0;"
+        : "=r" (ret), "+m" (lock->lock)
+        :: "memory", "cc");
+
+    return ret;
+}
+
 static inline void spinlock_unlock(spinlock_t* lock)
 {
     asm volatile(
@@ -15,3 +15,8 @@ static inline pgprot_t vm_to_pgprot(const vm_area_t* vma)
         : PAGE_PCD;
     return pg_flags;
 }
+
+static inline pgprot_t vm_to_pgprot_ro(const vm_area_t* vma)
+{
+    return vm_to_pgprot(vma) & ~PAGE_RW;
+}
@@ -18,7 +18,6 @@
 
 extern pte_t page0[];
 extern page_t* page_map;
-extern list_head_t free_pages;
 extern uintptr_t last_pfn;
 
 pte_t* kernel_page_tables;
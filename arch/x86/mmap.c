@@ -5,6 +5,7 @@
 #include <kernel/list.h>
 #include <kernel/kernel.h>
 #include <kernel/minmax.h>
+#include <kernel/dentry.h>
 #include <kernel/process.h>
 #include <kernel/vm_print.h>
 #include <kernel/page_table.h>
@@ -150,6 +151,7 @@ void* do_mmap(void* addr, size_t len, int prot, int flags, file_t* file, size_t
             return ptr(-ENOENT);
         }
 
+        dentry_get(file->dentry);
         vma->dentry = file->dentry;
         vma->offset = offset;
         list_add(&vma->mapping_entry, &vma->dentry->inode->mappings);
@@ -170,6 +172,7 @@ free_vma:
     if (vma->dentry)
     {
         inode_put(vma->dentry->inode);
+        dentry_put(vma->dentry);
     }
     delete(vma);
     return ptr(errno);
@@ -317,6 +320,7 @@ static void vm_copy_details(vm_area_t* to, const vm_area_t* from)
     to->dentry = from->dentry;
     if (to->dentry)
     {
+        dentry_get(to->dentry);
         to->offset += to->start - from->start;
     }
     to->ops = from->ops;
@@ -1,4 +1,5 @@
 #include <arch/asm.h>
+#include <arch/fpu.h>
 #include <arch/segment.h>
 #include <arch/register.h>
 #include <arch/processor.h>
@@ -12,6 +13,7 @@
 #include <kernel/signal.h>
 #include <kernel/process.h>
 #include <kernel/page_table.h>
+#include <kernel/kernel_lock.h>
 
 #define push(val, stack) \
     do { (stack)--; *stack = (typeof(*stack))(val); } while (0)
@@ -106,6 +108,10 @@ int arch_process_user_spawn(
     p->context.esp0 = addr(p->kernel_stack);
     p->context.esp2 = regs.esp;
     p->context.tls_base = tls;
+    p->context.fpu = NULL;
+    p->context.fpu_saved = NULL;
+    p->context.fpu_cpu = -1;
+    p->kernel_lock_depth = 1;
 
     return 0;
 }
@@ -133,6 +139,13 @@ int arch_process_spawn(process_t* child, process_entry_t entry, void* args, int)
     child->context.esp = addr(kernel_stack);
     child->context.eip = addr(&exit_kernel);
     child->context.tls_base = 0;
+    child->context.fpu = NULL;
+    child->context.fpu_saved = NULL;
+    child->context.fpu_cpu = -1;
+
+    // Kernel process keeps holding the kernel lock
+    // after exit_kernel returns to its entry
+    child->kernel_lock_depth = 2;
 
     return 0;
 }
@@ -147,7 +160,8 @@ int arch_process_copy(
     dest->context.esp0 = addr(dest->kernel_stack);
     dest->context.esp2 = src_regs->esp;
     dest->context.tls_base = src->context.tls_base;
-    return 0;
+    dest->kernel_lock_depth = 1;
+    return fpu_copy(dest, src);
 }
 
 void FASTCALL(NORETURN(__process_switch_bug(void*, void*, uintptr_t value)))
@@ -160,16 +174,21 @@ void FASTCALL(__process_switch(process_t* prev, process_t* next))
 {
     scoped_irq_lock();
 
-    tss.esp = next->context.esp;
-    tss.esp0 = next->context.esp0;
-    tss.esp2 = next->context.esp2;
+    tss_t* this_tss = THIS_CPU_GET(tss);
+    gdt_entry_t* this_gdt_entries = *THIS_CPU_GET(gdt_entries);
+
+    this_tss->esp = next->context.esp;
+    this_tss->esp0 = next->context.esp0;
+    this_tss->esp2 = next->context.esp2;
 
-    descriptor_set_base(gdt_entries, TLS_ENTRY, next->context.tls_base);
+    descriptor_set_base(this_gdt_entries, TLS_ENTRY, next->context.tls_base);
 
     if (next->mm != prev->mm)
     {
         pgd_load(next->mm->pgd);
     }
+
+    fpu_switch(prev, next);
 }
 
 #define context_set(stack, ip)  \
@@ -186,13 +205,17 @@ int NORETURN(arch_exec(void* entry, uintptr_t* kernel_stack, uint32_t user_stack
 {
     cli();
 
+    fpu_release(process_current);
+
     process_current->context.esp0 = addr(process_current->kernel_stack);
 
     exec_kernel_stack_frame(&kernel_stack, user_stack, addr(entry));
 
-    tss.esp = addr(kernel_stack);
-    tss.esp0 = process_current->context.esp0;
-    tss.esp2 = addr(user_stack);
+    tss_t* this_tss = THIS_CPU_GET(tss);
+
+    this_tss->esp = addr(kernel_stack);
+    this_tss->esp0 = process_current->context.esp0;
+    this_tss->esp2 = addr(user_stack);
 
     context_set(kernel_stack, &exit_kernel);
 
@@ -205,10 +228,12 @@ void NORETURN(sys_sigreturn(pt_regs_t))
 
     log_debug(DEBUG_SIGNAL, "%s", signame(frame->sig));
 
+    fpu_signal_leave(process_current, frame);
+
     process_current->context.esp0 = addr(frame->prev);
     process_current->need_signal = !!process_current->signals->ongoing;
 
-    tss.esp0 = addr(frame->prev);
+    THIS_CPU_GET(tss)->esp0 = addr(frame->prev);
 
     context_set(frame->context, &exit_kernel);
 
@@ -246,6 +271,7 @@ void do_signals(pt_regs_t regs)
         frame.sig = signum;
         frame.context = &regs;
         frame.prev = ptr(proc->context.esp0);
+        fpu_signal_enter(proc, &frame);
 
         // Signal frames are saved on the current kernel stack frame. With each nested
         // signal  esp0 is moving forward the stack so that previous frames are not
@@ -265,11 +291,14 @@ void do_signals(pt_regs_t regs)
         push(signum, user_stack);
         push(sigaction->sa_restorer, user_stack);
 
-        tss.esp0 = addr(&frame);
+        THIS_CPU_GET(tss)->esp0 = addr(&frame);
         delete(signal);
 
         mutex_unlock(&proc->signals->lock);
 
+        cli();
+        kernel_lock_leave();
+
         asm volatile(
             "pushl "ASM_VALUE(USER_DS)";" // ss
             "push %0;"                    // esp
@@ -337,8 +366,9 @@ static uintptr_t user_process_setup_stack(process_t* dest, process_t*, const pt_
     return addr(kernel_stack);
 }
 
-void arch_process_free(process_t*)
+void arch_process_free(process_t* p)
 {
+    fpu_release(p);
 }
 
 void syscall_regs_check(pt_regs_t regs)
@@ -393,8 +423,10 @@ int sys_execve(pt_regs_t regs)
 
 int sys_set_thread_area(uintptr_t base)
 {
+    gdt_entry_t* this_gdt_entries = *THIS_CPU_GET(gdt_entries);
+
     process_current->context.tls_base = base;
-    descriptor_set_base(gdt_entries, TLS_ENTRY, base);
+    descriptor_set_base(this_gdt_entries, TLS_ENTRY, base);
 
     return 0;
 }
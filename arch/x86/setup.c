@@ -5,6 +5,7 @@
 #include <arch/apm.h>
 #include <arch/asm.h>
 #include <arch/dmi.h>
+#include <arch/fpu.h>
 #include <arch/irq.h>
 #include <arch/nmi.h>
 #include <arch/pci.h>
@@ -84,18 +85,7 @@ UNMAP_AFTER_INIT void arch_setup(void)
     rtc_print();
 
 #ifdef __i386__
-    if (cpu_has(X86_FEATURE_SSE))
-    {
-        asm volatile(
-            "mov %cr0, %eax;"
-            "and $0xfffb, %ax;"
-            "or $0x2, %ax;"
-            "mov %eax, %cr0;"
-            "mov %cr4, %eax;"
-            "or $(3 << 9), %ax;"
-            "mov %eax, %cr4;"
-            "movb $1, (%eax);");
-    }
+    fpu_init();
 #endif
 }
 
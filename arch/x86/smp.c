@@ -1,22 +1,36 @@
 #define log_fmt(fmt) "smp: " fmt
+#include <arch/fpu.h>
 #include <arch/smp.h>
 #include <arch/idle.h>
 #include <arch/percpu.h>
 #include <arch/register.h>
+#include <arch/descriptor.h>
+#include <arch/page_table.h>
 #include <kernel/cpu.h>
 #include <kernel/init.h>
+#include <kernel/sched.h>
 #include <kernel/kernel.h>
+#include <kernel/process.h>
 #include <kernel/sections.h>
 #include <kernel/spinlock.h>
 #include <kernel/page_alloc.h>
+#include <kernel/kernel_lock.h>
 
 extern void smp_entry(void);
 extern void smp_entry_end(void);
 
+int vsyscall_cpu_init(void);
+
 READONLY static io32 booted = 1;
 READONLY void* per_cpu_data[CPU_COUNT];
 io8 notification;
 
+// Mask of lapic ids of CPUs which run the scheduler
+static io32 online;
+
+static io32 tlb_pending;
+static volatile uintptr_t tlb_address;
+
 static_assert(sizeof(cpu_boot_t) == SMP_CPU_SIZE);
 static_assert(offsetof(cpu_boot_t, stack) == SMP_STACK_OFFSET);
 static_assert(offsetof(cpu_boot_t, gdt) == SMP_GDT_OFFSET);
@@ -35,6 +49,16 @@ static inline void atomic_incl(io32* address)
     asm volatile("lock; incl (%0);" :: "r" (address) : "memory");
 }
 
+static inline void atomic_orl(io32* address, uint32_t value)
+{
+    asm volatile("lock; orl %1, (%0);" :: "r" (address), "r" (value) : "memory");
+}
+
+static inline void atomic_andl(io32* address, uint32_t value)
+{
+    asm volatile("lock; andl %1, (%0);" :: "r" (address), "r" (value) : "memory");
+}
+
 static inline uint8_t atomic_readb(io8* address)
 {
     return *address;
@@ -62,6 +86,73 @@ void smp_wait_for(uint8_t notif)
     }
 }
 
+void smp_resched_send(uint8_t lapic_id)
+{
+    apic_ipi_send(lapic_id, APIC_RESCHED_VECTOR);
+}
+
+// Make other CPUs flush given address from their TLBs and wait until it's done. It's
+// called with the kernel lock held, so there's only one shootdown at a time
+void tlb_shootdown(uintptr_t address)
+{
+    flags_t flags;
+    uint32_t cpus = atomic_readl(&online);
+
+    if (likely(!cpus))
+    {
+        return;
+    }
+
+    cpus &= ~(1 << this_cpu_id());
+
+    if (!cpus)
+    {
+        return;
+    }
+
+    // If user space address is being modified and mm is not shared, no other
+    // CPU can have it cached, as it's flushed each time pgd is switched
+    if (address < KERNEL_PAGE_OFFSET && process_current->mm->refcount == 1)
+    {
+        return;
+    }
+
+    irq_save(flags);
+
+    tlb_address = address;
+    atomic_orl(&tlb_pending, cpus);
+
+    apic_ipi_send(0, APIC_TLB_SHOOTDOWN_VECTOR | APIC_ICR_DEST_ALL_SELF_EXCLUDE);
+
+    while (atomic_readl(&tlb_pending))
+    {
+        cpu_relax();
+    }
+
+    irq_restore(flags);
+}
+
+void tlb_shootdown_poll(void)
+{
+    uint32_t mask = 1 << this_cpu_id();
+
+    if (!(atomic_readl(&tlb_pending) & mask))
+    {
+        return;
+    }
+
+    if (tlb_address == TLB_SHOOTDOWN_ALL)
+    {
+        local_tlb_flush();
+    }
+    else
+    {
+        local_tlb_flush_single(tlb_address);
+    }
+
+    atomic_andl(&tlb_pending, ~mask);
+}
+
 UNMAP_AFTER_INIT void bsp_per_cpu_setup(void)
 {
     *(void**)_data_per_cpu_start = _data_per_cpu_start;
@@ -159,6 +250,7 @@ UNMAP_AFTER_INIT void smp_cpus_boot(uint8_t* lapic_ids, size_t count)
     }
 
     per_cpu_data[cpu_info.lapic_id] = _data_per_cpu_start;
+    online = 1 << cpu_info.lapic_id;
     memcpy(ptr(SMP_CODE_AREA), &smp_entry, addr(&smp_entry_end) - addr(&smp_entry));
     memset(ptr(SMP_SIGNATURE_AREA), 0, PAGE_SIZE);
 
@@ -213,9 +305,37 @@ UNMAP_AFTER_INIT void smp_cpus_boot(uint8_t* lapic_ids, size_t count)
     log_info("all cpus booted sucessfully");
 }
 
+static void NORETURN(smp_cpu_online(uint8_t lapic_id, void* stack))
+{
+    process_t* idle_process;
+
+    kernel_lock_enter();
+
+    if (unlikely(!(idle_process = process_idle_create(stack))))
+    {
+        log_warning("cpu%u: cannot create idle process", lapic_id);
+        kernel_lock_leave();
+        for (;; halt());
+    }
+
+    tss_ap_init();
+    vsyscall_cpu_init();
+    sched_cpu_init(idle_process);
+    apic_ap_timer_enable();
+
+    atomic_orl(&online, 1 << lapic_id);
+
+    log_info("cpu%u: online", lapic_id);
+
+    kernel_lock_leave();
+
+    idle();
+}
+
 void smp_kmain(uint8_t lapic_id, uint32_t cpu_signature)
 {
     cpu_boot_t* cpu = (cpu_boot_t*)SMP_SIGNATURE_AREA + lapic_id;
+    void* stack = cpu->stack;
 
     cpu->lapic_id      = lapic_id;
     cpu->cpu_signature = cpu_signature;
@@ -229,15 +349,11 @@ void smp_kmain(uint8_t lapic_id, uint32_t cpu_signature)
 
     apic_ap_initialize();
     cpu_detect(false);
+    fpu_cpu_init();
 
     sti();
 
     smp_wait_for(SMP_IDLE_START);
 
-    log_info("cpu%u: go idle", lapic_id);
-
-    while (1)
-    {
-        halt();
-    }
+    smp_cpu_online(lapic_id, stack);
 }
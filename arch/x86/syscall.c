@@ -8,6 +8,7 @@ typedef int (*syscall_t)();
 
 #define __syscall(call, ...)    int sys_##call();
 #define __syscall0(...)         __syscall(__VA_ARGS__)
+#define __syscall0_void(...)    __syscall(__VA_ARGS__)
 #define __syscall1(...)         __syscall(__VA_ARGS__)
 #define __syscall1_noret(...)   __syscall(__VA_ARGS__)
 #define __syscall2(...)         __syscall(__VA_ARGS__)
@@ -19,6 +20,7 @@ typedef int (*syscall_t)();
 
 #undef __syscall
 #undef __syscall0
+#undef __syscall0_void
 #undef __syscall1
 #undef __syscall1_noret
 #undef __syscall2
@@ -28,6 +30,7 @@ typedef int (*syscall_t)();
 #undef __syscall6
 #define __syscall(call, ...)    [__NR_##call] = &sys_##call,
 #define __syscall0(...)         __syscall(__VA_ARGS__)
+#define __syscall0_void(...)    __syscall(__VA_ARGS__)
 #define __syscall1(...)         __syscall(__VA_ARGS__)
 #define __syscall1_noret(...)   __syscall(__VA_ARGS__)
 #define __syscall2(...)         __syscall(__VA_ARGS__)
@@ -46,7 +49,8 @@ READONLY const syscall_t syscalls[] = {
 
 extern void vsyscall_handler();
 
-UNMAP_AFTER_INIT int vsyscall_init(void)
+// Each CPU needs its own sysenter stack
+int vsyscall_cpu_init(void)
 {
     page_t* page;
 
@@ -69,6 +73,11 @@ UNMAP_AFTER_INIT int vsyscall_init(void)
     return 0;
 }
 
+UNMAP_AFTER_INIT int vsyscall_init(void)
+{
+    return vsyscall_cpu_init();
+}
+
 int do_vsyscall(int nr, pt_regs_t)
 {
     switch (nr)
@@ -7,6 +7,7 @@
 
 #include <kernel/cpu.h>
 #include <kernel/time.h>
+#include <kernel/vdso.h>
 #include <kernel/kernel.h>
 
 static uint64_t tsc_read(void);
@@ -19,6 +20,7 @@ static clock_source_t tsc_clock = {
     .name = "tsc",
     .mask = 0xffffffffffffffff,
     .read = &tsc_read,
+    .vdso_mode = VDSO_CLOCK_TSC,
 };
 
 UNMAP_AFTER_INIT void tsc_initialize(void)
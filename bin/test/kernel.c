@@ -5,8 +5,12 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/futex.h>
 #include <sys/wait.h>
 #include <sys/syscall.h>
 #include <common/compiler.h>
@@ -419,4 +423,285 @@ TEST(clone)
     EXPECT_EQ(WEXITSTATUS(status), 0);
 }
 
+TEST(pipe_large_transfer)
+{
+    int fds[2], status;
+    static char buf[4096];
+    size_t total = 0;
+    int pid, ret, valid = 1;
+
+    EXPECT_EQ(pipe(fds), 0);
+
+    pid = fork();
+
+    if (pid == 0)
+    {
+        close(fds[0]);
+
+        for (int i = 0; i < 256; ++i)
+        {
+            memset(buf, i, sizeof(buf));
+            if (write(fds[1], buf, sizeof(buf)) != sizeof(buf))
+            {
+                exit(1);
+            }
+        }
+
+        exit(0);
+    }
+
+    EXPECT_GT(pid, 0);
+    close(fds[1]);
+
+    while ((ret = read(fds[0], buf, sizeof(buf))) > 0)
+    {
+        for (int i = 0; i < ret; ++i)
+        {
+            if (buf[i] != (char)((total + i) / sizeof(buf)))
+            {
+                valid = 0;
+            }
+        }
+        total += ret;
+    }
+
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(total, 256 * sizeof(buf));
+    EXPECT_EQ(valid, 1);
+    EXPECT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+    close(fds[0]);
+}
+
+TEST(pipe_write_without_readers)
+{
+    int fds[2];
+
+    EXPECT_EQ(pipe(fds), 0);
+    close(fds[0]);
+
+    EXPECT_KILLED_BY(SIGPIPE)
+    {
+        write(fds[1], "x", 1);
+        exit(0);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    EXPECT_EQ(write(fds[1], "x", 1), -1);
+    EXPECT_EQ(errno, EPIPE);
+    signal(SIGPIPE, SIG_DFL);
+    close(fds[1]);
+}
+
+TEST(epoll_pipe)
+{
+    int fds[2], epfd;
+    char c = 'x';
+    struct epoll_event out[4];
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = 7};
+
+    EXPECT_EQ(pipe(fds), 0);
+    epfd = epoll_create1(0);
+    EXPECT_GE(epfd, 0);
+    EXPECT_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &ev), 0);
+    EXPECT_EQ(epoll_wait(epfd, out, 4, 0), 0);
+
+    // Level-triggered: reported until the data is read
+    EXPECT_EQ(write(fds[1], &c, 1), 1);
+    EXPECT_EQ(epoll_wait(epfd, out, 4, 0), 1);
+    EXPECT_EQ(out[0].events, EPOLLIN);
+    EXPECT_EQ(out[0].data.u32, 7);
+    EXPECT_EQ(epoll_wait(epfd, out, 4, 0), 1);
+    EXPECT_EQ(read(fds[0], &c, 1), 1);
+    EXPECT_EQ(epoll_wait(epfd, out, 4, 0), 0);
+
+    // Edge-triggered: reported once per write
+    ev.events = EPOLLIN | EPOLLET;
+    EXPECT_EQ(epoll_ctl(epfd, EPOLL_CTL_MOD, fds[0], &ev), 0);
+    EXPECT_EQ(write(fds[1], &c, 1), 1);
+    EXPECT_EQ(epoll_wait(epfd, out, 4, 0), 1);
+    EXPECT_EQ(epoll_wait(epfd, out, 4, 0), 0);
+    EXPECT_EQ(write(fds[1], &c, 1), 1);
+    EXPECT_EQ(epoll_wait(epfd, out, 4, 0), 1);
+
+    // Closing the write end wakes the item as well
+    close(fds[1]);
+
+    EXPECT_EQ(epoll_wait(epfd, out, 4, -1), 1);
+    EXPECT_EQ(out[0].events & EPOLLHUP, EPOLLHUP);
+
+    EXPECT_EQ(epoll_ctl(epfd, EPOLL_CTL_DEL, fds[0], NULL), 0);
+    EXPECT_EQ(epoll_ctl(epfd, EPOLL_CTL_DEL, fds[0], NULL), -1);
+    EXPECT_EQ(errno, ENOENT);
+
+    close(fds[0]);
+    close(epfd);
+}
+
+TEST(epoll_loop)
+{
+    int ep1, ep2;
+    struct epoll_event ev = {.events = EPOLLIN};
+
+    ep1 = epoll_create1(0);
+    ep2 = epoll_create1(0);
+    EXPECT_GE(ep1, 0);
+    EXPECT_GE(ep2, 0);
+
+    EXPECT_EQ(epoll_ctl(ep1, EPOLL_CTL_ADD, ep2, &ev), 0);
+    EXPECT_EQ(epoll_ctl(ep2, EPOLL_CTL_ADD, ep1, &ev), -1);
+    EXPECT_EQ(errno, ELOOP);
+
+    close(ep2);
+    close(ep1);
+}
+
+TEST(futex_wait_timeout)
+{
+    int value = 1;
+    struct timespec timeout = {.tv_sec = 0, .tv_nsec = 10000000};
+
+    EXPECT_EQ(futex(&value, FUTEX_WAIT, 2, &timeout, NULL, 0), -1);
+    EXPECT_EQ(errno, EAGAIN);
+    EXPECT_EQ(futex(&value, FUTEX_WAIT, 1, &timeout, NULL, 0), -1);
+    EXPECT_EQ(errno, ETIMEDOUT);
+    EXPECT_EQ(futex(&value, FUTEX_WAKE, 1, NULL, NULL, 0), 0);
+}
+
+static mtx_t counter_lock;
+static int counter;
+static uint8_t counter_stack[0x1000];
+
+static int counter_thread(void*)
+{
+    for (int i = 0; i < 10000; ++i)
+    {
+        mtx_lock(&counter_lock);
+        ++counter;
+        mtx_unlock(&counter_lock);
+    }
+    return 0;
+}
+
+TEST(mtx_threads)
+{
+    int status;
+    static int thread_tls[] = {
+        (int)&thread_tls[3],
+        0,
+        0,
+        0,
+    };
+
+    EXPECT_EQ(mtx_init(&counter_lock, mtx_plain), thrd_success);
+
+    int pid = clone(counter_thread, counter_stack + sizeof(counter_stack), CLONE_FS | CLONE_FILES | CLONE_VM | CLONE_SIGHAND, NULL, thread_tls);
+
+    EXPECT_GT(pid, 0);
+    counter_thread(NULL);
+    EXPECT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_EQ(counter, 20000);
+    EXPECT_EQ(mtx_trylock(&counter_lock), thrd_success);
+    EXPECT_EQ(mtx_trylock(&counter_lock), thrd_busy);
+    EXPECT_EQ(mtx_unlock(&counter_lock), thrd_success);
+}
+
+static inline int64_t timespec_ns(struct timespec* ts)
+{
+    return (int64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+TEST(clock_gettime_vdso)
+{
+    struct timespec before, now, after;
+
+    // Time read without a syscall has to fall between two syscall reads
+    for (int i = 0; i < 1000; ++i)
+    {
+        EXPECT_EQ(syscall(__NR_clock_gettime, CLOCK_MONOTONIC, &before), 0);
+        EXPECT_EQ(clock_gettime(CLOCK_MONOTONIC, &now), 0);
+        EXPECT_EQ(syscall(__NR_clock_gettime, CLOCK_MONOTONIC, &after), 0);
+
+        EXPECT_LT(now.tv_nsec, NSEC_PER_SEC);
+        EXPECT_GE(timespec_ns(&now), timespec_ns(&before));
+        EXPECT_LE(timespec_ns(&now), timespec_ns(&after));
+    }
+}
+
+static inline void xmm0_set(uint32_t value)
+{
+    asm volatile("movss %0, %%xmm0" :: "m" (value));
+}
+
+static inline uint32_t xmm0_get(void)
+{
+    uint32_t value;
+    asm volatile("movss %%xmm0, %0" : "=m" (value));
+    return value;
+}
+
+static void xmm0_clobber(int)
+{
+    xmm0_set(0xdeadbeef);
+}
+
+TEST(fpu_state_preserved)
+{
+    int p2c[2], c2p[2], status, pid;
+    int valid = 1;
+    char c = 0;
+
+    EXPECT_EQ(pipe(p2c), 0);
+    EXPECT_EQ(pipe(c2p), 0);
+
+    pid = fork();
+
+    if (pid == 0)
+    {
+        xmm0_set(0x11111111);
+
+        for (int i = 0; i < 100; ++i)
+        {
+            if (read(p2c[0], &c, 1) != 1 || xmm0_get() != 0x11111111)
+            {
+                exit(1);
+            }
+            xmm0_set(0x11111111);
+            write(c2p[1], &c, 1);
+        }
+
+        exit(0);
+    }
+
+    EXPECT_GT(pid, 0);
+
+    // Both processes keep their own register values across context switches
+    xmm0_set(0x22222222);
+
+    for (int i = 0; i < 100; ++i)
+    {
+        write(p2c[1], &c, 1);
+        if (read(c2p[0], &c, 1) != 1 || xmm0_get() != 0x22222222)
+        {
+            valid = 0;
+            break;
+        }
+    }
+
+    EXPECT_EQ(valid, 1);
+    EXPECT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+
+    // Signal handler doesn't change the state of the interrupted code
+    EXPECT_EQ(signal(SIGUSR1, &xmm0_clobber), 0);
+    EXPECT_EQ(raise(SIGUSR1), 0);
+    EXPECT_EQ(xmm0_get(), 0x22222222);
+    signal(SIGUSR1, SIG_DFL);
+
+    close(p2c[0]);
+    close(p2c[1]);
+    close(c2p[0]);
+    close(c2p[1]);
+}
+
 TEST_SUITE_END(kernel);
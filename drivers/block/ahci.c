@@ -8,6 +8,7 @@
 #include <kernel/devfs.h>
 #include <kernel/blkdev.h>
 #include <kernel/kernel.h>
+#include <kernel/minmax.h>
 #include <kernel/module.h>
 #include <kernel/execute.h>
 #include <kernel/process.h>
@@ -24,9 +25,17 @@ module_exit(ahci_deinit);
 KERNEL_MODULE(ahci);
 
 static int ahci_blk_read(void* blkdev, size_t offset, void* buffer, size_t size, bool irq);
+static int ahci_blk_readv(void* blkdev, size_t offset, const blkdev_segment_t* segs, size_t count, bool irq);
+static int ahci_blk_write(void* blkdev, size_t offset, const void* buffer, size_t size, bool irq);
+static int ahci_blk_writev(void* blkdev, size_t offset, const blkdev_segment_t* segs, size_t count, bool irq);
+static int ahci_blk_flush(void* blkdev);
 
 READONLY static blkdev_ops_t bops = {
     .read = &ahci_blk_read,
+    .write = &ahci_blk_write,
+    .readv = &ahci_blk_readv,
+    .writev = &ahci_blk_writev,
+    .flush = &ahci_blk_flush,
 };
 
 static_assert(sizeof(ahci_hba_t) == 0x1100);
@@ -36,11 +45,10 @@ static_assert(sizeof(ahci_command_t) == 32);
 static_assert(sizeof(FIS_REG_H2D) == 20);
 static_assert(sizeof(ahci_command_table_t) == 128);
 static_assert(sizeof(ahci_prdt_entry_t) == 16);
-static_assert(sizeof(ahci_port_data_t) <= PAGE_SIZE);
+static_assert(sizeof(ahci_command_slot_t) % 128 == 0);
 static_assert(offsetof(ahci_port_data_t, fis) == 0);
 static_assert(offsetof(ahci_port_data_t, cmdlist) == 0x400);
-static_assert(offsetof(ahci_port_data_t, cmdtable) == 0x800);
-static_assert(offsetof(ahci_port_data_t, prdt) == 0x880);
+static_assert(offsetof(ahci_port_data_t, slots) == 0x800);
 
 // Memory model used by AHCI driver
 //
@@ -52,11 +60,11 @@ static_assert(offsetof(ahci_port_data_t, prdt) == 0x880);
 //   clb = Physical Address of Port N Command List
 //   fb = Physical Address of Port N FIS
 //
-// data:
-// [0x0000 - 0x01ff] Port 0 FIS (ahci_received_fis_t)
-// [0x0400 - 0x04ff] Port 0 Command List (ahci_command_t); must be 1K aligned
-//   ctba = Physical Address of Port 0 Command Table[n]
-// [0x0800 - 0x08bf] Port 0 Command Table (ahci_command_table_t + ahci_prdt_entry_t * 4)
+// data (AHCI_PORT_DATA_PAGES physically contiguous pages for each port):
+// [0x0000 - 0x01ff] Port FIS (ahci_received_fis_t)
+// [0x0400 - 0x07ff] Port Command List (ahci_command_t * 32); must be 1K aligned
+//   ctba = Physical Address of Port Command Table[n]
+// [0x0800 - 0x87ff] Port Command Tables (ahci_command_slot_t * 32), one for each slot
 
 static const char* ahci_signature_string(uint32_t sig)
 {
@@ -141,14 +149,20 @@ static void ahci_irq_handle(uint32_t, void* private, pt_regs_t*)
         request_t* req;
         int errno = ahci_port_error_check(ahci, port);
 
+        // Queued command is completed once device clears its bit in
+        // SActive with Set Device Bits FIS; single interrupt may
+        // complete several of them
+        uint32_t active = port->regs->ci | port->regs->sact;
+
         list_for_each_entry_safe(req, &port->requests, list_entry)
         {
-            if (port->regs->ci & (1 << req->slot))
+            if (active & (1 << req->slot))
             {
                 continue;
             }
 
             req->errno = errno;
+            req->done = true;
 
             list_del(&req->list_entry);
 
@@ -281,7 +295,7 @@ static int ahci_drive_await_transfer_finish(ahci_t* ahci, ahci_port_t* port, int
 
         // In some longer duration reads, it may be helpful to spin on the DPS bit
         // in the PxIS port field as well (1 << 5)
-        if (!(port->regs->ci & (1 << slot)))
+        if (!((port->regs->ci | port->regs->sact) & (1 << slot)))
         {
             break;
         }
@@ -309,10 +323,10 @@ static int ahci_port_check(ahci_t* ahci, int nr)
     return 0;
 }
 
-static int ahci_port_cmd_slot_find(ahci_hba_port_t* port)
+static int ahci_port_cmd_slot_find(ahci_port_t* port)
 {
-    uint32_t slots = port->sact | port->ci;
-    for (int i = 0; i < AHCI_PORT_COUNT; i++)
+    uint32_t slots = port->slots | port->regs->sact | port->regs->ci;
+    for (int i = 0; i < port->slots_count; i++)
     {
         if (!(slots & 1))
         {
@@ -323,109 +337,349 @@ static int ahci_port_cmd_slot_find(ahci_hba_port_t* port)
     return -1;
 }
 
-static int ahci_read(ata_device_t* device, uint32_t offset, uint32_t count, char* buffer, bool irq)
+static int ahci_port_slot_get(ahci_port_t* port, bool exclusive)
 {
-    int errno;
-    ahci_t* ahci = device->data;
-    ahci_port_t* port = ahci->ports[device->id];
-    int slot = ahci_port_cmd_slot_find(port->regs);
-    uint32_t sectors = count / device->sector_size;
-
-    if (unlikely(slot == -1))
+    if (!exclusive)
     {
-        return -EBUSY;
+        return ahci_port_cmd_slot_find(port);
     }
 
-    uint32_t paddr = vm_paddr(addr(buffer), process_current->mm->pgd);
+    return (port->slots | port->regs->sact | port->regs->ci) ? -1 : 0;
+}
+
+// Non-queued command cannot be issued while queued ones are outstanding,
+// so when exclusive is set, all slots are taken
+static int ahci_slot_alloc(ahci_port_t* port, bool exclusive, bool irq)
+{
+    int slot;
+    flags_t flags;
 
-    if (unlikely(!paddr))
+    irq_save(flags);
+
+    while ((slot = ahci_port_slot_get(port, exclusive)) == -1)
     {
-        return -EFAULT;
+        if (!irq)
+        {
+            irq_restore(flags);
+            return -EBUSY;
+        }
+
+        WAIT_QUEUE_DECLARE(q, process_current);
+        process_wait_locked(&port->slot_queue, &q, &flags);
     }
 
-    ahci_port_error_clear(port);
+    port->slots |= exclusive ? ~0U : 1U << slot;
 
-    log_debug(DEBUG_AHCI, "device: %u, offset: %u, count: %u, slot: %u", device->id, offset, count, slot);
+    irq_restore(flags);
 
-    port->data->cmdlist[slot].cfl = sizeof(FIS_REG_H2D) / sizeof(uint32_t);
-    port->data->cmdlist[slot].w = 0;
-    port->data->cmdlist[slot].prdtl = 1;
+    return slot;
+}
 
-    ahci_prdt_entry_t* prdt = &port->data->prdt[0];
-    prdt->dba       = paddr;
-    prdt->dbau      = 0;
-    prdt->dbc       = count - 1;
-    prdt->i         = 1;
+static void ahci_slot_free(ahci_port_t* port, int slot, bool exclusive)
+{
+    process_t* proc;
 
-    FIS_REG_H2D* fis = ptr(&port->data->cmdtable.cfis);
-    fis->fis_type   = FIS_TYPE_REG_H2D;
-    fis->command    = ATA_CMD_READ_DMA_EXT;
-    fis->c          = 1;
+    scoped_irq_lock();
 
-    fis->lba0 = (uint8_t)offset;
-    fis->lba1 = (uint8_t)(offset >> 8);
-    fis->lba2 = (uint8_t)(offset >> 16);
-    fis->device = 1 << 6; // LBA mode
-    fis->lba3 = (uint8_t)(offset >> 24);
-    fis->lba4 = 0;
-    fis->lba5 = 0;
-    fis->countl = sectors & 0xff;
-    fis->counth = (sectors >> 8) & 0xff;
+    port->slots &= exclusive ? 0 : ~(1U << slot);
 
-    if (unlikely(errno = ahci_drive_wait(ahci, port)))
+    // Waiter for exclusive access may not be satisfied by a single slot,
+    // so all of them are woken up
+    while ((proc = wait_queue_pop(&port->slot_queue)))
     {
-        return errno;
+        process_wake(proc);
     }
+}
 
-    if (ahci->interrupts && irq)
+static void ahci_fis_lba_set(FIS_REG_H2D* fis, uint64_t lba)
+{
+    fis->lba0 = (uint8_t)lba;
+    fis->lba1 = (uint8_t)(lba >> 8);
+    fis->lba2 = (uint8_t)(lba >> 16);
+    fis->device = 1 << 6; // LBA mode
+    fis->lba3 = (uint8_t)(lba >> 24);
+    fis->lba4 = (uint8_t)(lba >> 32);
+    fis->lba5 = (uint8_t)(lba >> 40);
+}
+
+static inline void ahci_prdt_entry_set(ahci_prdt_entry_t* prdt, uintptr_t paddr, size_t size)
+{
+    prdt->dba   = paddr;
+    prdt->dbau  = 0;
+    prdt->dbc   = size - 1;
+    prdt->i     = 0;
+}
+
+static int ahci_command_issue(ahci_t* ahci, ahci_port_t* port, int slot, bool queued, bool irq)
+{
+    int errno;
+    flags_t flags;
+
+    if (!(ahci->interrupts && irq))
     {
-        flags_t flags;
+        if (queued)
+        {
+            port->regs->sact = 1 << slot;
+        }
+        port->regs->ci = 1 << slot;
+        return ahci_drive_await_transfer_finish(ahci, port, slot);
+    }
+
+    request_t req = {.slot = slot};
+
+    wait_queue_head_init(&req.queue);
+    list_init(&req.list_entry);
 
-        irq_save(flags);
-        request_t req = {.slot = slot};
+    irq_save(flags);
 
-        wait_queue_head_init(&req.queue);
-        list_init(&req.list_entry);
+    list_add_tail(&req.list_entry, &port->requests);
 
+    if (queued)
+    {
+        port->regs->sact = 1 << slot;
+    }
+    port->regs->ci = 1 << slot;
+
+    // Request lives on the stack and the DMA cannot be cancelled,
+    // so wait for the completion even if a signal arrives
+    while (!req.done)
+    {
         WAIT_QUEUE_DECLARE(q, process_current);
+        process_wait_locked(&req.queue, &q, &flags);
+    }
 
-        list_add_tail(&req.list_entry, &port->requests);
+    errno = req.errno;
 
-        port->regs->ci = 1 << slot;
+    irq_restore(flags);
+
+    return errno;
+}
+
+// Fills the PRDT of the slot with physical regions backing the segments,
+// starting at the cursor and merging the physically contiguous ones; returns
+// number of bytes described, which is less than count if PRDT gets full,
+// always a multiple of align
+static int ahci_prdt_build(
+    ahci_command_slot_t* table,
+    ahci_sg_cursor_t* cursor,
+    size_t count,
+    size_t align,
+    int* entries)
+{
+    int n = 0;
+    size_t len, done = 0;
+    uintptr_t vaddr, paddr, start = 0;
+    size_t size = 0;
+    const pgd_t* pgd = process_current->mm->pgd;
 
-        if (unlikely(errno = process_wait_locked(&req.queue, &q, &flags)))
+    while (done < count && cursor->seg != cursor->end)
+    {
+        vaddr = addr(cursor->seg->buffer) + cursor->offset;
+        len = min(count - done, cursor->seg->size - cursor->offset);
+        len = min(len, PAGE_SIZE - (vaddr & PAGE_MASK));
+        paddr = vm_paddr(vaddr, pgd);
+
+        // Data base address has to be word aligned
+        if (unlikely(!paddr || (paddr & 1)))
         {
-            irq_restore(flags);
-            return errno;
+            return -EFAULT;
         }
 
-        if (unlikely(errno = req.errno))
+        if (size && start + size == paddr && size + len <= AHCI_PRDT_MAX_SIZE)
         {
-            irq_restore(flags);
-            return errno;
+            size += len;
+        }
+        else
+        {
+            if (size)
+            {
+                if (n == PRDT_COUNT - 1)
+                {
+                    break;
+                }
+                ahci_prdt_entry_set(&table->prdt[n++], start, size);
+            }
+            start = paddr;
+            size = len;
         }
 
-        irq_restore(flags);
+        done += len;
+
+        if ((cursor->offset += len) == cursor->seg->size)
+        {
+            ++cursor->seg;
+            cursor->offset = 0;
+        }
     }
-    else
+
+    // Transfer is cut at the sector boundary; segments are made of whole
+    // sectors, so the remainder always comes from the current segment and
+    // the last region, starting at page boundary, is longer than it
+    len = done % align;
+    size -= len;
+    done -= len;
+    cursor->offset -= len;
+
+    ahci_prdt_entry_set(&table->prdt[n++], start, size);
+    table->prdt[n - 1].i = 1;
+
+    *entries = n;
+
+    return done;
+}
+
+static int ahci_rw(ata_device_t* device, uint32_t offset, const blkdev_segment_t* segs, size_t nsegs, bool write, bool irq)
+{
+    int errno, slot, entries, len;
+    ahci_t* ahci = device->data;
+    ahci_port_t* port = ahci->ports[device->id];
+    uint32_t sectors;
+    ahci_sg_cursor_t cursor = {.seg = segs, .end = segs + nsegs};
+
+    // PRDT is built from physical addresses, so user pages have to be
+    // mapped, and for reads shared ones have to be copied beforehand
+    for (size_t i = 0; i < nsegs; ++i)
     {
-        port->regs->ci = 1 << slot;
-        if ((errno = ahci_drive_await_transfer_finish(ahci, port, slot)))
+        if (unlikely(errno = vm_fault_in(segs[i].buffer, segs[i].size, !write)))
+        {
+            return errno;
+        }
+    }
+
+    while (cursor.seg != cursor.end)
+    {
+        if (unlikely((slot = ahci_slot_alloc(port, false, irq)) < 0))
+        {
+            return slot;
+        }
+
+        ahci_command_t* cmd = &port->data->cmdlist[slot];
+        ahci_command_slot_t* table = &port->data->slots[slot];
+
+        len = ahci_prdt_build(
+            table,
+            &cursor,
+            AHCI_MAX_SECTORS * device->sector_size,
+            device->sector_size,
+            &entries);
+
+        if (unlikely(len <= 0))
+        {
+            ahci_slot_free(port, slot, false);
+            return len ? len : -EFAULT;
+        }
+
+        sectors = len / device->sector_size;
+
+        log_debug(DEBUG_AHCI, "device: %u, %s offset: %u, count: %u, slot: %u, prdtl: %u",
+            device->id, write ? "write" : "read", offset, len, slot, entries);
+
+        cmd->cfl    = sizeof(FIS_REG_H2D) / sizeof(uint32_t);
+        cmd->w      = write;
+        cmd->prdtl  = entries;
+        cmd->prdbc  = 0;
+
+        FIS_REG_H2D* fis = ptr(&table->table.cfis);
+        memset(fis, 0, sizeof(*fis));
+        fis->fis_type   = FIS_TYPE_REG_H2D;
+        fis->c          = 1;
+
+        ahci_fis_lba_set(fis, offset);
+
+        if (port->ncq)
+        {
+            // Sector count goes to the features register and the tag to count
+            fis->command  = write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA;
+            fis->featurel = sectors & 0xff;
+            fis->featureh = (sectors >> 8) & 0xff;
+            fis->countl   = slot << 3;
+        }
+        else
+        {
+            fis->command  = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+            fis->countl   = sectors & 0xff;
+            fis->counth   = (sectors >> 8) & 0xff;
+        }
+
+        // With other commands outstanding the device is expected to be busy;
+        // HBA issues the command once the device is ready
+        if (!(port->slots & ~(1 << slot)))
+        {
+            ahci_port_error_clear(port);
+
+            if (unlikely(errno = ahci_drive_wait(ahci, port)))
+            {
+                ahci_slot_free(port, slot, false);
+                return errno;
+            }
+        }
+
+        errno = ahci_command_issue(ahci, port, slot, port->ncq, irq);
+
+        ahci_slot_free(port, slot, false);
+
+        if (unlikely(errno))
         {
             return errno;
         }
+
+        offset += sectors;
     }
 
     return 0;
 }
 
+static int ahci_flush(ata_device_t* device, bool irq)
+{
+    int errno, slot;
+    ahci_t* ahci = device->data;
+    ahci_port_t* port = ahci->ports[device->id];
+
+    if (unlikely((slot = ahci_slot_alloc(port, true, irq)) < 0))
+    {
+        return slot;
+    }
+
+    ahci_command_t* cmd = &port->data->cmdlist[slot];
+    FIS_REG_H2D* fis = ptr(&port->data->slots[slot].table.cfis);
+
+    cmd->cfl    = sizeof(FIS_REG_H2D) / sizeof(uint32_t);
+    cmd->w      = 0;
+    cmd->prdtl  = 0;
+    cmd->prdbc  = 0;
+
+    memset(fis, 0, sizeof(*fis));
+    fis->fis_type   = FIS_TYPE_REG_H2D;
+    fis->c          = 1;
+    fis->command    = ATA_CMD_CACHE_FLUSH_EXT;
+    fis->device     = 1 << 6;
+
+    ahci_port_error_clear(port);
+
+    if (likely(!(errno = ahci_drive_wait(ahci, port))))
+    {
+        errno = ahci_command_issue(ahci, port, slot, false, irq);
+    }
+
+    ahci_slot_free(port, slot, true);
+
+    return errno;
+}
+
 static int ahci_blk_read(void* blkdev, size_t offset, void* buffer, size_t size, bool irq)
+{
+    ata_device_t* device = blkdev;
+    blkdev_segment_t seg = {.buffer = buffer, .size = size * device->sector_size};
+
+    return ahci_blk_readv(blkdev, offset, &seg, 1, irq);
+}
+
+static int ahci_blk_readv(void* blkdev, size_t offset, const blkdev_segment_t* segs, size_t count, bool irq)
 {
     int errno;
     ata_device_t* device = blkdev;
-    size_t count = size * device->sector_size;
 
-    if (unlikely(errno = ahci_read(device, offset, count, buffer, irq)))
+    if (unlikely(errno = ahci_rw(device, offset, segs, count, false, irq)))
     {
         log_warning("read error!");
         return errno;
@@ -434,6 +688,41 @@ static int ahci_blk_read(void* blkdev, size_t offset, void* buffer, size_t size,
     return 0;
 }
 
+static int ahci_blk_write(void* blkdev, size_t offset, const void* buffer, size_t size, bool irq)
+{
+    ata_device_t* device = blkdev;
+    blkdev_segment_t seg = {.buffer = (void*)buffer, .size = size * device->sector_size};
+
+    return ahci_blk_writev(blkdev, offset, &seg, 1, irq);
+}
+
+static int ahci_blk_writev(void* blkdev, size_t offset, const blkdev_segment_t* segs, size_t count, bool irq)
+{
+    int errno;
+    ata_device_t* device = blkdev;
+
+    if (unlikely(errno = ahci_rw(device, offset, segs, count, true, irq)))
+    {
+        log_warning("write error!");
+        return errno;
+    }
+
+    return 0;
+}
+
+static int ahci_blk_flush(void* blkdev)
+{
+    int errno;
+
+    if (unlikely(errno = ahci_flush(blkdev, true)))
+    {
+        log_warning("flush error!");
+        return errno;
+    }
+
+    return 0;
+}
+
 static int ahci_mode_set(ahci_t* ahci)
 {
     ahci->hba->ghc.ae = 1;
@@ -504,9 +793,10 @@ static int ahci_port_setup(ahci_t* ahci, size_t id)
         return -ENOMEM;
     }
 
-    port->data_pages = page_alloc(1, PAGE_ALLOC_UNCACHED | PAGE_ALLOC_ZEROED);
+    port->data_pages = page_alloc(AHCI_PORT_DATA_PAGES, PAGE_ALLOC_CONT | PAGE_ALLOC_UNCACHED | PAGE_ALLOC_ZEROED);
 
     list_init(&port->requests);
+    wait_queue_head_init(&port->slot_queue);
 
     if (unlikely(!port->data_pages))
     {
@@ -517,6 +807,7 @@ static int ahci_port_setup(ahci_t* ahci, size_t id)
     port->id   = id;
     port->data = page_virt_ptr(port->data_pages);
     port->regs = &ahci->hba->ports[id];
+    port->slots_count = ahci->hba->cap.ncs + 1;
 
     port->regs->cmd &= ~AHCI_PxCMD_ST;
     while (port->regs->cmd & AHCI_PxCMD_CR);
@@ -531,10 +822,10 @@ static int ahci_port_setup(ahci_t* ahci, size_t id)
 
     log_debug(DEBUG_AHCI, "clb = %#x, fb = %#x", port->regs->clb, port->regs->fb);
 
-    for (int i = 0; i < 1; ++i)
+    for (int i = 0; i < CMDLIST_COUNT; ++i)
     {
         ahci_command_t* cmdheader = &port->data->cmdlist[i];
-        cmdheader->ctba = ahci_port_phys_addr(port, &port->data->cmdtable);
+        cmdheader->ctba = ahci_port_phys_addr(port, &port->data->slots[i]);
         log_debug(DEBUG_AHCI, "ctba = %#x", cmdheader->ctba);
     }
 
@@ -576,8 +867,8 @@ static void ahci_port_detect(ahci_t* ahci, ahci_port_t* port)
 {
     int errno;
     int id = port->id;
-    int slot = ahci_port_cmd_slot_find(port->regs);
-    FIS_REG_H2D* fis = ptr(&port->data->cmdtable.cfis);
+    int slot = ahci_port_cmd_slot_find(port);
+    FIS_REG_H2D* fis;
 
     page_t* page = page_alloc(1, PAGE_ALLOC_ZEROED);
 
@@ -595,6 +886,8 @@ static void ahci_port_detect(ahci_t* ahci, ahci_port_t* port)
         return;
     }
 
+    fis = ptr(&port->data->slots[slot].table.cfis);
+
     ahci_command_t* cmd = &port->data->cmdlist[slot];
     cmd->cfl        = sizeof(FIS_REG_H2D) / sizeof(uint32_t);
     cmd->w          = 0;
@@ -602,7 +895,7 @@ static void ahci_port_detect(ahci_t* ahci, ahci_port_t* port)
     cmd->prdbc      = 0;
     cmd->p          = 1;
 
-    ahci_prdt_entry_t* prdt = &port->data->prdt[0];
+    ahci_prdt_entry_t* prdt = &port->data->slots[slot].prdt[0];
     prdt->dba       = page_phys(page);
     prdt->dbau      = 0;
     prdt->dbc       = ATA_IDENT_SIZE - 1;
@@ -631,6 +924,14 @@ static void ahci_port_detect(ahci_t* ahci, ahci_port_t* port)
 
         ata_device_initialize(device, buf, id, ahci);
 
+        if (ahci->hba->cap.sncq && device->ncq)
+        {
+            port->ncq = true;
+            port->slots_count = min(port->slots_count, (int)device->queue_depth);
+        }
+
+        log_info("port %u: NCQ: %B; slots: %u", id, port->ncq, port->slots_count);
+
         ahci->devices[id] = device;
     }
 
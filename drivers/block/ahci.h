@@ -4,6 +4,7 @@
 #include <arch/pci.h>
 #include <kernel/list.h>
 #include <kernel/wait.h>
+#include <kernel/blkdev.h>
 #include <kernel/compiler.h>
 #include <kernel/page_alloc.h>
 
@@ -26,6 +27,8 @@ typedef struct ahci_received_fis ahci_received_fis_t;
 typedef struct ahci_command_table ahci_command_table_t;
 typedef struct ahci_command ahci_command_t;
 typedef struct ahci_prdt_entry ahci_prdt_entry_t;
+typedef struct ahci_command_slot ahci_command_slot_t;
+typedef struct ahci_sg_cursor ahci_sg_cursor_t;
 
 #define AHCI_REG(name, val) \
     AHCI_##name = val
@@ -423,6 +426,7 @@ struct request
 {
     int               slot;
     int               errno;
+    bool              done;
     wait_queue_head_t queue;
     list_head_t       list_entry;
 };
@@ -433,20 +437,46 @@ struct ahci_port
     uint32_t          signature;
     ahci_hba_port_t*  regs;
     list_head_t       requests;
+    uint32_t          slots;        // Bitmap of slots used by the driver
+    int               slots_count;  // Number of slots usable for the device
+    bool              ncq;          // Commands are issued as FPDMA QUEUED
+    wait_queue_head_t slot_queue;   // Processes waiting for a free slot
     ahci_port_data_t* data;
     page_t*           data_pages;
 };
 
 #define CMDLIST_COUNT 32
-#define PRDT_COUNT    4
+#define PRDT_COUNT    56
+
+// Byte count of PRDT entry is 22 bits wide
+#define AHCI_PRDT_MAX_SIZE  (4 * MiB)
+
+// Sector count of a single command is 16 bits wide
+#define AHCI_MAX_SECTORS    0xffff
+
+// Each command slot has its own table, so that all slots
+// can be in flight at the same time; table is 128 B aligned
+struct ahci_command_slot
+{
+    ahci_command_table_t    table;
+    ahci_prdt_entry_t       prdt[PRDT_COUNT];
+};
 
 struct ahci_port_data
 {
     ahci_received_fis_t     fis;
     uint8_t                 pad[1024 - sizeof(ahci_received_fis_t)];
     ahci_command_t          cmdlist[CMDLIST_COUNT];
-    ahci_command_table_t    cmdtable;
-    ahci_prdt_entry_t       prdt[PRDT_COUNT];
+    ahci_command_slot_t     slots[CMDLIST_COUNT];
+};
+
+#define AHCI_PORT_DATA_PAGES    (align(sizeof(ahci_port_data_t), PAGE_SIZE) / PAGE_SIZE)
+
+struct ahci_sg_cursor
+{
+    const blkdev_segment_t* seg;
+    const blkdev_segment_t* end;
+    size_t                  offset;
 };
 
 struct ahci
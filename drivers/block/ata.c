@@ -50,6 +50,15 @@ void ata_device_initialize(ata_device_t* device, uint8_t* buf, uint8_t id, void*
         {
             device->sector_size = ATA_SECTOR_SIZE;
         }
+
+        // SATA capabilities; 0 and 0xffff mean the word is not supported
+        uint16_t word76 = identw(ATA_IDENT_SATA_CAPS);
+
+        if (word76 && word76 != 0xffff && (word76 & (1 << 8)))
+        {
+            device->ncq = 1;
+            device->queue_depth = (identw(ATA_IDENT_QUEUE_DEPTH) & 0x1f) + 1;
+        }
     }
     else
     {
@@ -37,6 +37,8 @@ typedef struct ata_device ata_device_t;
 #define ATA_IDENT_CAPABILITIES  98
 #define ATA_IDENT_FIELDVALID    106
 #define ATA_IDENT_MAX_LBA       120
+#define ATA_IDENT_QUEUE_DEPTH   150
+#define ATA_IDENT_SATA_CAPS     152
 #define ATA_IDENT_COMMANDSETS   164
 #define ATA_IDENT_MAX_LBA_EXT   200
 #define ATA_IDENT_SECTOR_SIZE   234
@@ -49,6 +51,8 @@ typedef struct ata_device ata_device_t;
 #define ATA_CMD_WRITE_PIO_EXT   0x34
 #define ATA_CMD_WRITE_DMA       0xca
 #define ATA_CMD_WRITE_DMA_EXT   0x35
+#define ATA_CMD_READ_FPDMA      0x60    // READ FPDMA QUEUED (NCQ)
+#define ATA_CMD_WRITE_FPDMA     0x61    // WRITE FPDMA QUEUED (NCQ)
 #define ATA_CMD_CACHE_FLUSH     0xe7
 #define ATA_CMD_CACHE_FLUSH_EXT 0xea
 #define ATA_CMD_PACKET          0xa0
@@ -67,6 +71,8 @@ struct ata_device
     uint8_t  id;
     uint8_t  type:1;
     uint8_t  dma:1;
+    uint8_t  ncq:1;
+    uint8_t  queue_depth;
     uint16_t capabilities;
     uint32_t command_sets;
     size_t   sectors;
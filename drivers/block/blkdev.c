@@ -6,8 +6,10 @@
 #include <kernel/devfs.h>
 #include <kernel/blkdev.h>
 #include <kernel/kernel.h>
+#include <kernel/process.h>
 #include <kernel/page_alloc.h>
 
+#define DEBUG_BLKDEV   0
 #define MAX_BLOCK_SIZE 4096
 #define BLKDEV_SLOTS   24
 
@@ -42,20 +44,34 @@ struct blkdev
     char          devfs_name[16];
     char          vendor_id[40];
     char          model_id[64];
+    size_t        max_sectors;
+    list_head_t   queue;        // Pending bios sorted by LBA
+    uint32_t      head_pos;     // Sector following the last dispatched request
+    bool          busy;
+    bool          unplugged;
+    int           write_errno;  // Error of a write which nobody waited for
 };
 
 typedef struct blkdev blkdev_t;
 
 static int blkdev_open(file_t* file);
 static int blkdev_read(file_t* file, char* buf, size_t count);
+static int blkdev_write(file_t* file, const char* buf, size_t count);
 
 static blkdev_t* ide_blkdevs[BLKDEV_SLOTS];
 static blkdev_t* sata_blkdevs[BLKDEV_SLOTS];
 static blkdev_t* cdrom_blkdevs[BLKDEV_SLOTS];
 
+static blkdev_t** blkdevs_tables[] = {
+    ide_blkdevs,
+    sata_blkdevs,
+    cdrom_blkdevs,
+};
+
 READONLY static file_operations_t fops = {
     .open = &blkdev_open,
     .read = &blkdev_read,
+    .write = &blkdev_write,
 };
 
 static const char* blkdev_part_type_string(uint8_t type)
@@ -342,6 +358,13 @@ int blkdev_register(blkdev_char_t* blk, void* data, blkdev_ops_t* ops)
     blkdev->block_size  = blk->block_size;
     blkdev->block_shift = blk->block_size ? blkdev_block_shift_calculate(blk->block_size) : 0;
     blkdev->ops         = ops;
+    blkdev->max_sectors = blk->max_sectors;
+    blkdev->write_errno = 0;
+
+    list_init(&blkdev->queue);
+    blkdev->head_pos = 0;
+    blkdev->busy = false;
+    blkdev->unplugged = false;
 
     if (blk->vendor)
     {
@@ -421,6 +444,321 @@ int blkdev_free(int major, int id)
     return -EINVAL;
 }
 
+static blkdev_t* blkdev_find(dev_t dev)
+{
+    int drive = BLK_DRIVE(MINOR(dev));
+
+    if (unlikely(drive >= BLKDEV_SLOTS))
+    {
+        return NULL;
+    }
+
+    switch (MAJOR(dev))
+    {
+        case MAJOR_BLK_IDE:   return ide_blkdevs[drive];
+        case MAJOR_BLK_SATA:  return sata_blkdevs[drive];
+        case MAJOR_BLK_CDROM: return cdrom_blkdevs[drive];
+        default:              return NULL;
+    }
+}
+
+static void bio_complete(bio_t* bio, int errno)
+{
+    process_t* proc;
+
+    scoped_irq_lock();
+
+    bio->errno = errno;
+    bio->done = true;
+
+    if (bio->end_io)
+    {
+        bio->end_io(bio);
+    }
+
+    while ((proc = wait_queue_pop(&bio->queue)))
+    {
+        process_wake(proc);
+    }
+}
+
+// Queue is kept sorted by LBA
+static void blkdev_queue_insert(blkdev_t* blkdev, bio_t* bio)
+{
+    bio_t* pos;
+
+    list_for_each_entry(pos, &blkdev->queue, list_entry)
+    {
+        if (pos->lba > bio->lba)
+        {
+            break;
+        }
+    }
+
+    list_add_tail(&bio->list_entry, &pos->list_entry);
+}
+
+// Moves bios of the next request to the list; it starts with the first bio
+// at or after the last dispatched sector (wrapping around to the lowest one)
+// and spans all following bios of the same kind which continue it
+static size_t blkdev_request_collect(blkdev_t* blkdev, list_head_t* bios)
+{
+    bio_t* bio;
+    bio_t* first = NULL;
+    size_t count = 0, segments = 0;
+    uint32_t next;
+    int op;
+
+    list_for_each_entry(bio, &blkdev->queue, list_entry)
+    {
+        if (bio->lba >= blkdev->head_pos)
+        {
+            first = bio;
+            break;
+        }
+    }
+
+    if (!first)
+    {
+        first = list_front(&blkdev->queue, bio_t, list_entry);
+    }
+
+    next = first->lba;
+    op = first->op;
+
+    while (&first->list_entry != &blkdev->queue)
+    {
+        bio = first;
+        first = list_next_entry(&bio->list_entry, bio_t, list_entry);
+
+        if (bio->lba != next
+            || bio->op != op
+            || segments == BLKDEV_MAX_SEGMENTS
+            || (blkdev->max_sectors && count + bio->count > blkdev->max_sectors))
+        {
+            break;
+        }
+
+        list_del(&bio->list_entry);
+        list_add_tail(&bio->list_entry, bios);
+
+        next += bio->count;
+        count += bio->count;
+        ++segments;
+    }
+
+    blkdev->head_pos = next;
+
+    return segments;
+}
+
+static int blkdev_request_dispatch(blkdev_t* blkdev, list_head_t* bios, size_t segments)
+{
+    int errno;
+    bio_t* bio;
+    size_t i = 0;
+    blkdev_segment_t segs[BLKDEV_MAX_SEGMENTS];
+    bio_t* first = list_front(bios, bio_t, list_entry);
+    bool write = first->op == BIO_WRITE;
+    typeof(blkdev->ops->readv) vector = write ? blkdev->ops->writev : blkdev->ops->readv;
+
+    if (segments > 1 && vector)
+    {
+        log_debug(DEBUG_BLKDEV, "%s: %s lba: %u, segments: %zu",
+            blkdev->devfs_name,
+            write ? "write" : "read",
+            first->lba,
+            segments);
+
+        list_for_each_entry(bio, bios, list_entry)
+        {
+            segs[i].buffer = bio->buffer;
+            segs[i++].size = bio->count << blkdev->block_shift;
+        }
+
+        return vector(blkdev->data, first->lba, segs, segments, true);
+    }
+
+    list_for_each_entry(bio, bios, list_entry)
+    {
+        errno = write
+            ? blkdev->ops->write(blkdev->data, bio->lba, bio->buffer, bio->count, true)
+            : blkdev->ops->read(blkdev->data, bio->lba, bio->buffer, bio->count, true);
+
+        if (unlikely(errno))
+        {
+            return errno;
+        }
+    }
+
+    return 0;
+}
+
+// Requests are dispatched by the process which finds the queue idle; the
+// driver may sleep, so the others only add their bios in the meantime
+static void blkdev_queue_run(blkdev_t* blkdev)
+{
+    int errno;
+    bio_t* bio;
+    size_t segments;
+    flags_t flags;
+    list_head_t bios;
+
+    irq_save(flags);
+
+    if (blkdev->busy)
+    {
+        irq_restore(flags);
+        return;
+    }
+
+    blkdev->busy = true;
+
+    while (!list_empty(&blkdev->queue))
+    {
+        list_init(&bios);
+        segments = blkdev_request_collect(blkdev, &bios);
+
+        irq_restore(flags);
+
+        errno = blkdev_request_dispatch(blkdev, &bios, segments);
+
+        list_for_each_entry_safe(bio, &bios, list_entry)
+        {
+            list_del(&bio->list_entry);
+            bio_complete(bio, errno);
+        }
+
+        irq_save(flags);
+    }
+
+    blkdev->busy = false;
+
+    irq_restore(flags);
+}
+
+void bio_init(bio_t* bio, int op, dev_t dev, uint32_t sector, size_t count, void* buffer)
+{
+    memset(bio, 0, sizeof(*bio));
+    bio->op = op;
+    bio->dev = dev;
+    bio->sector = sector;
+    bio->count = count;
+    bio->buffer = buffer;
+    wait_queue_head_init(&bio->queue);
+    list_init(&bio->list_entry);
+}
+
+int bio_submit(bio_t* bio, blkdev_plug_t* plug)
+{
+    uint32_t first_sector, last_sector;
+    int partition = BLK_PARTITION(MINOR(bio->dev));
+    blkdev_t* blkdev = blkdev_find(bio->dev);
+
+    // Queue may be run by other process, so buffer has to be valid in
+    // any address space
+    if (unlikely(!blkdev || !bio->count || !kernel_address(addr(bio->buffer))))
+    {
+        return -EINVAL;
+    }
+
+    if (unlikely(bio->op == BIO_WRITE && !blkdev->ops->write))
+    {
+        return -EROFS;
+    }
+
+    if (partition != BLK_NO_PARTITION)
+    {
+        if (unlikely((size_t)partition >= blkdev->partition_count))
+        {
+            return -EINVAL;
+        }
+
+        first_sector = blkdev->partitions[partition].start;
+        last_sector  = blkdev->partitions[partition].end;
+    }
+    else
+    {
+        first_sector = 0;
+        last_sector  = blkdev->sectors;
+    }
+
+    if (unlikely(bio->sector + bio->count > last_sector - first_sector))
+    {
+        return -EINVAL;
+    }
+
+    bio->blkdev = blkdev;
+    bio->lba = first_sector + bio->sector;
+    bio->done = false;
+
+    if (plug)
+    {
+        list_add_tail(&bio->list_entry, &plug->bios);
+        return 0;
+    }
+
+    {
+        scoped_irq_lock();
+        blkdev_queue_insert(blkdev, bio);
+    }
+
+    blkdev_queue_run(blkdev);
+
+    return 0;
+}
+
+int bio_wait(bio_t* bio)
+{
+    flags_t flags;
+
+    irq_save(flags);
+
+    while (!bio->done)
+    {
+        WAIT_QUEUE_DECLARE(q, process_current);
+        process_wait_locked(&bio->queue, &q, &flags);
+    }
+
+    irq_restore(flags);
+
+    return bio->errno;
+}
+
+void blkdev_plug(blkdev_plug_t* plug)
+{
+    list_init(&plug->bios);
+}
+
+void blkdev_unplug(blkdev_plug_t* plug)
+{
+    bio_t* bio;
+    blkdev_t* blkdev;
+
+    {
+        scoped_irq_lock();
+
+        list_for_each_entry_safe(bio, &plug->bios, list_entry)
+        {
+            list_del(&bio->list_entry);
+            blkdev_queue_insert(bio->blkdev, bio);
+            bio->blkdev->unplugged = true;
+        }
+    }
+
+    for (size_t i = 0; i < array_size(blkdevs_tables); ++i)
+    {
+        for (int j = 0; j < BLKDEV_SLOTS; ++j)
+        {
+            if ((blkdev = blkdevs_tables[i][j]) && blkdev->unplugged)
+            {
+                blkdev->unplugged = false;
+                blkdev_queue_run(blkdev);
+            }
+        }
+    }
+}
+
 static int blkdev_open(file_t*)
 {
     return 0;
@@ -464,20 +802,12 @@ static int blkdev_medium_detect(blkdev_t* blkdev)
     return errno;
 }
 
-static int blkdev_read(file_t* file, char* buf, size_t count)
+static int blkdev_rw(file_t* file, char* buf, size_t count, int op)
 {
     int errno;
-    int drive = BLK_DRIVE(MINOR(file->dentry->inode->rdev));
-    int partition = BLK_PARTITION(MINOR(file->dentry->inode->rdev));
-    blkdev_t* blkdev = NULL;
-
-    switch (MAJOR(file->dentry->inode->rdev))
-    {
-        case MAJOR_BLK_IDE:   blkdev = ide_blkdevs[drive]; break;
-        case MAJOR_BLK_SATA:  blkdev = sata_blkdevs[drive]; break;
-        case MAJOR_BLK_CDROM: blkdev = cdrom_blkdevs[drive]; break;
-        default:              return -EINVAL;
-    }
+    dev_t dev = file->dentry->inode->rdev;
+    int partition = BLK_PARTITION(MINOR(dev));
+    blkdev_t* blkdev = blkdev_find(dev);
 
     if (unlikely(!blkdev))
     {
@@ -511,9 +841,7 @@ static int blkdev_read(file_t* file, char* buf, size_t count)
         last_sector  = blkdev->sectors;
     }
 
-    offset += first_sector;
-
-    max_count = (last_sector - offset) << blkdev->block_shift;
+    max_count = (last_sector - first_sector - offset) << blkdev->block_shift;
     count = count > max_count
         ? max_count
         : count;
@@ -523,7 +851,31 @@ static int blkdev_read(file_t* file, char* buf, size_t count)
         return 0;
     }
 
-    if (unlikely(errno = blkdev->ops->read(blkdev->data, offset, buf, count >> blkdev->block_shift, true)))
+    if (op == BIO_WRITE && unlikely(!blkdev->ops->write))
+    {
+        return -EROFS;
+    }
+
+    // User buffer is valid only in the current address space, so it cannot be
+    // queued; it's transferred synchronously
+    if (!kernel_address(addr(buf)))
+    {
+        errno = op == BIO_WRITE
+            ? blkdev->ops->write(blkdev->data, first_sector + offset, buf, count >> blkdev->block_shift, true)
+            : blkdev->ops->read(blkdev->data, first_sector + offset, buf, count >> blkdev->block_shift, true);
+    }
+    else
+    {
+        bio_t bio;
+        bio_init(&bio, op, dev, offset, count >> blkdev->block_shift, buf);
+
+        if (likely(!(errno = bio_submit(&bio, NULL))))
+        {
+            errno = bio_wait(&bio);
+        }
+    }
+
+    if (unlikely(errno))
     {
         return errno;
     }
@@ -532,3 +884,78 @@ static int blkdev_read(file_t* file, char* buf, size_t count)
 
     return count;
 }
+
+static int blkdev_read(file_t* file, char* buf, size_t count)
+{
+    return blkdev_rw(file, buf, count, BIO_READ);
+}
+
+static int blkdev_write(file_t* file, const char* buf, size_t count)
+{
+    return blkdev_rw(file, (char*)buf, count, BIO_WRITE);
+}
+
+size_t blkdev_block_size(dev_t dev)
+{
+    blkdev_t* blkdev = blkdev_find(dev);
+    return blkdev ? blkdev->block_size : 0;
+}
+
+void blkdev_write_error(dev_t dev, int errno)
+{
+    blkdev_t* blkdev = blkdev_find(dev);
+
+    if (likely(blkdev))
+    {
+        blkdev->write_errno = errno;
+    }
+}
+
+static int blkdev_flush_one(blkdev_t* blkdev)
+{
+    int errno = blkdev->write_errno;
+
+    if (unlikely(errno))
+    {
+        blkdev->write_errno = 0;
+        return errno;
+    }
+
+    if (!blkdev->ops->flush)
+    {
+        return 0;
+    }
+
+    return blkdev->ops->flush(blkdev->data);
+}
+
+int blkdev_flush(dev_t dev)
+{
+    int errno, res = 0;
+    blkdev_t* blkdev;
+
+    if (!dev)
+    {
+        for (size_t i = 0; i < array_size(blkdevs_tables); ++i)
+        {
+            for (int j = 0; j < BLKDEV_SLOTS; ++j)
+            {
+                if ((blkdev = blkdevs_tables[i][j]) && unlikely(errno = blkdev_flush_one(blkdev)))
+                {
+                    res = errno;
+                }
+            }
+        }
+
+        return res;
+    }
+
+    blkdev = blkdev_find(dev);
+
+    if (unlikely(!blkdev))
+    {
+        return -EINVAL;
+    }
+
+    return blkdev_flush_one(blkdev);
+}
@@ -10,10 +10,10 @@
 #include <kernel/time.h>
 #include <kernel/wait.h>
 #include <kernel/devfs.h>
-#include <kernel/mutex.h>
 #include <kernel/blkdev.h>
 #include <kernel/kernel.h>
 #include <kernel/malloc.h>
+#include <kernel/minmax.h>
 #include <kernel/module.h>
 #include <kernel/execute.h>
 #include <kernel/process.h>
@@ -29,6 +29,10 @@
 #define IDE_POLLING_TIMEOUT_MS      1000
 
 static int ide_blk_read(void* blkdev, size_t offset, void* buffer, size_t size, bool irq);
+static int ide_blk_readv(void* blkdev, size_t offset, const blkdev_segment_t* segs, size_t count, bool irq);
+static int ide_blk_write(void* blkdev, size_t offset, const void* buffer, size_t size, bool irq);
+static int ide_blk_writev(void* blkdev, size_t offset, const blkdev_segment_t* segs, size_t count, bool irq);
+static int ide_blk_flush(void* blkdev);
 static int ide_blk_medium_detect(void* blkdev, size_t* block_size, size_t* sectors);
 static void ide_irq();
 static void ide_write(uint8_t channel, uint8_t reg, uint8_t data);
@@ -48,6 +52,10 @@ KERNEL_MODULE(ide);
 
 READONLY static blkdev_ops_t bops = {
     .read = &ide_blk_read,
+    .write = &ide_blk_write,
+    .readv = &ide_blk_readv,
+    .writev = &ide_blk_writev,
+    .flush = &ide_blk_flush,
     .medium_detect = &ide_blk_medium_detect,
 };
 
@@ -153,8 +161,12 @@ static void ide_channel_fill(int channel, pci_device_t* ide_pci)
         channels[channel].bmide = 0;
     }
 
-    mutex_init(&channels[channel].lock);
+    list_init(&channels[channel].requests);
     wait_queue_head_init(&channels[channel].queue);
+
+    channels[channel].prdt = dma_region
+        ? dma_region->prdt + channel * IDE_PRDT_COUNT
+        : NULL;
 }
 
 static const char* ide_error_string(int e)
@@ -193,6 +205,7 @@ static void ide_device_register(ata_device_t* device)
         .model = device->model,
         .sectors = device->sectors,
         .block_size = device->sector_size,
+        .max_sectors = 0xff, // Sector count register is 8 bits wide
     };
 
     if (unlikely(errno = blkdev_register(&blk, device, &bops)))
@@ -605,45 +618,148 @@ static int ide_pio_request(request_t* req)
     return 0;
 }
 
-static int ide_dma_request(request_t* req)
+// Requests are served one at a time in the order of arrival; the following
+// ones sleep until the previous request is finished instead of failing
+static void ide_request_enqueue(request_t* req)
 {
-    int errno;
     flags_t flags;
-    uint32_t channel = req->device->id / 2;
-    request_t** current_request = &channels[channel].current_request;
+    ide_channel_t* channel = &channels[req->device->id / 2];
+
+    wait_queue_head_init(&req->queue);
+    list_init(&req->list_entry);
 
     irq_save(flags);
 
-    // FIXME: currently nothing blocks signals when drive is accessed, so it's possible to kill
-    // the process before it manages to clear the request
-    if (unlikely(*current_request))
+    list_add_tail(&req->list_entry, &channel->requests);
+
+    while (list_front(&channel->requests, request_t, list_entry) != req)
     {
-        log_warning("cannot perform DMA request, another one is ongoing: %#x", current_request);
-        errno = -EAGAIN;
-        goto error;
+        WAIT_QUEUE_DECLARE(q, process_current);
+        process_wait_locked(&req->queue, &q, &flags);
     }
 
-    *current_request = req;
+    irq_restore(flags);
+}
+
+static void ide_request_dequeue(request_t* req)
+{
+    process_t* proc;
+    request_t* next;
+    ide_channel_t* channel = &channels[req->device->id / 2];
+
+    scoped_irq_lock();
+
+    list_del(&req->list_entry);
+
+    if (list_empty(&channel->requests))
+    {
+        return;
+    }
+
+    next = list_front(&channel->requests, request_t, list_entry);
+
+    if ((proc = wait_queue_pop(&next->queue)))
+    {
+        process_wake(proc);
+    }
+}
+
+static uint32_t ide_prdt_phys(uint32_t channel)
+{
+    return DMA_PRD + addr(channels[channel].prdt) - addr(dma_region);
+}
+
+// Fills PRD table of the channel with physical regions backing the segments,
+// so that the device transfers data directly to the caller's pages; user
+// pages are faulted in first, and for reads the shared ones are copied
+static int ide_prdt_build(uint32_t channel, const blkdev_segment_t* segs, size_t nsegs, int direction)
+{
+    int n = 0, errno;
+    size_t len;
+    uintptr_t vaddr, paddr, start = 0;
+    size_t size = 0;
+    prd_t* prdt = channels[channel].prdt;
+    const pgd_t* pgd = process_current->mm->pgd;
+
+    for (size_t i = 0; i < nsegs; ++i)
+    {
+        if (unlikely(errno = vm_fault_in(segs[i].buffer, segs[i].size, direction == ATA_READ)))
+        {
+            return errno;
+        }
+
+        for (size_t done = 0; done < segs[i].size; done += len)
+        {
+            vaddr = addr(segs[i].buffer) + done;
+            len = min(segs[i].size - done, PAGE_SIZE - (vaddr & PAGE_MASK));
+            paddr = vm_paddr(vaddr, pgd);
+
+            // Region has to be word aligned
+            if (unlikely(!paddr || (paddr & 1)))
+            {
+                return -EFAULT;
+            }
+
+            if (size && start + size == paddr && paddr % IDE_PRD_BOUNDARY)
+            {
+                size += len;
+                continue;
+            }
+
+            if (size)
+            {
+                if (unlikely(n == IDE_PRDT_COUNT - 1))
+                {
+                    return -EINVAL;
+                }
+                prdt[n].addr = start;
+                prdt[n++].count = size & 0xffff; // 0 means 64K
+            }
+
+            start = paddr;
+            size = len;
+        }
+    }
+
+    prdt[n].addr = start;
+    prdt[n++].count = (size & 0xffff) | DMA_EOT;
+
+    return n;
+}
+
+static int ide_dma_request(request_t* req)
+{
+    int errno;
+    flags_t flags;
+    uint32_t channel = req->device->id / 2;
+    request_t** current_request = &channels[channel].current_request;
+    uint8_t bm_cmd = req->direction == ATA_WRITE ? BM_CMD_WRITE : BM_CMD_READ;
 
     // 1) Software prepares a PRD Table in system memory. Each PRD is 8 bytes long and consists of an
     // address pointer to the starting address and the transfer count of the memory buffer to be
     // transferred. In any given PRD Table, two consecutive PRDs are offset by 8-bytes and are aligned
     // on a 4-byte boundary.
-    dma_region->prdt->addr = DMA_START;
-    dma_region->prdt->count = req->sectors * req->device->sector_size | DMA_EOT;
+    if (unlikely((errno = ide_prdt_build(channel, req->segs, req->nsegs, req->direction)) < 0))
+    {
+        return errno;
+    }
 
-    log_debug(DEBUG_IDE, "dma: ch%u buffer: {phys=%#x, virt=%#x}, PRD: addr: %#x, size: %#x",
+    log_debug(DEBUG_IDE, "dma: ch%u buffer: %#x, PRDT: {phys=%#x, entries=%u}",
         channel,
-        DMA_START,
-        dma_region->buffer,
-        dma_region->prdt->addr,
-        dma_region->prdt->count);
+        req->buffer,
+        ide_prdt_phys(channel),
+        errno);
+
+    irq_save(flags);
+
+    req->done = false;
+    *current_request = req;
 
     // 2) Software provides the starting address of the PRD Table by loading the PRD Table Pointer
     // Register. The direction of the data transfer is specified by setting the Read/Write Control bit.
     // Clear the Interrupt bit and Error bit in the Status register.
-    bm_writel(channel, BM_REG_PRDT, DMA_PRD);
-    bm_writeb(channel, BM_REG_CMD, BM_CMD_READ);
+    bm_writel(channel, BM_REG_PRDT, ide_prdt_phys(channel));
+    bm_writeb(channel, BM_REG_CMD, bm_cmd);
     bm_writeb(channel, BM_REG_STATUS, BM_STATUS_ERROR | BM_STATUS_INTERRUPT);
 
     // 3) Software issues the appropriate DMA transfer command to the disk device.
@@ -651,40 +767,35 @@ static int ide_dma_request(request_t* req)
 
     // 4) Engage the bus master function by writing a '1' to the Start bit in the Bus Master IDE Command
     // Register for the appropriate channel.
-    bm_writeb(channel, BM_REG_CMD, BM_CMD_READ | BM_CMD_START);
+    bm_writeb(channel, BM_REG_CMD, bm_cmd | BM_CMD_START);
 
     log_debug(DEBUG_IDE, "putting %u to sleep", process_current->pid);
 
-    WAIT_QUEUE_DECLARE(q, process_current);
-
-    if (unlikely(errno = process_wait_locked(&channels[channel].queue, &q, &flags)))
+    // Device writes directly to the caller's pages, so the request
+    // cannot be abandoned before the interrupt arrives
+    while (!req->done)
     {
-        goto cleanup_request;
+        WAIT_QUEUE_DECLARE(q, process_current);
+        process_wait_locked(&channels[channel].queue, &q, &flags);
     }
 
+    *current_request = NULL;
+
     if (unlikely(errno = req->errno))
     {
-        goto cleanup_request;
+        if (DISABLE_DMA_AFTER_FAILURE && req->nsegs == 1)
+        {
+            req->dma = false;
+            irq_restore(flags);
+            return ide_pio_request(req);
+        }
+        irq_restore(flags);
+        return errno;
     }
 
-    *current_request = NULL;
-    log_debug(DEBUG_IDE, "copying %u B from %#x to %#x", req->count, dma_region->buffer, req->buffer);
-    memcpy(req->buffer, dma_region->buffer, req->count);
     irq_restore(flags);
 
     return 0;
-
-cleanup_request:
-    *current_request = NULL;
-    if (DISABLE_DMA_AFTER_FAILURE)
-    {
-        req->dma = false;
-        irq_restore(flags);
-        return ide_pio_request(req);
-    }
-error:
-    irq_restore(flags);
-    return errno;
 }
 
 static int ide_atapi_scsi_command(ata_device_t* device, scsi_packet_t* packet, void* data, size_t size)
@@ -702,14 +813,9 @@ static int ide_atapi_scsi_command(ata_device_t* device, scsi_packet_t* packet, v
         return -EINVAL;
     }
 
-    irq_save(flags);
+    ide_request_enqueue(&req);
 
-    if (unlikely(*current_request))
-    {
-        log_warning("cannot perform request, another one is ongoing: %#x", *current_request);
-        errno = -EAGAIN;
-        goto error;
-    }
+    irq_save(flags);
 
     *current_request = &req;
 
@@ -767,6 +873,7 @@ static int ide_atapi_scsi_command(ata_device_t* device, scsi_packet_t* packet, v
     *current_request = NULL;
 
     irq_restore(flags);
+    ide_request_dequeue(&req);
 
     return 0;
 
@@ -774,6 +881,7 @@ cleanup_request:
     *current_request = NULL;
 error:
     irq_restore(flags);
+    ide_request_dequeue(&req);
     return errno;
 }
 
@@ -818,6 +926,8 @@ static void ide_irq(int nr)
 
     bm_writeb(channel, BM_REG_CMD, 0);
 
+    current_request->done = true;
+
     process_t* proc = wait_queue_pop(&channels[channel].queue);
 
     if (unlikely(!proc))
@@ -845,12 +955,14 @@ static int ide_request_handle(request_t* req, bool irq)
         return 0;
     }
 
-    uint32_t channel = req->device->id / 2;
-
-    scoped_mutex_lock(&channels[channel].lock);
+    int errno;
 
     if (req->device->type == ATA_TYPE_ATAPI)
     {
+        if (req->direction == ATA_WRITE)
+        {
+            return -EROFS;
+        }
         if (!irq)
         {
             log_warning("%s: ATAPI requires IRQ enabled", __func__);
@@ -860,22 +972,31 @@ static int ide_request_handle(request_t* req, bool irq)
         return ide_atapi_scsi_command(req->device, &packet, req->buffer, req->count);
     }
 
-    return req->dma ? ide_dma_request(req) : ide_pio_request(req);
+    ide_request_enqueue(req);
+
+    errno = req->dma ? ide_dma_request(req) : ide_pio_request(req);
+
+    ide_request_dequeue(req);
+
+    return errno;
 }
 
-static int ide_blk_read(void* blkdev, size_t offset, void* buffer, size_t sectors, bool irq)
+static int ide_blk_rw(void* blkdev, size_t offset, void* buffer, size_t sectors, int direction, bool irq)
 {
     int errno;
     ata_device_t* device = blkdev;
     size_t sector_size = device->sector_size;
+    blkdev_segment_t seg = {.buffer = buffer, .size = sectors * sector_size};
 
     request_t req = {
         .device = device,
-        .direction = ATA_READ,
+        .direction = direction,
         .offset = offset,
         .sectors = sectors,
         .count = sectors * sector_size,
         .buffer = buffer,
+        .segs = &seg,
+        .nsegs = 1,
         .dma = device->dma && irq,
     };
 
@@ -887,6 +1008,119 @@ static int ide_blk_read(void* blkdev, size_t offset, void* buffer, size_t sector
     return 0;
 }
 
+static int ide_blk_rwv(void* blkdev, size_t offset, const blkdev_segment_t* segs, size_t count, int direction, bool irq)
+{
+    int errno;
+    ata_device_t* device = blkdev;
+    size_t sector_size = device->sector_size;
+    size_t sectors = 0;
+
+    // Only bus master DMA can spread a single command over several buffers
+    if (!(device->dma && irq))
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            sectors = segs[i].size / sector_size;
+
+            if (unlikely(errno = ide_blk_rw(blkdev, offset, segs[i].buffer, sectors, direction, irq)))
+            {
+                return errno;
+            }
+
+            offset += sectors;
+        }
+
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        sectors += segs[i].size / sector_size;
+    }
+
+    request_t req = {
+        .device = device,
+        .direction = direction,
+        .offset = offset,
+        .sectors = sectors,
+        .count = sectors * sector_size,
+        .buffer = segs[0].buffer,
+        .segs = segs,
+        .nsegs = count,
+        .dma = true,
+    };
+
+    return ide_request_handle(&req, irq);
+}
+
+static int ide_blk_read(void* blkdev, size_t offset, void* buffer, size_t sectors, bool irq)
+{
+    return ide_blk_rw(blkdev, offset, buffer, sectors, ATA_READ, irq);
+}
+
+static int ide_blk_readv(void* blkdev, size_t offset, const blkdev_segment_t* segs, size_t count, bool irq)
+{
+    return ide_blk_rwv(blkdev, offset, segs, count, ATA_READ, irq);
+}
+
+static int ide_blk_write(void* blkdev, size_t offset, const void* buffer, size_t sectors, bool irq)
+{
+    return ide_blk_rw(blkdev, offset, (void*)buffer, sectors, ATA_WRITE, irq);
+}
+
+static int ide_blk_writev(void* blkdev, size_t offset, const blkdev_segment_t* segs, size_t count, bool irq)
+{
+    return ide_blk_rwv(blkdev, offset, segs, count, ATA_WRITE, irq);
+}
+
+static int ide_blk_flush(void* blkdev)
+{
+    int errno = 0;
+    ata_device_t* device = blkdev;
+    uint32_t channel = device->id / 2;
+    request_t req = {.device = device};
+
+    if (device->type == ATA_TYPE_ATAPI)
+    {
+        return 0;
+    }
+
+    ide_request_enqueue(&req);
+
+    // Completion is polled, so the interrupt is masked for the time
+    // of the command
+    ide_disable_irq(channel);
+
+    ide_write(channel, ATA_REG_HDDEVSEL, 0xa0 | ((device->id % 2) << 4));
+    ide_wait(channel);
+    ide_write(channel, ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
+    ide_wait(channel);
+
+    for (size_t time_elapsed = 0; ide_status_read(channel) & ATA_SR_BSY; ++time_elapsed)
+    {
+        if (unlikely(time_elapsed > IDE_POLLING_TIMEOUT_MS * 100))
+        {
+            errno = -ETIMEDOUT;
+            break;
+        }
+        udelay(USEC_IN_MSEC / 100);
+    }
+
+    if (!errno && unlikely(ide_status_read(channel) & (ATA_SR_ERR | ATA_SR_DF)))
+    {
+        errno = -EIO;
+    }
+
+    if (device->dma)
+    {
+        ide_enable_irq(channel);
+    }
+
+    ide_request_dequeue(&req);
+
+    return errno;
+}
+
 static int ide_blk_medium_detect(void* blkdev, size_t* block_size, size_t* sectors)
 {
     int errno;
@@ -3,7 +3,7 @@
 #include <stdint.h>
 #include <kernel/mbr.h>
 #include <kernel/wait.h>
-#include <kernel/mutex.h>
+#include <kernel/blkdev.h>
 #include <kernel/kernel.h>
 
 #include "ata.h"
@@ -74,22 +74,35 @@ enum ide_polling_result
 
 struct request
 {
-    ata_device_t* device;
-    int           direction;
-    size_t        offset;
-    uint8_t       sectors;
-    size_t        count;
-    void*         buffer;
-    volatile int  errno;
-    int           dma;
+    ata_device_t*     device;
+    int               direction;
+    size_t            offset;
+    uint8_t           sectors;
+    size_t            count;
+    void*             buffer;
+    const blkdev_segment_t* segs;   // Buffers used by DMA
+    size_t            nsegs;
+    volatile int      errno;
+    int               dma;
+    volatile bool     done;
+    wait_queue_head_t queue;        // Process waiting for its turn
+    list_head_t       list_entry;
 };
 
+// PRD entries available for each channel; DMA region holds tables
+// for both of them
+#define IDE_PRDT_COUNT  255
+
+// PRD region cannot cross 64K boundary
+#define IDE_PRD_BOUNDARY    0x10000
+
 struct ide_channel
 {
     uint16_t          base;
     uint16_t          ctrl;
     uint16_t          bmide;
-    mutex_t           lock;
     request_t*        current_request;
+    list_head_t       requests;     // Requests in the order of arrival; the first one is served
     wait_queue_head_t queue;
+    struct prd*       prdt;
 };
@@ -8,6 +8,7 @@
 
 #include <kernel/fs.h>
 #include <kernel/vm.h>
+#include <kernel/abs.h>
 #include <kernel/tty.h>
 #include <kernel/ctype.h>
 #include <kernel/kernel.h>
@@ -34,6 +35,7 @@
 #define FONT_EXTENSION        ".psfu"
 #define DEFAULT_FONT_PATH     FONT_DIR "default8x16" FONT_EXTENSION
 #define CONSOLE_CONFIG_PATH   "/etc/vconsole.conf"
+#define GLYPH_ATTR_STALE      0xff
 
 static int console_open(tty_t* tty, file_t* file);
 static int console_setup(tty_t* tty, console_driver_t* driver);
@@ -113,22 +115,106 @@ static READONLY const command_t commands[] = {
         _glyph->bgcolor = console->current_bgcolor; \
     }
 
+static inline bool glyph_equal(const glyph_t* lhs, const glyph_t* rhs)
+{
+    return lhs->c == rhs->c
+        && lhs->attr == rhs->attr
+        && lhs->fgcolor == rhs->fgcolor
+        && lhs->bgcolor == rhs->bgcolor;
+}
+
+static void screen_draw(console_t* console, size_t x, size_t y, const glyph_t* glyph)
+{
+    glyph_t* drawn = &console->screen[y * console->resx + x];
+
+    if (glyph_equal(drawn, glyph))
+    {
+        return;
+    }
+
+    *drawn = *glyph;
+    console->driver->ops->glyph_draw(console->driver, x, y, drawn);
+}
+
+// Makes the next redraw draw all glyphs; used when the screen content
+// was changed by something else, e.g. cleared or drawn in graphics mode
+static void screen_invalidate(console_t* console)
+{
+    for (size_t i = 0; i < (size_t)console->resx * console->resy; ++i)
+    {
+        console->screen[i].attr = GLYPH_ATTR_STALE;
+    }
+
+    console->scroll_pending = 0;
+}
+
+static void screen_scrolled(console_t* console, size_t top, size_t bottom, int count)
+{
+    if (!console->scroll_pending)
+    {
+        console->scroll_pending_top = top;
+        console->scroll_pending_bottom = bottom;
+    }
+    else if (console->scroll_pending_top != top || console->scroll_pending_bottom != bottom)
+    {
+        // Only one region is moved; glyphs of the other are just drawn
+        return;
+    }
+
+    console->scroll_pending += count;
+}
+
+static void screen_scroll(console_t* console)
+{
+    int count = console->scroll_pending;
+    size_t top = console->scroll_pending_top;
+    size_t bottom = console->scroll_pending_bottom;
+    size_t height = bottom - top + 1;
+    size_t rows = height - abs(count);
+    size_t line_size = console->resx * sizeof(glyph_t);
+    glyph_t* screen = console->screen + top * console->resx;
+    console_driver_t* drv = console->driver;
+
+    console->scroll_pending = 0;
+
+    if (!count || (size_t)abs(count) >= height || !drv->ops->scroll)
+    {
+        return;
+    }
+
+    if (drv->ops->scroll(drv, top, bottom, count))
+    {
+        return;
+    }
+
+    if (count > 0)
+    {
+        memmove(screen, screen + count * console->resx, rows * line_size);
+    }
+    else
+    {
+        memmove(screen - count * console->resx, screen, rows * line_size);
+    }
+}
+
 static void cursor_update(console_t* console)
 {
     glyph_t current = console->visible_lines[console->y].glyphs[console->x];
     current.attr ^= GLYPH_ATTR_INVERSED;
     if (!console->disabled)
     {
-        console->driver->ops->glyph_draw(console->driver, console->x, console->y, &current);
+        screen_draw(console, console->x, console->y, &current);
     }
 
     if (console->prev_x != console->x || console->prev_y != console->y)
     {
-        glyph_t previous = console->visible_lines[console->prev_y].glyphs[console->prev_x];
-        previous.attr ^= ~GLYPH_ATTR_INVERSED;
         if (!console->disabled)
         {
-            console->driver->ops->glyph_draw(console->driver, console->prev_x, console->prev_y, &previous);
+            screen_draw(
+                console,
+                console->prev_x,
+                console->prev_y,
+                &console->visible_lines[console->prev_y].glyphs[console->prev_x]);
         }
 
         console->prev_x = console->x;
@@ -138,7 +224,6 @@ static void cursor_update(console_t* console)
 
 static void current_line_clear(console_t* console, int mode)
 {
-    console_driver_t* drv = console->driver;
     line_t* line = console->current_line;
     size_t start, end;
 
@@ -175,7 +260,7 @@ static void current_line_clear(console_t* console, int mode)
         {
             glyph_t* glyph = &line->glyphs[x];
             GLYPH_CLEAR(glyph);
-            drv->ops->glyph_draw(console->driver, x, console->y, glyph);
+            screen_draw(console, x, console->y, glyph);
         }
     }
 }
@@ -185,20 +270,27 @@ static void redraw(console_t* console)
     size_t x, y;
     glyph_t* pos;
     line_t* temp;
-    console_driver_t* drv = console->driver;
     glyph_t cursor = console->visible_lines[console->y].glyphs[console->x];
     cursor.attr ^= GLYPH_ATTR_INVERSED;
 
+    screen_scroll(console);
+
     for (y = 0, temp = console->visible_lines; y < console->resy; ++y, temp++)
     {
         for (pos = temp->glyphs, x = 0; x < console->resx; ++pos, ++x)
         {
-            drv->ops->glyph_draw(console->driver, x, y, pos);
+            if (x == console->x && y == console->y)
+            {
+                continue;
+            }
+            screen_draw(console, x, y, pos);
         }
     }
 
-    pos = &console->visible_lines[console->y].glyphs[console->y];
-    drv->ops->glyph_draw(console->driver, console->x, console->y, &cursor);
+    screen_draw(console, console->x, console->y, &cursor);
+
+    console->prev_x = console->x;
+    console->prev_y = console->y;
 }
 
 static void console_refresh(void* data)
@@ -282,6 +374,7 @@ static void lf(console_t* console)
 
         console->visible_lines++;
 
+        screen_scrolled(console, 0, console->resy - 1, 1);
         console_refresh_schedule(console);
     }
 }
@@ -319,7 +412,7 @@ static void console_write_char(console_t* console, uint8_t c)
 
     if (!console->redraw && !console->disabled)
     {
-        console->driver->ops->glyph_draw(console->driver, console->x, console->y, cur);
+        screen_draw(console, console->x, console->y, cur);
     }
 
     position_next(console);
@@ -467,7 +560,7 @@ static void line_nr_print(console_t* console)
     for (size_t i = 0; i < strlen(buf); ++i, ++pos)
     {
         glyph_t glyph = {.c = buf[i], .fgcolor = console->default_fgcolor, .bgcolor = console->default_bgcolor};
-        console->driver->ops->glyph_draw(console->driver, pos, 0, &glyph);
+        screen_draw(console, pos, 0, &glyph);
     }
 }
 
@@ -705,6 +798,7 @@ static void scroll_up(console_t* console, size_t origin, size_t count)
         lines_swap(&console->visible_lines[i], &console->visible_lines[i - count]);
     }
 
+    screen_scrolled(console, origin, console->scroll_bottom, -(int)count);
     console_refresh_schedule(console);
 }
 
@@ -726,6 +820,7 @@ static void scroll_down(console_t* console, size_t origin, size_t count)
         lines_swap(&console->visible_lines[i], &console->visible_lines[i + count]);
     }
 
+    screen_scrolled(console, origin, console->scroll_bottom, count);
     console_refresh_schedule(console);
 }
 
@@ -950,7 +1045,7 @@ finish:
                     c = ' ';
                 }
                 glyph.c = c;
-                console->driver->ops->glyph_draw(console->driver, i, console->resy - 1, &glyph);
+                screen_draw(console, i, console->resy - 1, &glyph);
             }
         }
     }
@@ -1458,7 +1553,8 @@ static int console_resize(console_t* console, size_t resx, size_t resy)
     size_t initial_capacity = align(resy > INITIAL_CAPACITY ? resy : INITIAL_CAPACITY, 32);
     size_t normal_size = page_align(sizeof(glyph_t) * resx * initial_capacity + sizeof(line_t) * max_capacity);
     size_t alt_size = page_align(sizeof(glyph_t) * resx * resy + sizeof(line_t) * resy);
-    size_t size = normal_size + alt_size;
+    size_t screen_size = page_align(sizeof(glyph_t) * resx * resy);
+    size_t size = normal_size + alt_size + screen_size;
     size_t needed_pages = size / PAGE_SIZE;
 
     log_notice("size: %u x %u; need %u B (%u pages) for %u lines", resx, resy, size, needed_pages, initial_capacity);
@@ -1522,6 +1618,9 @@ static int console_resize(console_t* console, size_t resx, size_t resy)
     console->scroll_bottom = console->resy - 1;
     console->scroll_top    = 0;
     console->pages         = pages;
+    console->screen        = page_virt_ptr(pages) + normal_size + alt_size;
+
+    screen_invalidate(console);
 
     if (prev_pages)
     {
@@ -1576,6 +1675,7 @@ static void console_notify(void* data)
     }
 
     console_resize(console, resx, resy);
+    screen_invalidate(console);
 
     redraw(console);
 }
@@ -1665,6 +1765,7 @@ static int kdsetmode(console_t* console, long mode)
                 console->driver->ops->screen_clear(console->driver, console->default_bgcolor);
             }
 
+            screen_invalidate(console);
             redraw(console);
             return 0;
         case KD_GRAPHICS:
@@ -1779,6 +1880,10 @@ static int kdfontop(console_t* console, tty_t* tty, console_font_op_t* op)
 
         tty_session_kill(tty, SIGWINCH);
     }
+    else
+    {
+        screen_invalidate(console);
+    }
 
     redraw(console);
 
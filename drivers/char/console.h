@@ -63,6 +63,13 @@ struct console
     line_t*  visible_lines;
     line_t*  orig_visible_lines;
 
+    // Glyphs as they're currently drawn; redraw only draws the ones which
+    // differ. Scrolls done since the last redraw are moved on the screen
+    // by the driver, if it's able to
+    glyph_t* screen;
+    int      scroll_pending;
+    uint16_t scroll_pending_top, scroll_pending_bottom;
+
     saved_state_t saved;
 
     int      tmux_state;
@@ -20,6 +20,10 @@ struct console_driver_ops
     void (*deinit)(console_driver_t* driver);
     void (*glyph_draw)(console_driver_t* driver, size_t x, size_t y, glyph_t* glyph);
     void (*screen_clear)(console_driver_t* driver, uint32_t color);
+    // Moves rows top..bottom up by count rows (down if it's negative); rows
+    // which are left uncovered keep their content. Returns error if moving
+    // is not supported or wouldn't be faster than drawing the glyphs
+    int (*scroll)(console_driver_t* driver, size_t top, size_t bottom, int count);
     void (*defcolor)(console_driver_t* driver, uint32_t* fgcolor, uint32_t* bgcolor);
     void (*sgr_rgb)(console_driver_t* driver, uint32_t value, uint32_t* color);
     void (*sgr_256)(console_driver_t* driver, uint32_t value, uint32_t* color);
@@ -1,3 +1,4 @@
+#include <kernel/abs.h>
 #include <kernel/vga.h>
 #include <kernel/init.h>
 #include <kernel/kernel.h>
@@ -18,6 +19,7 @@ static int fbcon_init(console_driver_t* driver, console_config_t* config, size_t
 static void fbcon_glyph_draw(console_driver_t* driver, size_t x, size_t y, glyph_t* glyph);
 static void fbcon_glyph_draw_var(console_driver_t* drv, size_t x, size_t y, glyph_t* glyph);
 static void fbcon_screen_clear(console_driver_t* driver, uint32_t color);
+static int fbcon_scroll(console_driver_t* driver, size_t top, size_t bottom, int count);
 static void fbcon_sgr_rgb(console_driver_t* driver, uint32_t value, uint32_t* color);
 static void fbcon_sgr_256(console_driver_t* driver, uint32_t value, uint32_t* color);
 static void fbcon_sgr_16(console_driver_t* driver, uint8_t value, uint32_t* color);
@@ -114,6 +116,7 @@ static console_driver_ops_t fbcon_ops_truecolor = {
     .sgr_16       = &fbcon_sgr_16,
     .sgr_8        = &fbcon_sgr_8,
     .screen_clear = &fbcon_screen_clear,
+    .scroll       = &fbcon_scroll,
     .defcolor     = &fbcon_defcolor,
     .font_load    = &fbcon_font_load,
     .sgr_rgb      = &fbcon_sgr_rgb,
@@ -129,6 +132,7 @@ static console_driver_ops_t fbcon_ops = {
     .sgr_16       = &fbcon_sgr_16,
     .sgr_8        = &fbcon_sgr_8,
     .screen_clear = &fbcon_screen_clear,
+    .scroll       = &fbcon_scroll,
     .defcolor     = &fbcon_defcolor,
     .font_load    = &fbcon_font_load,
     .sgr_rgb      = &fbcon_sgr_rgb,
@@ -331,6 +335,44 @@ static void fbcon_screen_clear(console_driver_t*, uint32_t color)
     }
 }
 
+static int fbcon_scroll(console_driver_t* drv, size_t top, size_t bottom, int count)
+{
+    data_t* data = drv->data;
+    size_t row_size = data->font_height_offset;
+    size_t rows = bottom - top + 1 - abs(count);
+    uint8_t* start = data->fb + top * row_size;
+
+    fb_rect_t rect = {
+        .x = 0,
+        .y = top * data->font->height,
+        .w = framebuffer.width,
+        .h = (bottom - top + 1) * data->font->height,
+    };
+
+    // Reading from the video memory is slow, so moving its content is not
+    // faster than drawing glyphs again, unless framebuffer is in RAM
+    if (!(framebuffer.flags & FB_FLAGS_VIRTFB))
+    {
+        return -ENOSYS;
+    }
+
+    if (count > 0)
+    {
+        memmove(start, start + count * row_size, rows * row_size);
+    }
+    else
+    {
+        memmove(start - count * row_size, start, rows * row_size);
+    }
+
+    if (framebuffer.ops->dirty_set)
+    {
+        framebuffer.ops->dirty_set(&rect);
+    }
+
+    return 0;
+}
+
 static void fbcon_sgr_rgb(console_driver_t*, uint32_t value, uint32_t* color)
 {
     if (unlikely(framebuffer.bpp == 8))
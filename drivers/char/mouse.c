@@ -127,15 +127,11 @@ static int mouse_poll(file_t*, short events, short* revents, wait_queue_head_t**
         return -EINVAL;
     }
 
-    if (fifo_empty(&mouse_fifo))
-    {
-        *head = &mouse_wq;
-    }
-    else
+    if (!fifo_empty(&mouse_fifo))
     {
         *revents = POLLIN;
-        *head = NULL;
     }
+    *head = &mouse_wq;
     return 0;
 }
 
@@ -1,3 +1,4 @@
+#include <kernel/abs.h>
 #include <kernel/vga.h>
 #include <kernel/init.h>
 #include <kernel/kernel.h>
@@ -15,6 +16,7 @@
 static int textcon_probe(framebuffer_t* fb);
 static int textcon_init(console_driver_t* driver, console_config_t* config, size_t* resx, size_t* resy);
 static void textcon_glyph_draw(console_driver_t* driver, size_t x, size_t y, glyph_t* glyph);
+static int textcon_scroll(console_driver_t* driver, size_t top, size_t bottom, int count);
 static void textcon_sgr_16(console_driver_t* driver, uint8_t value, uint32_t* color);
 static void textcon_sgr_8(console_driver_t* driver, uint8_t value, uint32_t* color);
 static void textcon_defcolor(console_driver_t* driver, uint32_t* fgcolor, uint32_t* bgcolor);
@@ -34,6 +36,7 @@ static console_driver_ops_t textcon_ops = {
     .probe      = &textcon_probe,
     .init       = &textcon_init,
     .glyph_draw = &textcon_glyph_draw,
+    .scroll     = &textcon_scroll,
     .defcolor   = &textcon_defcolor,
     .sgr_16     = &textcon_sgr_16,
     .sgr_8      = &textcon_sgr_8,
@@ -123,6 +126,25 @@ static void textcon_glyph_draw(console_driver_t* drv, size_t x, size_t y, glyph_
         off);
 }
 
+static int textcon_scroll(console_driver_t* drv, size_t top, size_t bottom, int count)
+{
+    data_t* data = drv->data;
+    size_t row_size = framebuffer.width * sizeof(*data->videomem);
+    size_t rows = bottom - top + 1 - abs(count);
+    void* start = ptr(data->videomem + top * framebuffer.width);
+
+    if (count > 0)
+    {
+        memmove(start, start + count * row_size, rows * row_size);
+    }
+    else
+    {
+        memmove(start - count * row_size, start, rows * row_size);
+    }
+
+    return 0;
+}
+
 static void textcon_color_set(uint8_t value, uint32_t* color)
 {
     *color = vga_palette[value];
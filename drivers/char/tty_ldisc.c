@@ -87,15 +87,11 @@ int tty_ldisc_poll(tty_t* tty, file_t*, short events, short* revents, wait_queue
     {
         return -EINVAL;
     }
-    if (fifo_empty(&tty->buf))
-    {
-        *head = &tty->wq;
-    }
-    else
+    if (!fifo_empty(&tty->buf))
     {
         *revents = POLLIN;
-        *head = NULL;
     }
+    *head = &tty->wq;
     return 0;
 }
 
@@ -5,6 +5,7 @@
 #include <kernel/irq.h>
 #include <kernel/time.h>
 #include <kernel/ksyms.h>
+#include <kernel/sched.h>
 #include <kernel/module.h>
 #include <kernel/string.h>
 #include <kernel/process.h>
@@ -190,13 +191,21 @@ static int c_kstat()
 
 static int c_running()
 {
+    int i;
     process_t* proc;
-    list_for_each_entry(proc, &running, running)
+    runqueue_t* rq;
+
+    for_each_runqueue(rq, i)
     {
-        printf("pid=%d name=%s stat=%d\n",
-            proc->pid,
-            proc->name,
-            proc->stat);
+        rb_for_each_entry(proc, &rq->queue, run_node)
+        {
+            printf("cpu=%d pid=%d name=%s stat=%d nice=%d\n",
+                rq->cpu,
+                proc->pid,
+                proc->name,
+                proc->stat,
+                proc->nice);
+        }
     }
     return 0;
 }
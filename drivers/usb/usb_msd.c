@@ -18,6 +18,8 @@
 static int usb_msd_probe(usb_device_t* device);
 static int usb_msd_initialize(usb_driver_t* driver);
 static int usb_msd_read(void* blkdev, size_t offset, void* buffer, size_t size, bool irq);
+static int usb_msd_write(void* blkdev, size_t offset, const void* buffer, size_t size, bool irq);
+static int usb_msd_flush(void* blkdev);
 
 static_assert(sizeof(usb_cbw_t) <= DMA_BLOCK_SIZE);
 static_assert(sizeof(usb_csw_t) <= DMA_BLOCK_SIZE);
@@ -30,6 +32,8 @@ READONLY static usb_driver_ops_t ops = {
 
 READONLY static blkdev_ops_t bops = {
     .read = &usb_msd_read,
+    .write = &usb_msd_write,
+    .flush = &usb_msd_flush,
 };
 
 static int usb_msd_probe(usb_device_t* device)
@@ -106,7 +110,7 @@ static int usb_msd_max_lun_get(usb_driver_t* driver)
     return usb_control_transfer(driver->device, GET_MAX_LUN_SETUP(), &msd->max_lun);
 }
 
-static int usb_msd_scsi_command(usb_driver_t* driver, scsi_packet_t packet, void* data, size_t size)
+static int usb_msd_scsi_command(usb_driver_t* driver, scsi_packet_t packet, void* data, size_t size, bool write)
 {
     int errno;
     usb_device_t* device = driver->device;
@@ -124,7 +128,7 @@ static int usb_msd_scsi_command(usb_driver_t* driver, scsi_packet_t packet, void
     cbw->signature = CBW_SIGNATURE;
     cbw->tag       = msd->last_tag++;
     cbw->len       = size;
-    cbw->direction = 0x80;
+    cbw->direction = write ? 0x00 : 0x80;
     cbw->unit      = 0;
     cbw->cmd_len   = sizeof(packet);
 
@@ -135,7 +139,7 @@ static int usb_msd_scsi_command(usb_driver_t* driver, scsi_packet_t packet, void
         goto error;
     }
 
-    if (unlikely(errno = device->ops->bulk_transfer(device, msd->in, data, size)))
+    if (size && unlikely(errno = device->ops->bulk_transfer(device, write ? msd->out : msd->in, data, size)))
     {
         goto error;
     }
@@ -188,7 +192,8 @@ int usb_msd_inquiry(usb_driver_t* driver)
         driver,
         SCSI_INQUIRY_PACKET(sizeof(msd->inquiry)),
         &msd->inquiry,
-        sizeof(msd->inquiry))))
+        sizeof(msd->inquiry),
+        false)))
     {
         return errno;
     }
@@ -205,7 +210,7 @@ int usb_msd_capacity_read(usb_driver_t* driver)
     scsi_capacity_t capacity = {};
     usb_msd_t* msd = driver->data;
 
-    if (unlikely(errno = usb_msd_scsi_command(driver, SCSI_READ_CAPACITY_PACKET(), &capacity, sizeof(capacity))))
+    if (unlikely(errno = usb_msd_scsi_command(driver, SCSI_READ_CAPACITY_PACKET(), &capacity, sizeof(capacity), false)))
     {
         return errno;
     }
@@ -276,7 +281,25 @@ static int usb_msd_read(void* blkdev, size_t offset, void* buffer, size_t sector
     usb_driver_t* driver = blkdev;
     usb_msd_t* msd = driver->data;
 
-    return usb_msd_scsi_command(driver, SCSI_READ_PACKET(offset, sectors), buffer, sectors * msd->block_size);
+    return usb_msd_scsi_command(driver, SCSI_READ_PACKET(offset, sectors), buffer, sectors * msd->block_size, false);
+}
+
+static int usb_msd_write(void* blkdev, size_t offset, const void* buffer, size_t sectors, bool)
+{
+    usb_driver_t* driver = blkdev;
+    usb_msd_t* msd = driver->data;
+
+    return usb_msd_scsi_command(
+        driver,
+        SCSI_WRITE_PACKET(offset, sectors),
+        (void*)buffer,
+        sectors * msd->block_size,
+        true);
+}
+
+static int usb_msd_flush(void* blkdev)
+{
+    return usb_msd_scsi_command(blkdev, SCSI_SYNC_CACHE_PACKET(), NULL, 0, false);
 }
 
 static int usb_msd_register(void)
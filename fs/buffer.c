@@ -1,73 +1,778 @@
 #define log_fmt(fmt) "buffer: " fmt
 #include <kernel/fs.h>
+#include <kernel/init.h>
+#include <kernel/time.h>
+#include <kernel/blkdev.h>
 #include <kernel/kernel.h>
+#include <kernel/memory.h>
+#include <kernel/minmax.h>
+#include <kernel/process.h>
+#include <kernel/seq_file.h>
 #include <kernel/page_alloc.h>
 
 #define DEBUG_BUFFER 0
 
-static LIST_DECLARE(buffers);
+#define BLOCKS_PER_PAGE     (PAGE_SIZE / BLOCK_SIZE)
 
-buffer_t* block_read(dev_t dev, file_t* file, uint32_t block)
+#define CACHE_HASH_BITS     8
+#define CACHE_HASH_SIZE     (1 << CACHE_HASH_BITS)
+
+// Cache may hold at most 1/2^CACHE_LIMIT_SHIFT of usable RAM; above it
+// unused entries are evicted before a new one is added
+#define CACHE_LIMIT_SHIFT   2
+
+// Dirty pages may take at most 1/2^DIRTY_LIMIT_SHIFT of the cache limit;
+// above it writers are throttled by doing the writeback themselves. The
+// flusher starts writing back everything at half of that
+#define DIRTY_LIMIT_SHIFT   1
+
+// Pages dirty for longer are written back by the flusher
+#define DIRTY_EXPIRE_TICKS  (5 * HZ)
+
+// Bounds of the sequential readahead window
+#define READAHEAD_MIN_PAGES 4
+#define READAHEAD_MAX_PAGES 32
+
+// Pages around the faulting one read by file_page_nopage() on a miss;
+// power of 2
+#define FAULT_AROUND_PAGES  16
+
+typedef struct cache_entry cache_entry_t;
+
+struct cache_entry
+{
+    dev_t       dev;
+    ino_t       ino;
+    size_t      index;
+    page_t*     page;
+    int         refcount;
+    list_head_t hash_entry;
+    list_head_t lru_entry;
+    buffer_t    buffers[BLOCKS_PER_PAGE]; // Used only for block device pages
+
+    // Writeback of block device pages
+    unsigned    dirty;          // Mask of dirty blocks
+    unsigned    dirty_time;     // Jiffies when page became dirty
+    bool        writeback;      // Write is in flight; page may get dirty again meanwhile
+    bool        reading;        // Asynchronous read is in flight
+    bool        stale;          // Asynchronous read failed; page has to be read again
+    list_head_t dirty_entry;
+    list_head_t writeback_entry;
+    bio_t       bio;
+};
+
+struct cache_stats
+{
+    size_t pages;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t dirty;
+    size_t writeback;
+};
+
+static list_head_t hash_table[CACHE_HASH_SIZE];
+static LIST_DECLARE(lru);
+static LIST_DECLARE(dirty_pages);
+static LIST_DECLARE(writeback_pages);
+static WAIT_QUEUE_HEAD_DECLARE(writeback_queue);
+static struct cache_stats stats;
+static process_t* flusher;
+
+static inline list_head_t* hash_bucket(dev_t dev, ino_t ino, size_t index)
+{
+    uint32_t key = (index ^ (ino << 10) ^ (dev << 20)) * 2654435761U;
+    list_head_t* bucket = &hash_table[key >> (32 - CACHE_HASH_BITS)];
+
+    if (unlikely(!bucket->next))
+    {
+        list_init(bucket);
+    }
+
+    return bucket;
+}
+
+static cache_entry_t* cache_find(dev_t dev, ino_t ino, size_t index)
+{
+    cache_entry_t* entry;
+
+    list_for_each_entry(entry, hash_bucket(dev, ino, index), hash_entry)
+    {
+        if (entry->dev == dev && entry->ino == ino && entry->index == index)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static cache_entry_t* cache_lookup(dev_t dev, ino_t ino, size_t index)
+{
+    cache_entry_t* entry = cache_find(dev, ino, index);
+
+    if (entry)
+    {
+        ++entry->refcount;
+        ++stats.hits;
+        list_move_tail(&entry->lru_entry, &lru);
+    }
+
+    return entry;
+}
+
+static void cache_entry_free(cache_entry_t* entry)
+{
+    entry->page->private = NULL;
+    pages_free(entry->page);
+    delete(entry);
+}
+
+static cache_entry_t* cache_entry_alloc(dev_t dev, ino_t ino, size_t index)
+{
+    cache_entry_t* entry;
+
+    if (unlikely((stats.pages + 1) << CACHE_LIMIT_SHIFT > usable_ram / PAGE_SIZE))
+    {
+        buffer_cache_shrink(1);
+    }
+
+    if (unlikely(!(entry = alloc(cache_entry_t))))
+    {
+        return NULL;
+    }
+
+    if (unlikely(!(entry->page = page_alloc(1, PAGE_ALLOC_ZEROED))))
+    {
+        delete(entry);
+        return NULL;
+    }
+
+    entry->dev = dev;
+    entry->ino = ino;
+    entry->index = index;
+    entry->refcount = 1;
+    entry->page->private = entry;
+    entry->page->flags |= PAGE_FILE;
+    entry->dirty = 0;
+    entry->writeback = false;
+    entry->reading = false;
+    entry->stale = false;
+    list_init(&entry->hash_entry);
+    list_init(&entry->lru_entry);
+    list_init(&entry->dirty_entry);
+    list_init(&entry->writeback_entry);
+
+    return entry;
+}
+
+// Filling the page may sleep, so other process could have added the same
+// page in the meantime; in that case the new entry is dropped
+static cache_entry_t* cache_insert(cache_entry_t* entry)
+{
+    cache_entry_t* existing = cache_lookup(entry->dev, entry->ino, entry->index);
+
+    if (unlikely(existing))
+    {
+        --stats.hits;
+        cache_entry_free(entry);
+        return existing;
+    }
+
+    ++stats.pages;
+    ++stats.misses;
+    list_add_tail(&entry->hash_entry, hash_bucket(entry->dev, entry->ino, entry->index));
+    list_add_tail(&entry->lru_entry, &lru);
+
+    return entry;
+}
+
+static inline void cache_entry_put(cache_entry_t* entry)
+{
+    ASSERT(entry->refcount > 0);
+    --entry->refcount;
+}
+
+size_t buffer_cache_shrink(size_t count)
+{
+    size_t freed = 0;
+    size_t scanned = 0;
+    size_t to_scan = stats.pages;
+    cache_entry_t* entry;
+
+    while (freed < count && scanned++ < to_scan && !list_empty(&lru))
+    {
+        entry = list_front(&lru, cache_entry_t, lru_entry);
+
+        // Page mapped by processes wouldn't be freed anyway; dirty
+        // pages have to be written back first
+        if (entry->refcount || entry->page->refcount > 1 || entry->dirty)
+        {
+            list_move_tail(&entry->lru_entry, &lru);
+            continue;
+        }
+
+        log_debug(DEBUG_BUFFER, "evicting dev=%#x ino=%u index=%zu", entry->dev, entry->ino, entry->index);
+
+        list_del(&entry->hash_entry);
+        list_del(&entry->lru_entry);
+        cache_entry_free(entry);
+
+        --stats.pages;
+        ++stats.evictions;
+        ++freed;
+    }
+
+    if (freed < count && stats.dirty && flusher)
+    {
+        process_wake(flusher);
+    }
+
+    return freed;
+}
+
+static void cache_entry_buffers_init(cache_entry_t* entry)
+{
+    buffer_t* b;
+
+    for (int i = 0; i < BLOCKS_PER_PAGE; ++i)
+    {
+        b = &entry->buffers[i];
+        b->block = entry->index * BLOCKS_PER_PAGE + i;
+        b->page = entry->page;
+        b->dev = entry->dev;
+        b->data = (char*)page_virt_ptr(entry->page) + i * BLOCK_SIZE;
+    }
+}
+
+// Waits for the asynchronous read of the page, and reads it again
+// synchronously if it failed
+static int cache_entry_read_wait(cache_entry_t* entry, file_t* file)
 {
     int res, errno;
-    page_t* page;
-    buffer_t* t;
-    buffer_t* b[PAGE_SIZE / BLOCK_SIZE];
-    size_t pages = block / (PAGE_SIZE / BLOCK_SIZE);
-    size_t offset = block % (PAGE_SIZE / BLOCK_SIZE);
 
-    log_debug(DEBUG_BUFFER, "reading block %u; page = %zu, offset = %zu", block, pages, offset);
+    if (entry->reading)
+    {
+        bio_wait(&entry->bio);
+    }
 
-    list_for_each_entry(t, &buffers, entry)
+    if (unlikely(entry->stale))
     {
-        if (t->dev == dev && t->block == block)
+        file->offset = entry->index * PAGE_SIZE;
+        res = file->ops->read(file, page_virt_ptr(entry->page), PAGE_SIZE);
+
+        if ((errno = errno_get(res)))
         {
-            log_debug(DEBUG_BUFFER, "found existing buffer");
-            return t;
+            log_warning("read failed with %d", res);
+            return errno;
         }
+
+        entry->stale = false;
     }
 
-    log_debug(DEBUG_BUFFER, "reading buffer");
+    return 0;
+}
+
+buffer_t* block_read(dev_t dev, file_t* file, uint32_t block)
+{
+    int res, errno;
+    cache_entry_t* entry;
+    size_t index = block / BLOCKS_PER_PAGE;
+    size_t offset = block % BLOCKS_PER_PAGE;
+
+    log_debug(DEBUG_BUFFER, "reading block %u; page = %zu, offset = %zu", block, index, offset);
+
+    if ((entry = cache_lookup(dev, 0, index)))
+    {
+        log_debug(DEBUG_BUFFER, "found existing buffer");
+        goto found;
+    }
 
-    page = page_alloc(1, PAGE_ALLOC_ZEROED);
+    log_debug(DEBUG_BUFFER, "reading buffer");
 
-    if (unlikely(!page))
+    if (unlikely(!(entry = cache_entry_alloc(dev, 0, index))))
     {
         log_warning("cannot allocate page for buffer");
         return ptr(-ENOMEM);
     }
 
-    for (int i = 0; i < PAGE_SIZE / BLOCK_SIZE; ++i)
+    cache_entry_buffers_init(entry);
+
+    file->offset = index * PAGE_SIZE;
+    res = file->ops->read(file, page_virt_ptr(entry->page), PAGE_SIZE);
+
+    if ((errno = errno_get(res)))
+    {
+        log_warning("read failed with %d", res);
+        cache_entry_free(entry);
+        return ptr(errno);
+    }
+
+    entry = cache_insert(entry);
+
+found:
+    if (unlikely(errno = cache_entry_read_wait(entry, file)))
+    {
+        cache_entry_put(entry);
+        return ptr(errno);
+    }
+
+    return &entry->buffers[offset];
+}
+
+// Called on completion by the process which dispatched the request, with
+// irqs disabled; the page is already in the cache, and the reference held
+// by the read is dropped
+static void cache_entry_read_end(bio_t* bio)
+{
+    cache_entry_t* entry = bio->private;
+
+    if (unlikely(bio->errno))
+    {
+        log_warning("read of dev=%#x index=%zu failed with %d", entry->dev, entry->index, bio->errno);
+        entry->stale = true;
+    }
+
+    entry->reading = false;
+    cache_entry_put(entry);
+}
+
+void blocks_prefetch(dev_t dev, uint32_t block, size_t count)
+{
+    size_t block_size;
+    blkdev_plug_t plug;
+    cache_entry_t* entry;
+
+    if (unlikely(!count))
+    {
+        return;
+    }
+
+    block_size = blkdev_block_size(dev);
+
+    if (unlikely(!block_size || BLOCK_SIZE % block_size))
+    {
+        return;
+    }
+
+    blkdev_plug(&plug);
+
+    for (size_t index = block / BLOCKS_PER_PAGE; index <= (block + count - 1) / BLOCKS_PER_PAGE; ++index)
     {
-        b[i] = alloc(buffer_t);
+        if (cache_find(dev, 0, index))
+        {
+            continue;
+        }
 
-        if (unlikely(!b[i]))
+        if (unlikely(!(entry = cache_entry_alloc(dev, 0, index))))
         {
-            log_warning("no mem for buf %u", i);
-            return ptr(-ENOMEM);
+            break;
         }
 
-        list_init(&b[i]->entry);
-        list_init(&b[i]->buf_in_page);
-        b[i]->block = pages * (PAGE_SIZE / BLOCK_SIZE) + i;
-        b[i]->page = page;
-        b[i]->dev = dev;
-        b[i]->count = 1;
-        b[i]->data = (char*)page_virt_ptr(page) + i * BLOCK_SIZE;
+        cache_entry_buffers_init(entry);
+
+        bio_init(
+            &entry->bio,
+            BIO_READ,
+            dev,
+            index * BLOCKS_PER_PAGE * (BLOCK_SIZE / block_size),
+            PAGE_SIZE / block_size,
+            page_virt_ptr(entry->page));
+
+        entry->bio.end_io = &cache_entry_read_end;
+        entry->bio.private = entry;
 
-        list_add_tail(&b[i]->entry, &buffers);
+        // Last page may reach past the end of the device; it's left
+        // for block_read(), which reads only the existing part
+        if (unlikely(bio_submit(&entry->bio, &plug)))
+        {
+            cache_entry_free(entry);
+            continue;
+        }
+
+        // Page is inserted right away, so that readers wait for the bio
+        // instead of reading it again; reference of the allocation is
+        // kept by the read until it completes
+        entry->reading = true;
+        cache_insert(entry);
     }
 
-    file->offset = pages * PAGE_SIZE;
-    res = file->ops->read(file, page_virt_ptr(page), PAGE_SIZE);
+    blkdev_unplug(&plug);
+}
 
-    if ((errno = errno_get(res)))
+void block_get(buffer_t* b)
+{
+    cache_entry_t* entry = b->page->private;
+    ++entry->refcount;
+}
+
+void block_put(buffer_t* b)
+{
+    cache_entry_put(b->page->private);
+}
+
+static inline size_t dirty_limit(void)
+{
+    return (usable_ram / PAGE_SIZE) >> (CACHE_LIMIT_SHIFT + DIRTY_LIMIT_SHIFT);
+}
+
+static void cache_entry_writeback_end(bio_t* bio)
+{
+    cache_entry_t* entry = bio->private;
+
+    if (unlikely(bio->errno))
     {
-        log_warning("read failed with %d", res);
+        log_warning("writeback of dev=%#x index=%zu failed with %d", entry->dev, entry->index, bio->errno);
+        blkdev_write_error(entry->dev, bio->errno);
+    }
+
+    entry->writeback = false;
+    list_del(&entry->writeback_entry);
+    --stats.writeback;
+    cache_entry_put(entry);
+
+    process_t* proc;
+    while ((proc = wait_queue_pop(&writeback_queue)))
+    {
+        process_wake(proc);
+    }
+}
+
+// Blocks from the first to the last dirty one are written with a single bio;
+// with a plug, bios of adjacent pages are merged into large requests
+static void cache_entry_writeback(cache_entry_t* entry, blkdev_plug_t* plug)
+{
+    int errno;
+    size_t first, last, block_size;
+
+    for (first = 0; !(entry->dirty & (1 << first)); ++first);
+    for (last = BLOCKS_PER_PAGE - 1; !(entry->dirty & (1 << last)); --last);
+
+    entry->dirty = 0;
+    list_del(&entry->dirty_entry);
+    --stats.dirty;
+
+    entry->writeback = true;
+    list_add_tail(&entry->writeback_entry, &writeback_pages);
+    ++stats.writeback;
+    ++entry->refcount;
+
+    block_size = blkdev_block_size(entry->dev);
+
+    if (unlikely(!block_size || BLOCK_SIZE % block_size))
+    {
+        entry->bio.errno = -EINVAL;
+        cache_entry_writeback_end(&entry->bio);
+        return;
+    }
+
+    bio_init(
+        &entry->bio,
+        BIO_WRITE,
+        entry->dev,
+        (entry->index * BLOCKS_PER_PAGE + first) * (BLOCK_SIZE / block_size),
+        (last - first + 1) * (BLOCK_SIZE / block_size),
+        entry->buffers[first].data);
+
+    entry->bio.end_io = &cache_entry_writeback_end;
+    entry->bio.private = entry;
+
+    if (unlikely(errno = bio_submit(&entry->bio, plug)))
+    {
+        scoped_irq_lock();
+        entry->bio.errno = errno;
+        cache_entry_writeback_end(&entry->bio);
+    }
+}
+
+// Start writeback of pages of dev (of all devices if 0) which have been
+// dirty for at least age ticks; pages already being written are skipped
+static void dirty_pages_submit(dev_t dev, unsigned age)
+{
+    blkdev_plug_t plug;
+    cache_entry_t* entry;
+
+    blkdev_plug(&plug);
+
+    // List is ordered by the time pages became dirty
+    list_for_each_entry_safe(entry, &dirty_pages, dirty_entry)
+    {
+        if (jiffies - entry->dirty_time < age)
+        {
+            break;
+        }
+
+        if ((dev && entry->dev != dev) || entry->writeback)
+        {
+            continue;
+        }
+
+        cache_entry_writeback(entry, &plug);
+    }
+
+    blkdev_unplug(&plug);
+}
+
+static bool writeback_pending(dev_t dev)
+{
+    cache_entry_t* entry;
+
+    list_for_each_entry(entry, &writeback_pages, writeback_entry)
+    {
+        if (!dev || entry->dev == dev)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void writeback_wait(dev_t dev)
+{
+    flags_t flags;
+
+    irq_save(flags);
+
+    while (writeback_pending(dev))
+    {
+        WAIT_QUEUE_DECLARE(q, process_current);
+        process_wait_locked(&writeback_queue, &q, &flags);
+    }
+
+    irq_restore(flags);
+}
+
+void block_mark_dirty(buffer_t* b, size_t size)
+{
+    cache_entry_t* entry = b->page->private;
+    size_t first = b - entry->buffers;
+    size_t count = align(size, BLOCK_SIZE) / BLOCK_SIZE;
+
+    ASSERT(count && first + count <= BLOCKS_PER_PAGE);
+
+    if (!entry->dirty)
+    {
+        entry->dirty_time = jiffies;
+        list_add_tail(&entry->dirty_entry, &dirty_pages);
+        ++stats.dirty;
+    }
+
+    entry->dirty |= ((1 << count) - 1) << first;
+
+    if (stats.dirty + stats.writeback > dirty_limit())
+    {
+        // Writer which produces dirty pages faster than the device takes
+        // them is slowed down to the device speed
+        dirty_pages_submit(0, 0);
+        writeback_wait(0);
+    }
+    else if (stats.dirty > dirty_limit() / 2 && flusher)
+    {
+        process_wake(flusher);
+    }
+}
+
+int buffer_cache_sync(dev_t dev)
+{
+    // Pages being written could have been modified after the write
+    // started, so they are submitted again once it completes
+    writeback_wait(dev);
+    dirty_pages_submit(dev, 0);
+    writeback_wait(dev);
+
+    // Fails also if writeback of any page of the device failed
+    return blkdev_flush(dev);
+}
+
+static void buffer_cache_flush(void*)
+{
+    timeval_t tv = {.tv_sec = 1};
+
+    REPEAT_PER(tv)
+    {
+        dirty_pages_submit(0, stats.dirty > dirty_limit() / 2 ? 0 : DIRTY_EXPIRE_TICKS);
+    }
+}
+
+UNMAP_AFTER_INIT static int buffer_cache_flusher_init(void)
+{
+    int errno;
+    process_t* p = process_spawn("kflushd", &buffer_cache_flush, NULL, SPAWN_KERNEL);
+
+    if (unlikely(errno = errno_get(p)))
+    {
+        log_warning("cannot create flusher: %d; dirty pages are written by writers only", errno);
+        return errno;
+    }
+
+    flusher = p;
+
+    return 0;
+}
+
+premodules_initcall(buffer_cache_flusher_init);
+
+page_t* file_page_read(inode_t* inode, size_t index, readpage_t readpage)
+{
+    int errno;
+    cache_entry_t* entry;
+    dev_t dev = inode->sb->dev;
+
+    if ((entry = cache_lookup(dev, inode->ino, index)))
+    {
+        return entry->page;
+    }
+
+    if (unlikely(!(entry = cache_entry_alloc(dev, inode->ino, index))))
+    {
+        return ptr(-ENOMEM);
+    }
+
+    if (unlikely(errno = errno_get(readpage(inode, entry->page, index))))
+    {
+        cache_entry_free(entry);
         return ptr(errno);
     }
 
-    ASSERT(offset < 4);
+    entry = cache_insert(entry);
+
+    return entry->page;
+}
+
+void file_page_put(page_t* page)
+{
+    cache_entry_put(page->private);
+}
+
+void file_pages_invalidate(dev_t dev, ino_t ino, size_t offset, size_t size)
+{
+    cache_entry_t* entry;
+    size_t last = (offset + size - 1) / PAGE_SIZE;
+
+    if (!size)
+    {
+        return;
+    }
+
+    for (size_t index = offset / PAGE_SIZE; index <= last; ++index)
+    {
+        if (!(entry = cache_lookup(dev, ino, index)))
+        {
+            continue;
+        }
+
+        --stats.hits;
+
+        // Entry becomes unreachable and is evicted once unused; pages
+        // already mapped keep the old content
+        list_del(&entry->hash_entry);
+        list_del(&entry->lru_entry);
+        list_add(&entry->lru_entry, &lru);
+        cache_entry_put(entry);
+    }
+}
+
+int file_page_nopage(
+    vm_area_t* vma,
+    uintptr_t address,
+    size_t size,
+    page_t** page,
+    readpage_t readpage,
+    readahead_t readahead)
+{
+    int errno;
+    page_t* cached;
+    inode_t* inode = vma->dentry->inode;
+    size_t offset = vma->offset + address - vma->start;
+    size_t index = offset / PAGE_SIZE;
+
+    if (unlikely(offset >= inode->size))
+    {
+        return -EFAULT;
+    }
+
+    // Executables are faulted in mostly at random within a range, so the
+    // whole aligned block of pages around is started at once
+    if (readahead && !cache_find(inode->sb->dev, inode->ino, index))
+    {
+        readahead(
+            inode,
+            (index & ~(FAULT_AROUND_PAGES - 1)) * PAGE_SIZE,
+            FAULT_AROUND_PAGES * PAGE_SIZE);
+    }
+
+    cached = file_page_read(inode, index, readpage);
+
+    if (unlikely(errno = errno_get(cached)))
+    {
+        return errno;
+    }
+
+    size = min(size, inode->size - offset);
+
+    // Cached page can be shared if the mapping covers all of it; beyond
+    // the end of file it's zeroed. Writable shared mappings still get
+    // a copy, as modified pages are never written back
+    if ((size == PAGE_SIZE || offset + size == inode->size)
+        && !((vma->vm_flags & VM_SHARED) && (vma->vm_flags & VM_WRITE)))
+    {
+        ++cached->refcount;
+        *page = cached;
+        file_page_put(cached);
+        return PAGE_SIZE;
+    }
+
+    if (unlikely(!(*page = page_alloc(1, 0))))
+    {
+        file_page_put(cached);
+        return -ENOMEM;
+    }
+
+    memcpy(page_virt_ptr(*page), page_virt_ptr(cached), size);
+    file_page_put(cached);
+
+    return size;
+}
 
-    return b[offset];
+bool file_readahead(file_ra_t* ra, size_t offset, size_t count, size_t* start, size_t* size)
+{
+    size_t first = offset / PAGE_SIZE;
+    size_t last = (offset + max(count, 1U) - 1) / PAGE_SIZE;
+    bool sequential = first == ra->next || first + 1 == ra->next;
+
+    ra->next = last + 1;
+
+    if (!sequential)
+    {
+        ra->size = 0;
+        ra->end = 0;
+        return false;
+    }
+
+    // Next window is issued once the reader gets into the second half
+    // of the previous one, so that it's ready before it's needed
+    if (ra->end > last + 1 + ra->size / 2)
+    {
+        return false;
+    }
+
+    ra->size = ra->size ? min(ra->size * 2, READAHEAD_MAX_PAGES) : READAHEAD_MIN_PAGES;
+    first = max(ra->end, last + 1);
+    ra->end = first + ra->size;
+
+    *start = first * PAGE_SIZE;
+    *size = ra->size * PAGE_SIZE;
+
+    return true;
+}
+
+void buffer_cache_meminfo(seq_file_t* s)
+{
+    seq_printf(s, "Cached: %zu kB\n", stats.pages * PAGE_SIZE / KiB);
+    seq_printf(s, "CacheHits: %zu\n", stats.hits);
+    seq_printf(s, "CacheMisses: %zu\n", stats.misses);
+    seq_printf(s, "CacheEvictions: %zu\n", stats.evictions);
+    seq_printf(s, "Dirty: %zu kB\n", stats.dirty * PAGE_SIZE / KiB);
+    seq_printf(s, "Writeback: %zu kB\n", stats.writeback * PAGE_SIZE / KiB);
 }
@@ -2,22 +2,101 @@
 #include <kernel/dentry.h>
 #include <kernel/malloc.h>
 
-static LIST_DECLARE(dentry_cache);
+#define DENTRY_HASH_BITS    10
+#define DENTRY_HASH_SIZE    (1 << DENTRY_HASH_BITS)
+
+static list_head_t hash_table[DENTRY_HASH_SIZE];
+static LIST_DECLARE(lru);
+static size_t lru_count;
+
+static uint32_t name_hash(const char* name)
+{
+    uint32_t hash = 2166136261U;
+
+    for (; *name; ++name)
+    {
+        hash = (hash ^ (uint8_t)*name) * 16777619U;
+    }
+
+    return hash;
+}
+
+static inline list_head_t* hash_bucket(dentry_t* parent_dentry, uint32_t hash)
+{
+    uint32_t key = (hash ^ (addr(parent_dentry) >> 4)) * 2654435761U;
+    list_head_t* bucket = &hash_table[key >> (32 - DENTRY_HASH_BITS)];
+
+    if (unlikely(!bucket->next))
+    {
+        list_init(bucket);
+    }
+
+    return bucket;
+}
+
+static dentry_t* dentry_find(dentry_t* parent_dentry, const char* name, uint32_t hash)
+{
+    dentry_t* dentry;
+
+    list_for_each_entry(dentry, hash_bucket(parent_dentry, hash), hash_entry)
+    {
+        if (dentry->hash == hash && dentry->parent == parent_dentry && !strcmp(dentry->name, name))
+        {
+            return dentry;
+        }
+    }
+
+    return NULL;
+}
 
 static void dentry_init(dentry_t* dentry, dentry_t* parent_dentry, inode_t* inode)
 {
-    list_init(&dentry->cache);
+    list_init(&dentry->hash_entry);
+    list_init(&dentry->lru);
     list_init(&dentry->child);
     list_init(&dentry->subdirs);
-    list_add(&dentry->cache, &dentry_cache);
     dentry->refcount = 1;
     dentry->inode = inode;
     dentry->parent = parent_dentry;
+    dentry->reclaimable = parent_dentry
+        && parent_dentry->inode->sb
+        && (parent_dentry->inode->sb->flags & SB_DCACHE);
+}
+
+static void dentry_free(dentry_t* dentry)
+{
+    dentry_t* parent_dentry = dentry->parent;
+
+    log_debug(DEBUG_DENTRY, "removing dentry %s %p", dentry->name, dentry->inode);
+
+    list_del(&dentry->hash_entry);
+    list_del(&dentry->child);
+
+    if (!list_empty(&dentry->lru))
+    {
+        list_del(&dentry->lru);
+        --lru_count;
+    }
+
+    if (dentry->reclaimable && dentry->inode)
+    {
+        inode_put(dentry->inode);
+    }
+
+    slab_free(dentry->name, strlen(dentry->name) + 1);
+    delete(dentry);
+
+    if (parent_dentry)
+    {
+        dentry_put(parent_dentry);
+    }
 }
 
 dentry_t* dentry_create(inode_t* inode, dentry_t* parent_dentry, const char* name)
 {
     size_t len;
+    dentry_t* existing;
+    uint32_t hash = name_hash(name);
     dentry_t* new_dentry = alloc(dentry_t, dentry_init(this, parent_dentry, inode));
 
     if (unlikely(!new_dentry))
@@ -25,11 +104,6 @@ dentry_t* dentry_create(inode_t* inode, dentry_t* parent_dentry, const char* nam
         return NULL;
     }
 
-    if (parent_dentry)
-    {
-        list_add(&new_dentry->child, &parent_dentry->subdirs);
-    }
-
     len = strlen(name) + 1;
     new_dentry->name = slab_alloc(len);
 
@@ -40,7 +114,37 @@ dentry_t* dentry_create(inode_t* inode, dentry_t* parent_dentry, const char* nam
     }
 
     strcpy(new_dentry->name, name);
-    inode->dentry = new_dentry;
+    new_dentry->hash = hash;
+
+    if (parent_dentry)
+    {
+        // Name which has just been created replaces the negative entry
+        if ((existing = dentry_find(parent_dentry, name, hash)) && !existing->inode)
+        {
+            dentry_detach(existing);
+        }
+
+        dentry_get(parent_dentry);
+        list_add(&new_dentry->child, &parent_dentry->subdirs);
+        list_add(&new_dentry->hash_entry, hash_bucket(parent_dentry, hash));
+    }
+
+    if (new_dentry->reclaimable)
+    {
+        // Done before the new dentry is added, so that it's not freed
+        if (lru_count >= DENTRY_CACHE_MAX)
+        {
+            dentry_cache_shrink(lru_count + 1 - DENTRY_CACHE_MAX);
+        }
+
+        list_add_tail(&new_dentry->lru, &lru);
+        ++lru_count;
+    }
+
+    if (inode)
+    {
+        inode->dentry = new_dentry;
+    }
 
     log_debug(DEBUG_DENTRY, "added %p for parent %p", new_dentry, parent_dentry);
 
@@ -56,25 +160,86 @@ dentry_t* dentry_lookup(dentry_t* parent_dentry, const char* name)
         return NULL;
     }
 
-    list_for_each_entry(dentry, &parent_dentry->subdirs, child)
+    if ((dentry = dentry_find(parent_dentry, name, name_hash(name))))
     {
-        if (!strcmp(dentry->name, name))
+        log_debug(DEBUG_DENTRY, "found %p", dentry);
+
+        if (!list_empty(&dentry->lru))
         {
-            log_debug(DEBUG_DENTRY, "found %p", dentry);
-            return dentry;
+            list_move_tail(&dentry->lru, &lru);
         }
     }
 
-    return NULL;
+    return dentry;
+}
+
+void dentry_get(dentry_t* dentry)
+{
+    ++dentry->refcount;
 }
 
-void dentry_delete(dentry_t* dentry)
+void dentry_put(dentry_t* dentry)
 {
     if (!--dentry->refcount)
     {
-        log_debug(DEBUG_DENTRY, "removing dentry %s %p", dentry->name, dentry->inode);
-        list_del(&dentry->child);
-        slab_free(dentry->name, strlen(dentry->name) + 1);
-        delete(dentry);
+        dentry_free(dentry);
+    }
+}
+
+void dentry_detach(dentry_t* dentry)
+{
+    log_debug(DEBUG_DENTRY, "detaching dentry %s %p", dentry->name, dentry->inode);
+
+    if (list_empty(&dentry->hash_entry))
+    {
+        return;
+    }
+
+    list_del(&dentry->hash_entry);
+    list_del(&dentry->child);
+
+    if (!list_empty(&dentry->lru))
+    {
+        list_del(&dentry->lru);
+        --lru_count;
+    }
+
+    // Drop the reference of the hash table
+    dentry_put(dentry);
+}
+
+void dentry_prune(dentry_t* dentry)
+{
+    dentry_t* child;
+
+    list_for_each_entry_safe(child, &dentry->subdirs, child)
+    {
+        dentry_detach(child);
     }
 }
+
+size_t dentry_cache_shrink(size_t count)
+{
+    size_t freed = 0;
+    size_t scanned = 0;
+    size_t to_scan = lru_count;
+    dentry_t* dentry;
+
+    while (freed < count && scanned++ < to_scan && !list_empty(&lru))
+    {
+        dentry = list_front(&lru, dentry_t, lru);
+
+        // Only the hash table references it; children and users hold
+        // references as well
+        if (dentry->refcount > 1)
+        {
+            list_move_tail(&dentry->lru, &lru);
+            continue;
+        }
+
+        dentry_detach(dentry);
+        ++freed;
+    }
+
+    return freed;
+}
@@ -0,0 +1,564 @@
+#include <kernel/fs.h>
+#include <kernel/dev.h>
+#include <kernel/time.h>
+#include <kernel/wait.h>
+#include <kernel/epoll.h>
+#include <kernel/timer.h>
+#include <kernel/dentry.h>
+#include <kernel/minmax.h>
+#include <kernel/process.h>
+#include <kernel/api/stat.h>
+
+#define DEBUG_EPOLL         0
+#define EPOLL_POLL_EVENTS   (EPOLLIN | EPOLLPRI | EPOLLOUT)
+#define EPOLL_WAIT_MAX      32 // Events returned by a single epoll_wait
+#define EPOLL_MAX_NESTS     4  // Depth of epolls watching other epolls
+
+static int epoll_close(file_t* file);
+static int epoll_poll(file_t* file, short events, short* revents, wait_queue_head_t** head);
+
+typedef struct epoll epoll_t;
+typedef struct epoll_item epoll_item_t;
+
+// Each item is kept on the wait queue of its file; when the file wakes it,
+// item is moved to the ready list, so epoll_wait only polls files which
+// changed since the last call instead of all watched ones
+struct epoll
+{
+    wait_queue_head_t wq;
+    list_head_t       items;
+    list_head_t       ready;
+};
+
+struct epoll_item
+{
+    int                fd;
+    file_t*            file;
+    epoll_t*           ep;
+    uint32_t           events;
+    epoll_data_t       data;
+    wait_queue_t       queue;
+    wait_queue_head_t* head;
+    list_head_t        entry;
+    list_head_t        file_entry;
+    list_head_t        ready_entry;
+};
+
+static file_operations_t epoll_fops = {
+    .close = &epoll_close,
+    .poll = &epoll_poll,
+};
+
+static inode_operations_t epoll_iops = {
+};
+
+static super_operations_t sb_ops;
+
+static super_block_t sb = {
+    .ops = &sb_ops
+};
+
+static process_t* epoll_item_wake(wait_queue_t* queue)
+{
+    process_t* proc;
+    epoll_item_t* item = wait_queue_entry(queue, epoll_item_t, queue);
+    epoll_t* ep = item->ep;
+
+    item->head = NULL;
+
+    if (list_empty(&item->ready_entry))
+    {
+        list_add_tail(&item->ready_entry, &ep->ready);
+    }
+
+    while ((proc = wait_queue_pop(&ep->wq)))
+    {
+        process_wake(proc);
+    }
+
+    return NULL;
+}
+
+static void epoll_item_disarm(epoll_item_t* item)
+{
+    if (item->head)
+    {
+        wait_queue_remove(&item->queue, item->head);
+        item->head = NULL;
+    }
+}
+
+// Polls file and puts item on its wait queue; has to be called with irqs disabled
+static int epoll_item_poll(epoll_item_t* item, short* revents)
+{
+    int errno;
+    wait_queue_head_t* head = NULL;
+
+    epoll_item_disarm(item);
+
+    *revents = 0;
+
+    if (unlikely(errno = item->file->ops->poll(item->file, item->events & EPOLL_POLL_EVENTS, revents, &head)))
+    {
+        return errno;
+    }
+
+    if (head)
+    {
+        item->head = head;
+        wait_queue_push(&item->queue, head);
+    }
+
+    return 0;
+}
+
+static void epoll_list_move(list_head_t* from, list_head_t* to)
+{
+    while (!list_empty(from))
+    {
+        list_move_tail(from->next, to);
+    }
+}
+
+static void epoll_item_free(epoll_item_t* item)
+{
+    epoll_item_disarm(item);
+    list_del(&item->entry);
+    list_del(&item->file_entry);
+    list_del(&item->ready_entry);
+    delete(item);
+}
+
+static epoll_item_t* epoll_item_find(epoll_t* ep, int fd, file_t* file)
+{
+    epoll_item_t* item;
+
+    list_for_each_entry(item, &ep->items, entry)
+    {
+        if (item->fd == fd && item->file == file)
+        {
+            return item;
+        }
+    }
+
+    return NULL;
+}
+
+static void epoll_item_init(epoll_item_t* item, epoll_t* ep, int fd, file_t* file)
+{
+    item->fd = fd;
+    item->file = file;
+    item->ep = ep;
+    item->head = NULL;
+    wait_queue_callback_init(&item->queue, &epoll_item_wake);
+    list_init(&item->ready_entry);
+    list_add_tail(&item->entry, &ep->items);
+    list_add_tail(&item->file_entry, &file->epoll_items);
+}
+
+static int epoll_item_update(epoll_item_t* item, struct epoll_event* event)
+{
+    int errno;
+    short revents;
+    epoll_t* ep = item->ep;
+
+    item->events = event->events;
+    item->data = event->data;
+
+    if (unlikely(errno = epoll_item_poll(item, &revents)))
+    {
+        return errno;
+    }
+
+    if (revents && list_empty(&item->ready_entry))
+    {
+        list_add_tail(&item->ready_entry, &ep->ready);
+    }
+
+    return 0;
+}
+
+// Returns whether ep watches target, directly or through other epolls; too
+// deep nesting is treated as a loop, as wakeups are propagated recursively
+static bool epoll_watches(epoll_t* ep, epoll_t* target, int depth)
+{
+    epoll_item_t* item;
+
+    list_for_each_entry(item, &ep->items, entry)
+    {
+        if (item->file->ops != &epoll_fops)
+        {
+            continue;
+        }
+
+        if (item->file->private == target
+            || depth >= EPOLL_MAX_NESTS
+            || epoll_watches(item->file->private, target, depth + 1))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int epoll_add(epoll_t* ep, int fd, file_t* file, struct epoll_event* event)
+{
+    int errno;
+    epoll_item_t* item;
+
+    if (unlikely(epoll_item_find(ep, fd, file)))
+    {
+        return -EEXIST;
+    }
+
+    if (file->ops == &epoll_fops && unlikely(epoll_watches(file->private, ep, 1)))
+    {
+        return -ELOOP;
+    }
+
+    if (unlikely(!(item = alloc(epoll_item_t, epoll_item_init(this, ep, fd, file)))))
+    {
+        return -ENOMEM;
+    }
+
+    scoped_irq_lock();
+
+    if (unlikely(errno = epoll_item_update(item, event)))
+    {
+        epoll_item_free(item);
+        return errno;
+    }
+
+    log_debug(DEBUG_EPOLL, "%u: epoll %p: added fd %u", process_current->pid, ep, fd);
+
+    return 0;
+}
+
+// Moves ready events to the buffer; level-triggered items stay on the
+// ready list until their file reports no events
+static int epoll_ready_collect(epoll_t* ep, struct epoll_event* events, int maxevents)
+{
+    int errno, count = 0;
+    short revents;
+    epoll_item_t* item;
+    LIST_DECLARE(pending);
+
+    epoll_list_move(&ep->ready, &pending);
+
+    while (count < maxevents && !list_empty(&pending))
+    {
+        item = list_front(&pending, epoll_item_t, ready_entry);
+        list_del(&item->ready_entry);
+
+        if (unlikely(errno = epoll_item_poll(item, &revents)))
+        {
+            list_add_tail(&item->ready_entry, &ep->ready);
+            epoll_list_move(&pending, &ep->ready);
+            return count ? count : errno;
+        }
+
+        if (!revents)
+        {
+            continue;
+        }
+
+        events[count].events = revents;
+        events[count].data = item->data;
+        ++count;
+
+        if (item->events & EPOLLONESHOT)
+        {
+            epoll_item_disarm(item);
+            item->events = 0;
+        }
+        else if (!(item->events & EPOLLET))
+        {
+            list_add_tail(&item->ready_entry, &ep->ready);
+        }
+    }
+
+    epoll_list_move(&pending, &ep->ready);
+
+    return count;
+}
+
+static int epoll_get(int epfd, epoll_t** ep)
+{
+    file_t* file;
+
+    if (unlikely(process_fd_get(process_current, epfd, &file)))
+    {
+        return -EBADF;
+    }
+
+    if (unlikely(file->ops != &epoll_fops))
+    {
+        return -EINVAL;
+    }
+
+    *ep = file->private;
+
+    return 0;
+}
+
+static void epoll_init(epoll_t* ep)
+{
+    wait_queue_head_init(&ep->wq);
+    list_init(&ep->items);
+    list_init(&ep->ready);
+}
+
+static void file_init(file_t* file, epoll_t* ep, dentry_t* dentry, int mode)
+{
+    memset(file, 0, sizeof(*file));
+
+    file->private = ep;
+    file->count = 1;
+    file->ops = &epoll_fops;
+    file->mode = mode;
+    file->dentry = dentry;
+
+    list_init(&file->epoll_items);
+    list_add_tail(&file->files, &files);
+}
+
+static void inode_init(inode_t* inode)
+{
+    inode->ops = &epoll_iops;
+    inode->file_ops = &epoll_fops;
+    inode->dev = MKDEV(0, 254);
+    inode->ino = 1;
+    inode->sb = &sb;
+    inode->mode = S_IFREG | 0600;
+    inode->fs_data = NULL;
+}
+
+static int epoll_close(file_t* file)
+{
+    epoll_item_t* item;
+    epoll_t* ep = file->private;
+
+    log_debug(DEBUG_EPOLL, "%u: epoll %p: closing", process_current->pid, ep);
+
+    scoped_irq_lock();
+
+    list_for_each_entry_safe(item, &ep->items, entry)
+    {
+        epoll_item_free(item);
+    }
+
+    delete(ep);
+
+    return 0;
+}
+
+static int epoll_poll(file_t* file, short events, short* revents, wait_queue_head_t** head)
+{
+    epoll_t* ep = file->private;
+
+    *revents = list_empty(&ep->ready) ? 0 : POLLIN & events;
+    *head = &ep->wq;
+
+    return 0;
+}
+
+void epoll_file_release(file_t* file)
+{
+    epoll_item_t* item;
+
+    scoped_irq_lock();
+
+    list_for_each_entry_safe(item, &file->epoll_items, file_entry)
+    {
+        epoll_item_free(item);
+    }
+}
+
+int sys_epoll_create1(int flags)
+{
+    int errno, fd;
+    epoll_t* ep;
+    file_t* file;
+    inode_t* inode;
+    dentry_t* dentry;
+    char namebuf[16];
+
+    static unsigned id;
+
+    if (unlikely(flags & ~EPOLL_CLOEXEC))
+    {
+        return -EINVAL;
+    }
+
+    if (unlikely(errno = inode_alloc(&inode)))
+    {
+        return errno;
+    }
+
+    inode_init(inode);
+
+    snprintf(namebuf, sizeof(namebuf), "epoll:%u", id++);
+
+    if (unlikely(!(dentry = dentry_create(inode, NULL, namebuf))))
+    {
+        inode_put(inode);
+        return -ENOMEM;
+    }
+
+    if (unlikely(!(ep = alloc(epoll_t, epoll_init(this)))))
+    {
+        dentry_put(dentry);
+        return -ENOMEM;
+    }
+
+    if (unlikely(!(file = alloc(file_t, file_init(this, ep, dentry, O_RDONLY | flags)))))
+    {
+        delete(ep);
+        dentry_put(dentry);
+        return -ENOMEM;
+    }
+
+    if (unlikely((fd = file_fd_allocate(file)) < 0))
+    {
+        do_close(file);
+        return fd;
+    }
+
+    return fd;
+}
+
+int sys_epoll_ctl(int epfd, int op, int fd, struct epoll_event* event)
+{
+    int errno;
+    epoll_t* ep;
+    file_t* file;
+    epoll_item_t* item;
+
+    if (unlikely(errno = epoll_get(epfd, &ep)))
+    {
+        return errno;
+    }
+
+    if (unlikely(process_fd_get(process_current, fd, &file)))
+    {
+        return -EBADF;
+    }
+
+    if (unlikely(file->private == ep || !file->ops->poll))
+    {
+        return -EPERM;
+    }
+
+    if (op != EPOLL_CTL_DEL && unlikely(errno = current_vm_verify(VERIFY_READ, event)))
+    {
+        return errno;
+    }
+
+    switch (op)
+    {
+        case EPOLL_CTL_ADD:
+            return epoll_add(ep, fd, file, event);
+
+        case EPOLL_CTL_MOD:
+            if (unlikely(!(item = epoll_item_find(ep, fd, file))))
+            {
+                return -ENOENT;
+            }
+            {
+                scoped_irq_lock();
+                return epoll_item_update(item, event);
+            }
+
+        case EPOLL_CTL_DEL:
+            if (unlikely(!(item = epoll_item_find(ep, fd, file))))
+            {
+                return -ENOENT;
+            }
+            {
+                scoped_irq_lock();
+                epoll_item_free(item);
+            }
+            return 0;
+    }
+
+    return -EINVAL;
+}
+
+static void epoll_timeout(ktimer_t* timer)
+{
+    bool* timedout = timer->data;
+    *timedout = true;
+    process_wake(timer->process);
+}
+
+int sys_epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout)
+{
+    int errno;
+    epoll_t* ep;
+    flags_t flags;
+    timeval_t t;
+    int count = 0;
+    timer_t timer = 0;
+    volatile bool timedout = false;
+    struct epoll_event buf[EPOLL_WAIT_MAX];
+
+    if (unlikely(errno = epoll_get(epfd, &ep)))
+    {
+        return errno;
+    }
+
+    if (unlikely(maxevents <= 0))
+    {
+        return -EINVAL;
+    }
+
+    if (unlikely(errno = current_vm_verify_array(VERIFY_WRITE, events, maxevents)))
+    {
+        return errno;
+    }
+
+    if (timeout > 0)
+    {
+        t.tv_sec = timeout / 1000;
+        t.tv_usec = (timeout % 1000) * 1000;
+        timer = ktimer_create_and_start(KTIMER_ONESHOT, t, &epoll_timeout, (void*)&timedout);
+
+        if (unlikely(errno = errno_get(timer)))
+        {
+            return errno;
+        }
+    }
+
+    // Events are copied out once irqs are enabled again, as writing
+    // to the user memory may fault
+    maxevents = min(maxevents, EPOLL_WAIT_MAX);
+
+    irq_save(flags);
+
+    while (!(count = epoll_ready_collect(ep, buf, maxevents)) && timeout && !timedout)
+    {
+        WAIT_QUEUE_DECLARE(q, process_current);
+
+        log_debug(DEBUG_EPOLL, "%u: epoll %p: waiting", process_current->pid, ep);
+
+        if ((count = process_wait_locked(&ep->wq, &q, &flags)))
+        {
+            break;
+        }
+    }
+
+    if (!timedout && timer)
+    {
+        ktimer_delete(timer);
+    }
+
+    irq_restore(flags);
+
+    if (count > 0)
+    {
+        memcpy(events, buf, count * sizeof(*buf));
+    }
+
+    return count;
+}
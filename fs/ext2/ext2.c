@@ -3,7 +3,9 @@
 
 #include <kernel/fs.h>
 #include <kernel/vm.h>
+#include <kernel/time.h>
 #include <kernel/ctype.h>
+#include <kernel/bitset.h>
 #include <kernel/kernel.h>
 #include <kernel/minmax.h>
 #include <kernel/module.h>
@@ -21,8 +23,16 @@ static int ext2_readdir(file_t* file, void* buf, direntadd_t dirent_add);
 static int ext2_mmap(file_t* file, vm_area_t* vma);
 static int ext2_mount(super_block_t* sb, inode_t* inode, void*, int);
 static int ext2_read(file_t* file, char* buffer, size_t count);
+static int ext2_write(file_t* file, const char* buffer, size_t count);
 static int ext2_nopage(vm_area_t* vma, uintptr_t address, size_t size, page_t** page);
 static int ext2_readlink(inode_t* inode, char* buffer, size_t size);
+static int ext2_create(inode_t* parent, const char* name, int, int mode, inode_t** result);
+static int ext2_mkdir(inode_t* parent, const char* name, int mode, int, inode_t** result);
+static int ext2_unlink(inode_t* parent, const char* name);
+static int ext2_rmdir(inode_t* parent, const char* name);
+static int ext2_rename(inode_t* old_parent, const char* old_name, inode_t* new_parent, const char* new_name);
+static int ext2_truncate(inode_t* inode, size_t size);
+static void ext2_inode_release(inode_t* inode);
 
 enum traverse_command
 {
@@ -32,140 +42,1453 @@ enum traverse_command
 
 typedef enum traverse_command cmd_t;
 
-typedef struct level level_t;
 typedef cmd_t (*block_cb_t)(void*, size_t, void*);
 
 static int ext2_traverse_blocks(
     ext2_data_t* data,
     ext2_inode_t* raw_inode,
+    ino_t ino,
     size_t offset,
     size_t count,
     void* cb_data,
     block_cb_t cb);
 
-// Each block can be addressed using leve[4], each for each
-// level of indirection
-
-#define LVL_DIRECT              0
-#define LVL_SINGLY_INDIRECT     1
-#define LVL_DOUBLY_INDIRECT     2
-#define LVL_TRIPLY_INDIRECT     3
-
-struct level
-{
-    int         lvl;
-    uint32_t    cur;     // list element index
-    uint32_t*   cur_ptr; // ptr to list element
-};
-
 static file_system_t ext2 = {
     .name  = "ext2",
     .mount = &ext2_mount,
 };
 
 static super_operations_t ext2_sb_ops = {
+    .inode_release = &ext2_inode_release,
 };
 
 static file_operations_t ext2_fops = {
     .open    = &ext2_open,
     .read    = &ext2_read,
+    .write   = &ext2_write,
     .readdir = &ext2_readdir,
     .mmap    = &ext2_mmap,
 };
 
 static inode_operations_t ext2_inode_ops = {
-    .lookup = &ext2_lookup,
+    .lookup   = &ext2_lookup,
     .readlink = &ext2_readlink,
+    .create   = &ext2_create,
+    .mkdir    = &ext2_mkdir,
+    .unlink   = &ext2_unlink,
+    .rmdir    = &ext2_rmdir,
+    .rename   = &ext2_rename,
+    .truncate = &ext2_truncate,
 };
 
 static vm_operations_t ext2_vmops = {
     .nopage = &ext2_nopage,
 };
 
-static ext2_bgd_t* ext2_bgd_get(ext2_data_t* data, uint32_t ino)
+// File system block spans 1 << block_shift consecutive cache blocks, all
+// within one page, so the data of the returned buffer covers all of it
+static inline buffer_t* ext2_block_read(ext2_data_t* data, uint32_t block)
 {
-    buffer_t* b;
-    ext2_bgd_t* bgd;
-    uint32_t group_index = (ino - 1) / data->inodes_per_group;
-    uint32_t group_block_nr = (group_index * sizeof(ext2_bgd_t)) / EXT2_BLOCK_SIZE + 2;
+    return block_read(data->dev, data->file, block << data->block_shift);
+}
 
-    group_index %= EXT2_BLOCK_SIZE / sizeof(ext2_bgd_t);
+static inline void ext2_block_dirty(ext2_data_t* data, buffer_t* b)
+{
+    block_mark_dirty(b, data->block_size);
+}
+
+static inline void ext2_sb_dirty(ext2_data_t* data)
+{
+    block_mark_dirty(data->sb_block, sizeof(ext2_sb_t));
+}
 
-    b = block_read(data->dev, data->file, group_block_nr);
+static inline uint32_t ext2_inode_group(ext2_data_t* data, ino_t ino)
+{
+    return (ino - 1) / data->inodes_per_group;
+}
 
-    if (unlikely(errno_get(b)))
+static inline uint32_t ext2_group_first_block(ext2_data_t* data, uint32_t group)
+{
+    return data->first_data_block + group * data->blocks_per_group;
+}
+
+// Last group may be shorter than the others
+static inline uint32_t ext2_group_blocks(ext2_data_t* data, uint32_t group)
+{
+    return min(data->blocks_per_group, data->blocks_count - ext2_group_first_block(data, group));
+}
+
+static ext2_bgd_t* ext2_bgd_get(ext2_data_t* data, uint32_t group, buffer_t** b)
+{
+    ext2_bgd_t* bgd;
+    uint32_t per_block = data->block_size / sizeof(ext2_bgd_t);
+
+    // Descriptors table follows the superblock
+    *b = ext2_block_read(data, data->first_data_block + 1 + group / per_block);
+
+    if (unlikely(errno_get(*b)))
     {
         return NULL;
     }
 
-    return (bgd = b->data) + group_index;
+    return (bgd = (*b)->data) + group % per_block;
 }
 
-static ext2_inode_t* ext2_inode_get(ext2_data_t* data, uint32_t ino)
+// Returned buffer has to be released by the caller
+static ext2_inode_t* ext2_inode_read(ext2_data_t* data, uint32_t ino, buffer_t** b)
 {
-    buffer_t* b;
-    ext2_inode_t* inode;
+    uint32_t inode_table;
     uint32_t inode_in_group_index = (ino - 1) % data->inodes_per_group;
     uint32_t block_nr = inode_in_group_index / data->inodes_per_block;
     uint32_t block_off = inode_in_group_index % data->inodes_per_block;
 
-    ext2_bgd_t* bgd = ext2_bgd_get(data, ino);
+    ext2_bgd_t* bgd = ext2_bgd_get(data, ext2_inode_group(data, ino), b);
 
     if (unlikely(!bgd))
     {
         return NULL;
     }
 
-    b = block_read(data->dev, data->file, bgd->inode_table + block_nr);
+    inode_table = bgd->inode_table;
+    block_put(*b);
 
-    if (unlikely(errno_get(b)))
+    *b = ext2_block_read(data, inode_table + block_nr);
+
+    if (unlikely(errno_get(*b)))
     {
         return NULL;
     }
 
-    return (inode = b->data) + block_off;
+    return shift_as(ext2_inode_t*, (*b)->data, block_off * data->inode_size);
 }
 
-typedef struct lookup_context lookup_context_t;
+// Returned inode points into the cached block, which is kept referenced,
+// as inode->fs_data keeps the pointer for the lifetime of the inode
+static ext2_inode_t* ext2_inode_get(ext2_data_t* data, uint32_t ino)
+{
+    buffer_t* b;
+    return ext2_inode_read(data, ino, &b);
+}
 
-struct lookup_context
+// Drops the reference of the block taken by ext2_inode_get()
+static void ext2_inode_unpin(ext2_data_t* data, uint32_t ino)
 {
-    ext2_data_t* data;
-    const char* name;
-    size_t name_len;
-    ext2_inode_t* res;
-    ino_t ino;
+    buffer_t* b;
+
+    if (likely(ext2_inode_read(data, ino, &b)))
+    {
+        block_put(b);
+        block_put(b);
+    }
+}
+
+static void ext2_inode_dirty(ext2_data_t* data, uint32_t ino)
+{
+    buffer_t* b;
+
+    if (likely(ext2_inode_read(data, ino, &b)))
+    {
+        ext2_block_dirty(data, b);
+        block_put(b);
+    }
+}
+
+// Returns whether any inode in use refers to ino
+static bool ext2_inode_in_use(ext2_data_t* data, ino_t ino)
+{
+    inode_t* inode;
+
+    list_for_each_entry(inode, &data->inodes, list)
+    {
+        if (inode->ino == ino)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void ext2_inode_fill(inode_t* inode, ext2_inode_t* raw_inode, ino_t ino)
+{
+    inode->ino = ino;
+    inode->ops = &ext2_inode_ops;
+    inode->size = raw_inode->size;
+    inode->file_ops = &ext2_fops;
+    inode->fs_data = raw_inode;
+    inode->mode = raw_inode->mode;
+    inode->uid = raw_inode->uid;
+    inode->gid = raw_inode->gid;
+    inode->ctime = raw_inode->ctime;
+    inode->mtime = raw_inode->mtime;
+    inode->nlink = raw_inode->links_count;
+}
+
+// Finds clear bit starting from start and wrapping around; returns -1 if all are set
+static int ext2_bitmap_find_zero(uint32_t* bitmap, size_t start, size_t size)
+{
+    size_t bit = start;
+
+    for (size_t left = size; left;)
+    {
+        if (!(bit % BITSET_BITS) && left >= BITSET_BITS && bit + BITSET_BITS <= size
+            && bitmap[bit / BITSET_BITS] == ~0U)
+        {
+            bit += BITSET_BITS;
+            left -= BITSET_BITS;
+        }
+        else
+        {
+            if (!bitset_test(bitmap, bit))
+            {
+                return bit;
+            }
+
+            ++bit;
+            --left;
+        }
+
+        if (bit >= size)
+        {
+            bit = 0;
+        }
+    }
+
+    return -1;
+}
+
+enum
+{
+    EXT2_BLOCK_BITMAP,
+    EXT2_INODE_BITMAP,
 };
 
-static cmd_t ext2_lookup_block(void* block, size_t to_copy, void* data)
+// Allocates a block or an inode, looking in the given group first, starting
+// from start, then in the following ones; result is an index counted from
+// the first data block or the first inode
+static int ext2_bit_alloc(ext2_data_t* data, int type, uint32_t group, uint32_t start, uint32_t* result)
 {
-    lookup_context_t* ctx = data;
-    ext2_dir_entry_t* dirent;
-    size_t total_len;
+    int bit = -1;
+    buffer_t* bgd_b;
+    buffer_t* bitmap_b;
+    ext2_bgd_t* bgd;
+    uint32_t per_group = type == EXT2_BLOCK_BITMAP ? data->blocks_per_group : data->inodes_per_group;
 
-    for (dirent = block, total_len = 0;
-        total_len < to_copy;
-        total_len += dirent->rec_len, dirent = ptr(addr(dirent) + dirent->rec_len))
+    for (uint32_t i = 0; i < data->groups_count; ++i, group = (group + 1) % data->groups_count, start = 0)
     {
-        if (ctx->name_len != dirent->name_len || strncmp(dirent->name, ctx->name, dirent->name_len))
+        if (unlikely(!(bgd = ext2_bgd_get(data, group, &bgd_b))))
+        {
+            return -EIO;
+        }
+
+        if (!(type == EXT2_BLOCK_BITMAP ? bgd->free_blocks_count : bgd->free_inodes_count))
         {
+            block_put(bgd_b);
             continue;
         }
 
-        ctx->res = ext2_inode_get(ctx->data, dirent->inode);
+        bitmap_b = ext2_block_read(data, type == EXT2_BLOCK_BITMAP ? bgd->block_bitmap : bgd->inode_bitmap);
 
-        if (unlikely(!ctx->res))
+        if (unlikely(errno_get(bitmap_b)))
         {
-            log_debug(DEBUG_EXT2FS, "cannot read inode %u", dirent->inode);
-            return -EIO;
+            block_put(bgd_b);
+            return errno_get(bitmap_b);
+        }
+
+        bit = ext2_bitmap_find_zero(
+            bitmap_b->data,
+            start,
+            type == EXT2_BLOCK_BITMAP ? ext2_group_blocks(data, group) : data->inodes_per_group);
+
+        if (bit >= 0)
+        {
+            bitset_set(bitmap_b->data, bit);
+            ext2_block_dirty(data, bitmap_b);
+
+            if (type == EXT2_BLOCK_BITMAP)
+            {
+                --bgd->free_blocks_count;
+                --data->sb->free_blocks_count;
+            }
+            else
+            {
+                --bgd->free_inodes_count;
+                --data->sb->free_inodes_count;
+            }
+
+            ext2_block_dirty(data, bgd_b);
+            ext2_sb_dirty(data);
+
+            *result = group * per_group + bit;
+        }
+
+        block_put(bitmap_b);
+        block_put(bgd_b);
+
+        if (bit >= 0)
+        {
+            return 0;
+        }
+    }
+
+    return -ENOSPC;
+}
+
+static void ext2_bit_free(ext2_data_t* data, int type, uint32_t index)
+{
+    buffer_t* bgd_b;
+    buffer_t* bitmap_b;
+    ext2_bgd_t* bgd;
+    uint32_t per_group = type == EXT2_BLOCK_BITMAP ? data->blocks_per_group : data->inodes_per_group;
+    uint32_t group = index / per_group;
+    uint32_t bit = index % per_group;
+
+    if (unlikely(group >= data->groups_count || !(bgd = ext2_bgd_get(data, group, &bgd_b))))
+    {
+        log_warning("cannot free %s %u", type == EXT2_BLOCK_BITMAP ? "block" : "inode", index);
+        return;
+    }
+
+    bitmap_b = ext2_block_read(data, type == EXT2_BLOCK_BITMAP ? bgd->block_bitmap : bgd->inode_bitmap);
+
+    if (unlikely(errno_get(bitmap_b)))
+    {
+        block_put(bgd_b);
+        return;
+    }
+
+    if (unlikely(!bitset_test(bitmap_b->data, bit)))
+    {
+        log_warning("freeing free %s %u", type == EXT2_BLOCK_BITMAP ? "block" : "inode", index);
+    }
+    else
+    {
+        bitset_clear(bitmap_b->data, bit);
+        ext2_block_dirty(data, bitmap_b);
+
+        if (type == EXT2_BLOCK_BITMAP)
+        {
+            ++bgd->free_blocks_count;
+            ++data->sb->free_blocks_count;
+        }
+        else
+        {
+            ++bgd->free_inodes_count;
+            ++data->sb->free_inodes_count;
+        }
+
+        ext2_block_dirty(data, bgd_b);
+        ext2_sb_dirty(data);
+    }
+
+    block_put(bitmap_b);
+    block_put(bgd_b);
+}
+
+static void ext2_group_dirs_add(ext2_data_t* data, ino_t ino, int count)
+{
+    buffer_t* b;
+    ext2_bgd_t* bgd = ext2_bgd_get(data, ext2_inode_group(data, ino), &b);
+
+    if (likely(bgd))
+    {
+        bgd->used_dirs_count += count;
+        ext2_block_dirty(data, b);
+        block_put(b);
+    }
+}
+
+// Allocates zeroed block, preferably the goal one or the first free after it
+static int ext2_block_alloc(ext2_data_t* data, ext2_inode_t* raw_inode, uint32_t goal, uint32_t* block)
+{
+    int errno;
+    buffer_t* b;
+    uint32_t index;
+
+    if (goal < data->first_data_block || goal >= data->blocks_count)
+    {
+        goal = data->first_data_block;
+    }
+
+    goal -= data->first_data_block;
+
+    if (unlikely(errno = ext2_bit_alloc(
+        data,
+        EXT2_BLOCK_BITMAP,
+        goal / data->blocks_per_group,
+        goal % data->blocks_per_group,
+        &index)))
+    {
+        return errno;
+    }
+
+    *block = data->first_data_block + index;
+
+    b = ext2_block_read(data, *block);
+
+    if (unlikely(errno = errno_get(b)))
+    {
+        ext2_bit_free(data, EXT2_BLOCK_BITMAP, index);
+        return errno;
+    }
+
+    memset(b->data, 0, data->block_size);
+    ext2_block_dirty(data, b);
+    block_put(b);
+
+    raw_inode->blocks += data->block_size / 512;
+
+    return 0;
+}
+
+static void ext2_block_free(ext2_data_t* data, ext2_inode_t* raw_inode, uint32_t block)
+{
+    ext2_bit_free(data, EXT2_BLOCK_BITMAP, block - data->first_data_block);
+    raw_inode->blocks -= data->block_size / 512;
+}
+
+// Splits file block into indices of block pointers on each level of
+// indirection; returns the depth, which is 0 for a direct block
+static int ext2_block_path(ext2_data_t* data, uint32_t block, uint32_t* offsets)
+{
+    uint32_t apb = data->addr_per_block;
+
+    if (block < EXT2_NDIR_BLOCKS)
+    {
+        offsets[0] = block;
+        return 0;
+    }
+
+    block -= EXT2_NDIR_BLOCKS;
+
+    if (block < apb)
+    {
+        offsets[0] = EXT2_IND_BLOCK;
+        offsets[1] = block;
+        return 1;
+    }
+
+    block -= apb;
+
+    if (block < apb * apb)
+    {
+        offsets[0] = EXT2_DIND_BLOCK;
+        offsets[1] = block / apb;
+        offsets[2] = block % apb;
+        return 2;
+    }
+
+    block -= apb * apb;
+
+    if (block < apb * apb * apb)
+    {
+        offsets[0] = EXT2_TIND_BLOCK;
+        offsets[1] = block / (apb * apb);
+        offsets[2] = (block / apb) % apb;
+        offsets[3] = block % apb;
+        return 3;
+    }
+
+    return -EFBIG;
+}
+
+// Maps block of a file to the device block; with create, missing blocks,
+// including the indirect ones, are allocated next to their predecessors,
+// so that files stay contiguous. Otherwise holes are mapped to 0
+static int ext2_bmap(
+    ext2_data_t* data,
+    ext2_inode_t* raw_inode,
+    ino_t ino,
+    uint32_t block,
+    bool create,
+    uint32_t* result)
+{
+    int depth, errno = 0;
+    uint32_t goal;
+    uint32_t offsets[4];
+    uint32_t* slot;
+    uint32_t* table = raw_inode->block;
+    buffer_t* b = NULL; // Block holding the table; NULL for the inode
+    buffer_t* next;
+
+    if (unlikely((depth = ext2_block_path(data, block, offsets)) < 0))
+    {
+        return depth;
+    }
+
+    for (int i = 0;; ++i)
+    {
+        slot = table + offsets[i];
+
+        if (!*slot)
+        {
+            if (!create)
+            {
+                *result = 0;
+                break;
+            }
+
+            goal = offsets[i] && slot[-1]
+                ? slot[-1] + 1
+                : b
+                    ? (b->block >> data->block_shift) + 1
+                    : ext2_group_first_block(data, ext2_inode_group(data, ino));
+
+            if (unlikely(errno = ext2_block_alloc(data, raw_inode, goal, slot)))
+            {
+                break;
+            }
+
+            if (b)
+            {
+                ext2_block_dirty(data, b);
+            }
+
+            ext2_inode_dirty(data, ino);
+        }
+
+        if (i == depth)
+        {
+            *result = *slot;
+            break;
+        }
+
+        next = ext2_block_read(data, *slot);
+
+        if (unlikely(errno = errno_get(next)))
+        {
+            break;
+        }
+
+        if (b)
+        {
+            block_put(b);
+        }
+
+        b = next;
+        table = b->data;
+    }
+
+    if (b)
+    {
+        block_put(b);
+    }
+
+    return errno;
+}
+
+// Maps block of a file to the longest run of contiguous device blocks
+// described by a single table; a hole is mapped as a run of one block
+static int ext2_block_run(ext2_data_t* data, ext2_inode_t* raw_inode, uint32_t block, ext2_extent_t* ext)
+{
+    int depth;
+    uint32_t limit;
+    uint32_t offsets[4];
+    uint32_t* table = raw_inode->block;
+    buffer_t* b = NULL;
+    buffer_t* next;
+
+    if (unlikely((depth = ext2_block_path(data, block, offsets)) < 0))
+    {
+        return depth;
+    }
+
+    ext->block = block;
+    ext->start = 0;
+    ext->count = 1;
+
+    for (int i = 0; i < depth; ++i)
+    {
+        if (!table[offsets[i]])
+        {
+            goto out;
+        }
+
+        next = ext2_block_read(data, table[offsets[i]]);
+
+        if (b)
+        {
+            block_put(b);
+        }
+
+        if (unlikely(errno_get(next)))
+        {
+            return errno_get(next);
+        }
+
+        b = next;
+        table = b->data;
+    }
+
+    table += offsets[depth];
+    limit = (depth ? data->addr_per_block : EXT2_NDIR_BLOCKS) - offsets[depth];
+
+    if ((ext->start = table[0]))
+    {
+        while (ext->count < limit && table[ext->count] == ext->start + ext->count)
+        {
+            ++ext->count;
+        }
+    }
+
+out:
+    if (b)
+    {
+        block_put(b);
+    }
+
+    return 0;
+}
+
+static ext2_extents_t* ext2_extents_find(ext2_data_t* data, ino_t ino)
+{
+    ext2_extents_t* extents;
+
+    list_for_each_entry(extents, &data->extents_hash[ino % EXT2_EXTENTS_HASH_SIZE], hash_entry)
+    {
+        if (extents->ino == ino)
+        {
+            list_move_tail(&extents->lru_entry, &data->extents_lru);
+            return extents;
+        }
+    }
+
+    return NULL;
+}
+
+static void ext2_extent_insert(ext2_data_t* data, ino_t ino, ext2_extent_t* ext)
+{
+    ext2_extent_t* slot = NULL;
+    ext2_extents_t* extents = ext2_extents_find(data, ino);
+
+    if (!extents)
+    {
+        if (data->extents_inodes < EXT2_EXTENTS_INODES)
+        {
+            if (unlikely(!(extents = alloc(ext2_extents_t))))
+            {
+                return;
+            }
+            ++data->extents_inodes;
+        }
+        else
+        {
+            extents = list_front(&data->extents_lru, ext2_extents_t, lru_entry);
+            list_del(&extents->hash_entry);
+            list_del(&extents->lru_entry);
+        }
+
+        memset(extents, 0, sizeof(*extents));
+        extents->ino = ino;
+        list_add_tail(&extents->hash_entry, &data->extents_hash[ino % EXT2_EXTENTS_HASH_SIZE]);
+        list_add_tail(&extents->lru_entry, &data->extents_lru);
+    }
+
+    for (int i = 0; i < EXT2_EXTENTS_PER_INODE; ++i)
+    {
+        ext2_extent_t* e = &extents->extents[i];
+
+        if (e->count
+            && e->block + e->count == ext->block
+            && e->start + e->count == ext->start)
+        {
+            e->count += ext->count;
+            return;
+        }
+
+        if (!e->count && !slot)
+        {
+            slot = e;
+        }
+    }
+
+    if (!slot)
+    {
+        slot = &extents->extents[extents->next++ % EXT2_EXTENTS_PER_INODE];
+    }
+
+    *slot = *ext;
+}
+
+// Forgets mapping of blocks starting from the first-th one
+static void ext2_extents_drop(ext2_data_t* data, ino_t ino, uint32_t first)
+{
+    ext2_extents_t* extents;
+
+    // Mapping which is being read concurrently may be stale already
+    ++data->extents_gen;
+
+    if (!(extents = ext2_extents_find(data, ino)))
+    {
+        return;
+    }
+
+    for (int i = 0; i < EXT2_EXTENTS_PER_INODE; ++i)
+    {
+        ext2_extent_t* e = &extents->extents[i];
+
+        if (e->block >= first)
+        {
+            e->count = 0;
+        }
+        else if (e->block + e->count > first)
+        {
+            e->count = first - e->block;
+        }
+    }
+}
+
+// Maps block of a file to a run of contiguous device blocks starting at it;
+// indirect blocks are walked only when the mapping isn't cached
+static int ext2_extent_get(ext2_data_t* data, ext2_inode_t* raw_inode, ino_t ino, uint32_t block, ext2_extent_t* ext)
+{
+    int errno;
+    unsigned gen;
+    ext2_extents_t* extents = ext2_extents_find(data, ino);
+
+    if (extents)
+    {
+        for (int i = 0; i < EXT2_EXTENTS_PER_INODE; ++i)
+        {
+            ext2_extent_t* e = &extents->extents[i];
+
+            if (e->count && block >= e->block && block - e->block < e->count)
+            {
+                ext->block = block;
+                ext->start = e->start + (block - e->block);
+                ext->count = e->count - (block - e->block);
+                return 0;
+            }
+        }
+    }
+
+    gen = data->extents_gen;
+
+    if (unlikely(errno = ext2_block_run(data, raw_inode, block, ext)))
+    {
+        return errno;
+    }
+
+    // Reading indirect blocks may sleep, and the blocks could have been
+    // freed meanwhile
+    if (ext->start && gen == data->extents_gen)
+    {
+        ext2_extent_insert(data, ino, ext);
+    }
+
+    return 0;
+}
+
+// Frees blocks of a tree of given depth rooted at indirect block, starting
+// from the first-th data block in it; returns true if the whole tree is free
+static bool ext2_ind_free(ext2_data_t* data, ext2_inode_t* raw_inode, uint32_t block, int depth, uint32_t first)
+{
+    uint32_t* table;
+    uint32_t span = 1;
+    buffer_t* b = ext2_block_read(data, block);
+
+    if (unlikely(errno_get(b)))
+    {
+        return false;
+    }
+
+    for (int i = 1; i < depth; ++i)
+    {
+        span *= data->addr_per_block;
+    }
+
+    table = b->data;
+
+    for (uint32_t i = first / span; i < data->addr_per_block; ++i)
+    {
+        if (!table[i])
+        {
+            continue;
+        }
+
+        if (depth == 1 || ext2_ind_free(data, raw_inode, table[i], depth - 1, i == first / span ? first % span : 0))
+        {
+            ext2_block_free(data, raw_inode, table[i]);
+            table[i] = 0;
+        }
+    }
+
+    ext2_block_dirty(data, b);
+    block_put(b);
+
+    return !first;
+}
+
+// Frees all blocks of the file starting from the first-th one
+static void ext2_blocks_free(ext2_data_t* data, ext2_inode_t* raw_inode, ino_t ino, uint32_t first)
+{
+    uint32_t* slot;
+    uint32_t span = 1;
+    uint32_t start = EXT2_NDIR_BLOCKS;
+
+    ext2_extents_drop(data, ino, first);
+
+    for (uint32_t i = first; i < EXT2_NDIR_BLOCKS; ++i)
+    {
+        if (raw_inode->block[i])
+        {
+            ext2_block_free(data, raw_inode, raw_inode->block[i]);
+            raw_inode->block[i] = 0;
+        }
+    }
+
+    for (int depth = 1; depth <= 3; ++depth, start += span)
+    {
+        span *= data->addr_per_block;
+        slot = &raw_inode->block[EXT2_IND_BLOCK + depth - 1];
+
+        if (*slot && first < start + span
+            && ext2_ind_free(data, raw_inode, *slot, depth, first > start ? first - start : 0))
+        {
+            ext2_block_free(data, raw_inode, *slot);
+            *slot = 0;
+        }
+    }
+}
+
+// Symlinks up to 60 characters are kept in the block pointers
+static inline bool ext2_inode_is_fast_symlink(ext2_data_t* data, ext2_inode_t* raw_inode)
+{
+    uint32_t ea_blocks = raw_inode->file_acl ? data->block_size / 512 : 0;
+    return S_ISLNK(raw_inode->mode) && raw_inode->blocks == ea_blocks;
+}
+
+typedef struct lookup_context lookup_context_t;
+
+struct lookup_context
+{
+    ext2_data_t* data;
+    const char* name;
+    size_t name_len;
+    ext2_inode_t* res;
+    ino_t ino;
+};
+
+static cmd_t ext2_lookup_block(void* block, size_t to_copy, void* data)
+{
+    lookup_context_t* ctx = data;
+    ext2_dir_entry_t* dirent;
+    size_t total_len;
+
+    for (dirent = block, total_len = 0;
+        total_len < to_copy && dirent->rec_len;
+        total_len += dirent->rec_len, dirent = ptr(addr(dirent) + dirent->rec_len))
+    {
+        if (!dirent->inode
+            || ctx->name_len != dirent->name_len
+            || strncmp(dirent->name, ctx->name, dirent->name_len))
+        {
+            continue;
+        }
+
+        ctx->res = ext2_inode_get(ctx->data, dirent->inode);
+
+        if (unlikely(!ctx->res))
+        {
+            log_debug(DEBUG_EXT2FS, "cannot read inode %u", dirent->inode);
+            return -EIO;
+        }
+
+        ctx->ino = dirent->inode;
+
+        log_debug(DEBUG_EXT2FS, "found inode; ino=%u, size=%u, name=%S",
+            dirent->inode,
+            ctx->res->size,
+            dirent->name);
+
+        return TRAVERSE_STOP;
+    }
+
+    return TRAVERSE_CONTINUE;
+}
+
+static int ext2_lookup_raw(
+    ext2_data_t* data,
+    ext2_inode_t* parent_inode,
+    ino_t parent_ino,
+    const char* name,
+    ext2_inode_t** child_inode,
+    ino_t* ino)
+{
+    int res, errno;
+    lookup_context_t ctx = {.data = data, .name = name, .name_len = strlen(name), .ino = 0, .res = NULL};
+
+    log_debug(DEBUG_EXT2FS, "name=%s", name);
+
+    res = ext2_traverse_blocks(data, parent_inode, parent_ino, 0, parent_inode->size, &ctx, &ext2_lookup_block);
+
+    if (unlikely(errno = errno_get(res)))
+    {
+        return errno;
+    }
+
+    if (unlikely(!ctx.res))
+    {
+        log_debug(DEBUG_EXT2FS, "no inode with name = %s", name);
+        return -ENOENT;
+    }
+
+    *child_inode = ctx.res;
+    *ino = ctx.ino;
+
+    return 0;
+}
+
+static int ext2_lookup(inode_t* parent, const char* name, inode_t** result)
+{
+    int errno;
+    ino_t ino;
+    ext2_inode_t* child_inode;
+    ext2_inode_t* parent_inode = parent->fs_data;
+    ext2_data_t* data = parent->sb->fs_data;
+
+    if (unlikely(parent->ino == EXT2_LOST_FOUND_INO))
+    {
+        return -ENOENT;
+    }
+
+    if (unlikely(errno = ext2_lookup_raw(data, parent_inode, parent->ino, name, &child_inode, &ino)))
+    {
+        return errno;
+    }
+
+    if (unlikely(errno = inode_alloc(result)))
+    {
+        return errno;
+    }
+
+    ext2_inode_fill(*result, child_inode, ino);
+
+    mutex_lock(&data->lock);
+    list_add(&(*result)->list, &data->inodes);
+    mutex_unlock(&data->lock);
+
+    return 0;
+}
+
+static int ext2_open(file_t*)
+{
+    return 0;
+}
+
+// Zeroes passed to callbacks for holes
+static const char ext2_zero_block[PAGE_SIZE];
+
+static int ext2_traverse_blocks(
+    ext2_data_t* data,
+    ext2_inode_t* raw_inode,
+    ino_t ino,
+    size_t offset,
+    size_t count,
+    void* cb_data,
+    block_cb_t cb)
+{
+    int errno;
+    buffer_t* b;
+    cmd_t cmd;
+    ext2_extent_t ext = {.count = 0};
+
+    size_t left, to_copy;
+    uint32_t block_nr   = offset / data->block_size;
+    size_t block_offset = offset % data->block_size;
+
+    if (offset >= raw_inode->size)
+    {
+        return 0;
+    }
+
+    for (left = min(count, raw_inode->size - offset), count = 0; left; block_offset = 0, ++block_nr)
+    {
+        if (!ext.count)
+        {
+            if (unlikely(errno = ext2_extent_get(data, raw_inode, ino, block_nr, &ext)))
+            {
+                return errno;
+            }
+
+            // Part of the extent which is going to be used is read with a
+            // single request instead of a page at a time
+            if (ext.start && ext.count > 1)
+            {
+                blocks_prefetch(
+                    data->dev,
+                    ext.start << data->block_shift,
+                    min(ext.count, (block_offset + left + data->block_size - 1) / data->block_size) << data->block_shift);
+            }
+        }
+
+        count += to_copy = min(data->block_size - block_offset, left);
+        left -= to_copy;
+
+        if (ext.start)
+        {
+            b = ext2_block_read(data, ext.start++);
+
+            if (unlikely(errno = errno_get(b)))
+            {
+                return errno;
+            }
+
+            cmd = cb(shift(b->data, block_offset), to_copy, cb_data);
+            block_put(b);
+        }
+        else
+        {
+            cmd = cb(ptr(addr(ext2_zero_block) + block_offset), to_copy, cb_data);
+        }
+
+        --ext.count;
+
+        if (cmd == TRAVERSE_STOP)
+        {
+            break;
+        }
+    }
+
+    return count;
+}
+
+// Starts reading blocks of the range of the file in background, with one
+// request per extent
+static void ext2_readahead(inode_t* inode, size_t offset, size_t size)
+{
+    ext2_extent_t ext;
+    uint32_t block, last;
+    ext2_data_t* data = inode->sb->fs_data;
+    ext2_inode_t* raw_inode = inode->fs_data;
+
+    if (!size || offset >= raw_inode->size)
+    {
+        return;
+    }
+
+    size = min(size, raw_inode->size - offset);
+    last = (offset + size - 1) / data->block_size;
+
+    for (block = offset / data->block_size; block <= last; block += ext.count)
+    {
+        if (unlikely(ext2_extent_get(data, raw_inode, inode->ino, block, &ext)))
+        {
+            return;
+        }
+
+        ext.count = min(ext.count, last - block + 1);
+
+        if (ext.start)
+        {
+            blocks_prefetch(data->dev, ext.start << data->block_shift, ext.count << data->block_shift);
+        }
+    }
+}
+
+static cmd_t ext2_read_block(void* block, size_t to_copy, void* data)
+{
+    char** buffer = data;
+    memcpy(*buffer, block, to_copy);
+    *buffer += to_copy;
+    return TRAVERSE_CONTINUE;
+}
+
+static int ext2_read(file_t* file, char* buffer, size_t count)
+{
+    int res, errno;
+    size_t ra_offset, ra_size;
+    ext2_data_t* data = file->dentry->inode->sb->fs_data;
+    ext2_inode_t* raw_inode = file->dentry->inode->fs_data;
+
+    if (file_readahead(&file->ra, file->offset, count, &ra_offset, &ra_size))
+    {
+        ext2_readahead(file->dentry->inode, ra_offset, ra_size);
+    }
+
+    res = ext2_traverse_blocks(
+        data,
+        raw_inode,
+        file->dentry->inode->ino,
+        file->offset,
+        count,
+        &buffer,
+        &ext2_read_block);
+
+    if (unlikely(errno = errno_get(res)))
+    {
+        return errno;
+    }
+
+    file->offset += res;
+
+    return res;
+}
+
+// Writes count bytes at offset, allocating missing blocks. Returns
+// number of bytes written or errno, if none was
+static int ext2_write_raw(ext2_data_t* data, inode_t* inode, size_t offset, const char* buffer, size_t count)
+{
+    int errno = 0;
+    buffer_t* b;
+    uint32_t block;
+    size_t block_offset, to_copy, done;
+    ext2_inode_t* raw_inode = inode->fs_data;
+
+    for (done = 0; done < count; done += to_copy)
+    {
+        block_offset = (offset + done) % data->block_size;
+        to_copy = min(data->block_size - block_offset, count - done);
+
+        if (unlikely(errno = ext2_bmap(data, raw_inode, inode->ino, (offset + done) / data->block_size, true, &block)))
+        {
+            break;
+        }
+
+        b = ext2_block_read(data, block);
+
+        if (unlikely(errno = errno_get(b)))
+        {
+            break;
+        }
+
+        memcpy(shift(b->data, block_offset), buffer + done, to_copy);
+        ext2_block_dirty(data, b);
+        block_put(b);
+    }
+
+    if (!done)
+    {
+        return errno;
+    }
+
+    if (offset + done > raw_inode->size)
+    {
+        inode->size = raw_inode->size = offset + done;
+    }
+
+    inode->mtime = inode->ctime = raw_inode->mtime = raw_inode->ctime = time_now();
+    ext2_inode_dirty(data, inode->ino);
+    file_pages_invalidate(data->dev, inode->ino, offset, done);
+
+    return done;
+}
+
+static int ext2_write(file_t* file, const char* buffer, size_t count)
+{
+    int res;
+    inode_t* inode = file->dentry->inode;
+    ext2_data_t* data = inode->sb->fs_data;
+    ext2_inode_t* raw_inode = inode->fs_data;
+
+    if (unlikely(!S_ISREG(raw_inode->mode)))
+    {
+        return -EINVAL;
+    }
+
+    scoped_mutex_lock(&data->lock);
+
+    if (file->mode & O_APPEND)
+    {
+        file->offset = raw_inode->size;
+    }
+
+    // Size field is 32-bit, so the end can't be past the limit; blocks
+    // between the old end and offset are left as holes
+    if (unlikely(file->offset > inode->sb->max_file_size || count > inode->sb->max_file_size - file->offset))
+    {
+        return -EFBIG;
+    }
+
+    res = ext2_write_raw(data, inode, file->offset, buffer, count);
+
+    if (likely(res > 0))
+    {
+        file->offset += res;
+    }
+
+    return res;
+}
+
+static int ext2_truncate(inode_t* inode, size_t size)
+{
+    int errno;
+    buffer_t* b;
+    uint32_t block;
+    size_t old_size;
+    ext2_data_t* data = inode->sb->fs_data;
+    ext2_inode_t* raw_inode = inode->fs_data;
+
+    if (unlikely(!S_ISREG(raw_inode->mode)))
+    {
+        return -EINVAL;
+    }
+
+    scoped_mutex_lock(&data->lock);
+
+    old_size = raw_inode->size;
+
+    if (size == old_size)
+    {
+        return 0;
+    }
+
+    // Blocks past the old end are holes, which read as zeroes
+    if (size > old_size)
+    {
+        goto set_size;
+    }
+
+    // Tail of the last block is zeroed, as the file may grow again
+    if (size % data->block_size)
+    {
+        if (unlikely(errno = ext2_bmap(data, raw_inode, inode->ino, size / data->block_size, false, &block)))
+        {
+            return errno;
+        }
+
+        if (block)
+        {
+            b = ext2_block_read(data, block);
+
+            if (unlikely(errno = errno_get(b)))
+            {
+                return errno;
+            }
+
+            memset(shift(b->data, size % data->block_size), 0, data->block_size - size % data->block_size);
+            ext2_block_dirty(data, b);
+            block_put(b);
+        }
+    }
+
+    ext2_blocks_free(data, raw_inode, inode->ino, align(size, data->block_size) / data->block_size);
+    file_pages_invalidate(data->dev, inode->ino, size, old_size - size);
+
+set_size:
+    inode->size = raw_inode->size = size;
+    inode->mtime = inode->ctime = raw_inode->mtime = raw_inode->ctime = time_now();
+    ext2_inode_dirty(data, inode->ino);
+
+    return 0;
+}
+
+static inline uint8_t ext2_file_type_get(mode_t mode)
+{
+    switch (mode & S_IFMT)
+    {
+        case S_IFREG:  return EXT2_FT_REG_FILE;
+        case S_IFDIR:  return EXT2_FT_DIR;
+        case S_IFCHR:  return EXT2_FT_CHRDEV;
+        case S_IFBLK:  return EXT2_FT_BLKDEV;
+        case S_IFIFO:  return EXT2_FT_FIFO;
+        case S_IFSOCK: return EXT2_FT_SOCK;
+        case S_IFLNK:  return EXT2_FT_SYMLINK;
+        default:       return EXT2_FT_UNKNOWN;
+    }
+}
+
+typedef struct dir_slot dir_slot_t;
+
+struct dir_slot
+{
+    buffer_t*         b;      // Referenced block containing the entry
+    ext2_dir_entry_t* dirent;
+    ext2_dir_entry_t* prev;   // Previous entry in the block; NULL if dirent is the first one
+};
+
+// Iterates over directory blocks until cb returns TRAVERSE_STOP; returns 1
+// in such case and 0 if all blocks were visited
+static int ext2_dir_iterate(
+    ext2_data_t* data,
+    ext2_inode_t* raw_dir,
+    cmd_t (*cb)(buffer_t* b, size_t size, void* cb_data),
+    void* cb_data)
+{
+    int errno;
+    cmd_t cmd;
+    buffer_t* b;
+    uint32_t block;
+
+    for (uint32_t i = 0; i < raw_dir->size / data->block_size; ++i)
+    {
+        if (unlikely(errno = ext2_bmap(data, raw_dir, 0, i, false, &block)))
+        {
+            return errno;
+        }
+
+        if (unlikely(!block))
+        {
+            continue;
+        }
+
+        b = ext2_block_read(data, block);
+
+        if (unlikely(errno = errno_get(b)))
+        {
+            return errno;
+        }
+
+        cmd = cb(b, data->block_size, cb_data);
+        block_put(b);
+
+        if (cmd == TRAVERSE_STOP)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+#define dirent_for_each(dirent, block, size) \
+    for (dirent = (block); \
+        addr(dirent) < addr(block) + (size) && dirent->rec_len; \
+        dirent = ptr(addr(dirent) + dirent->rec_len))
+
+typedef struct dir_find_context dir_find_context_t;
+
+struct dir_find_context
+{
+    const char* name;
+    size_t      name_len;
+    dir_slot_t* slot;
+};
+
+static cmd_t ext2_dir_find_block(buffer_t* b, size_t size, void* cb_data)
+{
+    ext2_dir_entry_t* prev = NULL;
+    ext2_dir_entry_t* dirent;
+    dir_find_context_t* ctx = cb_data;
+
+    dirent_for_each(dirent, b->data, size)
+    {
+        if (dirent->inode
+            && dirent->name_len == ctx->name_len
+            && !strncmp(dirent->name, ctx->name, ctx->name_len))
+        {
+            block_get(b);
+            ctx->slot->b = b;
+            ctx->slot->dirent = dirent;
+            ctx->slot->prev = prev;
+            return TRAVERSE_STOP;
+        }
+
+        prev = dirent;
+    }
+
+    return TRAVERSE_CONTINUE;
+}
+
+// On success slot holds referenced block, which has to be released
+static int ext2_dir_find(ext2_data_t* data, ext2_inode_t* raw_dir, const char* name, dir_slot_t* slot)
+{
+    int res, errno;
+    dir_find_context_t ctx = {.name = name, .name_len = strlen(name), .slot = slot};
+
+    res = ext2_dir_iterate(data, raw_dir, &ext2_dir_find_block, &ctx);
+
+    if (unlikely(errno = errno_get(res)))
+    {
+        return errno;
+    }
+
+    return res ? 0 : -ENOENT;
+}
+
+static cmd_t ext2_dir_empty_block(buffer_t* b, size_t size, void*)
+{
+    ext2_dir_entry_t* dirent;
+
+    dirent_for_each(dirent, b->data, size)
+    {
+        if (!dirent->inode)
+        {
+            continue;
+        }
+
+        if (dirent->name_len > 2
+            || dirent->name[0] != '.'
+            || (dirent->name_len == 2 && dirent->name[1] != '.'))
+        {
+            return TRAVERSE_STOP;
+        }
+    }
+
+    return TRAVERSE_CONTINUE;
+}
+
+static int ext2_dir_empty(ext2_data_t* data, ext2_inode_t* raw_dir)
+{
+    int res = ext2_dir_iterate(data, raw_dir, &ext2_dir_empty_block, NULL);
+
+    if (res > 0)
+    {
+        return -ENOTEMPTY;
+    }
+
+    return res;
+}
+
+static void ext2_dirent_set(ext2_data_t* data, ext2_dir_entry_t* dirent, const char* name, size_t len, ino_t ino, mode_t mode)
+{
+    dirent->inode = ino;
+    dirent->name_len = len;
+    dirent->file_type = data->filetype ? ext2_file_type_get(mode) : EXT2_FT_UNKNOWN;
+    memcpy(dirent->name, name, len);
+}
+
+// Directory is modified linearly, so the hash index would be stale
+static void ext2_dir_modified(ext2_data_t* data, inode_t* dir)
+{
+    ext2_inode_t* raw_dir = dir->fs_data;
+
+    raw_dir->flags &= ~EXT2_INDEX_FL;
+    dir->size = raw_dir->size;
+    dir->nlink = raw_dir->links_count;
+    dir->mtime = dir->ctime = raw_dir->mtime = raw_dir->ctime = time_now();
+    ext2_inode_dirty(data, dir->ino);
+}
+
+typedef struct dir_add_context dir_add_context_t;
+
+struct dir_add_context
+{
+    ext2_data_t* data;
+    const char*  name;
+    size_t       name_len;
+    ino_t        ino;
+    mode_t       mode;
+};
+
+static cmd_t ext2_dir_add_block(buffer_t* b, size_t size, void* cb_data)
+{
+    size_t used;
+    ext2_dir_entry_t* dirent;
+    ext2_dir_entry_t* new;
+    dir_add_context_t* ctx = cb_data;
+    size_t needed = EXT2_DIR_REC_LEN(ctx->name_len);
+
+    dirent_for_each(dirent, b->data, size)
+    {
+        used = dirent->inode ? EXT2_DIR_REC_LEN(dirent->name_len) : 0;
+
+        if (dirent->rec_len < used + needed)
+        {
+            continue;
         }
 
-        ctx->ino = dirent->inode;
+        new = dirent;
 
-        log_debug(DEBUG_EXT2FS, "found inode; ino=%u, size=%u, name=%S",
-            dirent->inode,
-            ctx->res->size,
-            dirent->name);
+        if (used)
+        {
+            new = ptr(addr(dirent) + used);
+            new->rec_len = dirent->rec_len - used;
+            dirent->rec_len = used;
+        }
+
+        ext2_dirent_set(ctx->data, new, ctx->name, ctx->name_len, ctx->ino, ctx->mode);
+        ext2_block_dirty(ctx->data, b);
 
         return TRAVERSE_STOP;
     }
@@ -173,403 +1496,473 @@ static cmd_t ext2_lookup_block(void* block, size_t to_copy, void* data)
     return TRAVERSE_CONTINUE;
 }
 
-static int ext2_lookup_raw(
-    ext2_data_t* data,
-    ext2_inode_t* parent_inode,
-    const char* name,
-    ext2_inode_t** child_inode,
-    ino_t* ino)
+static int ext2_dir_add(ext2_data_t* data, inode_t* dir, const char* name, ino_t ino, mode_t mode)
 {
     int res, errno;
-    lookup_context_t ctx = {.data = data, .name = name, .name_len = strlen(name), .ino = 0, .res = NULL};
+    buffer_t* b;
+    uint32_t block;
+    ext2_dir_entry_t* dirent;
+    ext2_inode_t* raw_dir = dir->fs_data;
+    dir_add_context_t ctx = {.data = data, .name = name, .name_len = strlen(name), .ino = ino, .mode = mode};
 
-    log_debug(DEBUG_EXT2FS, "name=%s", name);
+    if (unlikely(ctx.name_len > EXT2_NAME_LEN))
+    {
+        return -ENAMETOOLONG;
+    }
 
-    res = ext2_traverse_blocks(data, parent_inode, 0, parent_inode->size, &ctx, &ext2_lookup_block);
+    res = ext2_dir_iterate(data, raw_dir, &ext2_dir_add_block, &ctx);
 
     if (unlikely(errno = errno_get(res)))
     {
         return errno;
     }
 
-    if (unlikely(!ctx.res))
+    if (!res)
     {
-        log_debug(DEBUG_EXT2FS, "no inode with name = %s", name);
-        return -ENOENT;
+        // No space left in existing blocks; append a new one
+        if (unlikely(errno = ext2_bmap(data, raw_dir, dir->ino, raw_dir->size / data->block_size, true, &block)))
+        {
+            return errno;
+        }
+
+        b = ext2_block_read(data, block);
+
+        if (unlikely(errno = errno_get(b)))
+        {
+            return errno;
+        }
+
+        dirent = b->data;
+        dirent->rec_len = data->block_size;
+        ext2_dirent_set(data, dirent, name, ctx.name_len, ino, mode);
+        ext2_block_dirty(data, b);
+        block_put(b);
+
+        raw_dir->size += data->block_size;
     }
 
-    *child_inode = ctx.res;
-    *ino = ctx.ino;
+    ext2_dir_modified(data, dir);
 
     return 0;
 }
 
-static int ext2_lookup(inode_t* parent, const char* name, inode_t** result)
+// Releases the slot
+static void ext2_dir_remove(ext2_data_t* data, inode_t* dir, dir_slot_t* slot)
+{
+    if (slot->prev)
+    {
+        slot->prev->rec_len += slot->dirent->rec_len;
+    }
+    else
+    {
+        slot->dirent->inode = 0;
+    }
+
+    ext2_block_dirty(data, slot->b);
+    block_put(slot->b);
+
+    ext2_dir_modified(data, dir);
+}
+
+static int ext2_inode_create(ext2_data_t* data, inode_t* parent, mode_t mode, inode_t** result)
 {
     int errno;
+    buffer_t* b;
+    uint32_t index;
     ino_t ino;
-    ext2_inode_t* child_inode;
-    ext2_inode_t* parent_inode = parent->fs_data;
-    ext2_data_t* data = parent->sb->fs_data;
+    time_t now = time_now();
+    ext2_inode_t* raw_inode;
 
-    if (unlikely(parent->ino == EXT2_LOST_FOUND_INO))
+    // Inode is placed in the parent's group, so that its blocks end up
+    // close to the other files of the directory
+    if (unlikely(errno = ext2_bit_alloc(data, EXT2_INODE_BITMAP, ext2_inode_group(data, parent->ino), 0, &index)))
     {
-        return -ENOENT;
+        return errno;
     }
 
-    if (unlikely(errno = ext2_lookup_raw(data, parent_inode, name, &child_inode, &ino)))
+    ino = index + 1;
+
+    if (unlikely(!(raw_inode = ext2_inode_read(data, ino, &b))))
     {
-        return errno;
+        ext2_bit_free(data, EXT2_INODE_BITMAP, index);
+        return -EIO;
+    }
+
+    memset(raw_inode, 0, data->inode_size);
+    raw_inode->mode = mode;
+    raw_inode->uid = process_current->uid;
+    raw_inode->gid = process_current->gid;
+    raw_inode->atime = raw_inode->ctime = raw_inode->mtime = now;
+    raw_inode->links_count = S_ISDIR(mode) ? 2 : 1;
+
+    ext2_block_dirty(data, b);
+
+    if (S_ISDIR(mode))
+    {
+        ext2_group_dirs_add(data, ino, 1);
     }
 
     if (unlikely(errno = inode_alloc(result)))
     {
+        block_put(b);
         return errno;
     }
 
-    (*result)->ino = ino;
-    (*result)->ops = &ext2_inode_ops;
-    (*result)->size = child_inode->size;
-    (*result)->file_ops = &ext2_fops;
-    (*result)->fs_data = child_inode;
-    (*result)->mode = child_inode->mode;
-    (*result)->uid = child_inode->uid;
-    (*result)->gid = child_inode->gid;
-    (*result)->ctime = child_inode->ctime;
-    (*result)->mtime = child_inode->mtime;
-    (*result)->nlink = child_inode->links_count;
+    // Block stays referenced as for any other inode
+    ext2_inode_fill(*result, raw_inode, ino);
+    list_add(&(*result)->list, &data->inodes);
 
     return 0;
 }
 
-static int ext2_open(file_t*)
-{
-    return 0;
-}
-
-static int level_escalate(ext2_data_t* data, level_t** level)
+static void ext2_inode_delete(ext2_data_t* data, ext2_inode_t* raw_inode, ino_t ino)
 {
-    buffer_t* b;
-    level_t* cur = *level;
+    size_t size = raw_inode->size;
 
-    b = block_read(data->dev, data->file, *cur->cur_ptr);
+    if (!ext2_inode_is_fast_symlink(data, raw_inode))
+    {
+        ext2_blocks_free(data, raw_inode, ino, 0);
+    }
 
-    if (unlikely(errno_get(b)))
+    if (S_ISDIR(raw_inode->mode))
     {
-        return errno_get(b);
+        ext2_group_dirs_add(data, ino, -1);
     }
 
-    ++cur;
-    cur->cur = 0;
-    cur->cur_ptr = b->data;
-    *level = cur;
+    raw_inode->size = 0;
+    raw_inode->links_count = 0;
+    raw_inode->dtime = time_now();
+    ext2_inode_dirty(data, ino);
 
-    return 0;
+    ext2_bit_free(data, EXT2_INODE_BITMAP, ino - 1);
+    file_pages_invalidate(data->dev, ino, 0, size);
 }
 
-static int prev_level_forward(ext2_data_t* data, level_t* cur_lvl)
+static int ext2_create(inode_t* parent, const char* name, int, int mode, inode_t** result)
 {
-    buffer_t* b;
-    level_t* prev_lvl = cur_lvl - 1;
+    int errno;
+    dir_slot_t slot;
+    ext2_data_t* data = parent->sb->fs_data;
 
-    ++prev_lvl->cur;
-    ++prev_lvl->cur_ptr;
+    scoped_mutex_lock(&data->lock);
 
-    b = block_read(data->dev, data->file, *prev_lvl->cur_ptr);
+    if (!ext2_dir_find(data, parent->fs_data, name, &slot))
+    {
+        block_put(slot.b);
+        return -EEXIST;
+    }
 
-    if (unlikely(errno_get(b)))
+    if (unlikely(errno = ext2_inode_create(data, parent, S_IFREG | (mode & ~S_IFMT), result)))
     {
-        return errno_get(b);
+        return errno;
     }
 
-    cur_lvl->cur = 0;
-    cur_lvl->cur_ptr = b->data;
+    if (unlikely(errno = ext2_dir_add(data, parent, name, (*result)->ino, (*result)->mode)))
+    {
+        ext2_inode_delete(data, (*result)->fs_data, (*result)->ino);
+        ext2_inode_unpin(data, (*result)->ino);
+        inode_put(*result);
+        return errno;
+    }
 
     return 0;
 }
 
-static int ext2_next_block(ext2_data_t* data, level_t** cur_lvl, buffer_t** cur_block)
+static int ext2_mkdir(inode_t* parent, const char* name, int mode, int, inode_t** result)
 {
     int errno;
     buffer_t* b;
-    level_t* cur = *cur_lvl;
+    uint32_t block;
+    dir_slot_t slot;
+    inode_t* inode;
+    ext2_dir_entry_t* dirent;
+    ext2_inode_t* raw_inode;
+    ext2_inode_t* raw_parent = parent->fs_data;
+    ext2_data_t* data = parent->sb->fs_data;
 
-    ++cur->cur;
-    ++cur->cur_ptr;
+    scoped_mutex_lock(&data->lock);
 
-    switch (cur->lvl)
+    if (!ext2_dir_find(data, raw_parent, name, &slot))
     {
-        case LVL_DIRECT:
-            if (cur->cur == 12)
-            {
-                if ((errno = level_escalate(data, &cur)))
-                {
-                    return errno;
-                }
-            }
-            break;
-        case LVL_SINGLY_INDIRECT:
-            if (cur->cur == 256)
-            {
-                if ((errno = prev_level_forward(data, cur)) ||
-                    (errno = level_escalate(data, &cur)))
-                {
-                    return errno;
-                }
-            }
-            break;
-        case LVL_DOUBLY_INDIRECT:
-            if (cur->cur == 256)
-            {
-                if ((cur - 1)->cur == 255)
-                {
-                    log_info("triply-indirect addressing not yet supported");
-                    return -EFBIG;
-                }
-
-                if ((errno = prev_level_forward(data, cur)))
-                {
-                    return errno;
-                }
-            }
+        block_put(slot.b);
+        return -EEXIST;
     }
 
-    *cur_lvl = cur;
+    if (unlikely(errno = ext2_inode_create(data, parent, S_IFDIR | (mode & ~S_IFMT), &inode)))
+    {
+        return errno;
+    }
 
-    b = block_read(data->dev, data->file, *cur->cur_ptr);
+    raw_inode = inode->fs_data;
 
-    if (unlikely((errno = errno_get(b))))
+    if (unlikely(errno = ext2_bmap(data, raw_inode, inode->ino, 0, true, &block)))
     {
-        return errno;
+        goto delete_inode;
     }
 
-    *cur_block = b;
+    b = ext2_block_read(data, block);
 
-    return 0;
-}
+    if (unlikely(errno = errno_get(b)))
+    {
+        goto delete_inode;
+    }
 
-#define NDIR_BLOCKS     (12)
-#define IND_BLOCKS      (EXT2_BLOCK_SIZE / sizeof(uint32_t))
-#define DIND_BLOCKS     (IND_BLOCKS * IND_BLOCKS)
+    dirent = b->data;
+    dirent->rec_len = EXT2_DIR_REC_LEN(1);
+    ext2_dirent_set(data, dirent, ".", 1, inode->ino, S_IFDIR);
 
-static int ext2_traverse_blocks_init(
-    ext2_data_t* data,
-    ext2_inode_t* raw_inode,
-    uint32_t blocknr,
-    level_t* levels,
-    level_t** cur,
-    buffer_t** cur_block)
-{
-    buffer_t* b;
+    dirent = ptr(addr(dirent) + dirent->rec_len);
+    dirent->rec_len = data->block_size - EXT2_DIR_REC_LEN(1);
+    ext2_dirent_set(data, dirent, "..", 2, parent->ino, S_IFDIR);
 
-    levels[0].lvl = 0;
-    levels[1].lvl = 1;
-    levels[2].lvl = 2;
-    levels[3].lvl = 3;
+    ext2_block_dirty(data, b);
+    block_put(b);
 
-    if (blocknr >= NDIR_BLOCKS + IND_BLOCKS + DIND_BLOCKS)
+    inode->size = raw_inode->size = data->block_size;
+    ext2_inode_dirty(data, inode->ino);
+
+    if (unlikely(errno = ext2_dir_add(data, parent, name, inode->ino, inode->mode)))
     {
-        log_info("failed to setup; triply-indirect addressing not yet supported");
-        return -EFBIG;
+        goto delete_inode;
     }
-    else if (blocknr >= NDIR_BLOCKS + IND_BLOCKS) // doubly-indirect addressing
-    {
-        *cur = levels + 2;
-        blocknr -= NDIR_BLOCKS + IND_BLOCKS;
 
-        b = block_read(data->dev, data->file, raw_inode->block[EXT2_DIND_BLOCK]);
+    ++raw_parent->links_count;
+    ext2_dir_modified(data, parent);
 
-        if (unlikely(errno_get(b)))
-        {
-            return errno_get(b);
-        }
+    *result = inode;
 
-        levels[LVL_DIRECT].cur = EXT2_DIND_BLOCK;
-        levels[LVL_DIRECT].cur_ptr = raw_inode->block + EXT2_DIND_BLOCK;
+    return 0;
 
-        levels[LVL_SINGLY_INDIRECT].cur = blocknr / IND_BLOCKS;
-        levels[LVL_SINGLY_INDIRECT].cur_ptr = (uint32_t*)b->data + blocknr / IND_BLOCKS;
+delete_inode:
+    ext2_inode_delete(data, raw_inode, inode->ino);
+    ext2_inode_unpin(data, inode->ino);
+    inode_put(inode);
+    return errno;
+}
 
-        b = block_read(data->dev, data->file, *levels[1].cur_ptr);
+// Removes entry of the inode from the directory and drops its link; inode
+// is freed with the last link, or with the last inode which still refers
+// to it, so that files which have it opened can still use it
+static int ext2_remove(ext2_data_t* data, inode_t* parent, dir_slot_t* slot, bool dir)
+{
+    int errno;
+    buffer_t* b;
+    ino_t ino = slot->dirent->inode;
+    ext2_inode_t* raw_inode;
+    ext2_inode_t* raw_parent = parent->fs_data;
 
-        if (unlikely(errno_get(b)))
-        {
-            return errno_get(b);
-        }
+    if (unlikely(!(raw_inode = ext2_inode_read(data, ino, &b))))
+    {
+        block_put(slot->b);
+        return -EIO;
+    }
 
-        levels[LVL_DOUBLY_INDIRECT].cur = blocknr % IND_BLOCKS;
-        levels[LVL_DOUBLY_INDIRECT].cur_ptr = (uint32_t*)b->data + blocknr % IND_BLOCKS;
+    if (!dir && unlikely(S_ISDIR(raw_inode->mode)))
+    {
+        errno = -EISDIR;
+        goto error;
     }
-    else if (blocknr >= NDIR_BLOCKS) // indirect addressing
+    else if (dir && unlikely(!S_ISDIR(raw_inode->mode)))
     {
-        *cur = levels + 1;
-        blocknr -= NDIR_BLOCKS;
-
-        b = block_read(data->dev, data->file, raw_inode->block[EXT2_NDIR_BLOCKS]);
+        errno = -ENOTDIR;
+        goto error;
+    }
 
-        if (unlikely(errno_get(b)))
-        {
-            return errno_get(b);
-        }
+    if (dir && unlikely(errno = ext2_dir_empty(data, raw_inode)))
+    {
+        goto error;
+    }
 
-        levels[LVL_DIRECT].cur = EXT2_NDIR_BLOCKS;
-        levels[LVL_DIRECT].cur_ptr = raw_inode->block + EXT2_NDIR_BLOCKS;
+    ext2_dir_remove(data, parent, slot);
 
-        levels[LVL_SINGLY_INDIRECT].cur = blocknr;
-        levels[LVL_SINGLY_INDIRECT].cur_ptr = (uint32_t*)b->data + blocknr;
+    if (dir)
+    {
+        // Entry in the parent and "."; ".." of the directory is a link of the parent
+        raw_inode->links_count = 0;
+        --raw_parent->links_count;
+        ext2_dir_modified(data, parent);
     }
-    else // direct addressing
+    else
     {
-        *cur = levels;
-        levels[LVL_DIRECT].cur = blocknr;
-        levels[LVL_DIRECT].cur_ptr = raw_inode->block + blocknr;
+        --raw_inode->links_count;
     }
 
-    b = block_read(data->dev, data->file, *(*cur)->cur_ptr);
+    raw_inode->ctime = time_now();
 
-    if (unlikely(errno_get(b)))
+    if (!raw_inode->links_count && !ext2_inode_in_use(data, ino))
+    {
+        ext2_inode_delete(data, raw_inode, ino);
+    }
+    else
     {
-        return errno_get(b);
+        ext2_block_dirty(data, b);
     }
 
-    *cur_block = b;
+    block_put(b);
 
     return 0;
+
+error:
+    block_put(slot->b);
+    block_put(b);
+    return errno;
 }
 
-static int ext2_traverse_blocks(
-    ext2_data_t* data,
-    ext2_inode_t* raw_inode,
-    size_t offset,
-    size_t count,
-    void* cb_data,
-    block_cb_t cb)
+static int ext2_unlink(inode_t* parent, const char* name)
 {
     int errno;
-    buffer_t* cur_block = NULL;
-    level_t levels[4];
-    level_t* cur_lvl;
+    dir_slot_t slot;
+    ext2_data_t* data = parent->sb->fs_data;
 
-    size_t left, to_copy;
-    size_t block_nr     = offset / EXT2_BLOCK_SIZE;
-    size_t block_offset = offset % EXT2_BLOCK_SIZE;
+    scoped_mutex_lock(&data->lock);
 
-    if (unlikely(errno = ext2_traverse_blocks_init(data, raw_inode, block_nr, levels, &cur_lvl, &cur_block)))
+    if (unlikely(errno = ext2_dir_find(data, parent->fs_data, name, &slot)))
     {
         return errno;
     }
 
-    if (unlikely(!cur_block))
+    return ext2_remove(data, parent, &slot, false);
+}
+
+static int ext2_rmdir(inode_t* parent, const char* name)
+{
+    int errno;
+    dir_slot_t slot;
+    ext2_data_t* data = parent->sb->fs_data;
+
+    if (unlikely(!strcmp(name, ".") || !strcmp(name, "..")))
     {
-        log_error("ext2_traverse_blocks_init returned NULL cur_block");
         return -EINVAL;
     }
 
-    for (left = min(count, raw_inode->size - offset), count = 0;
-        left;
-        left -= to_copy, block_offset = 0, errno = ext2_next_block(data, &cur_lvl, &cur_block))
+    scoped_mutex_lock(&data->lock);
+
+    if (unlikely(errno = ext2_dir_find(data, parent->fs_data, name, &slot)))
+    {
+        return errno;
+    }
+
+    return ext2_remove(data, parent, &slot, true);
+}
+
+static int ext2_rename(inode_t* old_parent, const char* old_name, inode_t* new_parent, const char* new_name)
+{
+    int errno;
+    ino_t ino;
+    buffer_t* b;
+    dir_slot_t slot;
+    ext2_inode_t* raw_inode;
+    ext2_data_t* data = old_parent->sb->fs_data;
+
+    scoped_mutex_lock(&data->lock);
+
+    if (unlikely(errno = ext2_dir_find(data, old_parent->fs_data, old_name, &slot)))
+    {
+        return errno;
+    }
+
+    ino = slot.dirent->inode;
+    block_put(slot.b);
+
+    if (unlikely(!(raw_inode = ext2_inode_read(data, ino, &b))))
+    {
+        return -EIO;
+    }
+
+    // Existing target is replaced
+    if (!ext2_dir_find(data, new_parent->fs_data, new_name, &slot))
     {
-        if (unlikely(errno))
+        if (slot.dirent->inode == ino)
         {
-            return errno;
+            block_put(slot.b);
+            block_put(b);
+            return 0;
         }
 
-        count += to_copy = min(EXT2_BLOCK_SIZE - block_offset, left);
-
-        if (cb(shift(cur_block->data, block_offset), to_copy, cb_data) == TRAVERSE_STOP)
+        if (unlikely(errno = ext2_remove(data, new_parent, &slot, S_ISDIR(raw_inode->mode))))
         {
-            break;
+            block_put(b);
+            return errno;
         }
     }
 
-    return count;
-}
-
-static cmd_t ext2_read_block(void* block, size_t to_copy, void* data)
-{
-    char** buffer = data;
-    memcpy(*buffer, block, to_copy);
-    *buffer += to_copy;
-    return TRAVERSE_CONTINUE;
-}
+    if (unlikely(errno = ext2_dir_add(data, new_parent, new_name, ino, raw_inode->mode)))
+    {
+        block_put(b);
+        return errno;
+    }
 
-static int ext2_read(file_t* file, char* buffer, size_t count)
-{
-    int res, errno;
-    ext2_data_t* data = file->dentry->inode->sb->fs_data;
-    ext2_inode_t* raw_inode = file->dentry->inode->fs_data;
+    // Adding could have moved entries of the same directory
+    if (unlikely(errno = ext2_dir_find(data, old_parent->fs_data, old_name, &slot)))
+    {
+        block_put(b);
+        return errno;
+    }
 
-    res = ext2_traverse_blocks(
-        data,
-        raw_inode,
-        file->offset,
-        count,
-        &buffer,
-        &ext2_read_block);
+    ext2_dir_remove(data, old_parent, &slot);
 
-    if (unlikely(errno = errno_get(res)))
+    if (S_ISDIR(raw_inode->mode) && old_parent != new_parent)
     {
-        return errno;
+        if (likely(!ext2_dir_find(data, raw_inode, "..", &slot)))
+        {
+            slot.dirent->inode = new_parent->ino;
+            ext2_block_dirty(data, slot.b);
+            block_put(slot.b);
+        }
+
+        --((ext2_inode_t*)old_parent->fs_data)->links_count;
+        ++((ext2_inode_t*)new_parent->fs_data)->links_count;
+        ext2_dir_modified(data, old_parent);
+        ext2_dir_modified(data, new_parent);
     }
 
-    file->offset += res;
+    raw_inode->ctime = time_now();
+    ext2_block_dirty(data, b);
+    block_put(b);
 
-    return res;
+    return 0;
 }
 
 typedef struct readpage_context readpage_context_t;
 
 struct readpage_context
 {
-    size_t offset; // Offset within current page
-    page_t* current_page;
+    size_t offset; // Offset within the page
+    void* page_ptr;
 };
 
-static cmd_t ext2_nopage_block(void* block, size_t to_copy, void* data)
+static cmd_t ext2_readpage_block(void* block, size_t to_copy, void* data)
 {
     readpage_context_t* ctx = data;
-    page_t* current_page = ctx->current_page;
 
-    memcpy(shift(page_virt_ptr(current_page), ctx->offset), block, to_copy);
-
-    if ((ctx->offset += to_copy) == PAGE_SIZE)
-    {
-        ctx->current_page = list_next_entry(&current_page->list_entry, page_t, list_entry);
-        ctx->offset = 0;
-    }
+    memcpy(shift(ctx->page_ptr, ctx->offset), block, to_copy);
+    ctx->offset += to_copy;
 
     return TRAVERSE_CONTINUE;
 }
 
-static int ext2_nopage(vm_area_t* vma, uintptr_t address, size_t size, page_t** page)
+static int ext2_readpage(inode_t* inode, page_t* page, size_t index)
 {
-    int res, errno;
-    ext2_inode_t* inode = vma->dentry->inode->fs_data;
-    ext2_data_t* data = vma->dentry->inode->sb->fs_data;
-
-    *page = page_alloc(1, 0);
-
-    if (unlikely(!*page))
-    {
-        return -ENOMEM;
-    }
+    ext2_inode_t* raw_inode = inode->fs_data;
+    ext2_data_t* data = inode->sb->fs_data;
+    size_t offset = index * PAGE_SIZE;
 
     readpage_context_t ctx = {
-        .current_page = *page,
+        .page_ptr = page_virt_ptr(page),
         .offset = 0,
     };
 
-    off_t vma_off = address - vma->start;
-
-    res = ext2_traverse_blocks(data, inode, vma->offset + vma_off, size, &ctx, &ext2_nopage_block);
-
-    if (unlikely(errno = errno_get(res)))
+    if (offset >= raw_inode->size)
     {
-        pages_free(*page);
-        return errno;
+        return 0;
     }
 
-    return res;
+    return ext2_traverse_blocks(data, raw_inode, inode->ino, offset, PAGE_SIZE, &ctx, &ext2_readpage_block);
+}
+
+static int ext2_nopage(vm_area_t* vma, uintptr_t address, size_t size, page_t** page)
+{
+    return file_page_nopage(vma, address, size, page, &ext2_readpage, &ext2_readahead);
 }
 
 static int ext2_mmap(file_t*, vm_area_t* vma)
@@ -621,6 +2014,11 @@ static cmd_t ext2_readdir_block(void* block, size_t to_copy, void* data)
             return TRAVERSE_CONTINUE;
         }
 
+        if (!dirent->inode)
+        {
+            continue;
+        }
+
         log_debug(DEBUG_EXT2FS, "dirent: inode=%u, type=%#x, name=%S, rec_len=%u, len=%u",
             dirent->inode,
             dirent->file_type,
@@ -671,7 +2069,7 @@ static int ext2_readdir(file_t* file, void* buf, direntadd_t dirent_add)
         return 0;
     }
 
-    res = ext2_traverse_blocks(data, raw_inode, file->offset, raw_inode->size, &ctx, &ext2_readdir_block);
+    res = ext2_traverse_blocks(data, raw_inode, file->dentry->inode->ino, file->offset, raw_inode->size, &ctx, &ext2_readdir_block);
 
     if (unlikely(errno = errno_get(res)))
     {
@@ -706,6 +2104,24 @@ static int ext2_readlink(inode_t* inode, char* buffer, size_t size)
     return -ENAMETOOLONG;
 }
 
+static void ext2_inode_release(inode_t* inode)
+{
+    ext2_data_t* data = inode->sb->fs_data;
+    ext2_inode_t* raw_inode = inode->fs_data;
+
+    scoped_mutex_lock(&data->lock);
+
+    list_del(&inode->list);
+
+    // Inode unlinked while in use is freed once nothing refers to it
+    if (!raw_inode->links_count && !ext2_inode_in_use(data, inode->ino))
+    {
+        ext2_inode_delete(data, raw_inode, inode->ino);
+    }
+
+    ext2_inode_unpin(data, inode->ino);
+}
+
 static int ext2_mount(super_block_t* sb, inode_t* inode, void*, int)
 {
     int errno;
@@ -732,26 +2148,64 @@ static int ext2_mount(super_block_t* sb, inode_t* inode, void*, int)
     if (raw_sb->magic != EXT2_SIGNATURE)
     {
         log_info("invalid signature: %#x", raw_sb->magic);
+        block_put(b);
         return -ENODEV;
     }
 
     sb->ops = &ext2_sb_ops;
+
+    sb->flags = SB_DCACHE;
     sb->module = this_module;
     sb->block_size = EXT2_SUPERBLOCK_OFFSET << raw_sb->log_block_size;
 
-    if (sb->block_size != EXT2_BLOCK_SIZE)
+    // Block has to fit in a page of the buffer cache
+    if (sb->block_size > PAGE_SIZE)
     {
         log_info("unsupported block size: %u", sb->block_size);
+        block_put(b);
+        return -EINVAL;
+    }
+
+    if (raw_sb->rev_level != EXT2_GOOD_OLD_REV && (raw_sb->feature_incompat & ~EXT2_FEATURE_INCOMPAT_SUPP))
+    {
+        log_info("unsupported features: %#x", raw_sb->feature_incompat & ~EXT2_FEATURE_INCOMPAT_SUPP);
+        block_put(b);
+        return -EINVAL;
+    }
+
+    // File systems are always mounted read-write, so those have to be known as well
+    if (raw_sb->rev_level != EXT2_GOOD_OLD_REV && (raw_sb->feature_ro_compat & ~EXT2_FEATURE_RO_COMPAT_SUPP))
+    {
+        log_info("unsupported read-only compatible features: %#x", raw_sb->feature_ro_compat & ~EXT2_FEATURE_RO_COMPAT_SUPP);
+        block_put(b);
         return -EINVAL;
     }
 
+    data->block_size = sb->block_size;
+    data->block_shift = raw_sb->log_block_size;
     data->addr_per_block = sb->block_size / sizeof(uint32_t);
     data->last_ind_block = EXT2_IND_BLOCK + data->addr_per_block - 1;
     data->first_dind_block = data->last_ind_block + 1;
     data->last_dind_block = data->first_dind_block + data->addr_per_block * data->addr_per_block - 1;
-    data->sb = raw_sb;
+
+    // Files are limited by the triply indirect block and by the 32-bit size
+    uint64_t max_blocks = EXT2_NDIR_BLOCKS + data->addr_per_block
+        + (uint64_t)data->addr_per_block * data->addr_per_block
+        + (uint64_t)data->addr_per_block * data->addr_per_block * data->addr_per_block;
+    sb->max_file_size = min(max_blocks * sb->block_size, (uint64_t)UINT32_MAX);
+
+    data->sb = raw_sb; // Superblock buffer stays referenced while mounted
+    data->sb_block = b;
     data->dev = sb->dev;
     data->file = sb->device_file;
+    mutex_init(&data->lock);
+    list_init(&data->extents_lru);
+    list_init(&data->inodes);
+
+    for (int i = 0; i < EXT2_EXTENTS_HASH_SIZE; ++i)
+    {
+        list_init(&data->extents_hash[i]);
+    }
 
     sb->fs_data = data;
 
@@ -759,39 +2213,41 @@ static int ext2_mount(super_block_t* sb, inode_t* inode, void*, int)
     uint32_t blocks_count = raw_sb->blocks_count;
     uint32_t blocks_per_group = raw_sb->blocks_per_group;
     uint32_t inodes_per_group = raw_sb->inodes_per_group;
+    uint32_t first_data_block = raw_sb->first_data_block;
 
-    uint32_t block_group_count = align(blocks_count, blocks_per_group) / blocks_per_group;
+    uint32_t block_group_count = align(blocks_count - first_data_block, blocks_per_group) / blocks_per_group;
     uint32_t block_group_count2 = align(inodes_count, inodes_per_group) / inodes_per_group;
 
     if (unlikely(block_group_count != block_group_count2))
     {
         log_warning("bad fs");
+        block_put(b);
         delete(data);
         return -EINVAL;
     }
 
+    data->blocks_count = blocks_count;
+    data->blocks_per_group = blocks_per_group;
+    data->first_data_block = first_data_block;
+    data->groups_count = block_group_count;
     data->inodes_per_group = inodes_per_group;
-    data->inodes_per_block = EXT2_BLOCK_SIZE / sizeof(ext2_inode_t);
+    data->inode_size = raw_sb->rev_level == EXT2_GOOD_OLD_REV ? EXT2_GOOD_OLD_INODE_SIZE : raw_sb->inode_size;
+    data->inodes_per_block = data->block_size / data->inode_size;
+    data->filetype = raw_sb->rev_level != EXT2_GOOD_OLD_REV
+        && (raw_sb->feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE);
 
     root = ext2_inode_get(data, EXT2_ROOT_INO);
 
     if (unlikely(!root))
     {
         log_warning("cannot read root");
+        block_put(b);
         delete(data);
         return -EINVAL;
     }
 
-    inode->ino = EXT2_ROOT_INO;
-    inode->ops = &ext2_inode_ops;
-    inode->fs_data = root;
-    inode->file_ops = &ext2_fops;
-    inode->size = root->size;
+    ext2_inode_fill(inode, root, EXT2_ROOT_INO);
     inode->sb = sb;
-    inode->mode = root->mode;
-    inode->ctime = root->ctime;
-    inode->mtime = root->mtime;
-    inode->nlink = root->links_count;
 
     return 0;
 }
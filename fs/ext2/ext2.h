@@ -2,10 +2,11 @@
 
 #include <stdint.h>
 #include <kernel/dev.h>
+#include <kernel/list.h>
+#include <kernel/mutex.h>
 #include <kernel/compiler.h>
 #include <kernel/api/types.h>
 
-#define EXT2_BLOCK_SIZE         1024
 #define EXT2_SUPERBLOCK_OFFSET  1024
 #define EXT2_NDIR_BLOCKS        12
 #define EXT2_IND_BLOCK          EXT2_NDIR_BLOCKS
@@ -16,14 +17,48 @@
 #define EXT2_ROOT_INO           2
 #define EXT2_SIGNATURE          0xef53
 #define EXT2_LOST_FOUND_INO     11
+#define EXT2_GOOD_OLD_REV       0
+#define EXT2_GOOD_OLD_INODE_SIZE 128
+#define EXT2_GOOD_OLD_FIRST_INO 11
+
+#define EXT2_FEATURE_INCOMPAT_FILETYPE  0x0002
+#define EXT2_FEATURE_INCOMPAT_SUPP      EXT2_FEATURE_INCOMPAT_FILETYPE
+
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE   0x0002
+#define EXT2_FEATURE_RO_COMPAT_SUPP         (EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE)
+
+#define EXT2_INDEX_FL           0x00001000 /* Hash-indexed directory */
+
+#define EXT2_FT_UNKNOWN         0
+#define EXT2_FT_REG_FILE        1
+#define EXT2_FT_DIR             2
+#define EXT2_FT_CHRDEV          3
+#define EXT2_FT_BLKDEV          4
+#define EXT2_FT_FIFO            5
+#define EXT2_FT_SOCK            6
+#define EXT2_FT_SYMLINK         7
+
+// Block mapping cache: each inode read recently keeps a few runs of
+// physically contiguous blocks, so that reads don't walk the indirect
+// blocks for every block
+#define EXT2_EXTENTS_PER_INODE  16
+#define EXT2_EXTENTS_INODES     256
+#define EXT2_EXTENTS_HASH_SIZE  64
+
+// Size of directory entry with name of given length; entries are 4-byte aligned
+#define EXT2_DIR_REC_LEN(name_len) (((name_len) + 8 + 3) & ~3)
 
 struct file;
+struct buffer;
 
 typedef struct ext2_data ext2_data_t;
 typedef struct ext2_superblock ext2_sb_t;
 typedef struct ext2fs_inode ext2_inode_t;
 typedef struct ext2_dir_entry ext2_dir_entry_t;
 typedef struct ext2_block_group_desc ext2_bgd_t;
+typedef struct ext2_extent ext2_extent_t;
+typedef struct ext2_extents ext2_extents_t;
 
 struct ext2fs_inode
 {
@@ -126,15 +161,46 @@ struct ext2_superblock
     uint32_t    reserved[190];      /* Padding to the end of the block */
 };
 
+struct ext2_extent
+{
+    uint32_t    block;      // First block of the file
+    uint32_t    start;      // First device block; 0 for a hole
+    uint32_t    count;      // 0 for an unused slot
+};
+
+struct ext2_extents
+{
+    ino_t         ino;
+    unsigned      next;     // Slot replaced when all are used
+    ext2_extent_t extents[EXT2_EXTENTS_PER_INODE];
+    list_head_t   hash_entry;
+    list_head_t   lru_entry;
+};
+
 struct ext2_data
 {
     uint32_t    last_ind_block;
     uint32_t    first_dind_block;
     uint32_t    last_dind_block;
     uint32_t    addr_per_block;
+    uint32_t    block_size;
+    uint32_t    block_shift;        // log2 of number of cache blocks per fs block
+    uint32_t    blocks_count;
+    uint32_t    blocks_per_group;
+    uint32_t    first_data_block;
+    uint32_t    groups_count;
     uint32_t    inodes_per_group;
     uint32_t    inodes_per_block;
+    uint32_t    inode_size;
+    bool        filetype;           // Directory entries hold file type
     ext2_sb_t*  sb;
+    struct buffer* sb_block;
     dev_t       dev;
     struct file* file;
+    mutex_t     lock;               // Serializes modifications
+    list_head_t extents_hash[EXT2_EXTENTS_HASH_SIZE];
+    list_head_t extents_lru;
+    size_t      extents_inodes;
+    unsigned    extents_gen;        // Bumped whenever blocks are freed
+    list_head_t inodes;             // Inodes in use, linked by inode_t::list
 };
@@ -82,20 +82,28 @@ static int mount_impl(file_system_t* fs, const char* source, const char* mount_p
     sb->device_file = file;
     sb->dev = dev;
 
+    // Reference to the mount point is kept, so that it's never reclaimed
     lookup(mount_point, LOOKUP_NOFOLLOW, NULL, &dentry);
 
     if (dentry)
     {
         if (!S_ISDIR(dentry->inode->mode))
         {
+            dentry_put(dentry);
             return -ENOTDIR;
         }
 
         log_info("mounting %s in %s on %s", fs->name, mount_point, source);
 
-        errno = fs->mount(sb, dentry->inode, NULL, 0);
+        // Names cached for the covered directory don't exist in the mounted one
+        dentry_prune(dentry);
 
         inode = dentry->inode;
+
+        if (unlikely(errno = fs->mount(sb, inode, NULL, 0)))
+        {
+            dentry_put(dentry);
+        }
     }
     else if (unlikely(!root))
     {
@@ -211,10 +219,11 @@ int sys_umount2(const char*, int)
 int do_chroot(const char* path)
 {
     int errno;
-    dentry_t* dentry;
+    scoped_dentry_t* dentry = NULL;
 
     if (unlikely(!process_current->fs->root && !path))
     {
+        dentry_get(root_dentry);
         process_current->fs->root = root_dentry;
         return 0;
     }
@@ -229,6 +238,8 @@ int do_chroot(const char* path)
         return -ENOTDIR;
     }
 
+    dentry_get(dentry);
+    __dentry_put(&process_current->fs->root);
     process_current->fs->root = dentry;
 
     return 0;
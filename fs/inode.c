@@ -39,6 +39,11 @@ void inode_put(inode_t* inode)
 {
     if (!--inode->refcount)
     {
+        if (inode->sb && inode->sb->ops && inode->sb->ops->inode_release)
+        {
+            inode->sb->ops->inode_release(inode);
+        }
+
         list_del(&inode->list);
         list_add_tail(&inode->list, &free_inodes);
     }
@@ -22,6 +22,7 @@ static int iso9660_readdir(file_t* file, void* buf, direntadd_t dirent_add);
 static int iso9660_mount(super_block_t* sb, inode_t* inode, void*, int);
 static int iso9660_nopage(vm_area_t* vma, uintptr_t address, size_t size, page_t** page);
 static int iso9660_readlink(inode_t* inode, char* buffer, size_t size);
+static void iso9660_inode_release(inode_t* inode);
 
 static_assert(offsetof(iso9660_pvd_t, root) == 156 - 8);
 static_assert(offsetof(iso9660_dirent_t, name) == 33);
@@ -37,7 +38,9 @@ static file_system_t iso9660 = {
     .mount = &iso9660_mount,
 };
 
-static super_operations_t iso9660_sb_ops;
+static super_operations_t iso9660_sb_ops = {
+    .inode_release = &iso9660_inode_release,
+};
 
 static inode_operations_t iso9660_inode_ops = {
     .lookup = &iso9660_lookup,
@@ -129,6 +132,7 @@ static int iso9660_next_entry(
         {
             return errno;
         }
+        block_put(*result_b);
         *dirents_len -= dirent_len;
         *offset += dirent_len;
     }
@@ -147,6 +151,7 @@ static int iso9660_next_entry(
         {
             return errno;
         }
+        block_put(*result_b);
         dirent = b->data;
         if (!dirent->len)
         {
@@ -183,7 +188,7 @@ static int iso9660_traverse(
     size_t dirents_len = GET(parent_dirent->data_len) - offset;
     size_t start_block = offset / ISO9660_BLOCK_SIZE;
     size_t block_offset = offset % ISO9660_BLOCK_SIZE;
-    buffer_t* b = block(data, GET(parent_dirent->lba) + start_block);
+    buffer_t* b;
     rrip_t* px;
     rrip_t* nm;
 
@@ -192,6 +197,8 @@ static int iso9660_traverse(
         return 0;
     }
 
+    b = block(data, GET(parent_dirent->lba) + start_block);
+
     if (unlikely(errno = errno_get(b)))
     {
         log_debug(DEBUG_ISO9660, "cannot read block %u", GET(parent_dirent->lba));
@@ -203,6 +210,7 @@ static int iso9660_traverse(
         if (unlikely(errno))
         {
             log_debug(DEBUG_ISO9660, "cannot go to next entry: %d", errno);
+            block_put(b);
             return errno;
         }
 
@@ -219,10 +227,13 @@ static int iso9660_traverse(
 
         if ((ret = visitor(dirent, px, nm, b, offset, visitor_data)))
         {
+            block_put(b);
             return ret;
         }
     }
 
+    block_put(b);
+
     return 0;
 }
 
@@ -231,9 +242,7 @@ struct find_data
 {
     const char*  name;
     const size_t name_len;
-    rrip_t*      px;
-    rrip_t*      nm;
-    buffer_t*    b;
+    ino_t        ino;
     iso9660_dirent_t* dirent;
 };
 
@@ -245,7 +254,7 @@ enum find_result
 
 static int iso9660_find_visitor(
     iso9660_dirent_t* dirent,
-    rrip_t* px,
+    rrip_t*,
     rrip_t* nm,
     buffer_t* b,
     size_t,
@@ -261,10 +270,14 @@ static int iso9660_find_visitor(
     size_t nm_name_len = NM_NAME_LEN(nm);
     if (ctx->name_len == nm_name_len && !strncmp(ctx->name, nm->nm.name, nm_name_len))
     {
-        ctx->nm = nm;
-        ctx->px = px;
-        ctx->b  = b;
-        ctx->dirent = dirent;
+        // Inode keeps a copy of the dirent, so that the block isn't pinned
+        if (unlikely(!(ctx->dirent = slab_alloc(dirent->len))))
+        {
+            return -ENOMEM;
+        }
+
+        memcpy(ctx->dirent, dirent, dirent->len);
+        ctx->ino = ino_get(b, dirent);
         return DIRENT_FOUND;
     }
 
@@ -297,9 +310,8 @@ static int iso9660_dirent_find(
     if (likely(res == DIRENT_FOUND))
     {
         *result_dirent = ctx.dirent;
-        *result_px = ctx.px;
-        *result_nm = ctx.nm;
-        *ino = ino_get(ctx.b, ctx.dirent);
+        *ino = ctx.ino;
+        iso9660_px_nm_find(ctx.dirent, result_px, result_nm);
         return 0;
     }
 
@@ -385,6 +397,7 @@ static int iso9660_lookup(inode_t* parent, const char* name, inode_t** result)
     if (unlikely((errno = inode_alloc(result))))
     {
         log_debug(DEBUG_ISO9660, "cannot get free inode for \"%s\"", name);
+        slab_free(dirent, dirent->len);
         return errno;
     }
 
@@ -412,16 +425,49 @@ static int iso9660_lookup(inode_t* parent, const char* name, inode_t** result)
     return 0;
 }
 
+static void iso9660_inode_release(inode_t* inode)
+{
+    iso9660_dirent_t* dirent = inode->fs_data;
+    iso9660_data_t* data = inode->sb->fs_data;
+
+    // Root dirent is a part of the superblock
+    if (dirent && dirent != data->root)
+    {
+        slab_free(dirent, dirent->len);
+    }
+}
+
 static int iso9660_mmap(file_t*, vm_area_t* vma)
 {
     vma->ops= &iso9660_vmops;
     return 0;
 }
 
-static int iso9660_nopage(vm_area_t* vma, uintptr_t address, size_t size, page_t** page)
+// Files are contiguous, so the whole range is read with a single request
+static void iso9660_readahead(inode_t* inode, size_t offset, size_t size)
+{
+    iso9660_dirent_t* dirent = inode->fs_data;
+    iso9660_data_t* data = inode->sb->fs_data;
+    uint32_t first;
+
+    if (unlikely(!dirent || !data || !size || offset >= GET(dirent->data_len)))
+    {
+        return;
+    }
+
+    size = min(size, GET(dirent->data_len) - offset);
+    first = offset / BLOCK_SIZE;
+
+    blocks_prefetch(
+        data->dev,
+        block_nr_convert(GET(dirent->lba)) + first,
+        (offset + size - 1) / BLOCK_SIZE - first + 1);
+}
+
+static int iso9660_readpage(inode_t* inode, page_t* page, size_t index)
 {
-    iso9660_dirent_t* dirent = vma->dentry->inode->fs_data;
-    iso9660_data_t* data = vma->dentry->inode->sb->fs_data;
+    iso9660_dirent_t* dirent = inode->fs_data;
+    iso9660_data_t* data = inode->sb->fs_data;
 
     if (unlikely(!dirent || !data))
     {
@@ -430,37 +476,27 @@ static int iso9660_nopage(vm_area_t* vma, uintptr_t address, size_t size, page_t
     }
 
     int errno;
-    void* data_ptr;
-    off_t offset = vma->offset + address - vma->start;
-    uint32_t pos = offset, data_size;
-    uint32_t block_nr = offset / BLOCK_SIZE + block_nr_convert(GET(dirent->lba));
-    const size_t blocks_count = align(size, BLOCK_SIZE) / BLOCK_SIZE;
+    void* data_ptr = page_virt_ptr(page);
+    uint32_t pos = index * PAGE_SIZE, data_size;
+    uint32_t block_nr = pos / BLOCK_SIZE + block_nr_convert(GET(dirent->lba));
     size_t count = 0;
     buffer_t* b;
 
-    if (unlikely(!(*page = page_alloc(1, 0))))
-    {
-        log_debug(DEBUG_ISO9660, "cannot allocate page");
-        return -ENOMEM;
-    }
-
-    data_ptr = page_virt_ptr(*page);
-
-    for (size_t i = 0; i < blocks_count; ++i)
+    while (count < PAGE_SIZE && pos < GET(dirent->data_len))
     {
         b = block_read(data->dev, data->file, block_nr);
 
         if (unlikely(errno = errno_get(b)))
         {
-            goto error;
+            return errno;
         }
 
         data_size = min(BLOCK_SIZE, GET(dirent->data_len) - pos);
-        data_size = min(data_size, size - count);
 
         log_debug(DEBUG_ISO9660, "copying %u B from block %u %p to %p", data_size, block_nr, b->data, data_ptr);
 
         memcpy(data_ptr, b->data, data_size);
+        block_put(b);
 
         ++block_nr;
         pos += data_size;
@@ -469,11 +505,11 @@ static int iso9660_nopage(vm_area_t* vma, uintptr_t address, size_t size, page_t
     }
 
     return count;
+}
 
-error:
-    pages_free(*page);
-    *page = NULL;
-    return errno;
+static int iso9660_nopage(vm_area_t* vma, uintptr_t address, size_t size, page_t** page)
+{
+    return file_page_nopage(vma, address, size, page, &iso9660_readpage, &iso9660_readahead);
 }
 
 static int iso9660_readlink(inode_t* inode, char* buffer, size_t size)
@@ -496,6 +532,8 @@ static int iso9660_readlink(inode_t* inode, char* buffer, size_t size)
         return -ENOMEM;
     }
 
+    block_put(b);
+
     rrip_t* rrip = iso9660_sl_find(dirent);
 
     if (unlikely(!rrip))
@@ -588,6 +626,7 @@ static int iso9660_read(file_t* file, char* buffer, size_t count)
     buffer_t* b;
     char* block_data;
     size_t lba = GET(dirent->lba);
+    size_t ra_offset, ra_size;
 
     log_debug(DEBUG_ISO9660, "count: %u, dirent: %p, size: %u B, lba: %u, block_nr: %u",
         count,
@@ -596,6 +635,13 @@ static int iso9660_read(file_t* file, char* buffer, size_t count)
         lba,
         block_nr);
 
+    iso9660_readahead(file->dentry->inode, file->offset, count);
+
+    if (file_readahead(&file->ra, file->offset, count, &ra_offset, &ra_size))
+    {
+        iso9660_readahead(file->dentry->inode, ra_offset, ra_size);
+    }
+
     while (left)
     {
         to_copy = min(ISO9660_BLOCK_SIZE - block_offset, left);
@@ -611,6 +657,7 @@ static int iso9660_read(file_t* file, char* buffer, size_t count)
 
         log_debug(DEBUG_ISO9660, "copying %u B from block %u %p to %p", to_copy, block_nr, block_data, buffer);
         memcpy(buffer, block_data, to_copy);
+        block_put(b);
         buffer += to_copy;
         ++block_nr;
         block_offset = 0;
@@ -674,33 +721,39 @@ static int iso9660_mount(super_block_t* sb, inode_t* inode, void*, int)
     if (strncmp(raw_sb->identifier, ISO9660_SIGNATURE, ISO9660_SIGNATURE_LEN))
     {
         log_debug(DEBUG_ISO9660, "not an ISO9660 file system");
+        block_put(b);
         return -ENODEV;
     }
 
     if (unlikely(raw_sb->type != ISO9660_VOLUME_PRIMARY))
     {
         log_debug(DEBUG_ISO9660, "not a Primary Volume Descriptor");
+        block_put(b);
         return -ENODEV;
     }
 
     if (unlikely(GET(raw_sb->pvd.block_size) != ISO9660_BLOCK_SIZE))
     {
         log_debug(DEBUG_ISO9660, "unsupported block size: %u", GET(raw_sb->pvd.block_size));
+        block_put(b);
         return -EINVAL;
     }
 
     if (unlikely(!(data = alloc(iso9660_data_t))))
     {
         log_debug(DEBUG_ISO9660, "cannot allocate memory for data");
+        block_put(b);
         return -ENOMEM;
     }
 
     data->dev = sb->dev;
     data->file = sb->device_file;
-    data->raw_sb = raw_sb;
+    data->raw_sb = raw_sb; // Superblock buffer stays referenced while mounted
     data->root = &raw_sb->pvd.root;
 
     sb->ops = &iso9660_sb_ops;
+
+    sb->flags = SB_DCACHE;
     sb->module = this_module;
     sb->fs_data = data;
 
@@ -24,12 +24,15 @@ static inline void get_next_dir(const char** path, char* output)
     }
 }
 
+// Takes its own reference to dentry; on success, result is referenced
 static int link_follow(dentry_t* dentry, dentry_t** result)
 {
     int res, errno;
     char buffer[PATH_MAX];
     inode_t* inode;
-    dentry_t* parent_dentry = dentry->parent;
+    dentry_t* next;
+
+    dentry_get(dentry);
 
     while (S_ISLNK(dentry->inode->mode))
     {
@@ -37,70 +40,68 @@ static int link_follow(dentry_t* dentry, dentry_t** result)
 
         if (unlikely(!inode->ops || !inode->ops->readlink))
         {
-            return -ENOSYS;
+            errno = -ENOSYS;
+            goto error;
         }
 
         res = inode->ops->readlink(inode, buffer, sizeof(buffer));
 
         if (unlikely(errno = errno_get(res)))
         {
-            return errno;
+            goto error;
         }
 
         buffer[res] = 0;
 
-        if (unlikely(errno = lookup(buffer, LOOKUP_NOFOLLOW, parent_dentry, &dentry)))
+        if (unlikely(errno = lookup(buffer, LOOKUP_NOFOLLOW, dentry->parent, &next)))
         {
-            return errno;
+            goto error;
         }
 
-        parent_dentry = dentry->parent;
-    }
-
-    if (unlikely(!dentry))
-    {
-        log_error("%s:%u: VFS lookup bug: NULL dentry", __func__, __LINE__);
-        return -ENOENT;
+        dentry_put(dentry);
+        dentry = next;
     }
 
     *result = dentry;
 
     return 0;
+
+error:
+    dentry_put(dentry);
+    return errno;
 }
 
+// Dentry which is walked is referenced, so that it's not reclaimed while
+// file system lookup sleeps
 int lookup(const char* filename, int flag, dentry_t* start, dentry_t** result)
 {
     int errno;
     char name[PATH_MAX];
     const char* path = filename;
-    inode_t* parent_inode = NULL;
-    dentry_t* parent_dentry = NULL;
+    inode_t* inode;
     dentry_t* dentry = NULL;
+    dentry_t* next;
 
     log_debug(DEBUG_LOOKUP, "called for filename=%S", filename);
 
+    *result = NULL;
+
     if (!path_is_absolute(filename))
     {
-        if (!start)
-        {
-            dentry = process_current->fs->cwd;
-        }
-        else
-        {
-            dentry = start;
-        }
-        parent_inode = dentry->inode;
-        parent_dentry = dentry;
+        dentry = start ? start : process_current->fs->cwd;
         log_debug(DEBUG_LOOKUP, "relative; %O", dentry);
     }
     else if (process_current->fs->root)
     {
         dentry = process_current->fs->root;
-        parent_inode = dentry->inode;
-        parent_dentry = dentry;
         log_debug(DEBUG_LOOKUP, "absolute; %O", dentry);
     }
 
+    if (dentry)
+    {
+        dentry_get(dentry);
+    }
+
     while (1)
     {
         for (; *path && *path == '/'; ++path);
@@ -111,92 +112,90 @@ int lookup(const char* filename, int flag, dentry_t* start, dentry_t** result)
 
         if (*name && dentry && S_ISLNK(dentry->inode->mode))
         {
-            if (unlikely(errno = link_follow(dentry, &dentry)))
+            if (unlikely(errno = link_follow(dentry, &next)))
             {
-                *result = NULL;
-                return errno;
+                goto error;
             }
 
-            parent_inode = dentry->inode;
+            dentry_put(dentry);
+            dentry = next;
+        }
+
+        if (unlikely(!dentry))
+        {
+            return -ENOENT;
         }
 
         if (!strcmp(name, "."))
         {
-            if (unlikely(!dentry))
-            {
-                return -ENOENT;
-            }
             if (unlikely(!S_ISDIR(dentry->inode->mode)))
             {
-                *result = NULL;
-                return -ENOTDIR;
+                errno = -ENOTDIR;
+                goto error;
             }
         }
         else if (!strcmp(name, ".."))
         {
-            if (unlikely(!dentry))
-            {
-                return -ENOENT;
-            }
             if (unlikely(!S_ISDIR(dentry->inode->mode)))
             {
-                *result = NULL;
-                return -ENOTDIR;
+                errno = -ENOTDIR;
+                goto error;
             }
 
-            if (dentry != process_current->fs->root)
+            if (dentry != process_current->fs->root && dentry->parent)
             {
-                dentry = dentry->parent
-                    ? dentry->parent
-                    : dentry;
+                next = dentry->parent;
+                dentry_get(next);
+                dentry_put(dentry);
+                dentry = next;
             }
         }
-        else if (!*name && parent_dentry)
+        else if (!*name)
         {
-            *result = parent_dentry;
+            *result = dentry;
             return 0;
         }
         else
         {
-            parent_dentry = dentry;
-            dentry = dentry_lookup(dentry, name);
+            next = dentry_lookup(dentry, name);
 
-            if (unlikely(!dentry && !parent_inode))
+            // Negative dentry; name is known not to exist
+            if (next && !next->inode)
             {
-                *result = NULL;
-                return -ENOENT;
+                errno = -ENOENT;
+                goto error;
             }
-            else if (!dentry)
+            else if (!next)
             {
-                inode_t* inode;
+                log_debug(DEBUG_LOOKUP, "calling ops->lookup with %O, %S", dentry->inode, name);
 
-                log_debug(DEBUG_LOOKUP, "calling ops->lookup with %O, %S", parent_inode, name);
-
-                if (unlikely(errno = parent_inode->ops->lookup(parent_inode, name, &inode)))
+                if (unlikely(errno = dentry->inode->ops->lookup(dentry->inode, name, &inode)))
                 {
                     log_debug(DEBUG_LOOKUP, "lookup failed with %d", errno);
-                    *result = NULL;
-                    return errno;
+
+                    if (errno == -ENOENT && dentry->inode->sb && (dentry->inode->sb->flags & SB_DCACHE))
+                    {
+                        dentry_create(NULL, dentry, name);
+                    }
+
+                    goto error;
                 }
 
-                inode->dev = parent_inode->dev;
-                inode->sb = parent_inode->sb;
+                inode->dev = dentry->inode->dev;
+                inode->sb = dentry->inode->sb;
 
-                dentry = dentry_create(inode, parent_dentry, name);
+                next = dentry_create(inode, dentry, name);
 
-                if (unlikely(!dentry))
+                if (unlikely(!next))
                 {
-                    return -ENOMEM;
+                    errno = -ENOMEM;
+                    goto error;
                 }
-
-                parent_inode = inode;
-                parent_dentry = dentry;
-            }
-            else
-            {
-                parent_dentry = dentry;
-                parent_inode = parent_dentry->inode;
             }
+
+            dentry_get(next);
+            dentry_put(dentry);
+            dentry = next;
         }
 
         if (!path || strlen(path) == 0)
@@ -205,24 +204,23 @@ int lookup(const char* filename, int flag, dentry_t* start, dentry_t** result)
         }
     }
 
-    if (unlikely(!dentry))
-    {
-        log_debug(DEBUG_LOOKUP, "returning %O", dentry);
-        *result = NULL;
-        return -ENOENT;
-    }
-
     if (S_ISLNK(dentry->inode->mode) && (flag & LOOKUP_FOLLOW))
     {
-        if (unlikely(errno = link_follow(dentry, &dentry)))
+        if (unlikely(errno = link_follow(dentry, &next)))
         {
-            *result = NULL;
-            return errno;
+            goto error;
         }
+
+        dentry_put(dentry);
+        dentry = next;
     }
 
     log_debug(DEBUG_LOOKUP, "returning %O for dentry: %O", dentry->inode, dentry);
 
     *result = dentry;
     return 0;
+
+error:
+    dentry_put(dentry);
+    return errno;
 }
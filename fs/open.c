@@ -1,6 +1,7 @@
 #include <stdarg.h>
 #include <kernel/fs.h>
 #include <kernel/path.h>
+#include <kernel/epoll.h>
 #include <kernel/errno.h>
 #include <kernel/dentry.h>
 #include <kernel/process.h>
@@ -15,8 +16,8 @@ int do_open(file_t** new_file, const char* filename, int flags, int mode)
     int errno;
     inode_t* inode = NULL;
     inode_t* parent_inode = NULL;
-    dentry_t* dentry = NULL;
-    dentry_t* parent_dentry = NULL;
+    scoped_dentry_t* dentry = NULL;
+    scoped_dentry_t* parent_dentry = NULL;
     const char* basename;
     char parent[PATH_MAX];
 
@@ -31,6 +32,15 @@ int do_open(file_t** new_file, const char* filename, int flags, int mode)
             return -EPERM;
         }
 
+        if ((flags & O_TRUNC) && (flags & (O_RDWR | O_WRONLY)) && S_ISREG(inode->mode)
+            && inode->ops && inode->ops->truncate)
+        {
+            if (unlikely(errno = inode->ops->truncate(inode, 0)))
+            {
+                return errno;
+            }
+        }
+
         goto set_file;
     }
     else if (!dentry && !(flags & O_CREAT))
@@ -67,6 +77,11 @@ int do_open(file_t** new_file, const char* filename, int flags, int mode)
             {
                 parent_dentry = process_current->fs->cwd;
                 basename = filename;
+
+                if (likely(parent_dentry))
+                {
+                    dentry_get(parent_dentry);
+                }
             }
             else
             {
@@ -111,6 +126,8 @@ int do_open(file_t** new_file, const char* filename, int flags, int mode)
         return -ENOMEM;
     }
 
+    dentry_get(dentry);
+
 set_file:
     if (unlikely(!inode))
     {
@@ -142,15 +159,21 @@ set_file:
 
     log_debug(DEBUG_OPEN, "file=%O, inode=%O", *new_file, inode);
 
+    dentry_get(dentry);
+
     (*new_file)->ops     = inode->file_ops;
     (*new_file)->mode    = flags;
     (*new_file)->offset  = 0;
     (*new_file)->count   = 1;
     (*new_file)->dentry  = dentry;
     (*new_file)->private = NULL;
+    (*new_file)->ra      = (file_ra_t){};
+
+    list_init(&(*new_file)->epoll_items);
 
     if (unlikely(errno = (*new_file)->ops->open(*new_file)))
     {
+        dentry_put(dentry);
         list_del(&(*new_file)->files);
         delete(*new_file);
         *new_file = NULL;
@@ -220,10 +243,15 @@ int do_close(file_t* file)
 {
     if (!--file->count)
     {
+        if (unlikely(!list_empty(&file->epoll_items)))
+        {
+            epoll_file_release(file);
+        }
         if (file->ops->close)
         {
             file->ops->close(file);
         }
+        dentry_put(file->dentry);
         delete(file, list_del(&file->files));
     }
     return 0;
@@ -271,7 +299,7 @@ int do_mkdir(const char* path, int mode)
     int errno;
     inode_t* inode;
     dentry_t* new_dentry;
-    dentry_t* parent_dentry;
+    scoped_dentry_t* parent_dentry = NULL;
     char dir_name[PATH_MAX];
     const char* basename;
 
@@ -289,6 +317,11 @@ int do_mkdir(const char* path, int mode)
     {
         basename = path;
         parent_dentry = process_current->fs->cwd;
+
+        if (likely(parent_dentry))
+        {
+            dentry_get(parent_dentry);
+        }
     }
 
     if (unlikely(!parent_dentry))
@@ -354,12 +387,19 @@ int sys_creat(const char* pathname, int mode)
     return sys_open(pathname, O_CREAT | O_WRONLY | O_TRUNC, mode);
 }
 
+static void fs_cwd_set(dentry_t* dentry)
+{
+    dentry_get(dentry);
+    __dentry_put(&process_current->fs->cwd);
+    process_current->fs->cwd = dentry;
+}
+
 int do_chdir(const char* path)
 {
     int errno;
     mode_t mode;
-    dentry_t* dentry;
-    dentry_t* tmp;
+    scoped_dentry_t* dentry = NULL;
+    scoped_dentry_t* tmp = NULL;
 
     if (unlikely(errno = lookup(path, LOOKUP_NOFOLLOW, NULL, &dentry)))
     {
@@ -388,7 +428,7 @@ int do_chdir(const char* path)
         return -EACCES;
     }
 
-    process_current->fs->cwd = dentry;
+    fs_cwd_set(dentry);
 
     return 0;
 }
@@ -434,7 +474,7 @@ int sys_fchdir(int fd)
         return -EACCES;
     }
 
-    process_current->fs->cwd = dentry;
+    fs_cwd_set(dentry);
 
     return 0;
 }
@@ -475,7 +515,7 @@ static void stat_fill(struct stat* statbuf, const dentry_t* dentry)
 static int stat_impl(const char* pathname, struct stat* statbuf, int lookup_flag)
 {
     int errno;
-    dentry_t* dentry;
+    scoped_dentry_t* dentry = NULL;
 
     if (unlikely(errno = lookup(pathname, lookup_flag, NULL, &dentry)))
     {
@@ -522,7 +562,7 @@ int sys_fstat(int fd, struct stat* statbuf)
 int sys_statvfs(const char* path, struct statvfs* buf)
 {
     int errno;
-    dentry_t* dentry;
+    scoped_dentry_t* dentry = NULL;
 
     if (unlikely(errno = path_validate(path)))
     {
@@ -553,10 +593,100 @@ int sys_fstatvfs(int fd, struct statvfs* buf)
     return 0;
 }
 
+static int parent_lookup(const char* path, dentry_t** parent_dentry, const char** basename)
+{
+    char parent[PATH_MAX];
+
+    if (unlikely(dirname_get(path, parent, sizeof(parent))))
+    {
+        return -ENAMETOOLONG;
+    }
+
+    *parent_dentry = NULL;
+    *basename = basename_get(path);
+
+    if (*parent == '\0' && !path_is_absolute(path))
+    {
+        *parent_dentry = process_current->fs->cwd;
+        *basename = path;
+
+        if (likely(*parent_dentry))
+        {
+            dentry_get(*parent_dentry);
+        }
+    }
+    else
+    {
+        lookup(parent, LOOKUP_FOLLOW, NULL, parent_dentry);
+    }
+
+    if (unlikely(!*parent_dentry))
+    {
+        return -ENOENT;
+    }
+
+    if (unlikely(!S_ISDIR((*parent_dentry)->inode->mode)))
+    {
+        return -ENOTDIR;
+    }
+
+    return 0;
+}
+
+static int do_remove(const char* path, bool dir)
+{
+    int errno;
+    scoped_dentry_t* dentry = NULL;
+    inode_t* parent_inode;
+
+    if (unlikely(errno = path_validate(path)))
+    {
+        return errno;
+    }
+
+    if (unlikely(errno = lookup(path, LOOKUP_NOFOLLOW, NULL, &dentry)))
+    {
+        return errno;
+    }
+
+    if (unlikely(!dentry->parent))
+    {
+        return -EBUSY;
+    }
+
+    if (dir && unlikely(!S_ISDIR(dentry->inode->mode)))
+    {
+        return -ENOTDIR;
+    }
+    else if (!dir && unlikely(S_ISDIR(dentry->inode->mode)))
+    {
+        return -EISDIR;
+    }
+
+    parent_inode = dentry->parent->inode;
+
+    if (unlikely(!parent_inode->ops || !(dir ? parent_inode->ops->rmdir : parent_inode->ops->unlink)))
+    {
+        return -ENOSYS;
+    }
+
+    errno = dir
+        ? parent_inode->ops->rmdir(parent_inode, dentry->name)
+        : parent_inode->ops->unlink(parent_inode, dentry->name);
+
+    if (unlikely(errno))
+    {
+        return errno;
+    }
+
+    dentry_detach(dentry);
+
+    return 0;
+}
+
 int sys_unlink(const char* path)
 {
-    UNUSED(path);
-    return -ENOSYS;
+    return do_remove(path, false);
 }
 
 mode_t sys_umask(mode_t cmask)
@@ -584,7 +714,7 @@ int sys_fchmod(int fd, mode_t)
 int sys_access(const char* path, int amode)
 {
     int errno;
-    dentry_t* dentry;
+    scoped_dentry_t* dentry = NULL;
 
     UNUSED(amode);
 
@@ -603,8 +733,68 @@ int sys_access(const char* path, int amode)
 
 int sys_rename(const char* oldpath, const char* newpath)
 {
-    UNUSED(oldpath); UNUSED(newpath);
-    return -ENOSYS;
+    int errno;
+    scoped_dentry_t* old_dentry = NULL;
+    scoped_dentry_t* new_parent = NULL;
+    dentry_t* new_dentry;
+    inode_t* old_parent_inode;
+    const char* basename;
+
+    if (unlikely((errno = path_validate(oldpath)) || (errno = path_validate(newpath))))
+    {
+        return errno;
+    }
+
+    if (unlikely(errno = lookup(oldpath, LOOKUP_NOFOLLOW, NULL, &old_dentry)))
+    {
+        return errno;
+    }
+
+    if (unlikely(errno = parent_lookup(newpath, &new_parent, &basename)))
+    {
+        return errno;
+    }
+
+    if (unlikely(!old_dentry->parent))
+    {
+        return -EBUSY;
+    }
+
+    old_parent_inode = old_dentry->parent->inode;
+
+    if (unlikely(old_parent_inode->sb != new_parent->inode->sb))
+    {
+        return -EXDEV;
+    }
+
+    // Directory cannot be moved into itself
+    for (dentry_t* d = new_parent; d; d = d->parent)
+    {
+        if (unlikely(d == old_dentry))
+        {
+            return -EINVAL;
+        }
+    }
+
+    if (unlikely(!old_parent_inode->ops || !old_parent_inode->ops->rename))
+    {
+        return -ENOSYS;
+    }
+
+    if (unlikely(errno = old_parent_inode->ops->rename(old_parent_inode, old_dentry->name, new_parent->inode, basename)))
+    {
+        return errno;
+    }
+
+    // Both names are looked up again on the next access
+    if ((new_dentry = dentry_lookup(new_parent, basename)) && new_dentry != old_dentry)
+    {
+        dentry_detach(new_dentry);
+    }
+
+    dentry_detach(old_dentry);
+
+    return 0;
 }
 
 int sys_mknod(const char* pathname, mode_t mode, dev_t dev)
@@ -675,14 +865,13 @@ int sys_fchown(int fd, uid_t owner, gid_t group)
 
 int sys_rmdir(const char* pathname)
 {
-    UNUSED(pathname);
-    return -ENOSYS;
+    return do_remove(pathname, true);
 }
 
 ssize_t sys_readlink(const char* pathname, char* buf, size_t bufsiz)
 {
     int errno;
-    dentry_t* dentry;
+    scoped_dentry_t* dentry = NULL;
 
     if (unlikely(errno = path_validate(pathname))) return errno;
     if (unlikely(errno = lookup(pathname, LOOKUP_NOFOLLOW, NULL, &dentry))) return errno;
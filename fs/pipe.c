@@ -1,37 +1,60 @@
 #include <kernel/fs.h>
 #include <kernel/dev.h>
-#include <kernel/fifo.h>
+#include <kernel/mutex.h>
 #include <kernel/dentry.h>
 #include <kernel/kernel.h>
+#include <kernel/minmax.h>
+#include <kernel/signal.h>
 #include <kernel/process.h>
 #include <kernel/api/stat.h>
+#include <kernel/page_alloc.h>
 
-#define DEBUG_PIPE 0
+#define DEBUG_PIPE          0
+#define PIPE_SIZE           (64 * KiB)
+#define PIPE_PAGES          (PIPE_SIZE / PAGE_SIZE)
+
+// Writes up to this size are never interleaved with data of other writers
+#define PIPE_ATOMIC_SIZE    PAGE_SIZE
 
 static int pipe_read(file_t* file, char* buffer, size_t count);
 static int pipe_write(file_t* file, const char* buffer, size_t count);
 static int pipe_r_close(file_t* file);
 static int pipe_w_close(file_t* file);
+static int pipe_r_poll(file_t* file, short events, short* revents, wait_queue_head_t** head);
+static int pipe_w_poll(file_t* file, short events, short* revents, wait_queue_head_t** head);
 
 typedef struct pipe pipe_t;
 
+// Data is kept in a ring of PIPE_SIZE bytes made of single pages, which are
+// allocated on first write to them; head and tail count all bytes written
+// and read, so their difference is the number of bytes in the pipe.
+// Readers and writers copy data without the irq lock, which only guards
+// head, tail and the queues; read_lock and write_lock keep readers and
+// writers from copying at the same time and are never held while waiting
 struct pipe
 {
+    wait_queue_head_t rq;
     wait_queue_head_t wq;
+    mutex_t           read_lock;
+    mutex_t           write_lock;
     int               writers;
     int               readers;
     int               count;
-    BUFFER_MEMBER_DECLARE(buffer, 256);
+    size_t            head;
+    size_t            tail;
+    page_t*           pages[PIPE_PAGES];
 };
 
 static file_operations_t pipe_r_fops = {
     .read = &pipe_read,
     .close = &pipe_r_close,
+    .poll = &pipe_r_poll,
 };
 
 static file_operations_t pipe_w_fops = {
     .write = &pipe_write,
     .close = &pipe_w_close,
+    .poll = &pipe_w_poll,
 };
 
 static inode_operations_t pipe_iops = {
@@ -46,81 +69,280 @@ static super_block_t sb = {
     .ops = &sb_ops
 };
 
+static void pipe_wake_all(wait_queue_head_t* head)
+{
+    process_t* proc;
+
+    while ((proc = wait_queue_pop(head)))
+    {
+        log_debug_continue(DEBUG_PIPE, "; waking %u", proc->pid);
+        process_wake(proc);
+    }
+}
+
+static void pipe_free(pipe_t* pipe)
+{
+    log_debug(DEBUG_PIPE, "%u: pipe %p: removing", process_current->pid, pipe);
+
+    for (size_t i = 0; i < PIPE_PAGES; ++i)
+    {
+        if (pipe->pages[i])
+        {
+            pages_free(pipe->pages[i]);
+        }
+    }
+
+    delete(pipe);
+}
+
+static inline page_t** pipe_page(pipe_t* pipe, size_t pos)
+{
+    return &pipe->pages[(pos % PIPE_SIZE) / PAGE_SIZE];
+}
+
+static int pipe_pages_alloc(pipe_t* pipe, size_t pos, size_t count)
+{
+    page_t** page;
+    size_t chunk;
+
+    for (; count; pos += chunk, count -= chunk)
+    {
+        page = pipe_page(pipe, pos);
+        chunk = min(count, PAGE_SIZE - pos % PAGE_SIZE);
+
+        if (!*page && unlikely(!(*page = page_alloc(1, PAGE_ALLOC_DISCONT))))
+        {
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+static void pipe_copy_from(pipe_t* pipe, size_t pos, char* buffer, size_t count)
+{
+    size_t offset, chunk;
+
+    for (; count; pos += chunk, buffer += chunk, count -= chunk)
+    {
+        offset = pos % PAGE_SIZE;
+        chunk = min(count, PAGE_SIZE - offset);
+        memcpy(buffer, page_virt_ptr(*pipe_page(pipe, pos)) + offset, chunk);
+    }
+}
+
+static void pipe_copy_to(pipe_t* pipe, size_t pos, const char* buffer, size_t count)
+{
+    size_t offset, chunk;
+
+    for (; count; pos += chunk, buffer += chunk, count -= chunk)
+    {
+        offset = pos % PAGE_SIZE;
+        chunk = min(count, PAGE_SIZE - offset);
+        memcpy(page_virt_ptr(*pipe_page(pipe, pos)) + offset, buffer, chunk);
+    }
+}
+
 static int pipe_read(file_t* file, char* buffer, size_t count)
 {
-    flags_t flags;
-    size_t read;
     int errno;
+    flags_t flags;
+    size_t available;
     pipe_t* pipe = file->private;
 
-    for (read = 0; read < count; ++read)
+    if (unlikely(!count))
+    {
+        return 0;
+    }
+
+    for (;;)
     {
         irq_save(flags);
 
-        while (fifo_get(&pipe->buffer, &buffer[read]))
+        while (pipe->head == pipe->tail)
         {
             if (!pipe->writers)
             {
                 log_debug(DEBUG_PIPE, "%u: pipe %p: no more writers", process_current->pid, pipe);
                 irq_restore(flags);
-                goto finish;
+                return 0;
+            }
+
+            if (file->mode & O_NONBLOCK)
+            {
+                irq_restore(flags);
+                return -EAGAIN;
             }
 
-            log_debug(DEBUG_PIPE, "%u: pipe %p: waiting", process_current->pid, pipe);
+            log_debug(DEBUG_PIPE, "%u: pipe %p: waiting for data", process_current->pid, pipe);
             WAIT_QUEUE_DECLARE(q, process_current);
-            if ((errno = process_wait_locked(&pipe->wq, &q, &flags)))
+            if ((errno = process_wait_locked(&pipe->rq, &q, &flags)))
             {
                 irq_restore(flags);
                 return errno;
             }
-            log_debug(DEBUG_PIPE, "%u: pipe %p: woken", process_current->pid, pipe);
-            irq_restore(flags);
         }
+
+        irq_restore(flags);
+
+        mutex_lock(&pipe->read_lock);
+
+        irq_save(flags);
+        available = pipe->head - pipe->tail;
+        irq_restore(flags);
+
+        if (likely(available))
+        {
+            break;
+        }
+
+        // Another reader took the data in the meantime
+        mutex_unlock(&pipe->read_lock);
     }
 
-finish:
-    log_debug(DEBUG_PIPE, "%u: pipe: %p: read %u B", process_current->pid, pipe, read);
-    return read;
+    count = min(count, available);
+    pipe_copy_from(pipe, pipe->tail, buffer, count);
+
+    irq_save(flags);
+
+    pipe->tail += count;
+
+    log_debug(DEBUG_PIPE, "%u: pipe %p: read %u B", process_current->pid, pipe, count);
+    pipe_wake_all(&pipe->wq);
+
+    irq_restore(flags);
+
+    mutex_unlock(&pipe->read_lock);
+
+    return count;
+}
+
+static void pipe_sigpipe(void)
+{
+    siginfo_t siginfo = {
+        .si_code = SI_KERNEL,
+        .si_pid = process_current->pid,
+        .si_signo = SIGPIPE,
+    };
+
+    do_kill(process_current, &siginfo);
 }
 
 static int pipe_write(file_t* file, const char* buffer, size_t count)
 {
+    int errno;
     flags_t flags;
+    size_t space, chunk;
+    size_t written = 0;
     pipe_t* pipe = file->private;
+    size_t needed = count <= PIPE_ATOMIC_SIZE ? count : 1;
 
-    irq_save(flags);
-
-    for (size_t i = 0; i < count; ++i)
+    while (written < count)
     {
-        fifo_put(&pipe->buffer, buffer[i]);
-    }
+        irq_save(flags);
 
-    irq_restore(flags);
+        while (pipe->readers && PIPE_SIZE - (pipe->head - pipe->tail) < needed)
+        {
+            if (file->mode & O_NONBLOCK)
+            {
+                irq_restore(flags);
+                return written ? (int)written : -EAGAIN;
+            }
 
-    process_t* proc = wait_queue_pop(&pipe->wq);
+            log_debug(DEBUG_PIPE, "%u: pipe %p: waiting for space", process_current->pid, pipe);
+            WAIT_QUEUE_DECLARE(q, process_current);
+            if ((errno = process_wait_locked(&pipe->wq, &q, &flags)))
+            {
+                irq_restore(flags);
+                return written ? (int)written : errno;
+            }
+        }
 
-    log_debug(DEBUG_PIPE, "%u: pipe %p: written %u B", process_current->pid, pipe, count);
+        if (unlikely(!pipe->readers))
+        {
+            irq_restore(flags);
+            pipe_sigpipe();
+            return written ? (int)written : -EPIPE;
+        }
 
-    if (proc)
-    {
-        log_debug_continue(DEBUG_PIPE, "; waking %u", proc->pid);
-        process_wake(proc);
+        irq_restore(flags);
+
+        mutex_lock(&pipe->write_lock);
+
+        irq_save(flags);
+        space = pipe->readers ? PIPE_SIZE - (pipe->head - pipe->tail) : 0;
+        irq_restore(flags);
+
+        if (unlikely(space < needed))
+        {
+            // Another writer filled the pipe or readers went away in the meantime
+            mutex_unlock(&pipe->write_lock);
+            continue;
+        }
+
+        chunk = min(space, count - written);
+
+        if (unlikely(errno = pipe_pages_alloc(pipe, pipe->head, chunk)))
+        {
+            mutex_unlock(&pipe->write_lock);
+            return written ? (int)written : errno;
+        }
+
+        pipe_copy_to(pipe, pipe->head, buffer + written, chunk);
+        written += chunk;
+        needed = 1;
+
+        irq_save(flags);
+
+        pipe->head += chunk;
+
+        log_debug(DEBUG_PIPE, "%u: pipe %p: written %u B", process_current->pid, pipe, chunk);
+        pipe_wake_all(&pipe->rq);
+
+        irq_restore(flags);
+
+        mutex_unlock(&pipe->write_lock);
     }
 
-    return count;
+    return written;
+}
+
+static int pipe_r_poll(file_t* file, short events, short* revents, wait_queue_head_t** head)
+{
+    pipe_t* pipe = file->private;
+
+    *revents = (pipe->head != pipe->tail ? POLLIN : 0) | (pipe->writers ? 0 : POLLHUP);
+    *revents &= events | POLLHUP;
+    *head = &pipe->rq;
+
+    return 0;
+}
+
+static int pipe_w_poll(file_t* file, short events, short* revents, wait_queue_head_t** head)
+{
+    pipe_t* pipe = file->private;
+
+    *revents = pipe->readers
+        ? (PIPE_SIZE - (pipe->head - pipe->tail) >= PIPE_ATOMIC_SIZE ? POLLOUT & events : 0)
+        : POLLERR;
+    *head = &pipe->wq;
+
+    return 0;
 }
 
 static int pipe_r_close(file_t* file)
 {
     pipe_t* pipe = file->private;
     log_debug(DEBUG_PIPE, "%u: pipe %p: closing; refcount %u", process_current->pid, pipe, pipe->count);
-    --pipe->readers;
+    if (!--pipe->readers)
+    {
+        scoped_irq_lock();
+        pipe_wake_all(&pipe->wq);
+    }
     if (!--pipe->count)
     {
-        log_debug(DEBUG_PIPE, "%u: pipe %p: removing", process_current->pid, pipe);
-        delete(pipe);
+        pipe_free(pipe);
     }
-    dentry_delete(file->dentry);
     return 0;
 }
 
@@ -130,20 +352,13 @@ static int pipe_w_close(file_t* file)
     log_debug(DEBUG_PIPE, "%u: pipe %p: closing; refcount %u", process_current->pid, pipe, pipe->count);
     if (!--pipe->writers)
     {
-        process_t* proc = wait_queue_pop(&pipe->wq);
-
-        if (proc)
-        {
-            log_debug_continue(DEBUG_PIPE, "; waking %u", proc->pid);
-            process_wake(proc);
-        }
+        scoped_irq_lock();
+        pipe_wake_all(&pipe->rq);
     }
     if (!--pipe->count)
     {
-        log_debug(DEBUG_PIPE, "%u: pipe %p: removing", process_current->pid, pipe);
-        delete(pipe);
+        pipe_free(pipe);
     }
-    dentry_delete(file->dentry);
     return 0;
 }
 
@@ -158,16 +373,22 @@ static void file_init(file_t* file, pipe_t* pipe, dentry_t* dentry, file_operati
     file->dentry = dentry;
     pipe->count++;
 
+    list_init(&file->epoll_items);
     list_add_tail(&file->files, &files);
 }
 
 static void pipe_init(pipe_t* pipe)
 {
-    fifo_init(&pipe->buffer);
+    wait_queue_head_init(&pipe->rq);
     wait_queue_head_init(&pipe->wq);
+    mutex_init(&pipe->read_lock);
+    mutex_init(&pipe->write_lock);
     pipe->count = 0;
     pipe->readers = 1;
     pipe->writers = 1;
+    pipe->head = 0;
+    pipe->tail = 0;
+    memset(pipe->pages, 0, sizeof(pipe->pages));
 }
 
 static void inode_init(inode_t* inode)
@@ -257,7 +478,7 @@ error:
 
     if (!input && pipe)
     {
-        delete(pipe);
+        pipe_free(pipe);
     }
 
     if (inode_r)
@@ -38,6 +38,9 @@ static int cmdline_show(seq_file_t* s);
 static int uptime_show(seq_file_t* s);
 static int environ_show(seq_file_t* s);
 int syslog_show(seq_file_t* s);
+int schedstat_show(seq_file_t* s);
+int buddyinfo_show(seq_file_t* s);
+int slabinfo_show(seq_file_t* s);
 int maps_show(seq_file_t* s);
 
 typedef struct procfs_pid_data procfs_pid_data_t;
@@ -99,12 +102,18 @@ PROCFS_ENTRY(meminfo);
 PROCFS_ENTRY(cmdline);
 PROCFS_ENTRY(uptime);
 PROCFS_ENTRY(syslog);
+PROCFS_ENTRY(schedstat);
+PROCFS_ENTRY(buddyinfo);
+PROCFS_ENTRY(slabinfo);
 
 static generic_vfs_entry_t root_entries[] = {
     REG(meminfo, S_IFREG | S_IRUGO),
     REG(cmdline, S_IFREG | S_IRUGO),
     REG(uptime, S_IFREG | S_IRUGO),
     REG(syslog, S_IFREG | S_IRUGO),
+    REG(schedstat, S_IFREG | S_IRUGO),
+    REG(buddyinfo, S_IFREG | S_IRUGO),
+    REG(slabinfo, S_IFREG | S_IRUGO),
 };
 
 PROCFS_ENTRY(comm);
@@ -540,7 +549,7 @@ void procfs_unlink(inode_t* inode)
 {
     if (inode->dentry)
     {
-        dentry_delete(inode->dentry);
+        dentry_detach(inode->dentry);
     }
     inode_put(inode);
 }
@@ -595,6 +604,7 @@ static int status_show(seq_file_t* s)
     seq_printf(s, "State:   %c (%s)\n", process_state_char(p->stat), state);
     seq_printf(s, "Pid:     %u\n", p->pid);
     seq_printf(s, "Ppid:    %u\n", p->ppid);
+    seq_printf(s, "Nice:    %d\n", p->nice);
 
     if (p->type == USER_PROCESS)
     {
@@ -628,6 +638,7 @@ static int stack_show(seq_file_t* s)
 static int meminfo_show(seq_file_t* s)
 {
     seq_printf(s, "MemTotal: %u kB\n", usable_ram / KiB);
+    buffer_cache_meminfo(s);
     return 0;
 }
 
@@ -542,6 +542,8 @@ static int ramfs_mount(super_block_t* sb, inode_t* inode, void*, int)
     ram_sb_t* ram_sb;
 
     sb->ops = &ramfs_sb_ops;
+
+    sb->flags = SB_DCACHE;
     sb->module = this_module;
 
     if (!(root = alloc(ram_node_t, memset(this, 0, sizeof(*this)))))
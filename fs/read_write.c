@@ -179,3 +179,63 @@ int sys_lseek(int fd, off_t offset, int whence)
 
     return file->offset;
 }
+
+int sys_ftruncate(int fd, off_t length)
+{
+    file_t* file;
+    inode_t* inode;
+
+    if (unlikely(fd_check_bounds(fd))) return -EBADF;
+    if (unlikely(process_fd_get(process_current, fd, &file))) return -EBADF;
+    if (unlikely(!file->dentry)) return -EINVAL;
+    if (unlikely((file->mode & O_ACCMODE) == O_RDONLY)) return -EBADF;
+
+    inode = file->dentry->inode;
+
+    if (unlikely(!S_ISREG(inode->mode))) return -EINVAL;
+    if (unlikely(!inode->ops || !inode->ops->truncate)) return -ENOSYS;
+    if (unlikely(inode->sb && inode->sb->max_file_size && length > inode->sb->max_file_size)) return -EFBIG;
+
+    return inode->ops->truncate(inode, length);
+}
+
+int sys_sync(void)
+{
+    buffer_cache_sync(0);
+    return 0;
+}
+
+static int fd_sync(int fd)
+{
+    file_t* file;
+    inode_t* inode;
+
+    if (unlikely(fd_check_bounds(fd))) return -EBADF;
+    if (unlikely(process_fd_get(process_current, fd, &file))) return -EBADF;
+    if (unlikely(!file->dentry)) return -EINVAL;
+
+    inode = file->dentry->inode;
+
+    if (S_ISBLK(inode->mode))
+    {
+        return buffer_cache_sync(inode->rdev);
+    }
+
+    // Only file systems on block devices have anything to write back
+    if (!inode->sb || !inode->sb->dev)
+    {
+        return 0;
+    }
+
+    return buffer_cache_sync(inode->sb->dev);
+}
+
+int sys_fsync(int fd)
+{
+    return fd_sync(fd);
+}
+
+int sys_fdatasync(int fd)
+{
+    return fd_sync(fd);
+}
@@ -83,11 +83,11 @@ static int do_poll(struct pollfd* fds, const unsigned long nfds, timeval_t* time
                 goto error;
             }
 
-            if (!data[i].head)
+            if (data[i].fd->revents)
             {
                 ++ready;
             }
-            else
+            else if (data[i].head)
             {
                 wait_queue_push(&data[i].queue, data[i].head);
             }
@@ -317,6 +317,8 @@ typedef struct
 
 #define AT_MINSIGSTKSZ          51 /* Stack needed for signal delivery  */
 
+#define AT_VDSO_DATA            64 /* Address of the vdso_data page */
+
 typedef struct
 {
     uint32_t a_type;    /* Entry type */
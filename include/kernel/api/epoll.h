@@ -0,0 +1,42 @@
+#pragma once
+
+#include <common/bits.h>
+#include <kernel/api/poll.h>
+#include <kernel/api/types.h>
+#include <kernel/api/fcntl.h>
+
+__BEGIN_DECLS
+
+#define EPOLLIN         POLLIN
+#define EPOLLPRI        POLLPRI
+#define EPOLLOUT        POLLOUT
+#define EPOLLERR        POLLERR
+#define EPOLLHUP        POLLHUP
+#define EPOLLONESHOT    (1U << 30)
+#define EPOLLET         (1U << 31)
+
+#define EPOLL_CTL_ADD   1
+#define EPOLL_CTL_DEL   2
+#define EPOLL_CTL_MOD   3
+
+#define EPOLL_CLOEXEC   O_CLOEXEC
+
+typedef union epoll_data
+{
+    void*    ptr;
+    int      fd;
+    uint32_t u32;
+    uint64_t u64;
+} epoll_data_t;
+
+struct epoll_event
+{
+    uint32_t     events;
+    epoll_data_t data;
+};
+
+int epoll_create1(int flags);
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event);
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout);
+
+__END_DECLS
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <common/bits.h>
+#include <kernel/api/time.h>
+
+__BEGIN_DECLS
+
+#define FUTEX_WAIT          0
+#define FUTEX_WAKE          1
+#define FUTEX_REQUEUE       3
+#define FUTEX_CMP_REQUEUE   4
+#define FUTEX_PRIVATE_FLAG  128
+
+// For FUTEX_REQUEUE and FUTEX_CMP_REQUEUE, timeout carries the maximum
+// number of requeued waiters
+int futex(int* uaddr, int op, int val, const struct timespec* timeout, int* uaddr2, int val3);
+
+__END_DECLS
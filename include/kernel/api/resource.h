@@ -0,0 +1,11 @@
+#pragma once
+
+#include <common/bits.h>
+
+__BEGIN_DECLS
+
+#define PRIO_PROCESS    0
+#define PRIO_PGRP       1
+#define PRIO_USER       2
+
+__END_DECLS
@@ -83,11 +83,23 @@
 #define __NR_pinsyscalls    80
 #define __NR_chmod          81
 #define __NR_timer_delete   82
+#define __NR_nice           83
+#define __NR_getpriority    84
+#define __NR_setpriority    85
+#define __NR_sync           86
+#define __NR_fsync          87
+#define __NR_fdatasync      88
+#define __NR_ftruncate      89
+#define __NR_epoll_create1  90
+#define __NR_epoll_ctl      91
+#define __NR_epoll_wait     92
+#define __NR_futex          93
 
-#define __NR_syscalls       83
+#define __NR_syscalls       94
 
 #ifndef __ASSEMBLER__
 
+struct epoll_event;
 struct fd_set;
 struct itimerspec;
 struct pollfd;
@@ -107,6 +119,9 @@ struct timezone;
 #ifndef __syscall0
 #define __syscall0(...)
 #endif
+#ifndef __syscall0_void
+#define __syscall0_void(...)
+#endif
 #ifndef __syscall1
 #define __syscall1(...)
 #endif
@@ -211,3 +226,14 @@ __syscall1(set_thread_area, int, uintptr_t)
 __syscall2(pinsyscalls, int, void*, size_t)
 __syscall2(chmod, int, const char*, mode_t)
 __syscall1(timer_delete, int, timer_t)
+__syscall1(nice, int, int)
+__syscall2(getpriority, int, int, id_t)
+__syscall3(setpriority, int, int, id_t, int)
+__syscall0_void(sync, void)
+__syscall1(fsync, int, int)
+__syscall1(fdatasync, int, int)
+__syscall2(ftruncate, int, int, off_t)
+__syscall1(epoll_create1, int, int)
+__syscall4(epoll_ctl, int, int, int, int, struct epoll_event*)
+__syscall4(epoll_wait, int, int, struct epoll_event*, int, int)
+__syscall6(futex, int, int*, int, int, const struct timespec*, int*, int)
@@ -54,7 +54,10 @@ int pipe(int pipefd[2]);
 int lchown(const char* pathname, uid_t owner, gid_t group);
 int fchown(int fd, uid_t owner, gid_t group);
 int fsync(int fildes);
+int fdatasync(int fildes);
+void sync(void);
 int rmdir(const char* pathname);
+int nice(int inc);
 
 ssize_t readlink(const char* pathname, char* buf, size_t bufsiz);
 
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <common/bits.h>
+#include <kernel/api/types.h>
+
+__BEGIN_DECLS
+
+#define VDSO_CLOCK_NONE     0   /* Clock cannot be read from the user space */
+#define VDSO_CLOCK_TSC      1
+
+// Read-only page mapped to each process; its address is passed in AT_VDSO_DATA.
+// Fields are valid if seq was even and unchanged before and after reading them
+struct vdso_data
+{
+    uint32_t seq;
+    uint32_t clock_mode;
+    uint64_t cycles;    /* Clock value at the last update */
+    uint64_t mask;
+    uint32_t mult_ns;
+    uint32_t shift_ns;
+    uint32_t sec;       /* CLOCK_MONOTONIC at the last update */
+    uint32_t nsec;
+    uint32_t realtime;  /* Offset of CLOCK_REALTIME from CLOCK_MONOTONIC in seconds */
+};
+
+typedef struct vdso_data vdso_data_t;
+
+__END_DECLS
@@ -1,10 +1,34 @@
 #pragma once
 
 #include <kernel/fs.h>
+#include <kernel/list.h>
+#include <kernel/wait.h>
+
+struct blkdev;
+
+typedef struct bio bio_t;
+typedef struct blkdev_plug blkdev_plug_t;
+typedef struct blkdev_segment blkdev_segment_t;
+typedef void (*bio_end_io_t)(bio_t* bio);
+
+struct blkdev_segment
+{
+    void*  buffer;
+    size_t size;
+};
 
 struct blkdev_ops
 {
     int (*read)(void* blkdev, size_t offset, void* buffer, size_t size, bool irq);
+    int (*write)(void* blkdev, size_t offset, const void* buffer, size_t size, bool irq);
+
+    // Optional; transfer consecutive sectors from/to several buffers with a single command
+    int (*readv)(void* blkdev, size_t offset, const blkdev_segment_t* segs, size_t count, bool irq);
+    int (*writev)(void* blkdev, size_t offset, const blkdev_segment_t* segs, size_t count, bool irq);
+
+    // Optional; makes data written so far persistent
+    int (*flush)(void* blkdev);
+
     int (*medium_detect)(void* blkdev, size_t* block_size, size_t* sectors);
 };
 
@@ -17,9 +41,60 @@ struct blkdev_char
     uint16_t    major;
     size_t      block_size;
     size_t      sectors;
+    size_t      max_sectors; // Maximal number of sectors of a single command; 0 if unlimited
 };
 
 typedef struct blkdev_char blkdev_char_t;
 
+// Maximal number of bios merged into a single request
+#define BLKDEV_MAX_SEGMENTS 32
+
+#define BIO_READ    0
+#define BIO_WRITE   1
+
+struct bio
+{
+    int               op;         // BIO_READ or BIO_WRITE
+    dev_t             dev;        // Device or partition
+    uint32_t          sector;     // First sector, relative to dev
+    size_t            count;      // Number of sectors
+    void*             buffer;
+    int               errno;
+    bool              done;
+    bio_end_io_t      end_io;     // Called on completion; optional
+    void*             private;
+
+    // Used by the block layer
+    struct blkdev*    blkdev;
+    uint32_t          lba;
+    wait_queue_head_t queue;
+    list_head_t       list_entry;
+};
+
+// Bios submitted with a plug are only collected; they are sorted and
+// merged once the plug is removed, so that a batch of adjacent reads
+// becomes a few large commands
+struct blkdev_plug
+{
+    list_head_t bios;
+};
+
 int blkdev_register(blkdev_char_t* blk, void* data, blkdev_ops_t* ops);
 int blkdev_free(int major, int id);
+
+void bio_init(bio_t* bio, int op, dev_t dev, uint32_t sector, size_t count, void* buffer);
+int bio_submit(bio_t* bio, blkdev_plug_t* plug);
+int bio_wait(bio_t* bio);
+
+void blkdev_plug(blkdev_plug_t* plug);
+void blkdev_unplug(blkdev_plug_t* plug);
+
+// Returns 0 if device does not exist or its medium is unknown
+size_t blkdev_block_size(dev_t dev);
+
+// Records failure of a write whose issuer doesn't wait for it; it's
+// returned by the next blkdev_flush() of the device
+void blkdev_write_error(dev_t dev, int errno);
+
+// Flushes volatile cache of dev, or of all devices if dev is 0
+int blkdev_flush(dev_t dev);
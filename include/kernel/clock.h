@@ -22,6 +22,7 @@ struct clock_source
     uint32_t mult_ns;
     uint32_t shift_ns;
     uint32_t read_overhead;
+    uint32_t vdso_mode;
 
     void (*read_rtc)(rtc_meas_t*);
 
@@ -2,6 +2,8 @@
 
 #include <stddef.h>
 #include <arch/cpuid.h>
+#include <arch/percpu.h>
+#include <kernel/sections.h>
 
 struct cpu_info
 {
@@ -26,3 +28,8 @@ struct cpu_info
 typedef struct cpu_info cpu_info_t;
 
 extern struct cpu_info cpu_info;
+
+// CPUs are identified by their local APIC id, the same
+// way per_cpu_data is indexed
+#define this_cpu_id() \
+    ({ THIS_CPU_GET(cpu_info)->lapic_id; })
@@ -2,21 +2,59 @@
 
 #include <stdint.h>
 #include <kernel/list.h>
+#include <kernel/compiler.h>
 
 struct inode;
 typedef struct dentry dentry_t;
 
+// Dentries are kept in a hash table keyed by parent and name, which holds
+// one reference to each of them; each dentry also holds a reference to its
+// parent. Dentries of file systems with SB_DCACHE own their inodes, may be
+// negative (with NULL inode) for names which don't exist, and are reclaimed
+// in LRU order once nothing else references them
 struct dentry
 {
     struct inode* inode;
     char*         name;
-    list_head_t   cache;
+    uint32_t      hash;
+    bool          reclaimable;
+    list_head_t   hash_entry;
+    list_head_t   lru;
     list_head_t   child;
     list_head_t   subdirs;
     dentry_t*     parent;
     uint16_t      refcount;
 };
 
+// Number of reclaimable dentries above which they're freed on creation
+#define DENTRY_CACHE_MAX    4096
+
+// Creates hashed dentry; inode may be NULL only if the parent belongs
+// to a file system with SB_DCACHE
 dentry_t* dentry_create(struct inode* inode, dentry_t* parent_dentry, const char* name);
+
+// Returns dentry without taking a reference; it may be negative
 dentry_t* dentry_lookup(dentry_t* parent_dentry, const char* name);
-void dentry_delete(dentry_t* dentry);
+
+void dentry_get(dentry_t* dentry);
+void dentry_put(dentry_t* dentry);
+
+// Removes dentry from its parent, so that it's no longer found by lookup;
+// files which have it opened still can use it
+void dentry_detach(dentry_t* dentry);
+
+// Detaches all children of the dentry, including negative ones
+void dentry_prune(dentry_t* dentry);
+
+// Frees up to count unused dentries; returns number of freed ones
+size_t dentry_cache_shrink(size_t count);
+
+static inline void __dentry_put(dentry_t** dentry)
+{
+    if (*dentry)
+    {
+        dentry_put(*dentry);
+    }
+}
+
+#define scoped_dentry_t CLEANUP(__dentry_put) dentry_t
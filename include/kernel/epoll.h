@@ -0,0 +1,8 @@
+#pragma once
+
+#include <kernel/api/epoll.h>
+
+struct file;
+
+// Removes file from all epoll instances; called when its last reference is dropped
+void epoll_file_release(struct file* file);
@@ -18,6 +18,7 @@
 #define BLOCK_SIZE       1024
 
 typedef struct file file_t;
+typedef struct file_ra file_ra_t;
 typedef struct inode inode_t;
 typedef struct buffer buffer_t;
 typedef struct fd_set fd_set_t;
@@ -29,6 +30,8 @@ typedef struct inode_operations inode_operations_t;
 typedef struct super_operations super_operations_t;
 typedef struct statfs statfs_t;
 
+struct seq_file;
+
 struct inode
 {
     dev_t               dev;
@@ -58,6 +61,18 @@ struct inode_operations
     int (*create)(inode_t* parent, const char* name, int, int, inode_t** result);
     int (*mkdir)(inode_t* parent, const char* name, int, int, inode_t** result);
     int (*readlink)(inode_t* inode, char* buffer, size_t size);
+    int (*unlink)(inode_t* parent, const char* name);
+    int (*rmdir)(inode_t* parent, const char* name);
+    int (*rename)(inode_t* old_parent, const char* old_name, inode_t* new_parent, const char* new_name);
+    int (*truncate)(inode_t* inode, size_t size);
+};
+
+// Readahead state of an open file; all fields are page indices
+struct file_ra
+{
+    size_t next;    // Page following the previous read
+    size_t end;     // Page following the last one read ahead
+    size_t size;    // Size of the last window; 0 if access isn't sequential
 };
 
 struct file
@@ -69,6 +84,8 @@ struct file
     list_head_t        files;
     file_operations_t* ops;
     void*              private;
+    file_ra_t          ra;
+    list_head_t        epoll_items;
 };
 
 typedef int (*direntadd_t)(void* buf, const char* name, size_t name_len, ino_t ino, char type);
@@ -80,11 +97,18 @@ struct file_operations
     int (*readdir)(file_t* file, void* buf, direntadd_t dirent_add);
     int (*mmap)(file_t* file, vm_area_t* vma);
     int (*ioctl)(file_t* file, unsigned long request, void* arg);
+    // Sets revents to the ready events and head to the queue which is woken
+    // when they may change
     int (*poll)(file_t* file, short events, short* revents, wait_queue_head_t** head);
     int (*open)(file_t* file);
     int (*close)(file_t* file);
 };
 
+// Directories change only through VFS operations and inodes aren't held
+// by the file system, so missing names may be cached and unused dentries
+// reclaimed together with their inodes
+#define SB_DCACHE   (1 << 0)
+
 struct super_block
 {
     dev_t dev;
@@ -95,13 +119,17 @@ struct super_block
     list_head_t super_blocks;
 
     // Those are filled by specific fs during mount() call
+    unsigned int flags;
     unsigned int module;
     size_t block_size;
+    size_t max_file_size; // 0 if files aren't limited by the file system
     void* fs_data;
 };
 
 struct super_operations
 {
+    // Called when the last reference of the inode is dropped
+    void (*inode_release)(inode_t* inode);
 };
 
 struct file_system
@@ -127,14 +155,13 @@ struct mounted_system
 
 typedef struct mounted_system mounted_system_t;
 
+// Block of a device; buffers are embedded in a page cache entry, which
+// holds the page with PAGE_SIZE / BLOCK_SIZE consecutive blocks
 struct buffer
 {
-    list_head_t entry;
     size_t block;
     page_t* page;
     dev_t dev;
-    size_t count;
-    list_head_t buf_in_page;
     void* data;
 };
 
@@ -147,6 +174,7 @@ int file_system_register(file_system_t* fs);
 #define LOOKUP_NOFOLLOW 0
 #define LOOKUP_FOLLOW   1
 
+// On success, result is referenced and has to be released with dentry_put()
 int lookup(const char* filename, int flag, dentry_t* start, dentry_t** result);
 
 int do_mount(const char* source, const char* target, const char* filesystemtype, unsigned long mountflags);
@@ -176,7 +204,60 @@ void inode_put(inode_t* inode);
 
 void file_systems_print(void);
 
+// Pages of block devices and of regular files are kept in a single cache
+// keyed by (dev, ino, page index), where ino is 0 for a block device.
+// Each returned buffer or page holds a reference to its cache entry,
+// which must be dropped with block_put()/file_page_put(); unreferenced
+// entries are reclaimed in LRU order under memory pressure
+typedef int (*readpage_t)(inode_t* inode, page_t* page, size_t index);
+typedef void (*readahead_t)(inode_t* inode, size_t offset, size_t size);
+
 buffer_t* block_read(dev_t dev, file_t* file, uint32_t block);
+void block_get(buffer_t* b);
+void block_put(buffer_t* b);
+
+// Starts reading count blocks starting from block into the cache without
+// waiting; missing pages are read with a batch of bios, which the block
+// layer merges into requests as large as the device allows. block_read()
+// waits for a page being read, and retries the read if it failed
+void blocks_prefetch(dev_t dev, uint32_t block, size_t count);
+
+// Marks size bytes starting at the block as modified; they cannot cross
+// the page. Blocks are written back in background by the flusher, or by
+// the caller itself if there are too many dirty pages
+void block_mark_dirty(buffer_t* b, size_t size);
+
+page_t* file_page_read(inode_t* inode, size_t index, readpage_t readpage);
+void file_page_put(page_t* page);
+
+// Drops cached pages of inode ino on dev covering given range, so that
+// they are read again after the file is modified or its inode is reused
+void file_pages_invalidate(dev_t dev, ino_t ino, size_t offset, size_t size);
+
+// Generic nopage for file systems using the cache; page is shared with
+// the cache whenever possible and is mapped read-only then. On a miss,
+// readahead (if given) is asked to start reading the pages around
+int file_page_nopage(
+    vm_area_t* vma,
+    uintptr_t address,
+    size_t size,
+    page_t** page,
+    readpage_t readpage,
+    readahead_t readahead);
+
+// Updates readahead state with a read of count bytes at offset; if access
+// is sequential and the previous window is being consumed, returns true
+// and sets the byte range which should be read ahead. Window starts small
+// and doubles with each one issued
+bool file_readahead(file_ra_t* ra, size_t offset, size_t count, size_t* start, size_t* size);
+
+// Evict up to count unused pages; returns number of freed pages
+size_t buffer_cache_shrink(size_t count);
+void buffer_cache_meminfo(struct seq_file* s);
+
+// Writes back dirty pages of dev (of all devices if 0) and flushes the
+// device cache; returns the first writeback error since the last sync
+int buffer_cache_sync(dev_t dev);
 
 static inline void __close(file_t** file)
 {
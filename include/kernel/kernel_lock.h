@@ -0,0 +1,12 @@
+#pragma once
+
+struct process;
+
+// Kernel lock serializes execution of the kernel code between CPUs, so that
+// code relying on disabling interrupts for mutual exclusion stays correct
+// on SMP. It is taken on each entry to the kernel and released when CPU
+// goes back to the user space or halts in idle. Entries are nested per CPU;
+// depth is saved and restored on each context switch
+void kernel_lock_enter(void);
+void kernel_lock_leave(void);
+void kernel_lock_switch(struct process* prev, struct process* next);
@@ -12,6 +12,15 @@ typedef enum
     PAGE_ALLOC_ZEROED       = 8,
 } alloc_flag_t;
 
+// Free pages are kept in blocks of 2^order pages; the largest
+// block which can be allocated contiguously is 16 MiB
+#define PAGE_ORDERS             13
+
+// Single pages are allocated from per-CPU caches, which are refilled
+// and drained in batches; cache holds at most PAGE_CACHE_HIGH pages
+#define PAGE_CACHE_BATCH        16
+#define PAGE_CACHE_HIGH         64
+
 // Allocate a page(s) and map it/them in kernel; allocation of
 // multiple pages is done according to PAGE_ALLOC_* flags.
 // Returned pages are linked together through list_entry (first
@@ -20,6 +29,7 @@ MUST_CHECK(page_t*) __page_alloc(int count, alloc_flag_t flag);
 MUST_CHECK(page_t*) pages_split(page_t* pages, size_t pages_to_keep);
 void pages_merge(page_t* new_pages, page_t* pages);
 void __pages_free(page_t* pages);
+void page_alloc_init(void);
 
 void page_kernel_map(page_t* page, pgprot_t prot);
 void page_kernel_unmap(page_t* page);
@@ -24,11 +24,19 @@
 #define page_beginning(address) ((address) & ~PAGE_MASK)
 #define kernel_address(address) ((address) >= KERNEL_PAGE_OFFSET)
 
+#define PAGE_FREE               1   // Page is the first one of a free block
+#define PAGE_FILE               2   // Page is owned by a file system and shared
+                                    // with its mappings; stays mapped in kernel
+#define PAGE_SLAB               4   // Page belongs to a slab pointed by private
+
 struct page
 {
     uint16_t    refcount;
+    uint8_t     order;
+    uint8_t     flags;
     size_t      pages_count;
     void*       virtual;
+    void*       private;    // Data of the page owner, e.g. slab
 #if DEBUG_PAGE_DETAILED
     void*       caller;
 #endif
@@ -6,12 +6,15 @@
 #include <kernel/mutex.h>
 #include <kernel/dentry.h>
 #include <kernel/kernel.h>
+#include <kernel/rbtree.h>
 #include <kernel/signal.h>
 #include <kernel/api/wait.h>
 #include <kernel/segmexec.h>
 #include <kernel/api/sched.h>
 #include <kernel/page_alloc.h>
 
+#include <arch/percpu.h>
+
 typedef struct process process_t;
 
 #define STACK_MAGIC 0xdeadc0de
@@ -114,7 +117,7 @@ struct process
     task_type_t type:1;
     stat_t      stat:2;
     int         trace:3;
-    list_head_t running;
+    rb_node_t   run_node;
     unsigned    context_switches;
     unsigned    forks;
     pid_t       pid;
@@ -139,6 +142,11 @@ struct process
 
     // Cacheline 2
     int         alarm;
+    int         cpu;
+    int         kernel_lock_depth;
+    int         nice;
+    uint64_t    vruntime;
+    uint64_t    exec_start;
     list_head_t children;
     list_head_t siblings;
     list_head_t processes;
@@ -170,7 +178,7 @@ struct process
         .signals    = &proc##_signals, \
         .wait_child = WAIT_QUEUE_HEAD_INIT(proc.wait_child), \
         .processes  = LIST_INIT(proc.processes), \
-        .running    = LIST_INIT(proc.running), \
+        .run_node   = RB_NODE_INIT(proc.run_node), \
         .children   = LIST_INIT(proc.children), \
         .siblings   = LIST_INIT(proc.siblings), \
         .type       = KERNEL_PROCESS, \
@@ -186,9 +194,9 @@ struct process
 
 extern unsigned* need_resched;
 extern process_t init_process;
-extern process_t* process_current;
+extern process_t* current_process;
 
-extern list_head_t running;
+#define process_current (*THIS_CPU_GET(current_process))
 
 extern pid_t last_pid;
 extern unsigned int total_forks;
@@ -200,11 +208,15 @@ int processes_init();
 int process_clone(process_t* parent, struct pt_regs* regs, int clone_flags);
 void process_exit(process_t* p);
 process_t* process_spawn(const char* name, process_entry_t entry, void* args, int flags);
+process_t* process_idle_create(void* kernel_stack);
 int process_find(int pid, process_t** p);
 void process_wake_waiting(process_t* p);
 int process_find_free_fd(process_t* p, int* fd);
 int process_find_free_fd_at(process_t* p, int at, int* fd);
 void scheduler();
+void runqueue_add(process_t* p);
+void runqueue_del(process_t* p);
+int runqueue_select(void);
 void processes_stats_print(void);
 int do_exec(const char* pathname, const char* const argv[], const char* const envp[]);
 
@@ -260,7 +272,7 @@ static inline void process_stop(process_t* p)
 {
     scoped_irq_lock();
 
-    list_del(&p->running);
+    runqueue_del(p);
     p->stat = PROCESS_STOPPED;
     process_wake_waiting(p);
 
@@ -282,7 +294,7 @@ static inline void NONNULL() process_wake(process_t* p)
 
     if (p->stat != PROCESS_RUNNING)
     {
-        list_add_tail(&p->running, &running);
+        runqueue_add(p);
     }
 
     p->stat = PROCESS_RUNNING;
@@ -303,7 +315,7 @@ static inline int process_wait(wait_queue_head_t* wq, wait_queue_t* q)
         log_debug(DEBUG_EXIT, "%u waiting", process_current->pid);
 
         wait_queue_push(q, wq);
-        list_del(&process_current->running);
+        runqueue_del(process_current);
         process_current->stat = PROCESS_WAITING;
     }
 
@@ -327,7 +339,7 @@ static inline int process_wait(wait_queue_head_t* wq, wait_queue_t* q)
 static inline int process_wait_locked(wait_queue_head_t* wq, wait_queue_t* q, flags_t* flags)
 {
     wait_queue_push(q, wq);
-    list_del(&process_current->running);
+    runqueue_del(process_current);
     process_current->stat = PROCESS_WAITING;
 
     irq_restore(*flags);
@@ -348,7 +360,7 @@ static inline int process_wait_locked(wait_queue_head_t* wq, wait_queue_t* q, fl
 
 static inline void process_wait2(flags_t flags)
 {
-    list_del(&process_current->running);
+    runqueue_del(process_current);
     process_current->stat = PROCESS_WAITING;
     irq_restore(flags);
     scheduler();
@@ -406,6 +418,8 @@ static inline void process_fs_exit(process_t* p)
 {
     if (!--p->fs->refcount)
     {
+        __dentry_put(&p->fs->cwd);
+        __dentry_put(&p->fs->root);
         delete(p->fs);
     }
 }
@@ -415,6 +429,16 @@ static inline int current_can_kill(process_t* p)
     return p->pid != 0;
 }
 
+static inline int current_is_root(void)
+{
+    return process_current->uid == 0;
+}
+
+static inline int current_can_renice(process_t* p)
+{
+    return !process_is_kernel(p) && (current_is_root() || p->uid == process_current->uid);
+}
+
 static inline vm_area_t* process_code_vm_area(process_t* p)
 {
     uintptr_t code_start = p->mm->code_start;
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <kernel/compiler.h>
+
+// Intrusive red-black tree; node is embedded in the entry and the caller
+// walks the tree to find the link for a new node, as the ordering is
+// known only to the caller:
+//
+//  rb_node_t** link = &root->node;
+//  rb_node_t* parent = NULL;
+//  bool leftmost = true;
+//
+//  while (*link)
+//  {
+//      parent = *link;
+//      if (key < rb_entry(parent, type, node)->key)
+//      {
+//          link = &parent->left;
+//      }
+//      else
+//      {
+//          link = &parent->right;
+//          leftmost = false;
+//      }
+//  }
+//
+//  rb_link_node(&entry->node, parent, link);
+//  rb_insert_color(root, &entry->node, leftmost);
+//
+// Root caches the leftmost node, so rb_first() is O(1)
+
+struct rb_node
+{
+    struct rb_node* parent;
+    struct rb_node* left;
+    struct rb_node* right;
+    int             color;
+};
+
+typedef struct rb_node rb_node_t;
+
+struct rb_root
+{
+    rb_node_t* node;
+    rb_node_t* leftmost;
+};
+
+typedef struct rb_root rb_root_t;
+
+#define RB_RED      0
+#define RB_BLACK    1
+
+#define RB_ROOT_INIT        { NULL, NULL }
+#define RB_NODE_INIT(name)  { .parent = &(name) }
+
+#define rb_entry(ptr, type, member) \
+    ({ \
+       typecheck(rb_node_t*, ptr); \
+       ((type*)(ADDR(ptr) - ADDR(offsetof(type, member)))); \
+    })
+
+#define rb_entry_safe(ptr, type, member) \
+    ({ \
+       rb_node_t* __ptr = (ptr); \
+       __ptr ? rb_entry(__ptr, type, member) : NULL; \
+    })
+
+static inline void rb_root_init(rb_root_t* root)
+{
+    root->node = NULL;
+    root->leftmost = NULL;
+}
+
+// Node which is not in any tree points to itself
+static inline void rb_node_init(rb_node_t* node)
+{
+    node->parent = node;
+}
+
+static inline bool rb_node_empty(rb_node_t* node)
+{
+    return node->parent == node;
+}
+
+static inline bool rb_empty(rb_root_t* root)
+{
+    return !root->node;
+}
+
+static inline rb_node_t* rb_first(rb_root_t* root)
+{
+    return root->leftmost;
+}
+
+static inline void rb_link_node(rb_node_t* node, rb_node_t* parent, rb_node_t** link)
+{
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->color = RB_RED;
+    *link = node;
+}
+
+void rb_insert_color(rb_root_t* root, rb_node_t* node, bool leftmost);
+void rb_erase(rb_root_t* root, rb_node_t* node);
+rb_node_t* rb_last(rb_root_t* root);
+rb_node_t* rb_next(rb_node_t* node);
+rb_node_t* rb_prev(rb_node_t* node);
+
+#define rb_for_each_entry(pos, root, member) \
+    for (pos = rb_entry_safe(rb_first(root), typeof(*pos), member); \
+         pos; \
+         pos = rb_entry_safe(rb_next(&pos->member), typeof(*pos), member))
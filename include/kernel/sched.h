@@ -0,0 +1,48 @@
+#pragma once
+
+#include <arch/smp.h>
+#include <kernel/rbtree.h>
+#include <kernel/spinlock.h>
+
+struct process;
+
+struct runqueue
+{
+    spinlock_t      lock;
+    rb_root_t       queue;
+    uint64_t        min_vruntime;
+    unsigned        nr_running;
+    unsigned        migrations;
+    unsigned        ticks;
+    int             cpu;
+    struct process* curr;
+    struct process* idle;
+};
+
+// Period of the load balancing done on each CPU tick
+#define SCHED_BALANCE_TICKS 10
+
+#define NICE_MIN        -20
+#define NICE_MAX        19
+#define NICE_0_WEIGHT   1024
+
+// Virtual runtime by which running process may exceed the leftmost one
+// before it's preempted; it bounds the number of switches between
+// processes of the same weight
+#define SCHED_GRANULARITY_NS    4000000ULL
+
+// Woken up process is placed this much before the minimal virtual runtime
+// of the run queue, so that interactive processes are picked before CPU hogs
+#define SCHED_WAKEUP_CREDIT_NS  10000000ULL
+
+typedef struct runqueue runqueue_t;
+
+extern runqueue_t* runqueues[];
+
+#define for_each_runqueue(rq, i) \
+    for (i = 0; i < CPU_COUNT; ++i) \
+        if (((rq) = runqueues[i]))
+
+void sched_cpu_init(struct process* idle);
+void sched_tick(void);
+void sched_ipi(void);
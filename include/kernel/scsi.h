@@ -12,6 +12,8 @@ typedef struct scsi_capacity scsi_capacity_t;
 
 #define SCSI_CMD_READ_CAPACITY  0x25
 #define SCSI_CMD_READ           0xa8
+#define SCSI_CMD_WRITE          0xaa
+#define SCSI_CMD_SYNC_CACHE     0x35
 #define SCSI_CMD_INQUIRY        0x12
 #define SCSI_CMD_EJECT          0x1b
 
@@ -62,6 +64,31 @@ struct scsi_inquiry
         } \
     }
 
+#define SCSI_WRITE_PACKET(lba, sectors) \
+    (scsi_packet_t){ \
+        .data = { \
+            SCSI_CMD_WRITE, \
+            0, \
+            (lba >> 24) & 0xff, \
+            (lba >> 16) & 0xff, \
+            (lba >> 8) & 0xff, \
+            (lba >> 0) & 0xff, \
+            (sectors >> 24) & 0xff, \
+            (sectors >> 16) & 0xff, \
+            (sectors >> 8) & 0xff, \
+            (sectors >> 0) & 0xff, \
+            0, \
+            0, \
+        } \
+    }
+
+#define SCSI_SYNC_CACHE_PACKET() \
+    (scsi_packet_t){ \
+        .data = { \
+            SCSI_CMD_SYNC_CACHE, \
+        } \
+    }
+
 #define SCSI_READ_CAPACITY_PACKET() \
     (scsi_packet_t){ \
         .data = { \
@@ -19,6 +19,7 @@ typedef struct timeval timeval_t;
 typedef struct timespec timespec_t;
 
 void timestamp_get(timeval_t* ts);
+time_t time_now(void);
 void timestamp_update(void);
 void udelay(size_t useconds);
 void mdelay(size_t mseconds);
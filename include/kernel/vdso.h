@@ -0,0 +1,10 @@
+#pragma once
+
+#include <kernel/api/vdso.h>
+
+struct mm;
+
+extern vdso_data_t* vdso_data;
+
+// Maps vdso data page read-only to the mm; returns its user address
+int vdso_map(struct mm* mm, uintptr_t* address);
@@ -21,6 +21,7 @@ typedef struct vm_operations vm_operations_t;
 
 #define VM_TYPE_STACK   1
 #define VM_TYPE_HEAP    2
+#define VM_TYPE_VDSO    3
 
 #define VM_TYPE(type)    ((type) << 24)
 #define VM_TYPE_GET(val) ((val) >> 24)
@@ -58,6 +59,13 @@ int vm_free(vm_area_t* vma_list, pgd_t* pgd);
 int vm_copy(vm_area_t* dest_vma, const vm_area_t* src_vma, pgd_t* dest_pgd, pgd_t* src_pgd, struct mm* dest_mm);
 int vm_nopage(pgd_t* pgd, uintptr_t address, bool write, bool exec);
 
+// Maps pages of the current process backing the buffer, copying the shared
+// ones if write is set, so that a device can access them by physical address
+int vm_fault_in(const void* buffer, size_t size, bool write);
+
+// Maps page read-only at address of vma, taking a reference to it
+int vm_page_insert(vm_area_t* vma, page_t* page, uintptr_t address);
+
 uintptr_t vm_paddr(uintptr_t vaddr, const pgd_t* pgd);
 
 // vm_replace - replace vm areas <replace_start, replace_end> with <new_vmas, new_vmas_end>
@@ -6,15 +6,22 @@
 
 struct process;
 
+typedef struct wait_queue wait_queue_t;
+
+// Called instead of waking data when the entry is popped; returns process
+// which should be woken, or NULL to continue with the next entry. Callbacks
+// don't consume a wakeup, so all of them are run on each pop; for ones
+// queued behind the popped process the result is ignored
+typedef struct process* (*wait_queue_func_t)(wait_queue_t* queue);
+
 struct wait_queue
 {
     int flags;
     struct process* data;
+    wait_queue_func_t func;
     list_head_t processes;
 };
 
-typedef struct wait_queue wait_queue_t;
-
 struct wait_queue_head
 {
     spinlock_t lock;
@@ -32,11 +39,17 @@ typedef struct wait_queue_head wait_queue_head_t;
 
 // Defines for wait_queue
 #define WAIT_QUEUE_INIT(name, process) \
-    { 0, process, LIST_INIT((name).processes) }
+    { 0, process, NULL, LIST_INIT((name).processes) }
 
 #define WAIT_QUEUE_DECLARE(name, process) \
     wait_queue_t name = WAIT_QUEUE_INIT(name, process)
 
+#define wait_queue_entry(ptr, type, member) \
+    ({ \
+       typecheck(wait_queue_t*, ptr); \
+       ((type*)(ADDR(ptr) - ADDR(offsetof(type, member)))); \
+    })
+
 static inline void wait_queue_head_init(wait_queue_head_t* head)
 {
     list_init(&head->queue);
@@ -47,6 +60,15 @@ static inline void wait_queue_init(wait_queue_t* queue, struct process* proc)
 {
     queue->flags = 0;
     queue->data = proc;
+    queue->func = NULL;
+    list_init(&queue->processes);
+}
+
+static inline void wait_queue_callback_init(wait_queue_t* queue, wait_queue_func_t func)
+{
+    queue->flags = 0;
+    queue->data = NULL;
+    queue->func = func;
     list_init(&queue->processes);
 }
 
@@ -69,7 +91,7 @@ static inline void wait_queue_del(wait_queue_t* queue)
 
 static inline struct process* __wait_queue_pop(wait_queue_head_t* head)
 {
-    void* data;
+    void* data = NULL;
     struct wait_queue* queue;
 
     if (wait_queue_empty(head))
@@ -78,10 +100,22 @@ static inline struct process* __wait_queue_pop(wait_queue_head_t* head)
     }
 
     spinlock_lock(&head->lock);
-    queue = list_next_entry(&head->queue, struct wait_queue, processes);
-    data = queue->data;
 
-    wait_queue_del(queue);
+    while (!data && !wait_queue_empty(head))
+    {
+        queue = list_next_entry(&head->queue, struct wait_queue, processes);
+        wait_queue_del(queue);
+        data = queue->func ? queue->func(queue) : queue->data;
+    }
+
+    list_for_each_entry_safe(queue, &head->queue, processes)
+    {
+        if (queue->func)
+        {
+            wait_queue_del(queue);
+            queue->func(queue);
+        }
+    }
 
     spinlock_unlock(&head->lock);
 
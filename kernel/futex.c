@@ -0,0 +1,280 @@
+#include <kernel/time.h>
+#include <kernel/timer.h>
+#include <kernel/signal.h>
+#include <kernel/process.h>
+#include <kernel/api/futex.h>
+
+#define DEBUG_FUTEX         0
+#define FUTEX_HASH_BITS     6
+#define FUTEX_HASH_SIZE     (1 << FUTEX_HASH_BITS)
+
+typedef struct futex_waiter futex_waiter_t;
+
+// Futexes are identified by the address space and user address, so only
+// threads sharing the mm (CLONE_VM) can synchronize through them
+struct futex_waiter
+{
+    struct mm*  mm;
+    int*        uaddr;
+    process_t*  proc;
+    bool        woken;
+    list_head_t entry;
+};
+
+static list_head_t futex_hash[FUTEX_HASH_SIZE];
+
+static list_head_t* futex_bucket(struct mm* mm, int* uaddr)
+{
+    uint32_t key = ((addr(uaddr) >> 2) ^ (addr(mm) >> 4)) * 2654435761U;
+    list_head_t* bucket = &futex_hash[key >> (32 - FUTEX_HASH_BITS)];
+
+    if (unlikely(!bucket->next))
+    {
+        list_init(bucket);
+    }
+
+    return bucket;
+}
+
+static int futex_verify(int* uaddr)
+{
+    if (unlikely(addr(uaddr) & (sizeof(int) - 1)))
+    {
+        return -EINVAL;
+    }
+
+    return current_vm_verify(VERIFY_READ, uaddr);
+}
+
+static void futex_timeout(ktimer_t* timer)
+{
+    bool* timedout = timer->data;
+    *timedout = true;
+    process_wake(timer->process);
+}
+
+static int futex_wait(int* uaddr, int val, const struct timespec* timeout)
+{
+    int errno = 0;
+    flags_t flags;
+    timeval_t t;
+    timer_t timer = 0;
+    volatile bool timedout = false;
+    futex_waiter_t waiter = {
+        .mm = process_current->mm,
+        .uaddr = uaddr,
+        .proc = process_current,
+        .woken = false,
+    };
+
+    // Value is read with irqs enabled first, so that the page is faulted
+    // in before it's read again below
+    if (*uaddr != val)
+    {
+        return -EAGAIN;
+    }
+
+    if (timeout)
+    {
+        if (unlikely(current_vm_verify(VERIFY_READ, timeout)))
+        {
+            return -EFAULT;
+        }
+
+        if (unlikely(timeout->tv_nsec < 0 || timeout->tv_nsec >= NSEC_IN_SEC))
+        {
+            return -EINVAL;
+        }
+
+        if (!timeout->tv_sec && !timeout->tv_nsec)
+        {
+            return -ETIMEDOUT;
+        }
+
+        t.tv_sec = timeout->tv_sec;
+        t.tv_usec = nsec2usec(timeout->tv_nsec);
+        timer = ktimer_create_and_start(KTIMER_ONESHOT, t, &futex_timeout, (void*)&timedout);
+
+        if (unlikely(errno = errno_get(timer)))
+        {
+            return errno;
+        }
+    }
+
+    irq_save(flags);
+
+    // Value has to be checked with the waiter queued atomically, so that
+    // wake which follows the change in the user space cannot be missed
+    if (*uaddr != val)
+    {
+        errno = -EAGAIN;
+        goto finish;
+    }
+
+    list_add_tail(&waiter.entry, futex_bucket(waiter.mm, uaddr));
+
+    while (!waiter.woken)
+    {
+        // Timer could have fired before the process went to sleep
+        if (timedout)
+        {
+            errno = -ETIMEDOUT;
+            break;
+        }
+
+        log_debug(DEBUG_FUTEX, "%u: waiting on %p", process_current->pid, uaddr);
+
+        process_wait2(flags);
+
+        irq_save(flags);
+
+        if (waiter.woken)
+        {
+            break;
+        }
+
+        if (signal_run(process_current))
+        {
+            errno = -EINTR;
+            break;
+        }
+    }
+
+    list_del(&waiter.entry);
+
+finish:
+    irq_restore(flags);
+
+    if (!timedout && timer)
+    {
+        ktimer_delete(timer);
+    }
+
+    return errno;
+}
+
+static int futex_wake(int* uaddr, int count)
+{
+    int woken = 0;
+    futex_waiter_t* waiter;
+    struct mm* mm = process_current->mm;
+    list_head_t* bucket = futex_bucket(mm, uaddr);
+
+    scoped_irq_lock();
+
+    list_for_each_entry_safe(waiter, bucket, entry)
+    {
+        if (woken >= count)
+        {
+            break;
+        }
+
+        if (waiter->mm != mm || waiter->uaddr != uaddr)
+        {
+            continue;
+        }
+
+        list_del(&waiter->entry);
+        waiter->woken = true;
+        process_wake(waiter->proc);
+        ++woken;
+    }
+
+    return woken;
+}
+
+// Wakes up to count waiters of uaddr and moves up to requeue remaining ones,
+// so that they wait on uaddr2 without being woken
+static int futex_requeue(int* uaddr, int count, int* uaddr2, int requeue, int* cmpval)
+{
+    int moved = 0;
+    int woken = 0;
+    futex_waiter_t* waiter;
+    struct mm* mm = process_current->mm;
+    list_head_t* bucket = futex_bucket(mm, uaddr);
+    list_head_t* bucket2 = futex_bucket(mm, uaddr2);
+    LIST_DECLARE(requeued);
+
+    // Value is read with irqs enabled first, as in futex_wait()
+    if (cmpval && *uaddr != *cmpval)
+    {
+        return -EAGAIN;
+    }
+
+    scoped_irq_lock();
+
+    if (cmpval && *uaddr != *cmpval)
+    {
+        return -EAGAIN;
+    }
+
+    list_for_each_entry_safe(waiter, bucket, entry)
+    {
+        if (waiter->mm != mm || waiter->uaddr != uaddr)
+        {
+            continue;
+        }
+
+        if (woken < count)
+        {
+            list_del(&waiter->entry);
+            waiter->woken = true;
+            process_wake(waiter->proc);
+            ++woken;
+        }
+        else if (moved < requeue)
+        {
+            list_del(&waiter->entry);
+            waiter->uaddr = uaddr2;
+            list_add_tail(&waiter->entry, &requeued);
+            ++moved;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    // Waiters are moved after the walk, so that they aren't visited again
+    // if both addresses share the bucket
+    list_for_each_entry_safe(waiter, &requeued, entry)
+    {
+        list_move_tail(&waiter->entry, bucket2);
+    }
+
+    return woken + moved;
+}
+
+int sys_futex(int* uaddr, int op, int val, const struct timespec* timeout, int* uaddr2, int val3)
+{
+    int errno;
+
+    if (unlikely(errno = futex_verify(uaddr)))
+    {
+        return errno;
+    }
+
+    switch (op & ~FUTEX_PRIVATE_FLAG)
+    {
+        case FUTEX_WAIT:
+            return futex_wait(uaddr, val, timeout);
+
+        case FUTEX_WAKE:
+            return val > 0 ? futex_wake(uaddr, val) : 0;
+
+        case FUTEX_REQUEUE:
+        case FUTEX_CMP_REQUEUE:
+            if (unlikely(errno = futex_verify(uaddr2)))
+            {
+                return errno;
+            }
+            return futex_requeue(
+                uaddr,
+                val,
+                uaddr2,
+                (int)addr(timeout),
+                (op & ~FUTEX_PRIVATE_FLAG) == FUTEX_CMP_REQUEUE ? &val3 : NULL);
+    }
+
+    return -ENOSYS;
+}
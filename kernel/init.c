@@ -17,6 +17,7 @@
 #include <kernel/process.h>
 #include <kernel/sections.h>
 #include <kernel/backtrace.h>
+#include <kernel/kernel_lock.h>
 
 #include <arch/idle.h>
 #include <arch/earlycon.h>
@@ -43,6 +44,10 @@ NOINLINE static void NORETURN(idle_run(void))
     process_stop(process_current);
     scheduler();
 
+    // Idle process halts without the kernel lock,
+    // so that other CPUs can enter the kernel
+    kernel_lock_leave();
+
     idle();
 
     ASSERT_NOT_REACHED();
@@ -158,8 +163,6 @@ UNMAP_AFTER_INIT void NORETURN(kmain(void* data, ...))
     char buffer[CMDLINE_SIZE];
     param_t parameters[CMDLINE_PARAMS_COUNT];
 
-    printk_init();
-
     va_start(args, data);
     temp_cmdline = multiboot_read(args);
     va_end(args);
@@ -173,6 +176,10 @@ UNMAP_AFTER_INIT void NORETURN(kmain(void* data, ...))
 
     arch_setup();
 
+    // Boot code runs as init_process, which, as any
+    // other kernel process, holds the kernel lock
+    kernel_lock_enter();
+
     memory_print();
     paging_init();
     ksyms_load(ksyms_start, ksyms_end);
@@ -0,0 +1,368 @@
+#include <kernel/printk.h>
+#include <kernel/rbtree.h>
+
+static inline bool rb_is_red(rb_node_t* node)
+{
+    return node && node->color == RB_RED;
+}
+
+static inline void rb_change_child(rb_root_t* root, rb_node_t* old, rb_node_t* new, rb_node_t* parent)
+{
+    if (!parent)
+    {
+        root->node = new;
+    }
+    else if (parent->left == old)
+    {
+        parent->left = new;
+    }
+    else
+    {
+        parent->right = new;
+    }
+}
+
+// Rotated node always has the child which takes its place
+static void rb_rotate_left(rb_root_t* root, rb_node_t* node)
+{
+    rb_node_t* right = node->right;
+
+    if (unlikely(!right))
+    {
+        panic("bug: rbtree: rotating %p left without right child", node);
+    }
+
+    node->right = right->left;
+    if (right->left)
+    {
+        right->left->parent = node;
+    }
+
+    right->parent = node->parent;
+    rb_change_child(root, node, right, node->parent);
+
+    right->left = node;
+    node->parent = right;
+}
+
+static void rb_rotate_right(rb_root_t* root, rb_node_t* node)
+{
+    rb_node_t* left = node->left;
+
+    if (unlikely(!left))
+    {
+        panic("bug: rbtree: rotating %p right without left child", node);
+    }
+
+    node->left = left->right;
+    if (left->right)
+    {
+        left->right->parent = node;
+    }
+
+    left->parent = node->parent;
+    rb_change_child(root, node, left, node->parent);
+
+    left->right = node;
+    node->parent = left;
+}
+
+void rb_insert_color(rb_root_t* root, rb_node_t* node, bool leftmost)
+{
+    rb_node_t* parent;
+    rb_node_t* gparent;
+    rb_node_t* uncle;
+
+    if (leftmost)
+    {
+        root->leftmost = node;
+    }
+
+    while (rb_is_red(parent = node->parent))
+    {
+        // Red node is never a root, so grandparent exists
+        gparent = parent->parent;
+
+        if (parent == gparent->left)
+        {
+            uncle = gparent->right;
+
+            if (rb_is_red(uncle))
+            {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->right)
+            {
+                rb_rotate_left(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_right(root, gparent);
+        }
+        else
+        {
+            uncle = gparent->left;
+
+            if (rb_is_red(uncle))
+            {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->left)
+            {
+                rb_rotate_right(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_left(root, gparent);
+        }
+    }
+
+    root->node->color = RB_BLACK;
+}
+
+// Restore the properties after removing black node; node is the child
+// which took its place (may be NULL), parent is its new parent
+static void rb_erase_color(rb_root_t* root, rb_node_t* node, rb_node_t* parent)
+{
+    rb_node_t* sibling;
+
+    // Black non-root node always has a parent and a sibling, as otherwise
+    // paths through them would have different numbers of black nodes
+    while (node != root->node && !rb_is_red(node))
+    {
+        if (unlikely(!parent))
+        {
+            panic("bug: rbtree: black node %p has no parent", node);
+        }
+
+        if (node == parent->left)
+        {
+            sibling = parent->right;
+
+            if (rb_is_red(sibling))
+            {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_left(root, parent);
+                sibling = parent->right;
+            }
+
+            if (unlikely(!sibling))
+            {
+                panic("bug: rbtree: black node %p has no sibling", node);
+            }
+
+            if (!rb_is_red(sibling->left) && !rb_is_red(sibling->right))
+            {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!rb_is_red(sibling->right))
+            {
+                sibling->left->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_right(root, sibling);
+                sibling = parent->right;
+            }
+
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->right->color = RB_BLACK;
+            rb_rotate_left(root, parent);
+        }
+        else
+        {
+            sibling = parent->left;
+
+            if (rb_is_red(sibling))
+            {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_right(root, parent);
+                sibling = parent->left;
+            }
+
+            if (unlikely(!sibling))
+            {
+                panic("bug: rbtree: black node %p has no sibling", node);
+            }
+
+            if (!rb_is_red(sibling->left) && !rb_is_red(sibling->right))
+            {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!rb_is_red(sibling->left))
+            {
+                sibling->right->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_left(root, sibling);
+                sibling = parent->left;
+            }
+
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->left->color = RB_BLACK;
+            rb_rotate_right(root, parent);
+        }
+
+        node = root->node;
+        break;
+    }
+
+    if (node)
+    {
+        node->color = RB_BLACK;
+    }
+}
+
+void rb_erase(rb_root_t* root, rb_node_t* node)
+{
+    rb_node_t* child;
+    rb_node_t* parent;
+    int color;
+
+    if (root->leftmost == node)
+    {
+        root->leftmost = rb_next(node);
+    }
+
+    if (!node->left || !node->right)
+    {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        color = node->color;
+
+        if (child)
+        {
+            child->parent = parent;
+        }
+
+        rb_change_child(root, node, child, parent);
+    }
+    else
+    {
+        // Replace node with its successor, which has no left child
+        rb_node_t* successor = node->right;
+
+        while (successor->left)
+        {
+            successor = successor->left;
+        }
+
+        child = successor->right;
+        color = successor->color;
+
+        if (successor->parent == node)
+        {
+            parent = successor;
+        }
+        else
+        {
+            parent = successor->parent;
+            if (child)
+            {
+                child->parent = parent;
+            }
+            parent->left = child;
+            successor->right = node->right;
+            node->right->parent = successor;
+        }
+
+        successor->left = node->left;
+        node->left->parent = successor;
+        successor->parent = node->parent;
+        successor->color = node->color;
+        rb_change_child(root, node, successor, node->parent);
+    }
+
+    if (color == RB_BLACK)
+    {
+        rb_erase_color(root, child, parent);
+    }
+
+    rb_node_init(node);
+}
+
+rb_node_t* rb_last(rb_root_t* root)
+{
+    rb_node_t* node = root->node;
+
+    if (!node)
+    {
+        return NULL;
+    }
+
+    while (node->right)
+    {
+        node = node->right;
+    }
+
+    return node;
+}
+
+rb_node_t* rb_next(rb_node_t* node)
+{
+    rb_node_t* parent;
+
+    if (node->right)
+    {
+        node = node->right;
+        while (node->left)
+        {
+            node = node->left;
+        }
+        return node;
+    }
+
+    while ((parent = node->parent) && node == parent->right)
+    {
+        node = parent;
+    }
+
+    return parent;
+}
+
+rb_node_t* rb_prev(rb_node_t* node)
+{
+    rb_node_t* parent;
+
+    if (node->left)
+    {
+        node = node->left;
+        while (node->right)
+        {
+            node = node->right;
+        }
+        return node;
+    }
+
+    while ((parent = node->parent) && node == parent->left)
+    {
+        node = parent;
+    }
+
+    return parent;
+}
@@ -1,8 +1,15 @@
 #define log_fmt(fmt) "page: " fmt
+#include <arch/smp.h>
+#include <kernel/fs.h>
+#include <kernel/div.h>
 #include <kernel/list.h>
+#include <kernel/time.h>
+#include <kernel/clock.h>
 #include <kernel/ksyms.h>
 #include <kernel/mutex.h>
+#include <kernel/dentry.h>
 #include <kernel/memory.h>
+#include <kernel/seq_file.h>
 #include <kernel/page_alloc.h>
 #include <kernel/page_debug.h>
 #include <kernel/page_table.h>
@@ -10,24 +17,145 @@
 extern uintptr_t last_pfn;
 extern page_t* page_map;
 
+struct free_area
+{
+    list_head_t free;
+    size_t      count;
+};
+
+struct alloc_stats
+{
+    unsigned    count;
+    unsigned    failures;
+    uint64_t    cycles;
+    uint64_t    cycles_max;
+};
+
+// Per-CPU cache of single free pages; it's accessed only by its CPU with
+// interrupts disabled, so the global page_mutex is taken only to refill
+// or drain it in batches of PAGE_CACHE_BATCH pages
+struct page_cache
+{
+    list_head_t pages;
+    unsigned    count;
+    unsigned    hits;
+    unsigned    misses;
+    unsigned    frees;
+    unsigned    drains;
+};
+
+typedef struct free_area free_area_t;
+typedef struct alloc_stats alloc_stats_t;
+typedef struct page_cache page_cache_t;
+
 static MUTEX_DECLARE(page_mutex);
-LIST_DECLARE(free_pages);
+static free_area_t free_areas[PAGE_ORDERS];
+static size_t free_pages_count;
+static alloc_stats_t alloc_stats[2];
+static PER_CPU_DECLARE(page_cache_t page_cache);
+
+static inline void free_area_add(page_t* page, int order)
+{
+    page->flags |= PAGE_FREE;
+    page->order = order;
+    list_add(&page->list_entry, &free_areas[order].free);
+    free_areas[order].count++;
+    free_pages_count += 1 << order;
+}
+
+static inline void free_area_del(page_t* page, int order)
+{
+    page->flags &= ~PAGE_FREE;
+    list_del(&page->list_entry);
+    free_areas[order].count--;
+    free_pages_count -= 1 << order;
+}
+
+// Return block to the free areas, merging it with its buddy as long as
+// the buddy is a free block of the same order
+static void buddy_free(uintptr_t pfn, int order)
+{
+    uintptr_t buddy_pfn;
+    page_t* buddy;
+
+    for (; order < PAGE_ORDERS - 1; ++order)
+    {
+        buddy_pfn = pfn ^ (1 << order);
 
-static inline page_t* free_page_find(void)
+        if (buddy_pfn >= last_pfn)
+        {
+            break;
+        }
+
+        buddy = &page_map[buddy_pfn];
+
+        if (!(buddy->flags & PAGE_FREE) || buddy->order != order)
+        {
+            break;
+        }
+
+        free_area_del(buddy, order);
+        pfn &= ~(1 << order);
+    }
+
+    free_area_add(&page_map[pfn], order);
+}
+
+// Take the smallest free block of at least given order and split it;
+// upper halves are given back to the free areas
+static page_t* buddy_alloc(int order)
 {
-    if (unlikely(list_empty(&free_pages)))
+    int current;
+    page_t* page;
+
+    for (current = order; current < PAGE_ORDERS; ++current)
+    {
+        if (!list_empty(&free_areas[current].free))
+        {
+            break;
+        }
+    }
+
+    if (unlikely(current == PAGE_ORDERS))
     {
-        log_debug(DEBUG_PAGE, "no free pages!");
+        log_debug(DEBUG_PAGE, "no free block of order %u", order);
         return NULL;
     }
 
-    page_t* page = list_front(&free_pages, page_t, list_entry);
+    page = list_front(&free_areas[current].free, page_t, list_entry);
+    free_area_del(page, current);
 
-    list_del(&page->list_entry);
+    while (current > order)
+    {
+        --current;
+        free_area_add(page + (1 << current), current);
+    }
 
     return page;
 }
 
+static inline int count_to_order(int count)
+{
+    int order = 0;
+
+    while ((1 << order) < count)
+    {
+        ++order;
+    }
+
+    return order;
+}
+
+static inline void page_prepare(page_t* page)
+{
+    log_debug(DEBUG_PAGE, "[alloc] %#zx", page_phys(page));
+    page->refcount = 1;
+    page->flags = 0;
+    page->pages_count = 0;
+    page->private = NULL;
+    list_init(&page->list_entry);
+}
+
 static inline page_t* free_page_range_find_discont(const int count)
 {
     page_t* temp_page;
@@ -35,17 +163,14 @@ static inline page_t* free_page_range_find_discont(const int count)
 
     for (int i = 0; i < count; ++i)
     {
-        temp_page = free_page_find();
+        temp_page = buddy_alloc(0);
 
         if (unlikely(!temp_page))
         {
             goto no_pages;
         }
 
-        log_debug(DEBUG_PAGE, "[alloc] %p", ptr(page_phys(temp_page)));
-
-        list_del(&temp_page->list_entry);
-        temp_page->refcount = 1;
+        page_prepare(temp_page);
 
         if (!first_page)
         {
@@ -53,7 +178,6 @@ static inline page_t* free_page_range_find_discont(const int count)
         }
         else
         {
-            temp_page->pages_count = 0;
             list_add_tail(&temp_page->list_entry, &first_page->list_entry);
         }
     }
@@ -61,47 +185,41 @@ static inline page_t* free_page_range_find_discont(const int count)
     return first_page;
 
 no_pages:
-    // TODO: free pages
+    if (first_page)
+    {
+        list_for_each_entry_safe(temp_page, &first_page->list_entry, list_entry)
+        {
+            list_del(&temp_page->list_entry);
+            temp_page->refcount = 0;
+            buddy_free(pfn(temp_page), 0);
+        }
+        first_page->refcount = 0;
+        buddy_free(pfn(first_page), 0);
+    }
     return NULL;
 }
 
 static inline page_t* free_page_range_find(const int count)
 {
-    int temp_count = count;
-    page_t* first_page = NULL;
+    int order = count_to_order(count);
+    page_t* first_page;
+    uintptr_t offset;
 
-    for (uintptr_t i = 0; i < last_pfn; ++i)
+    if (unlikely(order >= PAGE_ORDERS || !(first_page = buddy_alloc(order))))
     {
-        if (!page_map[i].refcount)
-        {
-            if (!first_page)
-            {
-                first_page = &page_map[i];
-            }
-            --temp_count;
-        }
-        else
-        {
-            first_page = NULL;
-            temp_count = count;
-        }
-        if (!temp_count)
-        {
-            break;
-        }
+        return NULL;
     }
 
-    if (unlikely(!first_page))
+    // Give back the tail which exceeds count as the largest possible
+    // blocks; block is aligned to 2^order, so each of them is aligned too
+    for (offset = count; offset < (1u << order); offset += 1 << __builtin_ctz(offset))
     {
-        return NULL;
+        free_area_add(first_page + offset, __builtin_ctz(offset));
     }
 
     for (int i = 0; i < count; ++i)
     {
-        log_debug(DEBUG_PAGE, "[alloc] %#zx", page_phys(&first_page[i]));
-        first_page[i].refcount = 1;
-        first_page[i].pages_count = 0;
-        list_del(&first_page[i].list_entry);
+        page_prepare(&first_page[i]);
 
         if (i != 0)
         {
@@ -112,6 +230,197 @@ static inline page_t* free_page_range_find(const int count)
     return first_page;
 }
 
+static page_cache_t* page_cache_get(void)
+{
+    page_cache_t* cache = THIS_CPU_GET(page_cache);
+
+    // Per-CPU data of APs is zeroed when they are booted
+    if (unlikely(!cache->pages.next))
+    {
+        list_init(&cache->pages);
+    }
+
+    return cache;
+}
+
+static page_t* page_cache_take(page_cache_t* cache)
+{
+    page_t* page = list_front(&cache->pages, page_t, list_entry);
+
+    list_del(&page->list_entry);
+    --cache->count;
+
+    return page;
+}
+
+// Move up to count least recently freed pages to the given list
+static void page_cache_drain(page_cache_t* cache, list_head_t* pages, unsigned count)
+{
+    while (count-- && cache->count)
+    {
+        list_move_tail(cache->pages.prev, pages);
+        --cache->count;
+    }
+    ++cache->drains;
+}
+
+static void pages_list_release(list_head_t* pages)
+{
+    page_t* page;
+
+    scoped_mutex_lock(&page_mutex);
+
+    list_for_each_entry_safe(page, pages, list_entry)
+    {
+        list_del(&page->list_entry);
+        buddy_free(pfn(page), 0);
+    }
+}
+
+static page_t* page_cache_alloc(void)
+{
+    flags_t flags;
+    page_t* page;
+    page_cache_t* cache;
+    LIST_DECLARE(pages);
+
+    irq_save(flags);
+
+    cache = page_cache_get();
+
+    if (likely(cache->count))
+    {
+        ++cache->hits;
+        page = page_cache_take(cache);
+        irq_restore(flags);
+        goto found;
+    }
+
+    irq_restore(flags);
+
+    {
+        scoped_mutex_lock(&page_mutex);
+
+        for (int i = 0; i < PAGE_CACHE_BATCH; ++i)
+        {
+            if (unlikely(!(page = buddy_alloc(0))))
+            {
+                break;
+            }
+            list_add_tail(&page->list_entry, &pages);
+        }
+    }
+
+    if (unlikely(list_empty(&pages)))
+    {
+        return NULL;
+    }
+
+    // Process might have been moved to other CPU while
+    // waiting for the mutex, so take the cache again
+    irq_save(flags);
+
+    cache = page_cache_get();
+    ++cache->misses;
+
+    list_for_each_entry_safe(page, &pages, list_entry)
+    {
+        list_move_tail(&page->list_entry, &cache->pages);
+        ++cache->count;
+    }
+
+    page = page_cache_take(cache);
+
+    irq_restore(flags);
+
+found:
+    page_prepare(page);
+    return page;
+}
+
+static void page_cache_free(page_t* page)
+{
+    flags_t flags;
+    page_cache_t* cache;
+    LIST_DECLARE(pages);
+
+    irq_save(flags);
+
+    cache = page_cache_get();
+
+    // Recently freed page is most likely still in the CPU cache,
+    // so it's put at the front and it's reused first
+    list_add(&page->list_entry, &cache->pages);
+    ++cache->frees;
+
+    if (++cache->count > PAGE_CACHE_HIGH)
+    {
+        page_cache_drain(cache, &pages, PAGE_CACHE_BATCH);
+    }
+
+    irq_restore(flags);
+
+    if (!list_empty(&pages))
+    {
+        pages_list_release(&pages);
+    }
+}
+
+static page_t* page_range_alloc(int count, alloc_flag_t flag)
+{
+    page_t* first_page;
+    uint64_t start, cycles;
+    alloc_stats_t* stats = &alloc_stats[flag & PAGE_ALLOC_CONT];
+
+    scoped_mutex_lock(&page_mutex);
+
+    start = monotonic_clock->read();
+
+    first_page = flag & PAGE_ALLOC_CONT
+        ? free_page_range_find(count)
+        : free_page_range_find_discont(count);
+
+    cycles = (monotonic_clock->read() - start) & monotonic_clock->mask;
+
+    stats->count++;
+    stats->cycles += cycles;
+    if (cycles > stats->cycles_max)
+    {
+        stats->cycles_max = cycles;
+    }
+
+    if (unlikely(!first_page))
+    {
+        stats->failures++;
+    }
+
+    return first_page;
+}
+
+static page_t* page_range_alloc_drain(int count, alloc_flag_t flag)
+{
+    flags_t flags;
+    page_t* first_page;
+    page_cache_t* cache;
+    LIST_DECLARE(pages);
+
+    if (likely(first_page = page_range_alloc(count, flag)))
+    {
+        return first_page;
+    }
+
+    // Pages kept in the cache of this CPU might be
+    // missing to complete a larger block
+    irq_save(flags);
+    cache = page_cache_get();
+    page_cache_drain(cache, &pages, cache->count);
+    irq_restore(flags);
+
+    pages_list_release(&pages);
+
+    return page_range_alloc(count, flag);
+}
+
 page_t* __page_alloc(int count, alloc_flag_t flag)
 {
     page_t* temp;
@@ -121,15 +430,27 @@ page_t* __page_alloc(int count, alloc_flag_t flag)
 
     ASSERT(count);
 
-    scoped_mutex_lock(&page_mutex);
-
-    first_page = flag & PAGE_ALLOC_CONT
-        ? free_page_range_find(count)
-        : free_page_range_find_discont(count);
+    first_page = count == 1
+        ? page_cache_alloc()
+        : page_range_alloc_drain(count, flag);
 
     if (unlikely(!first_page))
     {
-        return NULL;
+        // Make the file system caches give back their unused pages;
+        // freeing dentries releases slab pages only if whole slabs empty
+        if (!buffer_cache_shrink(count) && !dentry_cache_shrink(DENTRY_CACHE_MAX / 8))
+        {
+            return NULL;
+        }
+
+        first_page = count == 1
+            ? page_cache_alloc()
+            : page_range_alloc_drain(count, flag);
+
+        if (unlikely(!first_page))
+        {
+            return NULL;
+        }
     }
 
     first_page->pages_count = count;
@@ -179,7 +500,7 @@ static void page_free(page_t* page)
         }
 
         list_del(&page->list_entry);
-        list_add(&page->list_entry, &free_pages);
+        page_cache_free(page);
     }
 }
 
@@ -187,8 +508,6 @@ void __pages_free(page_t* pages)
 {
     page_t* temp_page;
 
-    scoped_mutex_lock(&page_mutex);
-
     list_for_each_entry_safe(temp_page, &pages->list_entry, list_entry)
     {
         page_free(temp_page);
@@ -236,6 +555,107 @@ void pages_merge(page_t* new_pages, page_t* pages)
     new_pages->pages_count += pages->pages_count;
 }
 
+// Part of the free memory (in 1/1000) which cannot be used for
+// an allocation of given order, as it's split into smaller blocks
+static unsigned unusable_index(int order)
+{
+    size_t usable = 0;
+
+    if (!free_pages_count)
+    {
+        return 0;
+    }
+
+    for (int i = order; i < PAGE_ORDERS; ++i)
+    {
+        usable += free_areas[i].count << i;
+    }
+
+    return (free_pages_count - usable) * 1000 / free_pages_count;
+}
+
+static uint32_t alloc_latency_avg_ns(alloc_stats_t* stats)
+{
+    uint64_t cycles = stats->cycles;
+
+    if (!stats->count)
+    {
+        return 0;
+    }
+
+    do_div(cycles, stats->count);
+
+    return cycles2ns(cycles);
+}
+
+static const char* alloc_stats_names[] = {
+    [PAGE_ALLOC_DISCONT] = "discont",
+    [PAGE_ALLOC_CONT] = "cont",
+};
+
+int buddyinfo_show(seq_file_t* s)
+{
+    scoped_mutex_lock(&page_mutex);
+
+    seq_printf(s, "order blocks   unusable\n");
+
+    for (int i = 0; i < PAGE_ORDERS; ++i)
+    {
+        unsigned index = unusable_index(i);
+        seq_printf(s, "%- 5u %- 8u %u.%03u\n", i, free_areas[i].count, index / 1000, index % 1000);
+    }
+
+    seq_printf(s, "free: %u kB\n", free_pages_count * PAGE_SIZE / KiB);
+
+    for (int i = 0; i < CPU_COUNT; ++i)
+    {
+        page_cache_t* cache;
+
+        if (!per_cpu_data[i])
+        {
+            continue;
+        }
+
+        cache = CPU_GET(i, &page_cache);
+
+        seq_printf(s, "cpu%u: cached %u hits %u misses %u frees %u drains %u\n",
+            i,
+            cache->count,
+            cache->hits,
+            cache->misses,
+            cache->frees,
+            cache->drains);
+    }
+
+    for (size_t i = 0; i < array_size(alloc_stats); ++i)
+    {
+        seq_printf(s, "%s: allocs %u failures %u avg %u ns max %u ns\n",
+            alloc_stats_names[i],
+            alloc_stats[i].count,
+            alloc_stats[i].failures,
+            alloc_latency_avg_ns(&alloc_stats[i]),
+            (uint32_t)cycles2ns(alloc_stats[i].cycles_max));
+    }
+
+    return 0;
+}
+
+void page_alloc_init(void)
+{
+    for (int i = 0; i < PAGE_ORDERS; ++i)
+    {
+        list_init(&free_areas[i].free);
+    }
+
+    for (uintptr_t i = 0; i < last_pfn; ++i)
+    {
+        if (!page_map[i].refcount)
+        {
+            buddy_free(i, 0);
+        }
+    }
+}
+
 void page_stats_print()
 {
     log_info("memory stats:");
@@ -273,6 +693,42 @@ void page_stats_print()
     log_info("frames_free=%zu (%zu kB)", frames_free, frames_free * 4);
     log_info("frames_unavailable=%u (%zu kB)", frames_unavailable, frames_unavailable * 4);
 
+    for (int i = 0; i < PAGE_ORDERS; ++i)
+    {
+        unsigned index = unusable_index(i);
+        log_info("order=%u blocks=%u unusable=%u.%03u", i, free_areas[i].count, index / 1000, index % 1000);
+    }
+
+    for (int i = 0; i < CPU_COUNT; ++i)
+    {
+        page_cache_t* cache;
+
+        if (!per_cpu_data[i])
+        {
+            continue;
+        }
+
+        cache = CPU_GET(i, &page_cache);
+
+        log_info("cpu%u cached=%u hits=%u misses=%u frees=%u drains=%u",
+            i,
+            cache->count,
+            cache->hits,
+            cache->misses,
+            cache->frees,
+            cache->drains);
+    }
+
+    for (size_t i = 0; i < array_size(alloc_stats); ++i)
+    {
+        log_info("%s allocs=%u failures=%u avg=%u ns max=%u ns",
+            alloc_stats_names[i],
+            alloc_stats[i].count,
+            alloc_stats[i].failures,
+            alloc_latency_avg_ns(&alloc_stats[i]),
+            (uint32_t)cycles2ns(alloc_stats[i].cycles_max));
+    }
+
 #if DEBUG_PAGE_DETAILED
     char symbol[80];
     log_info("count paddr      symbol");
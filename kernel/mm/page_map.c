@@ -2,19 +2,21 @@
 #include <kernel/kernel.h>
 #include <kernel/memory.h>
 #include <kernel/sections.h>
+#include <kernel/page_alloc.h>
 #include <kernel/page_debug.h>
 #include <kernel/page_table.h>
 #include <kernel/page_types.h>
 
 uintptr_t last_pfn;
 page_t* page_map;
-extern list_head_t free_pages;
 
 void page_mmio_init(void);
 
 static inline void page_set_used(uintptr_t pfn)
 {
     page_map[pfn].refcount = 1;
+    page_map[pfn].flags = 0;
+    page_map[pfn].private = NULL;
     page_map[pfn].virtual = virt_ptr(pfn * PAGE_SIZE);
     list_init(&page_map[pfn].list_entry);
 }
@@ -22,8 +24,10 @@ static inline void page_set_used(uintptr_t pfn)
 static inline void page_set_unused(uintptr_t pfn)
 {
     page_map[pfn].refcount = 0;
+    page_map[pfn].flags = 0;
+    page_map[pfn].private = NULL;
     page_map[pfn].virtual = NULL;
-    list_add_tail(&page_map[pfn].list_entry, &free_pages);
+    list_init(&page_map[pfn].list_entry);
 }
 
 #define USED 1
@@ -94,6 +98,7 @@ UNMAP_AFTER_INIT void paging_init(void)
 
     page_tables_init(virt_end);
     page_map_init(virt_end);
+    page_alloc_init();
     page_mmio_init();
 
     ASSERT(!page_map[phys_addr(virt_end + PAGE_SIZE) / PAGE_SIZE].refcount);
@@ -1,5 +1,6 @@
 #include <kernel/vm.h>
 #include <kernel/minmax.h>
+#include <kernel/dentry.h>
 #include <kernel/signal.h>
 #include <kernel/process.h>
 #include <kernel/segmexec.h>
@@ -100,6 +101,15 @@ void vm_add_front(vm_area_t* new_vma, vm_area_t* old_vma)
     old_vma->prev = new_vma;
 }
 
+static void vm_area_free(vm_area_t* vma)
+{
+    if (vma->dentry)
+    {
+        dentry_put(vma->dentry);
+    }
+    delete(vma);
+}
+
 void vm_del(vm_area_t* vma)
 {
     if (vma->next)
@@ -110,7 +120,7 @@ void vm_del(vm_area_t* vma)
     {
         vma->prev->next = vma->next;
     }
-    delete(vma);
+    vm_area_free(vma);
 }
 
 void vm_areas_del(vm_area_t* vmas)
@@ -119,7 +129,7 @@ void vm_areas_del(vm_area_t* vmas)
     for (vm_area_t* v = vmas; v;)
     {
         temp = v->next;
-        delete(v);
+        vm_area_free(v);
         v = temp;
     }
 }
@@ -307,6 +317,11 @@ int vm_copy(vm_area_t* dest_vma, const vm_area_t* src_vma, pgd_t* dest_pgd, pgd_
     dest_vma->prev = NULL;
     dest_vma->mm = dest_mm;
 
+    if (dest_vma->dentry)
+    {
+        dentry_get(dest_vma->dentry);
+    }
+
     return vm_copy_impl(dest_vma, dest_pgd, src_pgd, src_vma->start, src_vma->end);
 }
 
@@ -343,7 +358,7 @@ static page_t* vm_page(const pgd_t* pgd, const uintptr_t vaddr)
     return page(pte_entry_paddr(pte));
 }
 
-static int vm_page_map(vm_area_t* vma, pgd_t* pgd, const page_t* page, uintptr_t address)
+static int vm_page_map(pgd_t* pgd, const page_t* page, uintptr_t address, pgprot_t prot)
 {
     pgd_t* pgde = pgd_offset(pgd, address);
     pud_t* pude = pud_alloc(pgde, address);
@@ -367,7 +382,21 @@ static int vm_page_map(vm_area_t* vma, pgd_t* pgd, const page_t* page, uintptr_t
         return -ENOMEM;
     }
 
-    pte_entry_set(pte, page_phys(page), vm_to_pgprot(vma));
+    pte_entry_set(pte, page_phys(page), prot);
+
+    return 0;
+}
+
+int vm_page_insert(vm_area_t* vma, page_t* page, uintptr_t address)
+{
+    int errno;
+
+    if (unlikely(errno = vm_page_map(vma->mm->pgd, page, address, vm_to_pgprot_ro(vma))))
+    {
+        return errno;
+    }
+
+    page->refcount++;
 
     return 0;
 }
@@ -376,6 +405,7 @@ int vm_nopage(pgd_t* pgd, uintptr_t address, bool write, bool exec)
 {
     int errno, res;
     size_t size;
+    pgprot_t prot;
     vm_area_t* vma = vm_find(address, process_current->mm->vm_areas);
 
     if (unlikely(!vma))
@@ -399,6 +429,7 @@ int vm_nopage(pgd_t* pgd, uintptr_t address, bool write, bool exec)
     vm_area_log_debug(DEBUG_NOPAGE, vma);
 
     address = page_beginning(address);
+    prot = vm_to_pgprot(vma);
 
     page_t* page = vm_page(pgd, address);
 
@@ -421,6 +452,29 @@ int vm_nopage(pgd_t* pgd, uintptr_t address, bool write, bool exec)
             return errno;
         }
 
+        // Page owned by a file system is shared by all mappings of the file;
+        // it's mapped read-only, so that write to it makes a private copy
+        if (page->flags & PAGE_FILE)
+        {
+            if (!write)
+            {
+                prot = vm_to_pgprot_ro(vma);
+                goto map_page;
+            }
+
+            page_t* new_page = page_alloc(1, 0);
+
+            if (unlikely(!new_page))
+            {
+                pages_free(page);
+                return -ENOMEM;
+            }
+
+            memcpy(page_virt_ptr(new_page), page_virt_ptr(page), PAGE_SIZE);
+            pages_free(page);
+            page = new_page;
+        }
+
         if (res != PAGE_SIZE)
         {
             memset(page_virt_ptr(page) + res, 0, PAGE_SIZE - res);
@@ -475,18 +529,18 @@ int vm_nopage(pgd_t* pgd, uintptr_t address, bool write, bool exec)
     }
 
 map_page:
-    if (!(vma->vm_flags & VM_IO))
+    if (!(vma->vm_flags & VM_IO) && !(page->flags & PAGE_FILE))
     {
         page_kernel_unmap(page);
     }
 
-    if ((errno = vm_page_map(vma, pgd, page, address)))
+    if ((errno = vm_page_map(pgd, page, address, prot)))
     {
         return errno;
     }
 
 #if CONFIG_SEGMEXEC
-    if (vma->vm_flags & VM_EXEC && (errno = vm_page_map(vma, pgd, page, address + CODE_START)))
+    if (vma->vm_flags & VM_EXEC && (errno = vm_page_map(pgd, page, address + CODE_START, prot)))
     {
         return errno;
     }
@@ -497,6 +551,35 @@ map_page:
     return 0;
 }
 
+int vm_fault_in(const void* buffer, size_t size, bool write)
+{
+    int errno;
+    uintptr_t vaddr;
+    uintptr_t end = addr(buffer) + size;
+    pgd_t* pgd = process_current->mm->pgd;
+
+    for (vaddr = page_beginning(addr(buffer)); vaddr < end; vaddr += PAGE_SIZE)
+    {
+        // Kernel memory is always mapped
+        if (kernel_address(vaddr))
+        {
+            break;
+        }
+
+        if (!write && vm_paddr(vaddr, pgd))
+        {
+            continue;
+        }
+
+        if (unlikely(errno = vm_nopage(pgd, vaddr, write, false)))
+        {
+            return errno;
+        }
+    }
+
+    return 0;
+}
+
 int vm_apply(vm_area_t* vmas, pgd_t* pgd, uintptr_t vaddr_start, uintptr_t vaddr_end)
 {
     const vm_area_t* vma = vmas;
@@ -547,6 +630,13 @@ int vm_apply(vm_area_t* vmas, pgd_t* pgd, uintptr_t vaddr_start, uintptr_t vaddr
             continue;
         }
 
+        // Shared pages must stay read-only to be copied on write
+        if (!(vma->vm_flags & VM_IO) && page(pte_entry_paddr(pte))->refcount > 1)
+        {
+            pte_entry_prot_set(pte, vm_to_pgprot_ro(vma));
+            continue;
+        }
+
         pte_entry_prot_set(pte, prot);
     }
 
@@ -843,7 +933,7 @@ int vm_free(vm_area_t* vma_list, pgd_t* pgd)
 
         temp = vma;
         vma = vma->next;
-        delete(temp);
+        vm_area_free(temp);
     }
 
     return 0;
@@ -161,6 +161,9 @@ void vm_file_path_read(vm_area_t* vma, char* buffer, size_t max_len)
             case VM_TYPE_STACK:
                 strlcpy(buffer, "[stack]", max_len);
                 break;
+            case VM_TYPE_VDSO:
+                strlcpy(buffer, "[vdso]", max_len);
+                break;
             default:
                 *buffer = '\0';
         }
@@ -3,6 +3,7 @@
 #include <kernel/fs.h>
 #include <kernel/vm.h>
 #include <kernel/dev.h>
+#include <kernel/init.h>
 #include <kernel/tty.h>
 #include <kernel/time.h>
 #include <kernel/debug.h>
@@ -11,68 +12,92 @@
 #include <kernel/reboot.h>
 #include <kernel/process.h>
 #include <kernel/seq_file.h>
-#include <kernel/spinlock.h>
 #include <kernel/backtrace.h>
 #include <kernel/api/syslog.h>
 
+#include <arch/system.h>
+#include <arch/register.h>
+
 #define PANIC_LINE_LEN           256
 #define PRINTK_LINE_LEN          256
-#define PRINTK_BUFFER_SIZE       (16 * KiB)
+#define PRINTK_RECORDS           256
 #define PRINTK_INITIALIZED       0xfeed
 
 typedef int (*write_t)(tty_t*, const char*, size_t);
+typedef struct printk_record printk_record_t;
 
+// Record is free to read once id is its sequence number + 1; id is 0
+// while the record is being written
+struct printk_record
+{
+    logseq_t   id;
+    loglevel_t log_level;
+    uint16_t   len;
+    uint16_t   content_start;
+    char       text[PRINTK_LINE_LEN];
+};
+
+// Writers reserve records by incrementing head, so printk called from
+// an interrupt which came in the middle of other printk doesn't wait for
+// it. Records are written to the consoles in order by a single context
+// at a time, which owns flushing; if printk is called with interrupts
+// disabled, it's left to the klogd thread, kicked on the next tick
 struct printk_state
 {
-    tty_t*     dedicated_tty;
-    write_t    fallback_write;
-    logseq_t   sequence;
-    off_t      start;
-    off_t      end;
-    off_t      gap;
-    off_t      cur;
-    off_t      prev_cur;
-    loglevel_t prev_loglevel;
-    int        initialized;
-    spinlock_t lock;
-    char       buffer[PRINTK_BUFFER_SIZE];
+    tty_t*          dedicated_tty;
+    write_t         fallback_write;
+    process_t*      flusher;
+    logseq_t        head;
+    logseq_t        console_seq;
+    loglevel_t      prev_loglevel;
+    bool            flushing;
+    bool            flush_pending;
+    int             initialized;
+    printk_record_t records[PRINTK_RECORDS];
 };
 
 static struct printk_state CACHELINE_ALIGN state;
 
-static void printk_shift_start_end(char* buffer, size_t len)
+static inline printk_record_t* printk_record_get(logseq_t seq)
 {
-    const char* start;
+    return &state.records[seq % PRINTK_RECORDS];
+}
 
-    if (state.cur > state.prev_cur)
-    {
-        if (state.end < state.start)
-        {
-            start = strchr(buffer + len + 1, '\n');
+static inline logseq_t printk_tail(logseq_t head)
+{
+    return head > PRINTK_RECORDS ? head - PRINTK_RECORDS : 0;
+}
 
-            state.start = start
-                ? start - state.buffer + 1
-                : 0;
-        }
+// Copies record; returns 1 if it's not committed yet, -1 if it has been
+// overwritten by a newer one, 0 on success
+static int printk_record_read(logseq_t seq, printk_record_t* record)
+{
+    printk_record_t* r = printk_record_get(seq);
+    logseq_t id = __atomic_load_n(&r->id, __ATOMIC_SEQ_CST);
 
-        state.end += len;
-    }
-    else
+    if (id != seq + 1)
     {
-        start = strchr(buffer + len + 1, '\n');
+        return !id || id < seq + 1 ? 1 : -1;
+    }
 
-        if (unlikely(!start))
-        {
-            __builtin_trap();
-        }
+    record->log_level = r->log_level;
+    record->content_start = r->content_start;
+    record->len = r->len;
+    memcpy(record->text, r->text, r->len);
 
-        state.end = len;
-        state.start = start - state.buffer + 1;
-    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    // Writer of a newer record could have started overwriting it
+    return __atomic_load_n(&r->id, __ATOMIC_RELAXED) == seq + 1 ? 0 : -1;
 }
 
-static void printk_emit(loglevel_t log_level, char* buffer, size_t len, int content_start)
+static void printk_emit(printk_record_t* record)
 {
+    char* buffer = record->text;
+    size_t len = record->len;
+    size_t content_start = record->content_start;
+    loglevel_t log_level = record->log_level;
+
     if (likely(state.dedicated_tty))
     {
         tty_write_to(state.dedicated_tty, buffer, len);
@@ -82,8 +107,6 @@ static void printk_emit(loglevel_t log_level, char* buffer, size_t len, int cont
         state.fallback_write(NULL, buffer, len);
     }
 
-    UNUSED(log_level); UNUSED(content_start);
-#if 1
     if (log_level >= KERN_NOTICE || (state.prev_loglevel >= KERN_NOTICE && log_level == KERN_CONT))
     {
         if (*buffer == ' ')
@@ -96,7 +119,65 @@ static void printk_emit(loglevel_t log_level, char* buffer, size_t len, int cont
             tty_write_to_all(buffer + content_start, len - content_start - 1, state.dedicated_tty);
         }
     }
-#endif
+
+    if (log_level != KERN_CONT)
+    {
+        state.prev_loglevel = log_level;
+    }
+}
+
+static size_t printk_console_flush(void)
+{
+    int ret;
+    size_t count = 0;
+    printk_record_t record;
+
+    if (unlikely(!state.dedicated_tty && !state.fallback_write))
+    {
+        return 0;
+    }
+
+    while (1)
+    {
+        // In panic mode the owner won't ever continue, so it's ignored
+        if (__atomic_exchange_n(&state.flushing, true, __ATOMIC_SEQ_CST) && !panic_mode)
+        {
+            return count;
+        }
+
+        for (logseq_t head; state.console_seq != (head = __atomic_load_n(&state.head, __ATOMIC_SEQ_CST));)
+        {
+            if (state.console_seq < printk_tail(head))
+            {
+                state.console_seq = printk_tail(head);
+                continue;
+            }
+
+            // Writer which hasn't finished yet flushes it by itself
+            if ((ret = printk_record_read(state.console_seq, &record)) > 0)
+            {
+                break;
+            }
+
+            ++state.console_seq;
+
+            if (!ret)
+            {
+                printk_emit(&record);
+                ++count;
+            }
+        }
+
+        __atomic_store_n(&state.flushing, false, __ATOMIC_SEQ_CST);
+
+        // Writer which committed its record after it was checked, but
+        // before flushing was released, has left it to this context
+        if (state.console_seq == __atomic_load_n(&state.head, __ATOMIC_SEQ_CST) ||
+            printk_record_read(state.console_seq, &record) > 0)
+        {
+            return count;
+        }
+    }
 }
 
 logseq_t printk(const printk_entry_t* entry, const char* fmt, ...)
@@ -105,18 +186,12 @@ logseq_t printk(const printk_entry_t* entry, const char* fmt, ...)
     va_list args;
     int len, content_start;
 
-    scoped_spinlock_irq_lock(&state.lock);
+    logseq_t seq = __atomic_fetch_add(&state.head, 1, __ATOMIC_SEQ_CST);
+    printk_record_t* record = printk_record_get(seq);
+    char* const buffer = record->text;
 
-    state.prev_cur = state.cur;
-
-    if (array_size(state.buffer) - state.cur < PRINTK_LINE_LEN)
-    {
-        state.gap = state.cur;
-        state.cur = 0;
-    }
-
-    char* const buffer = state.buffer + state.cur;
-    logseq_t current_seq = state.sequence;
+    __atomic_store_n(&record->id, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
 
     timestamp_update();
     timestamp_get(&ts);
@@ -126,7 +201,7 @@ logseq_t printk(const printk_entry_t* entry, const char* fmt, ...)
         case KERN_DEBUG:
             len = snprintf(buffer, PRINTK_LINE_LEN, "%u,%lu,%u.%06u;%s:%u:%s: ",
                 KERN_DEBUG,
-                state.sequence++,
+                seq,
                 ts.tv_sec,
                 ts.tv_usec,
                 entry->file,
@@ -139,7 +214,7 @@ logseq_t printk(const printk_entry_t* entry, const char* fmt, ...)
         default:
             len = snprintf(buffer, PRINTK_LINE_LEN, "%u,%lu,%u.%06u;",
                 entry->log_level,
-                state.sequence++,
+                seq,
                 ts.tv_sec,
                 ts.tv_usec);
             break;
@@ -151,24 +226,34 @@ logseq_t printk(const printk_entry_t* entry, const char* fmt, ...)
     len += vsnprintf(buffer + len, PRINTK_LINE_LEN - len, fmt, args);
     va_end(args);
 
-    len += snprintf(buffer + len, PRINTK_LINE_LEN - len, "\n");
-
-    if (unlikely(len >= PRINTK_LINE_LEN))
+    if (likely(len < PRINTK_LINE_LEN - 1))
+    {
+        len += snprintf(buffer + len, PRINTK_LINE_LEN - len, "\n");
+    }
+    else
     {
         strcpy(buffer + PRINTK_LINE_LEN - 5, "...\n");
+        len = PRINTK_LINE_LEN - 1;
     }
 
-    state.cur += len;
+    record->log_level = entry->log_level;
+    record->content_start = content_start;
+    record->len = len;
 
-    printk_shift_start_end(buffer, len);
-    printk_emit(entry->log_level, buffer, len, content_start);
+    __atomic_store_n(&record->id, seq + 1, __ATOMIC_SEQ_CST);
 
-    if (entry->log_level != KERN_CONT)
+    // Writing to the consoles may take long, so it's never done with
+    // interrupts disabled, unless there's no one else to do it
+    if (!state.flusher || panic_mode || (eflags_get() & EFL_IF))
+    {
+        printk_console_flush();
+    }
+    else
     {
-        state.prev_loglevel = entry->log_level;
+        state.flush_pending = true;
     }
 
-    return current_seq;
+    return seq;
 }
 
 void NORETURN(panic(const char* fmt, ...))
@@ -191,20 +276,12 @@ void NORETURN(panic(const char* fmt, ...))
     machine_halt();
 }
 
-#define BUFFER_DUMP(func, param) \
-    ({ \
-        size_t size = 0; \
-        if (state.start > state.end) \
-        { \
-            func(param, state.buffer + state.start, size = state.gap - state.start); \
-        } \
-        func(param, state.buffer, state.end); \
-        size += state.end; \
-    })
-
-static size_t printk_buffer_dump(tty_t* tty)
+void printk_tick(void)
 {
-    return BUFFER_DUMP(tty_write_to, tty);
+    if (state.flush_pending)
+    {
+        process_wake(state.flusher);
+    }
 }
 
 void ensure_printk_will_print(void)
@@ -219,32 +296,39 @@ void ensure_printk_will_print(void)
     state.fallback_write = &debugcon_write;
     state.initialized = PRINTK_INITIALIZED;
 
-    BUFFER_DUMP(state.fallback_write, NULL);
+    printk_console_flush();
 }
 
 void printk_register(tty_t* tty)
 {
+    size_t count;
+
     if (state.initialized == PRINTK_INITIALIZED)
     {
         return;
     }
 
-    scoped_irq_lock();
-
     state.dedicated_tty = tty;
     state.initialized = PRINTK_INITIALIZED;
 
-    size_t size = printk_buffer_dump(state.dedicated_tty);
-    log_notice("printk: dumped buffer; size = %d", size);
+    count = printk_console_flush();
+    log_notice("printk: dumped buffer; records = %u", count);
 }
 
 int syslog_show(seq_file_t* s)
 {
-    if (state.start > state.end)
+    printk_record_t record;
+    logseq_t head = __atomic_load_n(&state.head, __ATOMIC_SEQ_CST);
+
+    for (logseq_t seq = printk_tail(head); seq != head; ++seq)
     {
-        seq_puts(s, state.buffer + state.start);
+        if (!printk_record_read(seq, &record))
+        {
+            record.text[record.len] = 0;
+            seq_puts(s, record.text);
+        }
     }
-    seq_puts(s, state.buffer);
+
     return 0;
 }
 
@@ -263,7 +347,42 @@ int sys__syslog(int priority, int option, const char* message)
     return 0;
 }
 
-void printk_init(void)
+static void printk_flush(void*)
 {
-    spinlock_init(&state.lock);
+    flags_t flags;
+
+    while (1)
+    {
+        irq_save(flags);
+
+        if (!state.flush_pending)
+        {
+            process_wait2(flags);
+        }
+        else
+        {
+            irq_restore(flags);
+        }
+
+        state.flush_pending = false;
+        printk_console_flush();
+    }
 }
+
+UNMAP_AFTER_INIT static int printk_flusher_init(void)
+{
+    int errno;
+    process_t* p = process_spawn("klogd", &printk_flush, NULL, SPAWN_KERNEL);
+
+    if (unlikely(errno = errno_get(p)))
+    {
+        log_warning("cannot create klogd: %d; messages are written with interrupts disabled", errno);
+        return errno;
+    }
+
+    state.flusher = p;
+
+    return 0;
+}
+
+premodules_initcall(printk_flusher_init);
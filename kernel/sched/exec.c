@@ -1,5 +1,6 @@
 #include <kernel/exec.h>
 #include <kernel/path.h>
+#include <kernel/vdso.h>
 #include <kernel/timer.h>
 #include <kernel/module.h>
 #include <kernel/process.h>
@@ -394,7 +395,7 @@ int do_exec(const char* pathname, const char* const argv[], const char* const en
 {
     char copied_path[PATH_MAX];
     int errno;
-    uintptr_t user_stack;
+    uintptr_t user_stack, vdso_address;
     aux_t* execfn;
     arg_t* argv0;
     process_t* p = process_current;
@@ -467,6 +468,12 @@ int do_exec(const char* pathname, const char* const argv[], const char* const en
         goto restore;
     }
 
+    if (!vdso_map(p->mm, &vdso_address) && unlikely(!aux_insert(AT_VDSO_DATA, vdso_address, argvec)))
+    {
+        errno = -ENOMEM;
+        goto restore;
+    }
+
     user_stack = stack_vma->end;
 
     user_stack -= ARGVECS_SIZE(argvec);
@@ -171,7 +171,7 @@ void process_exit(process_t* p)
 
     current_log_debug(DEBUG_EXIT, "");
 
-    list_del(&p->running);
+    runqueue_del(p);
     process_files_exit(p);
     p->stat = PROCESS_ZOMBIE;
     process_wake_waiting(p);
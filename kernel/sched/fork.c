@@ -153,7 +153,7 @@ error:
 
 static inline void process_init(process_t* child, process_t* parent)
 {
-    list_init(&child->running);
+    rb_node_init(&child->run_node);
     child->pid = find_free_pid();
     child->stat = PROCESS_ZOMBIE;
     child->exit_code = 0;
@@ -165,6 +165,9 @@ static inline void process_init(process_t* child, process_t* parent)
     child->need_resched = false;
     child->need_signal = false;
     child->alarm = 0;
+    child->nice = parent->nice;
+    child->vruntime = 0;
+    child->exec_start = 0;
     child->procfs_inode = NULL;
     process_name_set(child, parent->name);
     wait_queue_head_init(&child->wait_child);
@@ -184,6 +187,16 @@ static inline void fs_init(struct fs* dest, struct fs* src)
 {
     copy_struct(dest, src);
     dest->refcount = 1;
+
+    if (dest->cwd)
+    {
+        dentry_get(dest->cwd);
+    }
+
+    if (dest->root)
+    {
+        dentry_get(dest->root);
+    }
 }
 
 static inline int process_fs_copy(process_t* child, process_t* parent, int clone_flags)
@@ -284,7 +297,8 @@ static int process_fork(process_t* parent, struct pt_regs* regs)
         ? parent->trace
         : 0;
     child->stat = PROCESS_RUNNING;
-    list_add_tail(&child->running, &running);
+    child->cpu = runqueue_select();
+    runqueue_add(child);
 
     parent->need_resched = true;
 
@@ -328,7 +342,8 @@ int sys_clone(int (*fn)(void*), void* stack, int clone_flags, void*, void* tls)
         ? parent->trace
         : 0;
     child->stat = PROCESS_RUNNING;
-    list_add_tail(&child->running, &running);
+    child->cpu = runqueue_select();
+    runqueue_add(child);
 
     parent->need_resched = true;
 
@@ -374,7 +389,8 @@ process_t* process_spawn(const char* name, process_entry_t entry, void* args, in
     process_name_set(child, name);
     child->trace = 0;
     child->stat = PROCESS_RUNNING;
-    list_add_tail(&child->running, &running);
+    child->cpu = runqueue_select();
+    runqueue_add(child);
 
     irq_restore(irqflags);
 
@@ -0,0 +1,63 @@
+#include <arch/smp.h>
+#include <kernel/cpu.h>
+#include <kernel/process.h>
+#include <kernel/spinlock.h>
+#include <kernel/kernel_lock.h>
+
+static SPINLOCK_DECLARE(kernel_lock);
+static PER_CPU_DECLARE(int kernel_lock_depth);
+
+void kernel_lock_enter(void)
+{
+    flags_t flags;
+    int* depth;
+
+    irq_save(flags);
+
+    depth = THIS_CPU_GET(kernel_lock_depth);
+
+    if (!*depth)
+    {
+        while (spinlock_try_lock(&kernel_lock))
+        {
+            // CPU which holds the lock may wait for this CPU to flush
+            // its TLB, so handle it here, as interrupts may be disabled
+            tlb_shootdown_poll();
+            cpu_relax();
+        }
+    }
+
+    ++*depth;
+
+    irq_restore(flags);
+}
+
+void kernel_lock_leave(void)
+{
+    flags_t flags;
+    int* depth;
+
+    irq_save(flags);
+
+    depth = THIS_CPU_GET(kernel_lock_depth);
+
+    if (unlikely(*depth <= 0))
+    {
+        panic("bug: kernel lock depth is %d", *depth);
+    }
+
+    if (!--*depth)
+    {
+        spinlock_unlock(&kernel_lock);
+    }
+
+    irq_restore(flags);
+}
+
+void kernel_lock_switch(process_t* prev, process_t* next)
+{
+    int* depth = THIS_CPU_GET(kernel_lock_depth);
+
+    prev->kernel_lock_depth = *depth;
+    *depth = next->kernel_lock_depth;
+}
@@ -1,4 +1,5 @@
 #include <kernel/debug.h>
+#include <kernel/sched.h>
 #include <kernel/timer.h>
 #include <kernel/procfs.h>
 #include <kernel/signal.h>
@@ -134,13 +135,47 @@ timer_t repeating_wake_schedule(timeval_t timeval)
         process_current);
 }
 
+// Create idle process for the CPU which is already running on the given
+// kernel stack; it shares everything with init_process, which is the idle
+// process of the BSP
+process_t* process_idle_create(void* kernel_stack)
+{
+    process_t* idle = zalloc(process_t);
+
+    if (unlikely(!idle))
+    {
+        return NULL;
+    }
+
+    rb_node_init(&idle->run_node);
+    list_init(&idle->children);
+    list_init(&idle->siblings);
+    list_init(&idle->processes);
+    list_init(&idle->timers);
+    wait_queue_head_init(&idle->wait_child);
+
+    idle->type         = KERNEL_PROCESS;
+    idle->stat         = PROCESS_STOPPED;
+    idle->kernel_stack = kernel_stack;
+    idle->mm           = init_process.mm;
+    idle->fs           = init_process.fs;
+    idle->files        = init_process.files;
+    idle->signals      = init_process.signals;
+    process_name_set(idle, "idle");
+
+    *(uintptr_t*)(addr(kernel_stack) - PAGE_SIZE) = STACK_MAGIC;
+
+    return idle;
+}
+
 int processes_init()
 {
     init_process.kernel_stack = ptr(&init_process_stack[INIT_PROCESS_STACK_SIZE]);
     init_process.mm->pgd = kernel_page_dir;
     init_process.mm->vm_areas = NULL;
     mutex_init(&init_process.mm->lock);
-    list_add_tail(&init_process.running, &running);
+    sched_cpu_init(&init_process);
+    runqueue_add(&init_process);
     arch_process_init();
     return 0;
 }
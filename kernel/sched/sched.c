@@ -1,58 +1,517 @@
+#include <kernel/cpu.h>
+#include <kernel/time.h>
+#include <kernel/clock.h>
+#include <kernel/sched.h>
 #include <kernel/process.h>
+#include <kernel/seq_file.h>
+#include <kernel/kernel_lock.h>
+#include <kernel/api/resource.h>
 #include <arch/context_switch.h>
 
 static_assert(NEED_RESCHED_SIGNAL_OFFSET == offsetof(process_t, _need_resched));
 
-process_t* process_current = &init_process;
-LIST_DECLARE(running);
+PER_CPU_DECLARE(process_t* current_process) = &init_process;
+static PER_CPU_DECLARE(runqueue_t runqueue);
+
+runqueue_t* runqueues[CPU_COUNT];
 unsigned int context_switches;
 
-// Simple RR scheduler
+// Inverse of the Linux nice to weight table (2^32 / weight); weight changes
+// by ~25% per nice level, so that process gets ~10% more CPU time than
+// a process with nice higher by 1
+static const uint32_t nice_to_wmult[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */     48388,     59856,     76040,     92818,    118348,
+    /* -15 */    147320,    184698,    229616,    287308,    360437,
+    /* -10 */    449829,    563644,    704093,    875809,   1099582,
+    /*  -5 */   1376151,   1717300,   2157191,   2708050,   3363326,
+    /*   0 */   4194304,   5237765,   6557202,   8165337,  10153587,
+    /*   5 */  12820798,  15790321,  19976592,  24970740,  31350126,
+    /*  10 */  39045157,  49367440,  61356676,  76695844,  95443717,
+    /*  15 */ 119304647, 148102320, 186737708, 238609294, 286331153,
+};
+
+static inline uint64_t sched_clock(void)
+{
+    return monotonic_clock->read();
+}
+
+// Convert real time to the virtual time of the process; it's
+// delta * NICE_0_WEIGHT / weight, as NICE_0_WEIGHT is 2^10
+static inline uint64_t vruntime_delta(process_t* p, uint64_t delta)
+{
+    return (delta * nice_to_wmult[p->nice - NICE_MIN]) >> 22;
+}
+
+static void runqueue_insert(runqueue_t* rq, process_t* p)
+{
+    rb_node_t** link = &rq->queue.node;
+    rb_node_t* parent = NULL;
+    bool leftmost = true;
+
+    while (*link)
+    {
+        parent = *link;
+
+        // Processes with equal vruntime are queued in FIFO order
+        if (p->vruntime < rb_entry(parent, process_t, run_node)->vruntime)
+        {
+            link = &parent->left;
+        }
+        else
+        {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+
+    rb_link_node(&p->run_node, parent, link);
+    rb_insert_color(&rq->queue, &p->run_node, leftmost);
+}
+
+static inline process_t* runqueue_first(runqueue_t* rq)
+{
+    return rb_entry_safe(rb_first(&rq->queue), process_t, run_node);
+}
+
+// Process which was sleeping cannot get more than SCHED_WAKEUP_CREDIT_NS
+// of advantage over processes on the run queue
+static void runqueue_place(runqueue_t* rq, process_t* p)
+{
+    uint64_t min_vruntime = rq->min_vruntime > SCHED_WAKEUP_CREDIT_NS
+        ? rq->min_vruntime - SCHED_WAKEUP_CREDIT_NS
+        : 0;
+
+    if (p->vruntime < min_vruntime)
+    {
+        p->vruntime = min_vruntime;
+    }
+}
+
+// Charge process which was running on this CPU for its execution time;
+// its position in the run queue has to be updated as the key changes
+static void runqueue_update_curr(runqueue_t* rq, process_t* p, uint64_t now)
+{
+    uint64_t delta = cycles2ns(now - p->exec_start);
+
+    p->exec_start = now;
+    p->vruntime += vruntime_delta(p, delta);
+
+    if (!rb_node_empty(&p->run_node))
+    {
+        rb_erase(&rq->queue, &p->run_node);
+        runqueue_insert(rq, p);
+    }
+}
+
+static void runqueue_min_vruntime_update(runqueue_t* rq)
+{
+    process_t* first = runqueue_first(rq);
+
+    if (first && first->vruntime > rq->min_vruntime)
+    {
+        rq->min_vruntime = first->vruntime;
+    }
+}
+
+void sched_cpu_init(process_t* idle)
+{
+    runqueue_t* rq = THIS_CPU_GET(runqueue);
+
+    spinlock_init(&rq->lock);
+    rb_root_init(&rq->queue);
+    rq->min_vruntime = 0;
+    rq->nr_running = 0;
+    rq->migrations = 0;
+    rq->ticks = 0;
+    rq->cpu = this_cpu_id();
+    rq->curr = idle;
+    rq->idle = idle;
+
+    idle->cpu = rq->cpu;
+    idle->exec_start = sched_clock();
+    process_current = idle;
+
+    mb();
+
+    runqueues[rq->cpu] = rq;
+}
+
+// Select CPU with the least number of runnable processes
+int runqueue_select(void)
+{
+    int i, cpu = this_cpu_id();
+    runqueue_t* rq;
+    unsigned min = runqueues[cpu]->nr_running;
+
+    for_each_runqueue(rq, i)
+    {
+        if (rq->nr_running < min)
+        {
+            min = rq->nr_running;
+            cpu = i;
+        }
+    }
+
+    return cpu;
+}
+
+void runqueue_add(process_t* p)
+{
+    runqueue_t* rq = runqueues[p->cpu];
+    bool resched, preempt;
+
+    {
+        scoped_spinlock_irq_lock(&rq->lock);
+
+        runqueue_place(rq, p);
+        runqueue_insert(rq, p);
+        resched = ++rq->nr_running == 1;
+
+        // Woken up process which is far behind the running one shouldn't
+        // wait for the next tick
+        preempt = rq->curr != rq->idle
+            && p->vruntime + SCHED_GRANULARITY_NS < rq->curr->vruntime;
+    }
+
+    if (rq != THIS_CPU_GET(runqueue))
+    {
+        // If remote CPU had nothing to run, it's halted in the idle
+        // process; otherwise it will notice new process on the next tick
+        if (resched || preempt)
+        {
+            smp_resched_send(rq->cpu);
+        }
+    }
+    else if (preempt)
+    {
+        process_current->need_resched = true;
+    }
+}
+
+void runqueue_del(process_t* p)
+{
+    runqueue_t* rq = runqueues[p->cpu];
+
+    {
+        scoped_spinlock_irq_lock(&rq->lock);
+
+        if (rb_node_empty(&p->run_node))
+        {
+            return;
+        }
+
+        rb_erase(&rq->queue, &p->run_node);
+        --rq->nr_running;
+    }
+
+    // Process may be running in the user space on the other CPU;
+    // force it to go through the scheduler
+    if (rq->curr == p && rq != THIS_CPU_GET(runqueue))
+    {
+        smp_resched_send(rq->cpu);
+    }
+}
+
+// Called on reschedule IPI
+void sched_ipi(void)
+{
+    process_current->need_resched = true;
+}
+
+// Lock 2 run queues always in the same order
+static void runqueues_lock(runqueue_t* rq1, runqueue_t* rq2)
+{
+    if (rq1->cpu > rq2->cpu)
+    {
+        runqueue_t* temp = rq1;
+        rq1 = rq2;
+        rq2 = temp;
+    }
+    spinlock_lock(&rq1->lock);
+    spinlock_lock(&rq2->lock);
+}
+
+static void runqueues_unlock(runqueue_t* rq1, runqueue_t* rq2)
+{
+    spinlock_unlock(&rq1->lock);
+    spinlock_unlock(&rq2->lock);
+}
+
+static runqueue_t* runqueue_busiest(void)
+{
+    int i;
+    runqueue_t* rq;
+    runqueue_t* busiest = NULL;
+
+    for_each_runqueue(rq, i)
+    {
+        if (!busiest || rq->nr_running > busiest->nr_running)
+        {
+            busiest = rq;
+        }
+    }
+
+    return busiest;
+}
+
+// Move one process from src to dest; process which is currently running on
+// src CPU cannot be moved. Switched out processes have their context fully
+// saved, as context switch is done with the kernel lock held
+static void runqueue_pull(runqueue_t* dest, runqueue_t* src)
+{
+    process_t* p;
+    int64_t lag;
+    rb_node_t* node = rb_last(&src->queue);
+
+    // Take the process which would wait the longest for the CPU
+    if (node && rb_entry(node, process_t, run_node) == src->curr)
+    {
+        node = rb_prev(node);
+    }
+
+    if (!node)
+    {
+        return;
+    }
+
+    p = rb_entry(node, process_t, run_node);
+
+    rb_erase(&src->queue, &p->run_node);
+    --src->nr_running;
+
+    // Keep the distance to the min_vruntime, as virtual
+    // time of each CPU progresses independently
+    lag = p->vruntime - src->min_vruntime;
+    p->vruntime = lag < 0 && (uint64_t)-lag > dest->min_vruntime
+        ? 0
+        : dest->min_vruntime + lag;
+
+    p->cpu = dest->cpu;
+    runqueue_insert(dest, p);
+    ++dest->nr_running;
+    ++dest->migrations;
+}
+
+// Steal a process from the busiest CPU if it has at least
+// 2 runnable processes more than this CPU
+static void runqueue_balance(runqueue_t* rq)
+{
+    flags_t flags;
+    runqueue_t* busiest = runqueue_busiest();
+
+    if (!busiest || busiest == rq || busiest->nr_running < rq->nr_running + 2)
+    {
+        return;
+    }
+
+    irq_save(flags);
+    runqueues_lock(rq, busiest);
+
+    if (busiest->nr_running >= rq->nr_running + 2)
+    {
+        runqueue_pull(rq, busiest);
+    }
+
+    runqueues_unlock(rq, busiest);
+    irq_restore(flags);
+}
+
+void sched_tick(void)
+{
+    runqueue_t* rq = THIS_CPU_GET(runqueue);
+
+    if (++rq->ticks % SCHED_BALANCE_TICKS == 0)
+    {
+        runqueue_balance(rq);
+    }
+}
+
+int schedstat_show(seq_file_t* s)
+{
+    int i;
+    runqueue_t* rq;
+
+    for_each_runqueue(rq, i)
+    {
+        seq_printf(s, "cpu%u running %u migrations %u current %u\n",
+            rq->cpu,
+            rq->nr_running,
+            rq->migrations,
+            rq->curr->pid);
+    }
+
+    return 0;
+}
+
+// Weighted fair scheduler over this CPU run queue; the process with the
+// smallest virtual runtime is picked. Virtual runtime grows slower for
+// processes with lower nice, so they get proportionally more CPU time
 void scheduler(void)
 {
+    flags_t flags;
+    uint64_t now;
+    process_t* next;
+    process_t* first;
     process_t* last = process_current;
+    runqueue_t* rq = THIS_CPU_GET(runqueue);
 
-    if (list_empty(&running))
+    // Idle CPU tries to steal some work from others
+    if (!rq->nr_running)
     {
-        // If there are no processes on the running queue,
-        // run init process, which is the idle process
-        process_current = &init_process;
-        goto end;
+        runqueue_balance(rq);
     }
 
-    if (!process_is_running(process_current))
+    irq_save(flags);
+    spinlock_lock(&rq->lock);
+
+    now = sched_clock();
+    runqueue_update_curr(rq, last, now);
+    runqueue_min_vruntime_update(rq);
+
+    if (!(first = runqueue_first(rq)))
+    {
+        // If there are no processes on the running queue,
+        // run idle process of this CPU
+        next = rq->idle;
+    }
+    else if (process_is_running(last)
+        && !rb_node_empty(&last->run_node)
+        && last->vruntime < first->vruntime + SCHED_GRANULARITY_NS)
     {
-        process_current = list_entry(running.next, process_t, running);
+        next = last;
     }
     else
     {
-        list_head_t* temp = process_current->running.next;
-        if (temp == &running)
-        {
-            temp = temp->next;
-        }
-        process_current = list_entry(temp, process_t, running);
+        next = first;
     }
 
 #if PARANOIA_SCHED
-    if (unlikely(process_current->stat != PROCESS_RUNNING))
+    if (unlikely(next != rq->idle && next->stat != PROCESS_RUNNING))
     {
         panic("bug: process %u:%p stat is %u; expected %u",
-            process_current->pid,
-            process_current,
-            process_current->stat,
+            next->pid,
+            next,
+            next->stat,
             PROCESS_RUNNING);
     }
 #endif
 
-end:
-    if (last == process_current)
+    next->exec_start = now;
+    rq->curr = next;
+    spinlock_unlock(&rq->lock);
+
+    if (last == next)
     {
+        irq_restore(flags);
         return;
     }
 
     context_switches++;
     last->context_switches++;
 
-    process_switch(last, process_current);
+    process_current = next;
+    kernel_lock_switch(last, next);
+
+    process_switch(last, next);
+}
+
+static bool priority_match(process_t* p, int which, id_t who)
+{
+    switch (which)
+    {
+        case PRIO_PROCESS:
+            return p->pid == (pid_t)(who ? who : process_current->pid);
+        case PRIO_PGRP:
+            return p->pgid == (int)(who ? who : (id_t)process_current->pgid);
+        case PRIO_USER:
+            return p->uid == (uid_t)(who ? who : process_current->uid);
+        default:
+            return false;
+    }
+}
+
+static int nice_clamp(int nice)
+{
+    return nice < NICE_MIN
+        ? NICE_MIN
+        : nice > NICE_MAX
+            ? NICE_MAX
+            : nice;
+}
+
+int sys_nice(int inc)
+{
+    if (inc < 0 && !current_is_root())
+    {
+        return -EPERM;
+    }
+
+    process_current->nice = nice_clamp(process_current->nice + inc);
+    return 0;
+}
+
+// Returns 20 - nice of the matching process with the highest priority,
+// so that the result is never negative
+int sys_getpriority(int which, id_t who)
+{
+    process_t* p;
+    int nice = NICE_MAX + 1;
+
+    if (which < PRIO_PROCESS || which > PRIO_USER)
+    {
+        return -EINVAL;
+    }
+
+    for_each_process(p)
+    {
+        if (priority_match(p, which, who) && p->nice < nice)
+        {
+            nice = p->nice;
+        }
+    }
+
+    if (nice > NICE_MAX)
+    {
+        return -ESRCH;
+    }
+
+    return 20 - nice;
+}
+
+int sys_setpriority(int which, id_t who, int value)
+{
+    process_t* p;
+    int errno = -ESRCH;
+
+    if (which < PRIO_PROCESS || which > PRIO_USER)
+    {
+        return -EINVAL;
+    }
+
+    value = nice_clamp(value);
+
+    // Only root can renice processes of other users and decrease nice
+    for_each_process(p)
+    {
+        if (!priority_match(p, which, who))
+        {
+            continue;
+        }
+
+        if (!current_can_renice(p))
+        {
+            errno = -EPERM;
+        }
+        else if (value < p->nice && !current_is_root())
+        {
+            errno = -EACCES;
+        }
+        else
+        {
+            p->nice = value;
+            errno = errno == -ESRCH ? 0 : errno;
+        }
+    }
+
+    return errno;
 }
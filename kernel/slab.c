@@ -1,9 +1,12 @@
+#include <arch/smp.h>
+#include <arch/percpu.h>
 #include <kernel/debug.h>
 #include <kernel/mutex.h>
 #include <kernel/kernel.h>
 #include <kernel/malloc.h>
 #include <kernel/printk.h>
 #include <kernel/compiler.h>
+#include <kernel/seq_file.h>
 #include <kernel/page_alloc.h>
 
 #define SLAB_CLASS(class_size, count) \
@@ -12,42 +15,70 @@
 enum
 {
 #include "slab_classes.h"
+    SLAB_CLASSES
 };
 
 #define SLAB_ZERO_AFTER_FREE 1
 #define SLAB_POISON          0x02532401
 
+// Number of objects cached per CPU for each size class; allocator
+// refills and flushes half of it at once
+#define SLAB_MAGAZINE_SIZE   16
+#define SLAB_MAGAZINE_BATCH  (SLAB_MAGAZINE_SIZE / 2)
+
+// Number of empty slabs kept by each allocator; other
+// ones are given back to the page allocator
+#define SLAB_EMPTY_MAX       1
+
 struct slab_block
 {
     list_head_t list_entry;
     uint32_t    poison;
 };
 
+struct slab_allocator;
+
 struct slab
 {
-    page_t*     pages;
-    uintptr_t   start;
-    uintptr_t   end;
-    size_t      allocated;
-    list_head_t free;
-    list_head_t list_entry;
+    page_t*                 pages;
+    struct slab_allocator*  allocator;
+    size_t                  allocated;
+    list_head_t             free;
+    list_head_t             list_entry;
 };
 
+// Slabs are kept on separate lists depending on their usage, so that
+// allocation never has to look for a slab with a free block
 struct slab_allocator
 {
     mutex_t     lock;
     uint16_t    size;
     uint16_t    slabs_count;
     size_t      slab_size;
-    list_head_t slabs;
+    size_t      allocated;
+    size_t      empty_count;
+    size_t      reclaimed;
+    list_head_t partial;
+    list_head_t full;
+    list_head_t empty;
+};
+
+struct slab_magazine
+{
+    unsigned    count;
+    unsigned    hits;
+    unsigned    misses;
+    void*       objects[SLAB_MAGAZINE_SIZE];
 };
 
 typedef struct slab slab_t;
 typedef struct slab_block slab_block_t;
+typedef struct slab_magazine slab_magazine_t;
 typedef struct slab_allocator slab_allocator_t;
 
 static MUTEX_DECLARE(lock);
 static LIST_DECLARE(slabs_free);
+static PER_CPU_DECLARE(slab_magazine_t magazines[SLAB_CLASSES]);
 
 #define SLAB_ENTRY_SIZE  (align(sizeof(slab_t), 32))
 #define SLAB_ENTRY_COUNT 512
@@ -60,7 +91,9 @@ static_assert((PAGE_SIZE % SLAB_ENTRY_SIZE) == 0);
         .lock      = MUTEX_INIT(allocators[SLAB_##class_size].lock), \
         .size      = class_size, \
         .slab_size = page_align((class_size) * (count)), \
-        .slabs     = LIST_INIT(allocators[SLAB_##class_size].slabs) \
+        .partial   = LIST_INIT(allocators[SLAB_##class_size].partial), \
+        .full      = LIST_INIT(allocators[SLAB_##class_size].full), \
+        .empty     = LIST_INIT(allocators[SLAB_##class_size].empty), \
     },
 
 static slab_allocator_t allocators[] = {
@@ -76,6 +109,11 @@ static inline slab_allocator_t* slab_allocator_get(size_t size)
     return NULL;
 }
 
+static inline slab_magazine_t* slab_magazine_get(slab_allocator_t* allocator)
+{
+    return THIS_CPU_GET(magazines[allocator - allocators]);
+}
+
 static void* slab_entry_alloc(void)
 {
     scoped_mutex_lock(&lock);
@@ -86,6 +124,11 @@ static void* slab_entry_alloc(void)
         page_t* pages = page_alloc(size / PAGE_SIZE, 0);
         page_t* page;
 
+        if (unlikely(!pages))
+        {
+            return NULL;
+        }
+
         PAGES_FOR_EACH(page, pages)
         {
             void* ptr = page_virt_ptr(page);
@@ -105,8 +148,20 @@ static void* slab_entry_alloc(void)
     return block;
 }
 
+static void slab_entry_free(slab_t* slab)
+{
+    slab_block_t* block = ptr(slab);
+
+    scoped_mutex_lock(&lock);
+
+    list_init(&block->list_entry);
+    list_add(&block->list_entry, &slabs_free);
+    block->poison = SLAB_POISON;
+}
+
 static slab_t* slab_create(slab_allocator_t* allocator)
 {
+    page_t* page;
     page_t* pages = page_alloc(
         allocator->slab_size / PAGE_SIZE,
         PAGE_ALLOC_CONT | PAGE_ALLOC_ZEROED);
@@ -126,13 +181,19 @@ static slab_t* slab_create(slab_allocator_t* allocator)
 
     list_init(&slab->list_entry);
     list_init(&slab->free);
-    list_add_tail(&slab->list_entry, &allocator->slabs);
     allocator->slabs_count++;
     slab->pages     = pages;
-    slab->start     = page_virt(pages);
-    slab->end       = page_virt(pages) + allocator->slab_size;
+    slab->allocator = allocator;
     slab->allocated = 0;
 
+    // Each page points to its slab, so that the slab is found
+    // in O(1) when its block is freed
+    PAGES_FOR_EACH(page, pages)
+    {
+        page->private = slab;
+        page->flags |= PAGE_SLAB;
+    }
+
     void* ptr = page_virt_ptr(pages);
 
     for (size_t i = 0; i < allocator->slab_size / allocator->size; ++i, ptr += allocator->size)
@@ -146,86 +207,310 @@ static slab_t* slab_create(slab_allocator_t* allocator)
     return slab;
 }
 
-static void* slab_block_get(slab_t* slab)
+static void slab_destroy(slab_t* slab)
 {
-    slab_block_t* block = list_front(&slab->free, slab_block_t, list_entry);
+    page_t* page;
+    slab_allocator_t* allocator = slab->allocator;
+
+    PAGES_FOR_EACH(page, slab->pages)
+    {
+        page->private = NULL;
+        page->flags &= ~PAGE_SLAB;
+    }
+
+    list_del(&slab->list_entry);
+    allocator->slabs_count--;
+    allocator->reclaimed++;
+
+    pages_free(slab->pages);
+    slab_entry_free(slab);
+}
+
+static slab_t* slab_find(void* ptr)
+{
+    extern uintptr_t last_pfn;
+    page_t* page;
+    uintptr_t paddr;
+
+    if (unlikely(!kernel_address(addr(ptr))))
+    {
+        return NULL;
+    }
+
+    paddr = phys_addr(ptr);
+
+    if (unlikely(paddr / PAGE_SIZE >= last_pfn))
+    {
+        return NULL;
+    }
+
+    page = page(paddr);
+
+    // Other owners, e.g. page cache, keep their own data in private
+    if (unlikely(!(page->flags & PAGE_SLAB)))
+    {
+        return NULL;
+    }
+
+    return page->private;
+}
+
+// Get a free block from a partial or an empty slab, creating a new one
+// if none is available; must be called with the allocator lock held
+static void* slab_block_get(slab_allocator_t* allocator)
+{
+    slab_t* slab;
+    slab_block_t* block;
+
+    if (!list_empty(&allocator->partial))
+    {
+        slab = list_front(&allocator->partial, slab_t, list_entry);
+    }
+    else if (!list_empty(&allocator->empty))
+    {
+        slab = list_front(&allocator->empty, slab_t, list_entry);
+        list_move_tail(&slab->list_entry, &allocator->partial);
+        allocator->empty_count--;
+    }
+    else
+    {
+        if (unlikely(!(slab = slab_create(allocator))))
+        {
+            return NULL;
+        }
+        list_add_tail(&slab->list_entry, &allocator->partial);
+    }
+
+    block = list_front(&slab->free, slab_block_t, list_entry);
     list_del(&block->list_entry);
     block->poison = 0;
     slab->allocated++;
+    allocator->allocated++;
+
+    if (list_empty(&slab->free))
+    {
+        list_move_tail(&slab->list_entry, &allocator->full);
+    }
+
     return block;
 }
 
-void* slab_alloc(size_t size)
+// Give back a block to its slab; must be called with the allocator lock held
+static void slab_block_put(slab_t* slab, slab_block_t* block)
 {
-    slab_t* slab;
-    slab_allocator_t* allocator = slab_allocator_get(size);
+    slab_allocator_t* allocator;
 
-    if (unlikely(!allocator))
+    // Blocks are checked when freed, so this can only be a memory corruption
+    if (unlikely(!slab))
     {
-        return NULL;
+        log_error("%s: block %p: unknown pointer", __func__, block);
+        return;
+    }
+
+    allocator = slab->allocator;
+
+    if (list_empty(&slab->free))
+    {
+        list_move_tail(&slab->list_entry, &allocator->partial);
+    }
+
+    list_add_tail(&block->list_entry, &slab->free);
+    slab->allocated--;
+    allocator->allocated--;
+
+    if (!slab->allocated)
+    {
+        if (allocator->empty_count < SLAB_EMPTY_MAX)
+        {
+            list_move_tail(&slab->list_entry, &allocator->empty);
+            allocator->empty_count++;
+        }
+        else
+        {
+            slab_destroy(slab);
+        }
     }
+}
+
+static void slab_magazine_refill(slab_allocator_t* allocator)
+{
+    flags_t flags;
+    size_t count = 0;
+    slab_magazine_t* magazine;
+    void* objects[SLAB_MAGAZINE_BATCH];
 
     scoped_mutex_lock(&allocator->lock);
 
-    list_for_each_entry(slab, &allocator->slabs, list_entry)
+    for (; count < SLAB_MAGAZINE_BATCH; ++count)
     {
-        if (unlikely(list_empty(&slab->free)))
+        if (unlikely(!(objects[count] = slab_block_get(allocator))))
         {
-            continue;
+            break;
         }
+    }
+
+    // Process might have been moved to other CPU while
+    // waiting for the mutex, so take the magazine again
+    irq_save(flags);
+
+    magazine = slab_magazine_get(allocator);
+    magazine->misses++;
 
-        return slab_block_get(slab);
+    while (count && magazine->count < SLAB_MAGAZINE_SIZE)
+    {
+        magazine->objects[magazine->count++] = objects[--count];
     }
 
-    slab = slab_create(allocator);
+    irq_restore(flags);
 
-    if (unlikely(!slab))
+    while (count)
     {
-        return NULL;
+        slab_block_t* block = objects[--count];
+        slab_block_put(slab_find(block), block);
     }
+}
+
+static void slab_magazine_flush(slab_allocator_t* allocator, void** objects, size_t count)
+{
+    scoped_mutex_lock(&allocator->lock);
 
-    return slab_block_get(slab);
+    while (count)
+    {
+        slab_block_t* block = objects[--count];
+        slab_block_put(slab_find(block), block);
+    }
 }
 
-void slab_free(void* ptr, size_t size)
+void* slab_alloc(size_t size)
 {
-    slab_t* slab;
-    slab_block_t* block = ptr;
+    flags_t flags;
+    slab_block_t* block;
+    slab_magazine_t* magazine;
     slab_allocator_t* allocator = slab_allocator_get(size);
 
     if (unlikely(!allocator))
     {
-        log_error("%s: ptr: %p, size: %zu: invalid size", __func__, ptr, size);
-        return;
+        return NULL;
     }
 
-    scoped_mutex_lock(&allocator->lock);
-
-    list_for_each_entry(slab, &allocator->slabs, list_entry)
+    for (int retry = 0; retry < 2; ++retry)
     {
-        if (!(addr(ptr) >= slab->start && addr(ptr) < slab->end))
-        {
-            continue;
-        }
+        irq_save(flags);
+
+        magazine = slab_magazine_get(allocator);
 
-        // FIXME: this can be randomly happen on some data which happens to set exact same value
-        if (unlikely(block->poison == SLAB_POISON))
+        if (likely(magazine->count))
         {
-            log_info("possibly freeing already free block %p", ptr);
+            block = magazine->objects[--magazine->count];
+            block->poison = 0;
+            magazine->hits++;
+            irq_restore(flags);
+            return block;
         }
 
-        list_init(&block->list_entry);
+        irq_restore(flags);
 
-        list_add_tail(&block->list_entry, &slab->free);
-        block->poison = SLAB_POISON;
-        slab->allocated--;
+        slab_magazine_refill(allocator);
+    }
+
+    return NULL;
+}
+
+void slab_free(void* ptr, size_t size)
+{
+    flags_t flags;
+    slab_t* slab = slab_find(ptr);
+    slab_block_t* block = ptr;
+    slab_magazine_t* magazine;
+    slab_allocator_t* allocator;
+    void* objects[SLAB_MAGAZINE_BATCH];
+
+    if (unlikely(!slab))
+    {
+        log_error("%s: ptr: %p, size: %zu: unknown pointer", __func__, ptr, size);
+        return;
+    }
+
+    allocator = slab->allocator;
+
+    if (unlikely(allocator != slab_allocator_get(size)))
+    {
+        log_error("%s: ptr: %p, size: %zu: invalid size; allocated with size %u", __func__, ptr, size, allocator->size);
+    }
+
+    // FIXME: this can be randomly happen on some data which happens to set exact same value
+    if (unlikely(block->poison == SLAB_POISON))
+    {
+        log_info("possibly freeing already free block %p", ptr);
+    }
+
+    list_init(&block->list_entry);
+    block->poison = SLAB_POISON;
 
 #if SLAB_ZERO_AFTER_FREE
-        memset(shift(block, sizeof(*block)), 0, allocator->size - sizeof(*block));
+    memset(shift(block, sizeof(*block)), 0, allocator->size - sizeof(*block));
 #endif
 
+    irq_save(flags);
+
+    magazine = slab_magazine_get(allocator);
+
+    if (likely(magazine->count < SLAB_MAGAZINE_SIZE))
+    {
+        magazine->objects[magazine->count++] = block;
+        irq_restore(flags);
         return;
     }
 
-    log_error("%s: ptr: %p, size: %zu: unknown pointer", __func__, ptr, size);
+    // Magazine is full; give back the oldest half of it to the slabs
+    memcpy(objects, magazine->objects, sizeof(objects));
+    memmove(magazine->objects, magazine->objects + SLAB_MAGAZINE_BATCH,
+        (SLAB_MAGAZINE_SIZE - SLAB_MAGAZINE_BATCH) * sizeof(void*));
+    magazine->count -= SLAB_MAGAZINE_BATCH;
+    magazine->objects[magazine->count++] = block;
+
+    irq_restore(flags);
+
+    slab_magazine_flush(allocator, objects, SLAB_MAGAZINE_BATCH);
+}
+
+int slabinfo_show(seq_file_t* s)
+{
+    seq_printf(s, "# name       objsize active_objs num_objs slabs pages_per_slab cached hits misses reclaimed\n");
+
+    for (size_t i = 0; i < array_size(allocators); ++i)
+    {
+        slab_allocator_t* allocator = &allocators[i];
+        size_t objs_per_slab = allocator->slab_size / allocator->size;
+        unsigned cached = 0, hits = 0, misses = 0;
+
+        for (int cpu = 0; cpu < CPU_COUNT; ++cpu)
+        {
+            slab_magazine_t* magazine;
+
+            if (!per_cpu_data[cpu])
+            {
+                continue;
+            }
+
+            magazine = CPU_GET(cpu, &magazines[i]);
+            cached += magazine->count;
+            hits += magazine->hits;
+            misses += magazine->misses;
+        }
+
+        seq_printf(s, "size-%-7u %-7u %-11u %-8u %-5u %-14u %-6u %-8u %-6u %u\n",
+            allocator->size,
+            allocator->size,
+            allocator->allocated - cached,
+            allocator->slabs_count * objs_per_slab,
+            allocator->slabs_count,
+            allocator->slab_size / PAGE_SIZE,
+            cached,
+            hits,
+            misses,
+            allocator->reclaimed);
+    }
+
+    return 0;
 }
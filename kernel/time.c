@@ -1,6 +1,7 @@
 #define log_fmt(fmt) "time: " fmt
 #include <arch/io.h>
 #include <kernel/time.h>
+#include <kernel/vdso.h>
 #include <kernel/clock.h>
 #include <kernel/timer.h>
 #include <kernel/kernel.h>
@@ -10,6 +11,7 @@
 volatile unsigned int jiffies;
 static seqlock_t timestamp_lock;
 timeval_t timestamp;
+static uint32_t timestamp_nsec;
 static uint32_t realtime;
 
 // This is from Linux source code
@@ -33,11 +35,41 @@ time_t mktime(
       ) * 60 + second; // seconds
 }
 
-static void ts_update(uint64_t useconds)
+static void vdso_update(void)
+{
+    vdso_data_t* data = vdso_data;
+
+    if (unlikely(!data))
+    {
+        return;
+    }
+
+    ++data->seq;
+    mb();
+
+    data->clock_mode = monotonic_clock->vdso_mode;
+    data->cycles = monotonic_clock->cycles_prev;
+    data->mask = monotonic_clock->mask;
+    data->mult_ns = monotonic_clock->mult_ns;
+    data->shift_ns = monotonic_clock->shift_ns;
+    data->sec = timestamp.tv_sec;
+    data->nsec = usec2nsec(timestamp.tv_usec) + timestamp_nsec;
+    data->realtime = realtime;
+
+    mb();
+    ++data->seq;
+}
+
+// Nanoseconds below a microsecond are carried over to the next update,
+// so that time read from the vdso data doesn't drift from the timestamp
+static void ts_update(uint64_t nseconds)
 {
     seqlock_write_lock(&timestamp_lock);
-    timestamp.tv_usec += useconds;
+    nseconds += timestamp_nsec;
+    timestamp_nsec = do_div(nseconds, 1000);
+    timestamp.tv_usec += nseconds;
     ts_normalize(&timestamp);
+    vdso_update();
     seqlock_write_unlock(&timestamp_lock);
 }
 
@@ -49,10 +81,9 @@ void timestamp_update(void)
 
     cycles_cur = monotonic_clock->read();
     diff = (cycles_cur - monotonic_clock->cycles_prev) & monotonic_clock->mask;
-
-    ts_update((diff * monotonic_clock->mult) >> monotonic_clock->shift);
-
     monotonic_clock->cycles_prev = cycles_cur;
+
+    ts_update((diff * monotonic_clock->mult_ns) >> monotonic_clock->shift_ns);
 }
 
 void timestamp_get(timeval_t* ts)
@@ -125,6 +156,11 @@ static void io_delay_measure(void)
     log_info("dummy IO duration: %u ns", nseconds / IO_LOOPS);
 }
 
+time_t time_now(void)
+{
+    return realtime + timestamp.tv_sec;
+}
+
 time_t sys_time(time_t* tloc)
 {
     if (tloc && current_vm_verify(VERIFY_WRITE, tloc))
@@ -132,7 +168,7 @@ time_t sys_time(time_t* tloc)
         return -EFAULT;
     }
 
-    return realtime + timestamp.tv_sec;
+    return time_now();
 }
 
 int sys_gettimeofday(struct timeval* tv, struct timezone* tz)
@@ -194,7 +230,7 @@ int sys_clock_gettime(clockid_t clockid, struct timespec* tp)
             {
                 seq = seqlock_read_begin(&timestamp_lock);
                 tp->tv_sec = off + timestamp.tv_sec;
-                tp->tv_nsec = timestamp.tv_usec * 1000;
+                tp->tv_nsec = usec2nsec(timestamp.tv_usec) + timestamp_nsec;
             }
             while (seqlock_read_check(&timestamp_lock, seq));
             return 0;
@@ -213,7 +249,9 @@ int sys_clock_settime(clockid_t clockid, const struct timespec* tp)
         case CLOCK_REALTIME:
         {
             timestamp_update();
+            scoped_irq_lock();
             realtime = tp->tv_sec - timestamp.tv_sec;
+            vdso_update();
             return 0;
         }
     }
@@ -229,4 +267,5 @@ void time_setup(void)
     rtc_meas_t m;
     rtc_clock->read_rtc(&m);
     realtime = mktime(m.year, m.month, m.day, m.hour, m.minute, m.second);
+    vdso_update();
 }
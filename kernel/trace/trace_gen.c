@@ -496,4 +496,70 @@ syscall_t trace_syscalls[] = {
         .nargs  = 1,
         .args   = { TYPE_UNSIGNED_LONG },
     },
+    {
+        .name   = "nice",
+        .ret    = TYPE_LONG,
+        .nargs  = 1,
+        .args   = { TYPE_LONG },
+    },
+    {
+        .name   = "getpriority",
+        .ret    = TYPE_LONG,
+        .nargs  = 2,
+        .args   = { TYPE_LONG, TYPE_UNSIGNED_LONG },
+    },
+    {
+        .name   = "setpriority",
+        .ret    = TYPE_LONG,
+        .nargs  = 3,
+        .args   = { TYPE_LONG, TYPE_UNSIGNED_LONG, TYPE_LONG },
+    },
+    {
+        .name   = "sync",
+        .ret    = TYPE_LONG,
+        .nargs  = 0,
+        .args   = {  },
+    },
+    {
+        .name   = "fsync",
+        .ret    = TYPE_LONG,
+        .nargs  = 1,
+        .args   = { TYPE_LONG },
+    },
+    {
+        .name   = "fdatasync",
+        .ret    = TYPE_LONG,
+        .nargs  = 1,
+        .args   = { TYPE_LONG },
+    },
+    {
+        .name   = "ftruncate",
+        .ret    = TYPE_LONG,
+        .nargs  = 2,
+        .args   = { TYPE_LONG, TYPE_UNSIGNED_LONG },
+    },
+    {
+        .name   = "epoll_create1",
+        .ret    = TYPE_LONG,
+        .nargs  = 1,
+        .args   = { TYPE_LONG },
+    },
+    {
+        .name   = "epoll_ctl",
+        .ret    = TYPE_LONG,
+        .nargs  = 4,
+        .args   = { TYPE_LONG, TYPE_LONG, TYPE_LONG, TYPE_VOID_PTR },
+    },
+    {
+        .name   = "epoll_wait",
+        .ret    = TYPE_LONG,
+        .nargs  = 4,
+        .args   = { TYPE_LONG, TYPE_VOID_PTR, TYPE_LONG, TYPE_LONG },
+    },
+    {
+        .name   = "futex",
+        .ret    = TYPE_LONG,
+        .nargs  = 6,
+        .args   = { TYPE_VOID_PTR, TYPE_LONG, TYPE_LONG, TYPE_VOID_PTR, TYPE_VOID_PTR, TYPE_LONG },
+    },
 };
\ No newline at end of file
@@ -0,0 +1,57 @@
+#define log_fmt(fmt) "vdso: " fmt
+#include <kernel/vm.h>
+#include <kernel/init.h>
+#include <kernel/vdso.h>
+#include <kernel/process.h>
+#include <kernel/page_alloc.h>
+
+#define VDSO_DATA_ADDRESS   (USER_STACK_VIRT_ADDRESS - PAGE_SIZE)
+
+static page_t* vdso_page;
+vdso_data_t* vdso_data;
+
+int vdso_map(struct mm* mm, uintptr_t* address)
+{
+    int errno;
+    vm_area_t* vma;
+
+    if (unlikely(!vdso_page))
+    {
+        return -ENOSYS;
+    }
+
+    if (unlikely(!(vma = vm_create(VDSO_DATA_ADDRESS, PAGE_SIZE, VM_READ | VM_TYPE(VM_TYPE_VDSO), mm))))
+    {
+        return -ENOMEM;
+    }
+
+    if (unlikely(errno = vm_add(&mm->vm_areas, vma)))
+    {
+        vm_del(vma);
+        return errno;
+    }
+
+    if (unlikely(errno = vm_page_insert(vma, vdso_page, VDSO_DATA_ADDRESS)))
+    {
+        return errno;
+    }
+
+    *address = VDSO_DATA_ADDRESS;
+
+    return 0;
+}
+
+UNMAP_AFTER_INIT static int vdso_init(void)
+{
+    if (unlikely(!(vdso_page = page_alloc(1, PAGE_ALLOC_ZEROED))))
+    {
+        log_warning("cannot allocate page");
+        return -ENOMEM;
+    }
+
+    vdso_data = page_virt_ptr(vdso_page);
+
+    return 0;
+}
+
+premodules_initcall(vdso_init);
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <kernel/api/elf.h>
 
 typedef void (*ctor_t)();
 
@@ -18,11 +19,11 @@ static void _call_global_dtors(void)
 }
 
 extern int main(int argc, char* const argv[], char* const envp[]);
-extern void __libc_start_main(int argc, char* const argv[], char* const envp[]);
+extern void __libc_start_main(int argc, char* const argv[], char* const envp[], elf32_auxv_t* auxv);
 
-__attribute__((noreturn)) void _entry(int argc, char** argv, char** envp)
+__attribute__((noreturn)) void _entry(int argc, char** argv, char** envp, elf32_auxv_t* auxv)
 {
-    __libc_start_main(argc, argv, envp);
+    __libc_start_main(argc, argv, envp, auxv);
 
     _call_global_ctors();
 
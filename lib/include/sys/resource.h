@@ -3,6 +3,7 @@
 #include <sys/time.h>
 #include <sys/cdefs.h>
 #include <sys/types.h>
+#include <kernel/api/resource.h>
 
 /* https://pubs.opengroup.org/onlinepubs/9699919799/basedefs/sys_resource.h.html */
 
@@ -10,10 +11,6 @@ __BEGIN_DECLS
 
 typedef unsigned long rlim_t;
 
-#define PRIO_PROCESS    0
-#define PRIO_PGRP       1
-#define PRIO_USER       2
-
 #define RLIM_INFINITY   ((rlim_t)-1)
 #define RLIM_SAVED_MAX  ((rlim_t)-2)
 #define RLIM_SAVED_CUR  ((rlim_t)-3)
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <time.h>
+#include <sys/cdefs.h>
+
+/* https://en.cppreference.com/w/c/thread */
+
+__BEGIN_DECLS
+
+enum
+{
+    thrd_success,
+    thrd_busy,
+    thrd_error,
+    thrd_nomem,
+    thrd_timedout,
+};
+
+enum
+{
+    mtx_plain = 0,
+    mtx_recursive = 1,
+    mtx_timed = 2,
+};
+
+// 0 - unlocked, 1 - locked, 2 - locked with possible waiters
+typedef struct
+{
+    int state;
+} mtx_t;
+
+typedef struct
+{
+    int    seq;
+    int    waiters;
+    mtx_t* mtx;
+} cnd_t;
+
+typedef int once_flag;
+
+#define ONCE_FLAG_INIT  0
+
+int mtx_init(mtx_t* mtx, int type);
+int mtx_lock(mtx_t* mtx);
+int mtx_timedlock(mtx_t* __RESTRICT mtx, const struct timespec* __RESTRICT ts);
+int mtx_trylock(mtx_t* mtx);
+int mtx_unlock(mtx_t* mtx);
+void mtx_destroy(mtx_t* mtx);
+
+int cnd_init(cnd_t* cond);
+int cnd_signal(cnd_t* cond);
+int cnd_broadcast(cnd_t* cond);
+int cnd_wait(cnd_t* cond, mtx_t* mtx);
+int cnd_timedwait(cnd_t* __RESTRICT cond, mtx_t* __RESTRICT mtx, const struct timespec* __RESTRICT ts);
+void cnd_destroy(cnd_t* cond);
+
+void call_once(once_flag* flag, void (*func)(void));
+
+__END_DECLS
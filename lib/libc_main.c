@@ -1,12 +1,14 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <kernel/api/elf.h>
 
 void stdio_init(void);
+void vdso_init(elf32_auxv_t* auxv);
 
 int libc_debug;
 
-void __libc_start_main(int, char* const argv[], char* const envp[])
+void __libc_start_main(int, char* const argv[], char* const envp[], elf32_auxv_t* auxv)
 {
     char* short_name;
     extern char** environ;
@@ -21,6 +23,7 @@ void __libc_start_main(int, char* const argv[], char* const envp[])
     }
 
     stdio_init();
+    vdso_init(auxv);
 }
 
 #define STUB(name) \
@@ -407,7 +407,7 @@ static void link(dynamic_t* dynamic, uintptr_t base_address, uintptr_t lib_base,
     missing_symbols_verify(&missing_symbols);
 }
 
-extern void __libc_start_main(int, char* const argv[], char* const envp[]);
+extern void __libc_start_main(int, char* const argv[], char* const envp[], elf32_auxv_t* auxv);
 
 #define EARLY_ENSURE(x) \
     if (UNLIKELY(!(x))) \
@@ -509,7 +509,7 @@ static __attribute__((noreturn,noinline)) void loader_main(int argc, char* argv[
     relocate_itself(auxv);
     asm volatile("" ::: "memory");
 
-    __libc_start_main(argc, argv, envp);
+    __libc_start_main(argc, argv, envp, *auxv);
 
     debug = !!getenv("L");
 
@@ -1,9 +1,25 @@
 #include <string.h>
+#include <unistd.h>
 #include <sys/resource.h>
 
-int LIBC(getpriority)(int which, id_t who)
+int LIBC(nice)(int inc);
+int LIBC(getpriority)(int which, id_t who);
+
+// Kernel returns 20 - nice, so that the result
+// cannot be confused with an error
+int getpriority(int which, id_t who)
+{
+    int res = LIBC(getpriority)(which, who);
+    return res < 0 ? res : 20 - res;
+}
+
+int nice(int inc)
 {
-    NOT_IMPLEMENTED(-1, "%d, %d", which, who);
+    if (LIBC(nice)(inc))
+    {
+        return -1;
+    }
+    return getpriority(PRIO_PROCESS, 0);
 }
 
 int LIBC(getrlimit)(int resource, struct rlimit* rlp)
@@ -18,18 +34,11 @@ int LIBC(getrusage)(int who, struct rusage* r_usage)
     NOT_IMPLEMENTED(-1, "%d, %p", who, r_usage);
 }
 
-int LIBC(setpriority)(int which, id_t who, int value)
-{
-    NOT_IMPLEMENTED(-1, "%d, %u, %d", which, who, value);
-}
-
 int LIBC(setrlimit)(int resource, const struct rlimit* rlp)
 {
     NOT_IMPLEMENTED(-1, "%d, %p", resource, rlp);
 }
 
-LIBC_ALIAS(getpriority);
 LIBC_ALIAS(getrlimit);
 LIBC_ALIAS(getrusage);
-LIBC_ALIAS(setpriority);
 LIBC_ALIAS(setrlimit);
@@ -15,11 +15,3 @@ void stdio_init(void)
     file_init(STDOUT_FILENO, O_WRONLY, stdout, stdout_buffer, sizeof(stdout_buffer));
     file_init(STDERR_FILENO, O_WRONLY, stderr, stderr_buffer, sizeof(stderr_buffer));
 }
-
-// Temporary
-int LIBC(fsync)(int fd)
-{
-    NOT_IMPLEMENTED(0, "%d", fd);
-}
-
-LIBC_ALIAS(fsync);
@@ -43,6 +43,13 @@ int syscall(int nr, ...)
     } \
     LIBC_ALIAS(name);
 
+#define __syscall0_void(name, ret) \
+    ret LIBC(name)(void) \
+    { \
+        syscall(__NR_##name); \
+    } \
+    LIBC_ALIAS(name);
+
 #define __syscall1(name, ret, t1) \
     ret LIBC(name)(typeof(t1) a1) \
     { \
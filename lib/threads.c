@@ -0,0 +1,231 @@
+#include <time.h>
+#include <limits.h>
+#include <threads.h>
+#include <sys/futex.h>
+
+// Mutex, condition variable and once flag never enter the kernel unless
+// they have to wait or there's someone to wake up
+
+#define ONCE_RUNNING    1
+#define ONCE_WAITERS    2
+#define ONCE_DONE       3
+
+static inline int cmpxchg(int* ptr, int expected, int desired)
+{
+    __atomic_compare_exchange_n(ptr, &expected, desired, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    return expected;
+}
+
+static inline int xchg(int* ptr, int value)
+{
+    return __atomic_exchange_n(ptr, value, __ATOMIC_ACQUIRE);
+}
+
+// Converts absolute CLOCK_REALTIME time to the timeout relative to now;
+// returns 0 if it has already passed
+static int timeout_get(const struct timespec* abs, struct timespec* rel)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    rel->tv_sec = abs->tv_sec - now.tv_sec;
+    rel->tv_nsec = abs->tv_nsec - now.tv_nsec;
+
+    if (rel->tv_nsec < 0)
+    {
+        rel->tv_nsec += NSEC_PER_SEC;
+        --rel->tv_sec;
+    }
+
+    return abs->tv_sec > now.tv_sec || (abs->tv_sec == now.tv_sec && abs->tv_nsec > now.tv_nsec);
+}
+
+static int mtx_lock_slow(mtx_t* mtx, const struct timespec* ts)
+{
+    struct timespec rel;
+    int c = xchg(&mtx->state, 2);
+
+    while (c)
+    {
+        if (ts && !timeout_get(ts, &rel))
+        {
+            return thrd_timedout;
+        }
+
+        futex(&mtx->state, FUTEX_WAIT | FUTEX_PRIVATE_FLAG, 2, ts ? &rel : NULL, NULL, 0);
+
+        c = xchg(&mtx->state, 2);
+    }
+
+    return thrd_success;
+}
+
+int mtx_init(mtx_t* mtx, int type)
+{
+    if (UNLIKELY(type & mtx_recursive))
+    {
+        return thrd_error;
+    }
+
+    mtx->state = 0;
+
+    return thrd_success;
+}
+
+int mtx_lock(mtx_t* mtx)
+{
+    if (LIKELY(!cmpxchg(&mtx->state, 0, 1)))
+    {
+        return thrd_success;
+    }
+
+    return mtx_lock_slow(mtx, NULL);
+}
+
+int mtx_timedlock(mtx_t* __RESTRICT mtx, const struct timespec* __RESTRICT ts)
+{
+    if (LIKELY(!cmpxchg(&mtx->state, 0, 1)))
+    {
+        return thrd_success;
+    }
+
+    return mtx_lock_slow(mtx, ts);
+}
+
+int mtx_trylock(mtx_t* mtx)
+{
+    return cmpxchg(&mtx->state, 0, 1) ? thrd_busy : thrd_success;
+}
+
+int mtx_unlock(mtx_t* mtx)
+{
+    if (UNLIKELY(__atomic_fetch_sub(&mtx->state, 1, __ATOMIC_RELEASE) != 1))
+    {
+        __atomic_store_n(&mtx->state, 0, __ATOMIC_RELEASE);
+        futex(&mtx->state, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, 1, NULL, NULL, 0);
+    }
+
+    return thrd_success;
+}
+
+void mtx_destroy(mtx_t*)
+{
+}
+
+int cnd_init(cnd_t* cond)
+{
+    cond->seq = 0;
+    cond->waiters = 0;
+    cond->mtx = NULL;
+
+    return thrd_success;
+}
+
+int cnd_signal(cnd_t* cond)
+{
+    __atomic_fetch_add(&cond->seq, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST))
+    {
+        futex(&cond->seq, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, 1, NULL, NULL, 0);
+    }
+
+    return thrd_success;
+}
+
+int cnd_broadcast(cnd_t* cond)
+{
+    int seq = __atomic_add_fetch(&cond->seq, 1, __ATOMIC_SEQ_CST);
+    mtx_t* mtx = __atomic_load_n(&cond->mtx, __ATOMIC_RELAXED);
+
+    if (!__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST))
+    {
+        return thrd_success;
+    }
+
+    // Wake one waiter and move the rest to the mutex; each of them locks it
+    // as contended, so its unlock wakes the next one
+    if (!mtx || futex(&cond->seq, FUTEX_CMP_REQUEUE | FUTEX_PRIVATE_FLAG, 1,
+            (const struct timespec*)INT_MAX, &mtx->state, seq) < 0)
+    {
+        futex(&cond->seq, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, INT_MAX, NULL, NULL, 0);
+    }
+
+    return thrd_success;
+}
+
+int cnd_timedwait(cnd_t* __RESTRICT cond, mtx_t* __RESTRICT mtx, const struct timespec* __RESTRICT ts)
+{
+    int seq, res = thrd_success;
+    struct timespec rel;
+
+    __atomic_fetch_add(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&cond->mtx, mtx, __ATOMIC_RELAXED);
+
+    seq = __atomic_load_n(&cond->seq, __ATOMIC_SEQ_CST);
+
+    mtx_unlock(mtx);
+
+    if (ts && !timeout_get(ts, &rel))
+    {
+        res = thrd_timedout;
+    }
+    else if (futex(&cond->seq, FUTEX_WAIT | FUTEX_PRIVATE_FLAG, seq, ts ? &rel : NULL, NULL, 0) < 0
+        && errno == ETIMEDOUT)
+    {
+        res = thrd_timedout;
+    }
+
+    __atomic_fetch_sub(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+
+    // Waiter might have been requeued to the mutex, so the mutex is locked
+    // as contended to not lose the wakeup of the next one
+    while (xchg(&mtx->state, 2))
+    {
+        futex(&mtx->state, FUTEX_WAIT | FUTEX_PRIVATE_FLAG, 2, NULL, NULL, 0);
+    }
+
+    return res;
+}
+
+int cnd_wait(cnd_t* cond, mtx_t* mtx)
+{
+    return cnd_timedwait(cond, mtx, NULL);
+}
+
+void cnd_destroy(cnd_t*)
+{
+}
+
+void call_once(once_flag* flag, void (*func)(void))
+{
+    int state;
+
+    if (LIKELY(__atomic_load_n(flag, __ATOMIC_ACQUIRE) == ONCE_DONE))
+    {
+        return;
+    }
+
+    if (!cmpxchg(flag, 0, ONCE_RUNNING))
+    {
+        func();
+
+        if (__atomic_exchange_n(flag, ONCE_DONE, __ATOMIC_RELEASE) == ONCE_WAITERS)
+        {
+            futex(flag, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, INT_MAX, NULL, NULL, 0);
+        }
+
+        return;
+    }
+
+    while ((state = __atomic_load_n(flag, __ATOMIC_ACQUIRE)) != ONCE_DONE)
+    {
+        if (state == ONCE_RUNNING && cmpxchg(flag, ONCE_RUNNING, ONCE_WAITERS) != ONCE_RUNNING)
+        {
+            continue;
+        }
+
+        futex(flag, FUTEX_WAIT | FUTEX_PRIVATE_FLAG, ONCE_WAITERS, NULL, NULL, 0);
+    }
+}
@@ -0,0 +1,103 @@
+#include <time.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include <kernel/api/elf.h>
+#include <kernel/api/vdso.h>
+
+// clock_gettime and gettimeofday read the clock and the time of the last
+// kernel update from the shared page, so they don't need a syscall
+
+static const volatile vdso_data_t* vdso_data;
+
+int LIBC(clock_gettime)(clockid_t clockid, struct timespec* tp);
+int LIBC(gettimeofday)(struct timeval* tv, struct timezone* tz);
+
+void vdso_init(elf32_auxv_t* aux)
+{
+    for (; aux->a_type != AT_NULL; ++aux)
+    {
+        if (aux->a_type == AT_VDSO_DATA)
+        {
+            vdso_data = (const volatile vdso_data_t*)aux->a_un.a_val;
+            return;
+        }
+    }
+}
+
+// rdtsc may run ahead of earlier loads; lfence keeps it after the read of
+// seq, so that counter is never older than cycles written by the kernel
+static inline uint64_t rdtsc_ordered(void)
+{
+    uint64_t val;
+    asm volatile("lfence; rdtsc" : "=A" (val) :: "memory");
+    return val;
+}
+
+static int vdso_read(struct timespec* tp, int coarse, int realtime)
+{
+    uint32_t seq, sec, nsec;
+    uint64_t ns = 0;
+
+    do
+    {
+        while ((seq = vdso_data->seq) & 1);
+
+        asm volatile("" ::: "memory");
+
+        if (vdso_data->clock_mode != VDSO_CLOCK_TSC)
+        {
+            return -1;
+        }
+
+        if (!coarse)
+        {
+            ns = ((rdtsc_ordered() - vdso_data->cycles) & vdso_data->mask) * vdso_data->mult_ns;
+            ns >>= vdso_data->shift_ns;
+        }
+
+        sec = vdso_data->sec + (realtime ? vdso_data->realtime : 0);
+        nsec = vdso_data->nsec;
+
+        asm volatile("" ::: "memory");
+    }
+    while (vdso_data->seq != seq);
+
+    // Delta is below a timer tick, so this runs at most a few times
+    ns += nsec;
+
+    while (ns >= NSEC_PER_SEC)
+    {
+        ns -= NSEC_PER_SEC;
+        ++sec;
+    }
+
+    tp->tv_sec = sec;
+    tp->tv_nsec = ns;
+
+    return 0;
+}
+
+int clock_gettime(clockid_t clockid, struct timespec* tp)
+{
+    if (vdso_data && (unsigned)clockid < CLOCK_ID_COUNT && tp &&
+        !vdso_read(tp, clockid & __CLOCK_COARSE, (clockid & __CLOCK_MASK) == CLOCK_REALTIME))
+    {
+        return 0;
+    }
+
+    return LIBC(clock_gettime)(clockid, tp);
+}
+
+int gettimeofday(struct timeval* tv, struct timezone* tz)
+{
+    struct timespec ts;
+
+    if (vdso_data && !tz && tv && !vdso_read(&ts, 0, 1))
+    {
+        tv->tv_sec = ts.tv_sec;
+        tv->tv_usec = ts.tv_nsec / 1000;
+        return 0;
+    }
+
+    return LIBC(gettimeofday)(tv, tz);
+}